@@ -148,6 +148,22 @@ static void FindBestFilename(string &strPath, bool noSpace)
 	}
 }
 
+/* the in-process muxer avoids piping every packet to the ffmpeg-mux helper,
+ * but if OBS crashes the file is left as it is.  mp4/mov need their moov atom
+ * written at the end (and faststart rewrites the file), which the helper
+ * still does when OBS crashes, so they keep using ffmpeg_muxer */
+static const char *GetRecordingMuxer(const char *format)
+{
+	static const char *crashSafeFormats[] = {"mkv", "flv", "ts"};
+
+	for (const char *safeFormat : crashSafeFormats) {
+		if (format && astrcmpi(format, safeFormat) == 0)
+			return "ffmpeg_inproc_muxer";
+	}
+
+	return "ffmpeg_muxer";
+}
+
 /* ------------------------------------------------------------------------ */
 
 static bool CreateAACEncoder(OBSEncoder &res, string &id, int bitrate,
@@ -359,7 +375,10 @@ SimpleOutput::SimpleOutput(OBSBasic *main_) : BasicOutputHandler(main_)
 					OBSReplayBufferStopping, this);
 		}
 
-		fileOutput = obs_output_create("ffmpeg_muxer",
+		const char *format = config_get_string(main->Config(),
+				"SimpleOutput", "RecFormat");
+
+		fileOutput = obs_output_create(GetRecordingMuxer(format),
 				"simple_file_output", nullptr, nullptr);
 		if (!fileOutput)
 			throw "Failed to create recording output "
@@ -732,12 +751,20 @@ bool SimpleOutput::StartStreaming(obs_service_t *service)
 			"DelaySec");
 	bool preserveDelay = config_get_bool(main->Config(), "Output",
 			"DelayPreserve");
+	int delayMaxMemory = config_get_int(main->Config(), "Output",
+			"DelayMaxMemoryMB");
 	const char *bindIP = config_get_string(main->Config(), "Output",
 			"BindIP");
 	bool enableNewSocketLoop = config_get_bool(main->Config(), "Output",
 			"NewSocketLoopEnable");
 	bool enableLowLatencyMode = config_get_bool(main->Config(), "Output",
 			"LowLatencyEnable");
+	bool enableDynBitrate = config_get_bool(main->Config(), "Output",
+			"DynBitrateEnable");
+	int dynBitrateMin = config_get_int(main->Config(), "Output",
+			"DynBitrateMin");
+	int dynBitrateMax = config_get_int(main->Config(), "Output",
+			"DynBitrateMax");
 
 	obs_data_t *settings = obs_data_create();
 	obs_data_set_string(settings, "bind_ip", bindIP);
@@ -745,6 +772,9 @@ bool SimpleOutput::StartStreaming(obs_service_t *service)
 			enableNewSocketLoop);
 	obs_data_set_bool(settings, "low_latency_mode_enabled",
 			enableLowLatencyMode);
+	obs_data_set_bool(settings, "abr_enabled", enableDynBitrate);
+	obs_data_set_int(settings, "abr_min_bitrate", dynBitrateMin);
+	obs_data_set_int(settings, "abr_max_bitrate", dynBitrateMax);
 	obs_output_update(streamOutput, settings);
 	obs_data_release(settings);
 
@@ -753,6 +783,7 @@ bool SimpleOutput::StartStreaming(obs_service_t *service)
 
 	obs_output_set_delay(streamOutput, useDelay ? delaySec : 0,
 			preserveDelay ? OBS_OUTPUT_DELAY_PRESERVE : 0);
+	obs_output_set_delay_spill(streamOutput, delayMaxMemory, nullptr);
 
 	obs_output_set_reconnect_settings(streamOutput, maxRetries,
 			retryDelay);
@@ -1124,7 +1155,10 @@ AdvancedOutput::AdvancedOutput(OBSBasic *main_) : BasicOutputHandler(main_)
 					OBSReplayBufferStopping, this);
 		}
 
-		fileOutput = obs_output_create("ffmpeg_muxer",
+		const char *format = config_get_string(main->Config(),
+				"AdvOut", "RecFormat");
+
+		fileOutput = obs_output_create(GetRecordingMuxer(format),
 				"adv_file_output", nullptr, nullptr);
 		if (!fileOutput)
 			throw "Failed to create recording output "
@@ -1510,12 +1544,20 @@ bool AdvancedOutput::StartStreaming(obs_service_t *service)
 			"DelaySec");
 	bool preserveDelay = config_get_bool(main->Config(), "Output",
 			"DelayPreserve");
+	int delayMaxMemory = config_get_int(main->Config(), "Output",
+			"DelayMaxMemoryMB");
 	const char *bindIP = config_get_string(main->Config(), "Output",
 			"BindIP");
 	bool enableNewSocketLoop = config_get_bool(main->Config(), "Output",
 			"NewSocketLoopEnable");
 	bool enableLowLatencyMode = config_get_bool(main->Config(), "Output",
 			"LowLatencyEnable");
+	bool enableDynBitrate = config_get_bool(main->Config(), "Output",
+			"DynBitrateEnable");
+	int dynBitrateMin = config_get_int(main->Config(), "Output",
+			"DynBitrateMin");
+	int dynBitrateMax = config_get_int(main->Config(), "Output",
+			"DynBitrateMax");
 
 	obs_data_t *settings = obs_data_create();
 	obs_data_set_string(settings, "bind_ip", bindIP);
@@ -1523,6 +1565,9 @@ bool AdvancedOutput::StartStreaming(obs_service_t *service)
 			enableNewSocketLoop);
 	obs_data_set_bool(settings, "low_latency_mode_enabled",
 			enableLowLatencyMode);
+	obs_data_set_bool(settings, "abr_enabled", enableDynBitrate);
+	obs_data_set_int(settings, "abr_min_bitrate", dynBitrateMin);
+	obs_data_set_int(settings, "abr_max_bitrate", dynBitrateMax);
 	obs_output_update(streamOutput, settings);
 	obs_data_release(settings);
 
@@ -1531,6 +1576,7 @@ bool AdvancedOutput::StartStreaming(obs_service_t *service)
 
 	obs_output_set_delay(streamOutput, useDelay ? delaySec : 0,
 			preserveDelay ? OBS_OUTPUT_DELAY_PRESERVE : 0);
+	obs_output_set_delay_spill(streamOutput, delayMaxMemory, nullptr);
 
 	obs_output_set_reconnect_settings(streamOutput, maxRetries,
 			retryDelay);
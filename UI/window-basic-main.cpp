@@ -1242,6 +1242,8 @@ bool OBSBasic::InitBasicConfigDefaults()
 	config_set_default_bool  (basicConfig, "Output", "DelayEnable", false);
 	config_set_default_uint  (basicConfig, "Output", "DelaySec", 20);
 	config_set_default_bool  (basicConfig, "Output", "DelayPreserve", true);
+	config_set_default_uint  (basicConfig, "Output", "DelayMaxMemoryMB",
+			512);
 
 	config_set_default_bool  (basicConfig, "Output", "Reconnect", true);
 	config_set_default_uint  (basicConfig, "Output", "RetryDelay", 10);
@@ -1252,6 +1254,10 @@ bool OBSBasic::InitBasicConfigDefaults()
 			false);
 	config_set_default_bool  (basicConfig, "Output", "LowLatencyEnable",
 			false);
+	config_set_default_bool  (basicConfig, "Output", "DynBitrateEnable",
+			false);
+	config_set_default_uint  (basicConfig, "Output", "DynBitrateMin", 500);
+	config_set_default_uint  (basicConfig, "Output", "DynBitrateMax", 0);
 
 	int i = 0;
 	uint32_t scale_cx = cx;
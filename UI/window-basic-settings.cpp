@@ -448,6 +448,9 @@ OBSBasicSettings::OBSBasicSettings(QWidget *parent)
 	HookWidget(ui->bindToIP,             COMBO_CHANGED,  ADV_CHANGED);
 	HookWidget(ui->enableNewSocketLoop,  CHECK_CHANGED,  ADV_CHANGED);
 	HookWidget(ui->enableLowLatencyMode, CHECK_CHANGED,  ADV_CHANGED);
+	HookWidget(ui->dynBitrateEnable,     CHECK_CHANGED,  ADV_CHANGED);
+	HookWidget(ui->dynBitrateMin,        SCROLL_CHANGED, ADV_CHANGED);
+	HookWidget(ui->dynBitrateMax,        SCROLL_CHANGED, ADV_CHANGED);
 	HookWidget(ui->disableFocusHotkeys,  CHECK_CHANGED,  ADV_CHANGED);
 	HookWidget(ui->autoRemux,            CHECK_CHANGED,  ADV_CHANGED);
 
@@ -502,8 +505,10 @@ OBSBasicSettings::OBSBasicSettings(QWidget *parent)
 	delete ui->processPriorityLabel;
 	delete ui->processPriority;
 	delete ui->advancedGeneralGroupBox;
+#ifndef __linux__
 	delete ui->enableNewSocketLoop;
 	delete ui->enableLowLatencyMode;
+#endif
 	delete ui->browserHWAccel;
 	delete ui->sourcesGroup;
 #if defined(__APPLE__) || HAVE_PULSEAUDIO
@@ -516,8 +521,10 @@ OBSBasicSettings::OBSBasicSettings(QWidget *parent)
 	ui->processPriorityLabel = nullptr;
 	ui->processPriority = nullptr;
 	ui->advancedGeneralGroupBox = nullptr;
+#ifndef __linux__
 	ui->enableNewSocketLoop = nullptr;
 	ui->enableLowLatencyMode = nullptr;
+#endif
 	ui->browserHWAccel = nullptr;
 	ui->sourcesGroup = nullptr;
 #if defined(__APPLE__) || HAVE_PULSEAUDIO
@@ -2220,6 +2227,12 @@ void OBSBasicSettings::LoadAdvancedSettings()
 			"RetryDelay");
 	int maxRetries = config_get_int(main->Config(), "Output",
 			"MaxRetries");
+	bool dynBitrate = config_get_bool(main->Config(), "Output",
+			"DynBitrateEnable");
+	int dynBitrateMin = config_get_int(main->Config(), "Output",
+			"DynBitrateMin");
+	int dynBitrateMax = config_get_int(main->Config(), "Output",
+			"DynBitrateMax");
 	const char *filename = config_get_string(main->Config(), "Output",
 			"FilenameFormatting");
 	bool overwriteIfExists = config_get_bool(main->Config(), "Output",
@@ -2261,6 +2274,10 @@ void OBSBasicSettings::LoadAdvancedSettings()
 	ui->reconnectRetryDelay->setValue(retryDelay);
 	ui->reconnectMaxRetries->setValue(maxRetries);
 
+	ui->dynBitrateEnable->setChecked(dynBitrate);
+	ui->dynBitrateMin->setValue(dynBitrateMin);
+	ui->dynBitrateMax->setValue(dynBitrateMax);
+
 	ui->streamDelaySec->setValue(delaySec);
 	ui->streamDelayPreserve->setChecked(preserveDelay);
 	ui->streamDelayEnable->setChecked(enableDelay);
@@ -2293,24 +2310,27 @@ void OBSBasicSettings::LoadAdvancedSettings()
 
 	const char *processPriority = config_get_string(App()->GlobalConfig(),
 			"General", "ProcessPriority");
-	bool enableNewSocketLoop = config_get_bool(main->Config(), "Output",
-			"NewSocketLoopEnable");
-	bool enableLowLatencyMode = config_get_bool(main->Config(), "Output",
-			"LowLatencyEnable");
 
 	int idx = ui->processPriority->findData(processPriority);
 	if (idx == -1)
 		idx = ui->processPriority->findData("Normal");
 	ui->processPriority->setCurrentIndex(idx);
 
-	ui->enableNewSocketLoop->setChecked(enableNewSocketLoop);
-	ui->enableLowLatencyMode->setChecked(enableLowLatencyMode);
-
 	bool browserHWAccel = config_get_bool(App()->GlobalConfig(),
 			"General", "BrowserHWAccel");
 	ui->browserHWAccel->setChecked(browserHWAccel);
 #endif
 
+#if defined(_WIN32) || defined(__linux__)
+	bool enableNewSocketLoop = config_get_bool(main->Config(), "Output",
+			"NewSocketLoopEnable");
+	bool enableLowLatencyMode = config_get_bool(main->Config(), "Output",
+			"LowLatencyEnable");
+
+	ui->enableNewSocketLoop->setChecked(enableNewSocketLoop);
+	ui->enableLowLatencyMode->setChecked(enableLowLatencyMode);
+#endif
+
 	bool disableFocusHotkeys = config_get_bool(App()->GlobalConfig(),
 			"General", "DisableHotkeysInFocus");
 	ui->disableFocusHotkeys->setChecked(disableFocusHotkeys);
@@ -2951,14 +2971,16 @@ void OBSBasicSettings::SaveAdvancedSettings()
 	if (main->Active())
 		SetProcessPriority(priority.c_str());
 
-	SaveCheckBox(ui->enableNewSocketLoop, "Output", "NewSocketLoopEnable");
-	SaveCheckBox(ui->enableLowLatencyMode, "Output", "LowLatencyEnable");
-
 	bool browserHWAccel = ui->browserHWAccel->isChecked();
 	config_set_bool(App()->GlobalConfig(), "General",
 			"BrowserHWAccel", browserHWAccel);
 #endif
 
+#if defined(_WIN32) || defined(__linux__)
+	SaveCheckBox(ui->enableNewSocketLoop, "Output", "NewSocketLoopEnable");
+	SaveCheckBox(ui->enableLowLatencyMode, "Output", "LowLatencyEnable");
+#endif
+
 	bool disableFocusHotkeys = ui->disableFocusHotkeys->isChecked();
 	config_set_bool(App()->GlobalConfig(), "General",
 			"DisableHotkeysInFocus", disableFocusHotkeys);
@@ -3003,6 +3025,9 @@ void OBSBasicSettings::SaveAdvancedSettings()
 	SaveCheckBox(ui->reconnectEnable, "Output", "Reconnect");
 	SaveSpinBox(ui->reconnectRetryDelay, "Output", "RetryDelay");
 	SaveSpinBox(ui->reconnectMaxRetries, "Output", "MaxRetries");
+	SaveCheckBox(ui->dynBitrateEnable, "Output", "DynBitrateEnable");
+	SaveSpinBox(ui->dynBitrateMin, "Output", "DynBitrateMin");
+	SaveSpinBox(ui->dynBitrateMax, "Output", "DynBitrateMax");
 	SaveComboData(ui->bindToIP, "Output", "BindIP");
 	SaveCheckBox(ui->autoRemux, "Video", "AutoRemux");
 
@@ -45,6 +45,24 @@ struct video_input {
 	struct video_frame        frame[MAX_CONVERT_BUFFERS];
 	int                       cur_frame;
 
+	/* downscaled inputs in the same cascade group (the renditions of an
+	 * encoder ladder) scale from the smallest larger downscaled input of
+	 * that group rather than from the full frame (1080 -> 720 -> 480 for
+	 * example).  inputs without a group always scale from the full frame,
+	 * so their output never depends on what else is connected.
+	 * cascade_src is the index of the source input, or -1 to use the full
+	 * frame, and scaled/scaled_valid hold this input's output for the
+	 * current frame so later inputs can use it */
+	struct video_scale_info   scaler_src;
+	const void                *cascade_group;
+	long                      cascade_src;
+	struct video_data         scaled;
+	bool                      scaled_valid;
+
+	/* only frames with a frame_index divisible by this are scaled and
+	 * passed to the callback */
+	uint32_t                  frame_rate_divisor;
+
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
 };
@@ -67,6 +85,7 @@ struct video_output {
 	uint64_t                   frame_time;
 	uint32_t                   skipped_frames;
 	uint32_t                   total_frames;
+	uint64_t                   frame_index;
 
 	bool                       initialized;
 
@@ -128,18 +147,39 @@ static inline bool video_output_cur_frame(struct video_output *video)
 
 	/* -------------------------------- */
 
+	frame_info->frame.frame_index = video->frame_index;
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	for (size_t i = 0; i < video->inputs.num; i++) {
 		struct video_input *input = video->inputs.array+i;
 		struct video_data frame = frame_info->frame;
 
-		if (scale_video_output(input, &frame))
+		input->scaled_valid = false;
+
+		if (video->frame_index % input->frame_rate_divisor != 0)
+			continue;
+
+		if (input->cascade_src >= 0) {
+			struct video_input *src =
+				video->inputs.array + input->cascade_src;
+			if (!src->scaled_valid)
+				continue;
+
+			frame = src->scaled;
+		}
+
+		if (scale_video_output(input, &frame)) {
+			input->scaled = frame;
+			input->scaled_valid = true;
 			input->callback(input->param, &frame);
+		}
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
 
+	video->frame_index++;
+
 	/* -------------------------------- */
 
 	pthread_mutex_lock(&video->data_mutex);
@@ -292,33 +332,62 @@ static size_t video_get_input_idx(const video_t *video,
 	return DARRAY_INVALID;
 }
 
+static inline void get_output_scale_info(const struct video_output *video,
+		struct video_scale_info *info)
+{
+	info->format     = video->info.format;
+	info->width      = video->info.width;
+	info->height     = video->info.height;
+	info->range      = video->info.range;
+	info->colorspace = video->info.colorspace;
+}
+
+static inline bool scale_info_equal(const struct video_scale_info *a,
+		const struct video_scale_info *b)
+{
+	return a->format == b->format && a->width == b->width &&
+		a->height == b->height && a->range == b->range &&
+		a->colorspace == b->colorspace;
+}
+
+static bool video_input_create_scaler(struct video_input *input,
+		const struct video_scale_info *from)
+{
+	int ret;
+
+	video_scaler_destroy(input->scaler);
+	input->scaler = NULL;
+
+	ret = video_scaler_create(&input->scaler, &input->conversion, from,
+			VIDEO_SCALE_FAST_BILINEAR);
+	if (ret != VIDEO_SCALER_SUCCESS) {
+		if (ret == VIDEO_SCALER_BAD_CONVERSION)
+			blog(LOG_ERROR, "video_input_init: Bad "
+			                "scale conversion type");
+		else
+			blog(LOG_ERROR, "video_input_init: Failed to "
+			                "create scaler");
+
+		return false;
+	}
+
+	input->scaler_src = *from;
+	return true;
+}
+
 static inline bool video_input_init(struct video_input *input,
 		struct video_output *video)
 {
+	input->cascade_src = -1;
+
 	if (input->conversion.width  != video->info.width ||
 	    input->conversion.height != video->info.height ||
 	    input->conversion.format != video->info.format) {
-		struct video_scale_info from = {
-			.format = video->info.format,
-			.width  = video->info.width,
-			.height = video->info.height,
-			.range = video->info.range,
-			.colorspace = video->info.colorspace
-		};
-
-		int ret = video_scaler_create(&input->scaler,
-				&input->conversion, &from,
-				VIDEO_SCALE_FAST_BILINEAR);
-		if (ret != VIDEO_SCALER_SUCCESS) {
-			if (ret == VIDEO_SCALER_BAD_CONVERSION)
-				blog(LOG_ERROR, "video_input_init: Bad "
-				                "scale conversion type");
-			else
-				blog(LOG_ERROR, "video_input_init: Failed to "
-				                "create scaler");
+		struct video_scale_info from;
+		get_output_scale_info(video, &from);
 
+		if (!video_input_create_scaler(input, &from))
 			return false;
-		}
 
 		for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
 			video_frame_init(&input->frame[i],
@@ -330,10 +399,108 @@ static inline bool video_input_init(struct video_input *input,
 	return true;
 }
 
+static inline uint64_t input_area(const struct video_input *input)
+{
+	return (uint64_t)input->conversion.width * input->conversion.height;
+}
+
+static inline bool is_downscaled(const struct video_output *video,
+		const struct video_input *input)
+{
+	return input->scaler &&
+		input->conversion.width  <= video->info.width &&
+		input->conversion.height <= video->info.height &&
+		input_area(input) < (uint64_t)video->info.width *
+		                    video->info.height;
+}
+
+/* a larger downscaled input with the same color settings can be used as the
+ * source of a smaller one, as long as it scales every frame the smaller one
+ * needs */
+static inline bool can_cascade(const struct video_output *video,
+		const struct video_input *src, const struct video_input *dst)
+{
+	return dst->cascade_group && src->cascade_group == dst->cascade_group &&
+		is_downscaled(video, src) && is_downscaled(video, dst) &&
+		dst->frame_rate_divisor % src->frame_rate_divisor == 0 &&
+		src->conversion.width  >= dst->conversion.width &&
+		src->conversion.height >= dst->conversion.height &&
+		input_area(src) > input_area(dst) &&
+		src->conversion.range      == dst->conversion.range &&
+		src->conversion.colorspace == dst->conversion.colorspace;
+}
+
+static int cmp_input_area(const void *a, const void *b)
+{
+	uint64_t area_a = input_area(a);
+	uint64_t area_b = input_area(b);
+	return area_a < area_b ? 1 : (area_a > area_b ? -1 : 0);
+}
+
+/* inputs are kept sorted from largest to smallest so every cascade source is
+ * scaled before the inputs that use it */
+static void update_cascade(struct video_output *video)
+{
+	struct video_scale_info full;
+	get_output_scale_info(video, &full);
+
+	if (video->inputs.num > 1)
+		qsort(video->inputs.array, video->inputs.num,
+				sizeof(struct video_input), cmp_input_area);
+
+	for (size_t i = 0; i < video->inputs.num; i++) {
+		struct video_input *input = video->inputs.array+i;
+		const struct video_scale_info *from = &full;
+		long src_idx = -1;
+
+		if (!input->scaler)
+			continue;
+
+		for (size_t j = 0; j < i; j++) {
+			struct video_input *src = video->inputs.array+j;
+
+			if (can_cascade(video, src, input))
+				src_idx = (long)j;
+		}
+
+		if (src_idx >= 0)
+			from = &video->inputs.array[src_idx].conversion;
+
+		if (!scale_info_equal(from, &input->scaler_src) &&
+		    !video_input_create_scaler(input, from)) {
+			/* fall back to scaling from the full frame */
+			src_idx = -1;
+			video_input_create_scaler(input, &full);
+		}
+
+		input->cascade_src = src_idx;
+	}
+}
+
 bool video_output_connect(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
+{
+	return video_output_connect3(video, conversion, 1, NULL, callback,
+			param);
+}
+
+bool video_output_connect2(video_t *video,
+		const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param)
+{
+	return video_output_connect3(video, conversion, frame_rate_divisor,
+			NULL, callback, param);
+}
+
+bool video_output_connect3(video_t *video,
+		const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor, const void *cascade_group,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param)
 {
 	bool success = false;
 
@@ -351,8 +518,12 @@ bool video_output_connect(video_t *video,
 		struct video_input input;
 		memset(&input, 0, sizeof(input));
 
-		input.callback = callback;
-		input.param    = param;
+		input.callback      = callback;
+		input.param         = param;
+		input.cascade_group = cascade_group;
+
+		input.frame_rate_divisor = frame_rate_divisor ?
+			frame_rate_divisor : 1;
 
 		if (conversion) {
 			input.conversion = *conversion;
@@ -368,8 +539,10 @@ bool video_output_connect(video_t *video,
 			input.conversion.height = video->info.height;
 
 		success = video_input_init(&input, video);
-		if (success)
+		if (success) {
 			da_push_back(video->inputs, &input);
+			update_cascade(video);
+		}
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -390,6 +563,7 @@ void video_output_disconnect(video_t *video,
 	if (idx != DARRAY_INVALID) {
 		video_input_free(video->inputs.array+idx);
 		da_erase(video->inputs, idx);
+		update_cascade(video);
 	}
 
 	if (video->inputs.num == 0) {
@@ -68,6 +68,11 @@ struct video_data {
 	uint8_t           *data[MAX_AV_PLANES];
 	uint32_t          linesize[MAX_AV_PLANES];
 	uint64_t          timestamp;
+
+	/* index of the frame since the video output was opened, counting
+	 * every frame of the output (including those skipped by inputs with a
+	 * frame rate divisor) */
+	uint64_t          frame_index;
 };
 
 struct video_output_info {
@@ -179,6 +184,22 @@ EXPORT bool video_output_connect(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
+/* connects an input that only receives every frame_rate_divisor'th frame of
+ * the output.  frames are picked by frame_index, so inputs with the same
+ * divisor receive the same frames */
+EXPORT bool video_output_connect2(video_t *video,
+		const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param);
+/* like video_output_connect2, but downscaled inputs with the same non-NULL
+ * cascade_group (the renditions of an encoder ladder for example) are scaled
+ * from the next larger input of the group instead of the full frame */
+EXPORT bool video_output_connect3(video_t *video,
+		const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor, const void *cascade_group,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param);
 EXPORT void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
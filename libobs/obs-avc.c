@@ -15,7 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
-#include "obs.h"
+#include "obs-internal.h"
 #include "obs-avc.h"
 #include "util/array-serializer.h"
 
@@ -97,15 +97,33 @@ static inline int get_drop_priority(int priority)
 	return priority;
 }
 
-static void serialize_avc_data(struct serializer *s, const uint8_t *data,
-		size_t size, bool *is_keyframe, int *priority)
+static inline void write_be32(uint8_t *out, uint32_t val)
+{
+	out[0] = (uint8_t)(val >> 24);
+	out[1] = (uint8_t)(val >> 16);
+	out[2] = (uint8_t)(val >> 8);
+	out[3] = (uint8_t)val;
+}
+
+/* each start code is at least three bytes and is replaced with a four byte
+ * size, so the output can grow by at most one byte per three input bytes */
+static inline size_t max_avc_data_size(size_t size)
+{
+	return size + size / 3 + 4;
+}
+
+static size_t write_avc_data(uint8_t *out, const uint8_t *data, size_t size,
+		bool *is_keyframe, int *priority)
 {
 	const uint8_t *nal_start, *nal_end;
 	const uint8_t *end = data+size;
+	uint8_t *out_start = out;
 	int type;
 
 	nal_start = obs_avc_find_startcode(data, end);
 	while (true) {
+		size_t nal_size;
+
 		while (nal_start < end && !*(nal_start++));
 
 		if (nal_start == end)
@@ -121,28 +139,28 @@ static void serialize_avc_data(struct serializer *s, const uint8_t *data,
 		}
 
 		nal_end = obs_avc_find_startcode(nal_start, end);
-		s_wb32(s, (uint32_t)(nal_end - nal_start));
-		s_write(s, nal_start, nal_end - nal_start);
+		nal_size = nal_end - nal_start;
+
+		write_be32(out, (uint32_t)nal_size);
+		memcpy(out + 4, nal_start, nal_size);
+		out += 4 + nal_size;
 		nal_start = nal_end;
 	}
+
+	return out - out_start;
 }
 
+/* the converted packet is written directly in to a pooled packet buffer
+ * rather than going through a serializer and being copied again */
 void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 		const struct encoder_packet *src)
 {
-	struct array_output_data output;
-	struct serializer s;
-	long ref = 1;
-
-	array_output_serializer_init(&s, &output);
 	*avc_packet = *src;
 
-	serialize(&s, &ref, sizeof(ref));
-	serialize_avc_data(&s, src->data, src->size, &avc_packet->keyframe,
+	avc_packet->data = obs_packet_pool_alloc(max_avc_data_size(src->size));
+	avc_packet->size = write_avc_data(avc_packet->data, src->data,
+			src->size, &avc_packet->keyframe,
 			&avc_packet->priority);
-
-	avc_packet->data          = output.bytes.array + sizeof(ref);
-	avc_packet->size          = output.bytes.num - sizeof(ref);
 	avc_packet->drop_priority = get_drop_priority(avc_packet->priority);
 }
 
@@ -0,0 +1,280 @@
+/******************************************************************************
+    Copyright (C) 2019 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-internal.h"
+
+/* the CPU budget splits a fixed number of worker threads between everything
+ * that claims part of it (software encoders), in proportion to each claim's
+ * weight.  every claim is rebalanced whenever a claim is created or destroyed,
+ * so the first claim doesn't keep the whole budget.  encoders generally can't
+ * change their thread count once open, so a rebalance only affects what they
+ * use the next time they're opened.  core affinity is optional, and if
+ * enabled each claim is given its own contiguous range of cores where
+ * possible.
+ *
+ * nothing is constrained until obs_set_cpu_budget has been called, until then
+ * claims are assigned 0 threads, which lets encoders pick their own count */
+
+struct obs_cpu_claim {
+	char              *name;
+	uint64_t          weight;
+	int               threads;
+	uint64_t          affinity;
+	uint64_t          saved_affinity;
+	bool              affinity_pushed;
+	struct obs_cpu_claim *next;
+};
+
+struct obs_cpu_budget {
+	pthread_mutex_t   mutex;
+	int               threads;
+	bool              use_affinity;
+	bool              configured;
+	struct obs_cpu_claim *first_claim;
+};
+
+static struct obs_cpu_budget budget;
+
+void obs_cpu_budget_init(void)
+{
+	pthread_mutex_init(&budget.mutex, NULL);
+	budget.threads = 0;
+	budget.use_affinity = false;
+	budget.configured = false;
+	budget.first_claim = NULL;
+}
+
+void obs_cpu_budget_free(void)
+{
+	if (budget.first_claim)
+		blog(LOG_WARNING, "CPU budget: claim '%s' was never released",
+				budget.first_claim->name);
+
+	pthread_mutex_destroy(&budget.mutex);
+}
+
+static inline int get_budget_threads(void)
+{
+	int threads = budget.threads;
+
+	if (threads <= 0)
+		threads = os_get_logical_cores();
+	return threads > 0 ? threads : 1;
+}
+
+static uint64_t assign_affinity(int threads, int total, int *next_core)
+{
+	uint64_t mask = 0;
+
+	if (!budget.use_affinity || total > 64)
+		return 0;
+	if (threads >= total)
+		return 0;
+
+	for (int i = 0; i < threads; i++) {
+		mask |= 1ULL << *next_core;
+		if (++*next_core == total)
+			*next_core = 0;
+	}
+
+	return mask;
+}
+
+/* returns the number of threads assigned in total, which can be slightly
+ * more than the budget as every claim gets at least one */
+static int rebalance_claims(void)
+{
+	struct obs_cpu_claim *claim;
+	uint64_t total_weight = 0;
+	int total_threads = get_budget_threads();
+	int allocated = 0;
+	int next_core = 0;
+
+	for (claim = budget.first_claim; claim; claim = claim->next)
+		total_weight += claim->weight;
+
+	for (claim = budget.first_claim; claim; claim = claim->next) {
+		if (!budget.configured) {
+			claim->threads = 0;
+			claim->affinity = 0;
+			continue;
+		}
+
+		claim->threads = (int)(((uint64_t)total_threads *
+					claim->weight + total_weight / 2) /
+				total_weight);
+		if (claim->threads < 1)
+			claim->threads = 1;
+
+		claim->affinity = assign_affinity(claim->threads,
+				total_threads, &next_core);
+		allocated += claim->threads;
+	}
+
+	return allocated;
+}
+
+void obs_set_cpu_budget(int threads, bool use_affinity)
+{
+	pthread_mutex_lock(&budget.mutex);
+	budget.threads = threads;
+	budget.use_affinity = use_affinity;
+	budget.configured = true;
+	rebalance_claims();
+	pthread_mutex_unlock(&budget.mutex);
+}
+
+int obs_get_cpu_budget(void)
+{
+	int threads;
+
+	pthread_mutex_lock(&budget.mutex);
+	threads = get_budget_threads();
+	pthread_mutex_unlock(&budget.mutex);
+	return threads;
+}
+
+obs_cpu_claim_t *obs_cpu_claim_create(const char *name, uint64_t weight)
+{
+	struct obs_cpu_claim *claim;
+	struct obs_cpu_claim *cur;
+	int total_threads;
+	int allocated;
+	int num_claims = 0;
+	bool configured;
+
+	if (!weight)
+		weight = 1;
+
+	claim = bzalloc(sizeof(struct obs_cpu_claim));
+	claim->name = bstrdup(name ? name : "(unnamed)");
+	claim->weight = weight;
+
+	pthread_mutex_lock(&budget.mutex);
+
+	claim->next = budget.first_claim;
+	budget.first_claim = claim;
+
+	allocated = rebalance_claims();
+	total_threads = get_budget_threads();
+	configured = budget.configured;
+
+	if (configured) {
+		for (cur = budget.first_claim; cur; cur = cur->next) {
+			blog(LOG_INFO, "CPU budget: '%s' assigned %d of %d "
+					"threads (affinity mask 0x%llx)",
+					cur->name, cur->threads,
+					total_threads,
+					(unsigned long long)cur->affinity);
+			num_claims++;
+		}
+	}
+
+	pthread_mutex_unlock(&budget.mutex);
+
+	if (configured && allocated > total_threads)
+		blog(LOG_WARNING, "CPU budget: %d claims need at least one "
+				"thread each, %d threads assigned in total, "
+				"%d available",
+				num_claims, allocated, total_threads);
+
+	return claim;
+}
+
+void obs_cpu_claim_destroy(obs_cpu_claim_t *claim)
+{
+	struct obs_cpu_claim **cur;
+
+	if (!claim)
+		return;
+
+	pthread_mutex_lock(&budget.mutex);
+
+	for (cur = &budget.first_claim; *cur; cur = &(*cur)->next) {
+		if (*cur == claim) {
+			*cur = claim->next;
+			break;
+		}
+	}
+
+	rebalance_claims();
+
+	pthread_mutex_unlock(&budget.mutex);
+
+	blog(LOG_DEBUG, "CPU budget: '%s' released %d threads",
+			claim->name, claim->threads);
+
+	bfree(claim->name);
+	bfree(claim);
+}
+
+int obs_cpu_claim_get_threads(const obs_cpu_claim_t *claim)
+{
+	int threads;
+
+	if (!obs_ptr_valid(claim, "obs_cpu_claim_get_threads"))
+		return 0;
+
+	pthread_mutex_lock(&budget.mutex);
+	threads = claim->threads;
+	pthread_mutex_unlock(&budget.mutex);
+	return threads;
+}
+
+uint64_t obs_cpu_claim_get_affinity(const obs_cpu_claim_t *claim)
+{
+	uint64_t affinity;
+
+	if (!obs_ptr_valid(claim, "obs_cpu_claim_get_affinity"))
+		return 0;
+
+	pthread_mutex_lock(&budget.mutex);
+	affinity = claim->affinity;
+	pthread_mutex_unlock(&budget.mutex);
+	return affinity;
+}
+
+void obs_cpu_claim_push_affinity(obs_cpu_claim_t *claim)
+{
+	uint64_t affinity;
+
+	if (!obs_ptr_valid(claim, "obs_cpu_claim_push_affinity"))
+		return;
+	if (claim->affinity_pushed)
+		return;
+
+	affinity = obs_cpu_claim_get_affinity(claim);
+	if (!affinity)
+		return;
+
+	claim->saved_affinity = os_get_thread_affinity();
+	if (!claim->saved_affinity)
+		return;
+
+	claim->affinity_pushed = os_set_thread_affinity(affinity);
+}
+
+void obs_cpu_claim_pop_affinity(obs_cpu_claim_t *claim)
+{
+	if (!obs_ptr_valid(claim, "obs_cpu_claim_pop_affinity"))
+		return;
+	if (!claim->affinity_pushed)
+		return;
+
+	os_set_thread_affinity(claim->saved_affinity);
+	claim->affinity_pushed = false;
+}
@@ -0,0 +1,233 @@
+/******************************************************************************
+    Copyright (C) 2019 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+
+#include "obs-internal.h"
+
+/* an encoder ladder is a set of video encoders encoding renditions of the
+ * same video output.  video-io decimates each rendition by the frame index of
+ * the output, so renditions with the same divisor get the same frames.  the
+ * ladder starts on a frame that every rendition receives (a multiple of the
+ * lcm of the divisors), and every rendition is given a keyframe every
+ * gop_frames frames from there.  a rendition that starts after the others
+ * waits for the next keyframe boundary.
+ *
+ * the downscaling itself is cascaded by video-io, which scales each
+ * rendition from the next larger one rather than from the full frame */
+
+struct obs_encoder_ladder {
+	pthread_mutex_t         mutex;
+	video_t                 *video;
+	uint32_t                keyint_ms;
+	uint64_t                lcm;
+	uint64_t                gop_frames;
+	uint64_t                start_index;
+	size_t                  active;
+	DARRAY(obs_encoder_t*)  encoders;
+};
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static uint64_t get_gop_frames(const struct obs_encoder_ladder *ladder,
+		uint32_t divisor, uint64_t *lcm_out)
+{
+	const struct video_output_info *voi = video_output_get_info(
+			ladder->video);
+	uint64_t gop = ((uint64_t)ladder->keyint_ms * voi->fps_num +
+			(uint64_t)voi->fps_den * 500) /
+		((uint64_t)voi->fps_den * 1000);
+	uint64_t lcm = divisor;
+
+	for (size_t i = 0; i < ladder->encoders.num; i++) {
+		uint64_t d = ladder->encoders.array[i]->frame_rate_divisor;
+		lcm = lcm / gcd(lcm, d) * d;
+	}
+
+	*lcm_out = lcm;
+
+	if (gop < lcm)
+		gop = lcm;
+	return (gop + lcm - 1) / lcm * lcm;
+}
+
+obs_encoder_ladder_t *obs_encoder_ladder_create(video_t *video,
+		uint32_t keyint_ms)
+{
+	struct obs_encoder_ladder *ladder;
+
+	if (!obs_ptr_valid(video, "obs_encoder_ladder_create"))
+		return NULL;
+
+	ladder = bzalloc(sizeof(struct obs_encoder_ladder));
+	ladder->video      = video;
+	ladder->keyint_ms  = keyint_ms ? keyint_ms : 2000;
+	ladder->gop_frames = get_gop_frames(ladder, 1, &ladder->lcm);
+
+	if (pthread_mutex_init(&ladder->mutex, NULL) != 0) {
+		bfree(ladder);
+		return NULL;
+	}
+
+	return ladder;
+}
+
+void obs_encoder_ladder_destroy(obs_encoder_ladder_t *ladder)
+{
+	if (!ladder)
+		return;
+
+	for (size_t i = 0; i < ladder->encoders.num; i++) {
+		obs_encoder_t *encoder = ladder->encoders.array[i];
+
+		if (obs_encoder_active(encoder))
+			blog(LOG_WARNING, "obs_encoder_ladder_destroy: "
+					"encoder '%s' is still active",
+					obs_encoder_get_name(encoder));
+		encoder->ladder = NULL;
+	}
+
+	da_free(ladder->encoders);
+	pthread_mutex_destroy(&ladder->mutex);
+	bfree(ladder);
+}
+
+bool obs_encoder_ladder_add(obs_encoder_ladder_t *ladder,
+		obs_encoder_t *encoder, uint32_t width, uint32_t height,
+		uint32_t frame_rate_divisor)
+{
+	uint64_t gop_frames;
+	uint64_t lcm;
+
+	if (!obs_ptr_valid(ladder, "obs_encoder_ladder_add"))
+		return false;
+	if (!obs_ptr_valid(encoder, "obs_encoder_ladder_add"))
+		return false;
+	if (encoder->info.type != OBS_ENCODER_VIDEO) {
+		blog(LOG_WARNING, "obs_encoder_ladder_add: encoder '%s' is "
+				"not a video encoder",
+				obs_encoder_get_name(encoder));
+		return false;
+	}
+	if (obs_encoder_active(encoder) || encoder->ladder) {
+		blog(LOG_WARNING, "obs_encoder_ladder_add: encoder '%s' is "
+				"active or already part of a ladder",
+				obs_encoder_get_name(encoder));
+		return false;
+	}
+
+	if (!frame_rate_divisor)
+		frame_rate_divisor = 1;
+
+	pthread_mutex_lock(&ladder->mutex);
+
+	/* the start frame and keyframe interval of active renditions can't
+	 * change, so a new rendition must receive frames on both */
+	gop_frames = get_gop_frames(ladder, frame_rate_divisor, &lcm);
+	if (ladder->active && (gop_frames != ladder->gop_frames ||
+	                       lcm != ladder->lcm)) {
+		pthread_mutex_unlock(&ladder->mutex);
+		blog(LOG_WARNING, "obs_encoder_ladder_add: frame rate divisor "
+				"%"PRIu32" of encoder '%s' does not line up with "
+				"the active renditions",
+				frame_rate_divisor,
+				obs_encoder_get_name(encoder));
+		return false;
+	}
+
+	ladder->gop_frames = gop_frames;
+	ladder->lcm        = lcm;
+	da_push_back(ladder->encoders, &encoder);
+
+	pthread_mutex_unlock(&ladder->mutex);
+
+	obs_encoder_set_video(encoder, ladder->video);
+	obs_encoder_set_scaled_size(encoder, width, height);
+	obs_encoder_set_frame_rate_divisor(encoder, frame_rate_divisor);
+	encoder->ladder = ladder;
+
+	blog(LOG_INFO, "encoder ladder: added '%s' (%"PRIu32"x%"PRIu32", "
+			"frame rate divisor %"PRIu32", keyframe every "
+			"%"PRIu64" frames)",
+			obs_encoder_get_name(encoder), width, height,
+			frame_rate_divisor, gop_frames);
+	return true;
+}
+
+void obs_encoder_ladder_remove(obs_encoder_ladder_t *ladder,
+		obs_encoder_t *encoder)
+{
+	if (!ladder || !encoder || encoder->ladder != ladder)
+		return;
+
+	pthread_mutex_lock(&ladder->mutex);
+	da_erase_item(ladder->encoders, &encoder);
+	pthread_mutex_unlock(&ladder->mutex);
+
+	encoder->ladder = NULL;
+}
+
+/* called from the video thread for each frame video-io passes to an encoder
+ * in the ladder.  returns false if the encoder should skip the frame */
+bool obs_encoder_ladder_accept_frame(struct obs_encoder_ladder *ladder,
+		struct obs_encoder *encoder, uint64_t frame_index,
+		bool *keyframe)
+{
+	bool accept = true;
+
+	pthread_mutex_lock(&ladder->mutex);
+
+	if (!ladder->active && !encoder->start_ts) {
+		if (frame_index % ladder->lcm != 0) {
+			pthread_mutex_unlock(&ladder->mutex);
+			return false;
+		}
+		ladder->start_index = frame_index;
+	}
+
+	*keyframe = frame_index >= ladder->start_index &&
+		(frame_index - ladder->start_index) % ladder->gop_frames == 0;
+
+	if (!encoder->start_ts) {
+		accept = *keyframe;
+		if (accept)
+			ladder->active++;
+	}
+
+	pthread_mutex_unlock(&ladder->mutex);
+	return accept;
+}
+
+void obs_encoder_ladder_encoder_stopped(struct obs_encoder_ladder *ladder,
+		struct obs_encoder *encoder)
+{
+	if (!encoder->start_ts)
+		return;
+
+	pthread_mutex_lock(&ladder->mutex);
+	if (ladder->active)
+		ladder->active--;
+	pthread_mutex_unlock(&ladder->mutex);
+}
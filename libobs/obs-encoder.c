@@ -15,6 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include <inttypes.h>
 #include "obs.h"
 #include "obs-internal.h"
 
@@ -41,6 +42,11 @@ const char *obs_encoder_get_display_name(const char *id)
 	return ei ? ei->get_name(ei->type_data) : NULL;
 }
 
+static const char *encoder_signals[] = {
+	"void adaptive_preset(ptr encoder, int level, bool overloaded)",
+	NULL
+};
+
 static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		obs_data_t *settings, obs_data_t *hotkey_data)
 {
@@ -49,6 +55,8 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 	pthread_mutex_init_value(&encoder->init_mutex);
 	pthread_mutex_init_value(&encoder->callbacks_mutex);
 	pthread_mutex_init_value(&encoder->outputs_mutex);
+	pthread_mutex_init_value(&encoder->settings_mutex);
+	pthread_mutex_init_value(&encoder->encode_queue_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -63,6 +71,12 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		return false;
 	if (pthread_mutex_init(&encoder->outputs_mutex, NULL) != 0)
 		return false;
+	if (pthread_mutex_init(&encoder->settings_mutex, NULL) != 0)
+		return false;
+	if (pthread_mutex_init(&encoder->encode_queue_mutex, NULL) != 0)
+		return false;
+
+	signal_handler_add_array(encoder->context.signals, encoder_signals);
 
 	if (encoder->info.get_defaults)
 		encoder->info.get_defaults(encoder->context.settings);
@@ -83,6 +97,7 @@ static struct obs_encoder *create_encoder(const char *id,
 
 	encoder = bzalloc(sizeof(struct obs_encoder));
 	encoder->mixer_idx = mixer_idx;
+	encoder->frame_rate_divisor = 1;
 
 	if (!ei) {
 		blog(LOG_ERROR, "Encoder ID '%s' not found", id);
@@ -177,19 +192,153 @@ static inline bool has_scaling(const struct obs_encoder *encoder)
 		 video_height != encoder->scaled_height);
 }
 
+static void *encode_thread(void *param);
+static void reset_adaptive_preset(struct obs_encoder *encoder);
+static void restore_adaptive_preset(struct obs_encoder *encoder);
+
+struct encoder_audio_header {
+	int64_t  pts;
+	uint64_t queued_ts;
+};
+
+static void free_encode_queue(struct obs_encoder *encoder)
+{
+	for (size_t i = 0; i < ENCODER_MAX_QUEUED_FRAMES; i++)
+		video_frame_free(&encoder->encode_queue[i].frame);
+	circlebuf_free(&encoder->encode_audio_queue);
+
+	encoder->encode_queue_first = 0;
+	encoder->encode_queue_num = 0;
+	encoder->encode_queue_has_last = false;
+}
+
+static void log_encode_queue_stats(struct obs_encoder *encoder)
+{
+	double avg_latency_ms = encoder->encoded_frames ?
+		(double)encoder->total_latency_ns /
+		(double)encoder->encoded_frames / 1000000.0 : 0.0;
+
+	blog(LOG_INFO, "encoder '%s': %"PRIu32" frames encoded, "
+			"%"PRIu32" dropped (queue full), "
+			"%"PRIu32" skipped (duplicate), "
+			"average latency %.2fms, max queue depth %d",
+			encoder->context.name,
+			encoder->encoded_frames, encoder->dropped_frames,
+			encoder->duplicate_frames,
+			avg_latency_ms, (int)encoder->max_queued_frames);
+}
+
+/* on a normal stop the thread encodes whatever is still queued before it
+ * exits.  the packets go to the callbacks that are still registered, so
+ * obs_encoder_stop only erases the last callback once this has returned,
+ * and the end of a recording isn't cut off.  if called from the encode
+ * thread itself (an encoder error for example), the queue is discarded and the
+ * thread is only told to exit, and is joined when it's next started or when
+ * the encoder is destroyed */
+static void stop_encode_thread(struct obs_encoder *encoder)
+{
+	if (!encoder->encode_thread_active)
+		return;
+
+	if (pthread_equal(pthread_self(), encoder->encode_thread)) {
+		os_atomic_set_bool(&encoder->encode_thread_drain, false);
+		os_atomic_set_bool(&encoder->encode_thread_stop, true);
+		return;
+	}
+
+	os_atomic_set_bool(&encoder->encode_thread_drain, true);
+	os_atomic_set_bool(&encoder->encode_thread_stop, true);
+
+	os_sem_post(encoder->encode_sem);
+	pthread_join(encoder->encode_thread, NULL);
+	encoder->encode_thread_active = false;
+
+	log_encode_queue_stats(encoder);
+
+	os_sem_destroy(encoder->encode_sem);
+	encoder->encode_sem = NULL;
+	free_encode_queue(encoder);
+}
+
+/* info is only used for video encoders */
+static bool start_encode_thread(struct obs_encoder *encoder,
+		const struct video_scale_info *info)
+{
+	stop_encode_thread(encoder);
+
+	if (info) {
+		for (size_t i = 0; i < ENCODER_MAX_QUEUED_FRAMES; i++)
+			video_frame_init(&encoder->encode_queue[i].frame,
+					info->format, info->width,
+					info->height);
+
+		encoder->encode_queue_format = info->format;
+		encoder->encode_queue_height = info->height;
+
+		reset_adaptive_preset(encoder);
+	} else {
+		/* the audio queue never grows past its cap, so it's allocated
+		 * up front and pushing a frame is only ever a copy */
+		circlebuf_reserve(&encoder->encode_audio_queue,
+				ENCODER_MAX_QUEUED_AUDIO_FRAMES *
+				(sizeof(struct encoder_audio_header) +
+				 encoder->planes * encoder->framesize_bytes));
+	}
+
+	encoder->dropped_frames      = 0;
+	encoder->duplicate_frames    = 0;
+	encoder->encoded_frames      = 0;
+	encoder->max_queued_frames   = 0;
+	encoder->total_latency_ns    = 0;
+	encoder->encode_thread_stop  = false;
+	encoder->encode_thread_drain = false;
+
+	if (!encoder->profile_encode_thread_name)
+		encoder->profile_encode_thread_name =
+			profile_store_name(obs_get_profiler_name_store(),
+					"encode_thread(%s)",
+					encoder->context.name);
+
+	if (os_sem_init(&encoder->encode_sem, 0) != 0)
+		goto fail;
+	if (pthread_create(&encoder->encode_thread, NULL, encode_thread,
+				encoder) != 0)
+		goto fail;
+
+	encoder->encode_thread_active = true;
+	return true;
+
+fail:
+	blog(LOG_ERROR, "encoder '%s': failed to create encode thread",
+			encoder->context.name);
+	os_sem_destroy(encoder->encode_sem);
+	encoder->encode_sem = NULL;
+	free_encode_queue(encoder);
+	return false;
+}
+
 static void add_connection(struct obs_encoder *encoder)
 {
 	if (encoder->info.type == OBS_ENCODER_AUDIO) {
 		struct audio_convert_info audio_info = {0};
 		get_audio_info(encoder, &audio_info);
 
+		if (!start_encode_thread(encoder, NULL))
+			return;
+
 		audio_output_connect(encoder->media, encoder->mixer_idx,
 				&audio_info, receive_audio, encoder);
 	} else {
 		struct video_scale_info info = {0};
 		get_video_info(encoder, &info);
 
-		start_raw_video(encoder->media, &info, receive_video, encoder);
+		if (!start_encode_thread(encoder, &info))
+			return;
+
+		/* only the renditions of a ladder scale from each other */
+		start_raw_video(encoder->media, &info,
+				encoder->frame_rate_divisor, encoder->ladder,
+				receive_video, encoder);
 	}
 
 	set_encoder_active(encoder, true);
@@ -203,6 +352,12 @@ static void remove_connection(struct obs_encoder *encoder)
 	else
 		stop_raw_video(encoder->media, receive_video, encoder);
 
+	stop_encode_thread(encoder);
+	restore_adaptive_preset(encoder);
+
+	if (encoder->ladder)
+		obs_encoder_ladder_encoder_stopped(encoder->ladder, encoder);
+
 	obs_encoder_shutdown(encoder);
 	set_encoder_active(encoder, false);
 }
@@ -212,7 +367,9 @@ static inline void free_audio_buffers(struct obs_encoder *encoder)
 	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
 		circlebuf_free(&encoder->audio_input_buffer[i]);
 		bfree(encoder->audio_output_buffer[i]);
+		bfree(encoder->encode_audio_buffer[i]);
 		encoder->audio_output_buffer[i] = NULL;
+		encoder->encode_audio_buffer[i] = NULL;
 	}
 }
 
@@ -229,6 +386,9 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 
 		blog(LOG_DEBUG, "encoder '%s' destroyed", encoder->context.name);
 
+		obs_encoder_ladder_remove(encoder->ladder, encoder);
+
+		stop_encode_thread(encoder);
 		free_audio_buffers(encoder);
 
 		if (encoder->context.data)
@@ -237,6 +397,8 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 		pthread_mutex_destroy(&encoder->init_mutex);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
+		pthread_mutex_destroy(&encoder->settings_mutex);
+		pthread_mutex_destroy(&encoder->encode_queue_mutex);
 		obs_context_data_free(&encoder->context);
 		if (encoder->owns_info_id)
 			bfree((void*)encoder->info.id);
@@ -351,11 +513,15 @@ void obs_encoder_update(obs_encoder_t *encoder, obs_data_t *settings)
 	if (!obs_encoder_valid(encoder, "obs_encoder_update"))
 		return;
 
+	pthread_mutex_lock(&encoder->settings_mutex);
+
 	obs_data_apply(encoder->context.settings, settings);
 
 	if (encoder->info.update && encoder->context.data)
 		encoder->info.update(encoder->context.data,
 				encoder->context.settings);
+
+	pthread_mutex_unlock(&encoder->settings_mutex);
 }
 
 bool obs_encoder_get_extra_data(const obs_encoder_t *encoder,
@@ -384,9 +550,12 @@ static inline void reset_audio_buffers(struct obs_encoder *encoder)
 {
 	free_audio_buffers(encoder);
 
-	for (size_t i = 0; i < encoder->planes; i++)
+	for (size_t i = 0; i < encoder->planes; i++) {
 		encoder->audio_output_buffer[i] =
 			bmalloc(encoder->framesize_bytes);
+		encoder->encode_audio_buffer[i] =
+			bmalloc(encoder->framesize_bytes);
+	}
 }
 
 static void intitialize_audio_encoder(struct obs_encoder *encoder)
@@ -413,9 +582,11 @@ static inline bool obs_encoder_initialize_internal(obs_encoder_t *encoder)
 
 	obs_encoder_shutdown(encoder);
 
+	pthread_mutex_lock(&encoder->settings_mutex);
 	if (encoder->info.create)
 		encoder->context.data = encoder->info.create(
 				encoder->context.settings, encoder);
+	pthread_mutex_unlock(&encoder->settings_mutex);
 	if (!encoder->context.data)
 		return false;
 
@@ -519,14 +690,26 @@ static inline bool obs_encoder_stop_internal(obs_encoder_t *encoder,
 
 	idx = get_callback_idx(encoder, new_packet, param);
 	if (idx != DARRAY_INVALID) {
-		da_erase(encoder->callbacks, idx);
-		last = (encoder->callbacks.num == 0);
+		last = (encoder->callbacks.num == 1);
+
+		/* the last callback still receives the packets of the frames
+		 * that are queued, it's erased once the encode thread has
+		 * finished with them */
+		if (!last)
+			da_erase(encoder->callbacks, idx);
 	}
 
 	pthread_mutex_unlock(&encoder->callbacks_mutex);
 
 	if (last) {
 		remove_connection(encoder);
+
+		pthread_mutex_lock(&encoder->callbacks_mutex);
+		idx = get_callback_idx(encoder, new_packet, param);
+		if (idx != DARRAY_INVALID)
+			da_erase(encoder->callbacks, idx);
+		pthread_mutex_unlock(&encoder->callbacks_mutex);
+
 		encoder->initialized = false;
 
 		if (encoder->destroy_on_stop) {
@@ -674,10 +857,57 @@ void obs_encoder_set_video(obs_encoder_t *encoder, video_t *video)
 	voi = video_output_get_info(video);
 
 	encoder->media        = video;
-	encoder->timebase_num = voi->fps_den;
+	encoder->timebase_num = voi->fps_den * encoder->frame_rate_divisor;
 	encoder->timebase_den = voi->fps_num;
 }
 
+void obs_encoder_set_frame_rate_divisor(obs_encoder_t *encoder,
+		uint32_t divisor)
+{
+	const struct video_output_info *voi;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_set_frame_rate_divisor"))
+		return;
+	if (encoder->info.type != OBS_ENCODER_VIDEO) {
+		blog(LOG_WARNING, "obs_encoder_set_frame_rate_divisor: "
+				"encoder '%s' is not a video encoder",
+				obs_encoder_get_name(encoder));
+		return;
+	}
+	if (encoder_active(encoder)) {
+		blog(LOG_WARNING, "encoder '%s': Cannot set the frame rate "
+		                  "divisor while the encoder is active",
+		                  obs_encoder_get_name(encoder));
+		return;
+	}
+	if (encoder->ladder) {
+		blog(LOG_WARNING, "encoder '%s': Cannot set the frame rate "
+		                  "divisor of an encoder in a ladder",
+		                  obs_encoder_get_name(encoder));
+		return;
+	}
+
+	encoder->frame_rate_divisor = divisor ? divisor : 1;
+
+	if (encoder->media) {
+		voi = video_output_get_info(encoder->media);
+		encoder->timebase_num =
+			voi->fps_den * encoder->frame_rate_divisor;
+	}
+}
+
+uint32_t obs_encoder_get_frame_rate_divisor(const obs_encoder_t *encoder)
+{
+	return obs_encoder_valid(encoder, "obs_encoder_get_frame_rate_divisor") ?
+		encoder->frame_rate_divisor : 1;
+}
+
+bool obs_encoder_keyframes_forced(const obs_encoder_t *encoder)
+{
+	return obs_encoder_valid(encoder, "obs_encoder_keyframes_forced") ?
+		encoder->ladder != NULL : false;
+}
+
 void obs_encoder_set_audio(obs_encoder_t *encoder, audio_t *audio)
 {
 	if (!obs_encoder_valid(encoder, "obs_encoder_set_audio"))
@@ -730,6 +960,146 @@ bool obs_encoder_active(const obs_encoder_t *encoder)
 		encoder_active(encoder) : false;
 }
 
+size_t obs_encoder_get_output_count(obs_encoder_t *encoder)
+{
+	size_t count;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_output_count"))
+		return 0;
+
+	pthread_mutex_lock(&encoder->outputs_mutex);
+	count = encoder->outputs.num;
+	pthread_mutex_unlock(&encoder->outputs_mutex);
+	return count;
+}
+
+void obs_encoder_set_adaptive_preset(obs_encoder_t *encoder, bool enable)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_set_adaptive_preset"))
+		return;
+	if (encoder->info.type != OBS_ENCODER_VIDEO) {
+		blog(LOG_WARNING, "obs_encoder_set_adaptive_preset: "
+				"encoder '%s' is not a video encoder",
+				obs_encoder_get_name(encoder));
+		return;
+	}
+	if (enable && !encoder->info.step_preset)
+		blog(LOG_WARNING, "obs_encoder_set_adaptive_preset: "
+				"encoder '%s' does not support changing "
+				"presets", obs_encoder_get_name(encoder));
+
+	os_atomic_set_bool(&encoder->adaptive_preset, enable);
+}
+
+bool obs_encoder_adaptive_preset_enabled(const obs_encoder_t *encoder)
+{
+	return obs_encoder_valid(encoder,
+			"obs_encoder_adaptive_preset_enabled") ?
+		os_atomic_load_bool(&encoder->adaptive_preset) : false;
+}
+
+int obs_encoder_get_adaptive_preset_level(const obs_encoder_t *encoder)
+{
+	return obs_encoder_valid(encoder,
+			"obs_encoder_get_adaptive_preset_level") ?
+		(int)os_atomic_load_long(&encoder->adaptive_level) : 0;
+}
+
+uint32_t obs_encoder_get_frames_dropped(const obs_encoder_t *encoder)
+{
+	struct obs_encoder *enc = (struct obs_encoder*)encoder;
+	uint32_t dropped;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_frames_dropped"))
+		return 0;
+
+	pthread_mutex_lock(&enc->encode_queue_mutex);
+	dropped = enc->dropped_frames;
+	pthread_mutex_unlock(&enc->encode_queue_mutex);
+	return dropped;
+}
+
+void obs_encoder_set_skip_duplicate_frames(obs_encoder_t *encoder, bool skip)
+{
+	if (!obs_encoder_valid(encoder,
+				"obs_encoder_set_skip_duplicate_frames"))
+		return;
+	if (encoder->info.type != OBS_ENCODER_VIDEO) {
+		blog(LOG_WARNING, "obs_encoder_set_skip_duplicate_frames: "
+				"encoder '%s' is not a video encoder",
+				obs_encoder_get_name(encoder));
+		return;
+	}
+	/* skipped frames leave gaps in the timestamps, which only encoders
+	 * that base rate control and keyframe intervals on timestamps handle */
+	if (skip && (encoder->info.caps & OBS_ENCODER_CAP_VFR) == 0) {
+		blog(LOG_WARNING, "encoder '%s': Cannot skip duplicate "
+		                  "frames, encoder '%s' doesn't support "
+		                  "variable frame rate input",
+		                  obs_encoder_get_name(encoder),
+		                  encoder->info.id);
+		return;
+	}
+	if (encoder_active(encoder)) {
+		blog(LOG_WARNING, "encoder '%s': Cannot change duplicate "
+		                  "frame skipping while the encoder is active",
+		                  obs_encoder_get_name(encoder));
+		return;
+	}
+
+	encoder->skip_duplicate_frames = skip;
+}
+
+bool obs_encoder_skips_duplicate_frames(const obs_encoder_t *encoder)
+{
+	return obs_encoder_valid(encoder,
+			"obs_encoder_skips_duplicate_frames") ?
+		encoder->skip_duplicate_frames : false;
+}
+
+uint32_t obs_encoder_get_frames_duplicate(const obs_encoder_t *encoder)
+{
+	struct obs_encoder *enc = (struct obs_encoder*)encoder;
+	uint32_t duplicate;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_frames_duplicate"))
+		return 0;
+
+	pthread_mutex_lock(&enc->encode_queue_mutex);
+	duplicate = enc->duplicate_frames;
+	pthread_mutex_unlock(&enc->encode_queue_mutex);
+	return duplicate;
+}
+
+uint32_t obs_encoder_get_queued_frames(const obs_encoder_t *encoder)
+{
+	struct obs_encoder *enc = (struct obs_encoder*)encoder;
+	size_t queued;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_queued_frames"))
+		return 0;
+
+	pthread_mutex_lock(&enc->encode_queue_mutex);
+	queued = enc->encode_queue_num;
+	pthread_mutex_unlock(&enc->encode_queue_mutex);
+	return (uint32_t)queued;
+}
+
+uint64_t obs_encoder_get_average_latency(const obs_encoder_t *encoder)
+{
+	struct obs_encoder *enc = (struct obs_encoder*)encoder;
+	uint64_t latency = 0;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_average_latency"))
+		return 0;
+
+	pthread_mutex_lock(&enc->encode_queue_mutex);
+	if (enc->encoded_frames)
+		latency = enc->total_latency_ns / enc->encoded_frames;
+	pthread_mutex_unlock(&enc->encode_queue_mutex);
+	return latency;
+}
+
 static inline bool get_sei(const struct obs_encoder *encoder,
 		uint8_t **sei, size_t *size)
 {
@@ -793,6 +1163,17 @@ static void full_stop(struct obs_encoder *encoder)
 }
 
 static const char *do_encode_name = "do_encode";
+static inline void release_pooled_packet_data(struct obs_encoder *encoder)
+{
+	struct encoder_packet pkt = {0};
+
+	if (encoder->pooled_packet_data) {
+		pkt.data = encoder->pooled_packet_data;
+		encoder->pooled_packet_data = NULL;
+		obs_encoder_packet_release(&pkt);
+	}
+}
+
 static inline void do_encode(struct obs_encoder *encoder,
 		struct encoder_frame *frame)
 {
@@ -810,11 +1191,22 @@ static inline void do_encode(struct obs_encoder *encoder,
 	pkt.timebase_den = encoder->timebase_den;
 	pkt.encoder = encoder;
 
+	uint64_t encode_start = os_gettime_ns();
+
 	profile_start(encoder->profile_encoder_encode_name);
 	success = encoder->info.encode(encoder->context.data, frame, &pkt,
 			&received);
 	profile_end(encoder->profile_encoder_encode_name);
-	if (!success) {
+
+	encoder->last_encode_ns = os_gettime_ns() - encode_start;
+	if (!success && os_atomic_set_bool(&encoder->encode_thread_drain,
+				false)) {
+		/* the thread stopping the encoder is waiting for the drain
+		 * and shuts the encoder down itself once it ends */
+		blog(LOG_ERROR, "Error encoding with encoder '%s' while "
+				"stopping", encoder->context.name);
+		goto error;
+	} else if (!success) {
 		full_stop(encoder);
 		blog(LOG_ERROR, "Error encoding with encoder '%s'",
 				encoder->context.name);
@@ -845,39 +1237,177 @@ static inline void do_encode(struct obs_encoder *encoder,
 	}
 
 error:
+	release_pooled_packet_data(encoder);
 	profile_end(do_encode_name);
 }
 
 static const char *receive_video_name = "receive_video";
+static inline uint32_t plane_height(enum video_format format, size_t plane,
+		uint32_t height)
+{
+	if (plane > 0 && (format == VIDEO_FORMAT_I420 ||
+	                  format == VIDEO_FORMAT_NV12))
+		return height / 2;
+	return height;
+}
+
+/* the source frame can have a larger pitch than the queued frame (mapped
+ * staging textures for example), so copy row by row if they differ */
+static void copy_queued_frame(struct obs_encoder *encoder,
+		struct video_frame *dst, const struct video_data *src)
+{
+	enum video_format format = encoder->encode_queue_format;
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		uint32_t height = plane_height(format, i,
+				encoder->encode_queue_height);
+		uint32_t linesize;
+
+		if (!src->data[i] || !dst->data[i])
+			break;
+
+		if (src->linesize[i] == dst->linesize[i]) {
+			memcpy(dst->data[i], src->data[i],
+					(size_t)src->linesize[i] * height);
+			continue;
+		}
+
+		linesize = src->linesize[i] < dst->linesize[i] ?
+			src->linesize[i] : dst->linesize[i];
+
+		for (uint32_t y = 0; y < height; y++)
+			memcpy(dst->data[i] + (size_t)dst->linesize[i] * y,
+			       src->data[i] + (size_t)src->linesize[i] * y,
+			       linesize);
+	}
+}
+
+static bool frame_equal(struct obs_encoder *encoder,
+		const struct video_frame *a, const struct video_data *b)
+{
+	enum video_format format = encoder->encode_queue_format;
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		uint32_t height = plane_height(format, i,
+				encoder->encode_queue_height);
+		uint32_t linesize;
+
+		if (!a->data[i] || !b->data[i])
+			break;
+
+		if (a->linesize[i] == b->linesize[i]) {
+			if (memcmp(a->data[i], b->data[i],
+					(size_t)a->linesize[i] * height) != 0)
+				return false;
+			continue;
+		}
+
+		linesize = a->linesize[i] < b->linesize[i] ?
+			a->linesize[i] : b->linesize[i];
+
+		for (uint32_t y = 0; y < height; y++)
+			if (memcmp(a->data[i] + (size_t)a->linesize[i] * y,
+			           b->data[i] + (size_t)b->linesize[i] * y,
+			           linesize) != 0)
+				return false;
+	}
+
+	return true;
+}
+
+/* the last queued entry is only ever overwritten by the video thread, so it
+ * still holds the last queued frame even if it's already been encoded */
+static bool is_duplicate_frame(struct obs_encoder *encoder,
+		struct video_data *frame, bool keyframe)
+{
+	struct encoder_queued_frame *last;
+
+	if (!encoder->skip_duplicate_frames || keyframe)
+		return false;
+	if (!encoder->encode_queue_has_last)
+		return false;
+
+	last = &encoder->encode_queue[encoder->encode_queue_last];
+	if (frame->timestamp - encoder->last_queued_frame_ts >=
+			ENCODER_MAX_DUPLICATE_NS)
+		return false;
+
+	return frame_equal(encoder, &last->frame, frame);
+}
+
+static void queue_video_frame(struct obs_encoder *encoder,
+		struct video_data *frame, bool keyframe)
+{
+	struct encoder_queued_frame *entry;
+	size_t idx;
+
+	if (is_duplicate_frame(encoder, frame, keyframe)) {
+		pthread_mutex_lock(&encoder->encode_queue_mutex);
+		encoder->duplicate_frames++;
+		pthread_mutex_unlock(&encoder->encode_queue_mutex);
+		return;
+	}
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+
+	if (encoder->encode_queue_num == ENCODER_MAX_QUEUED_FRAMES) {
+		encoder->dropped_frames++;
+		pthread_mutex_unlock(&encoder->encode_queue_mutex);
+		return;
+	}
+
+	idx = (encoder->encode_queue_first + encoder->encode_queue_num) %
+		ENCODER_MAX_QUEUED_FRAMES;
+
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+
+	/* the encode thread only touches queued entries, so the free entry
+	 * can be filled without holding the lock */
+	entry = &encoder->encode_queue[idx];
+	copy_queued_frame(encoder, &entry->frame, frame);
+	entry->pts            = encoder->cur_pts;
+	entry->queued_ts      = os_gettime_ns();
+	entry->force_keyframe = keyframe;
+
+	encoder->encode_queue_last = idx;
+	encoder->encode_queue_has_last = true;
+	encoder->last_queued_frame_ts = frame->timestamp;
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+
+	encoder->encode_queue_num++;
+	if (encoder->encode_queue_num > encoder->max_queued_frames)
+		encoder->max_queued_frames = encoder->encode_queue_num;
+
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+
+	os_sem_post(encoder->encode_sem);
+}
+
 static void receive_video(void *param, struct video_data *frame)
 {
 	profile_start(receive_video_name);
 
 	struct obs_encoder    *encoder  = param;
 	struct obs_encoder    *pair     = encoder->paired_encoder;
-	struct encoder_frame  enc_frame;
+	bool                  keyframe  = false;
 
-	if (!encoder->first_received && pair) {
+	if (!encoder->start_ts && pair) {
 		if (!pair->first_received ||
 		    pair->first_raw_ts > frame->timestamp) {
 			goto wait_for_audio;
 		}
 	}
 
-	memset(&enc_frame, 0, sizeof(struct encoder_frame));
-
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		enc_frame.data[i]     = frame->data[i];
-		enc_frame.linesize[i] = frame->linesize[i];
-	}
+	if (encoder->ladder &&
+	    !obs_encoder_ladder_accept_frame(encoder->ladder, encoder,
+			    frame->frame_index, &keyframe))
+		goto wait_for_audio;
 
 	if (!encoder->start_ts)
 		encoder->start_ts = frame->timestamp;
 
-	enc_frame.frames = 1;
-	enc_frame.pts    = encoder->cur_pts;
-
-	do_encode(encoder, &enc_frame);
+	queue_video_frame(encoder, frame, keyframe);
 
 	encoder->cur_pts += encoder->timebase_num;
 
@@ -885,6 +1415,301 @@ wait_for_audio:
 	profile_end(receive_video_name);
 }
 
+/* the adaptive preset controller looks at the encoder in two second windows.
+ * if encoding takes up most of the frame interval or frames are being
+ * dropped/skipped it steps the preset toward faster presets, and once the
+ * encoder has had plenty of headroom for several windows in a row it steps
+ * back toward the original preset.  after any change it waits a few windows
+ * to let the new preset settle */
+#define ADAPTIVE_WINDOW_SEC        2
+#define ADAPTIVE_OVERLOAD_LOAD     0.90
+#define ADAPTIVE_UNDERLOAD_LOAD    0.50
+#define ADAPTIVE_COOLDOWN_WINDOWS  3
+#define ADAPTIVE_RECOVER_WINDOWS   5
+
+/* the encoder applies the step itself, context.settings isn't touched here
+ * since the UI can update or read them at the same time */
+static bool step_adaptive_preset(struct obs_encoder *encoder, int direction)
+{
+	bool stepped;
+
+	if (!encoder->info.step_preset || !encoder->context.data)
+		return false;
+
+	stepped = encoder->info.step_preset(encoder->context.data, direction);
+	if (stepped)
+		os_atomic_set_long(&encoder->adaptive_level,
+				encoder->adaptive_level - direction);
+	return stepped;
+}
+
+static void signal_adaptive_preset(struct obs_encoder *encoder,
+		bool overloaded)
+{
+	struct calldata params;
+	uint8_t stack[128];
+
+	calldata_init_fixed(&params, stack, sizeof(stack));
+	calldata_set_ptr(&params, "encoder", encoder);
+	calldata_set_int(&params, "level",
+			os_atomic_load_long(&encoder->adaptive_level));
+	calldata_set_bool(&params, "overloaded", overloaded);
+	signal_handler_signal(encoder->context.signals, "adaptive_preset",
+			&params);
+}
+
+static void reset_adaptive_window(struct obs_encoder *encoder,
+		uint32_t dropped, uint32_t skipped)
+{
+	encoder->adaptive_encode_ns = 0;
+	encoder->adaptive_frames    = 0;
+	encoder->adaptive_dropped   = dropped;
+	encoder->adaptive_skipped   = skipped;
+}
+
+static void reset_adaptive_preset(struct obs_encoder *encoder)
+{
+	const struct video_output_info *voi;
+
+	voi = video_output_get_info(encoder->media);
+	encoder->frame_interval_ns = voi && voi->fps_num ?
+		1000000000ULL * voi->fps_den / voi->fps_num : 0;
+
+	encoder->adaptive_cooldown = 0;
+	encoder->adaptive_idle     = 0;
+	reset_adaptive_window(encoder, 0,
+			video_output_get_skipped_frames(encoder->media));
+}
+
+/* steps only ever change the encoder instance, not its settings, so the
+ * original preset is used again once the encoder is shut down and created
+ * again.  only the level has to be reset */
+static void restore_adaptive_preset(struct obs_encoder *encoder)
+{
+	if (os_atomic_load_long(&encoder->adaptive_level) > 0)
+		blog(LOG_INFO, "encoder '%s': original preset will be used "
+				"on the next start", encoder->context.name);
+
+	os_atomic_set_long(&encoder->adaptive_level, 0);
+}
+
+static void update_adaptive_preset(struct obs_encoder *encoder)
+{
+	uint32_t dropped, skipped;
+	uint32_t new_dropped, new_skipped;
+	uint64_t window_frames;
+	double load;
+	bool overloaded, underloaded;
+
+	if (!os_atomic_load_bool(&encoder->adaptive_preset) ||
+	    !encoder->frame_interval_ns)
+		return;
+
+	encoder->adaptive_encode_ns += encoder->last_encode_ns;
+	encoder->adaptive_frames++;
+
+	window_frames = ADAPTIVE_WINDOW_SEC * 1000000000ULL /
+		encoder->frame_interval_ns;
+	if (encoder->adaptive_frames < window_frames)
+		return;
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+	dropped = encoder->dropped_frames;
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+	skipped = video_output_get_skipped_frames(encoder->media);
+
+	new_dropped = dropped - encoder->adaptive_dropped;
+	new_skipped = skipped - encoder->adaptive_skipped;
+	load = (double)encoder->adaptive_encode_ns /
+		((double)encoder->adaptive_frames *
+		 (double)encoder->frame_interval_ns);
+
+	overloaded = load > ADAPTIVE_OVERLOAD_LOAD ||
+		new_dropped > 0 || new_skipped > 0;
+	underloaded = load < ADAPTIVE_UNDERLOAD_LOAD &&
+		!new_dropped && !new_skipped;
+
+	reset_adaptive_window(encoder, dropped, skipped);
+
+	if (encoder->adaptive_cooldown > 0) {
+		encoder->adaptive_cooldown--;
+		return;
+	}
+
+	if (overloaded) {
+		encoder->adaptive_idle = 0;
+
+		if (step_adaptive_preset(encoder, -1)) {
+			blog(LOG_INFO, "encoder '%s': overloaded (load %.0f%%, "
+					"%"PRIu32" dropped, %"PRIu32" skipped), "
+					"stepped to a faster preset "
+					"(level %ld)",
+					encoder->context.name, load * 100.0,
+					new_dropped, new_skipped,
+					os_atomic_load_long(
+						&encoder->adaptive_level));
+			encoder->adaptive_cooldown = ADAPTIVE_COOLDOWN_WINDOWS;
+			signal_adaptive_preset(encoder, true);
+		}
+
+	} else if (underloaded &&
+	           os_atomic_load_long(&encoder->adaptive_level) > 0) {
+		if (++encoder->adaptive_idle < ADAPTIVE_RECOVER_WINDOWS)
+			return;
+
+		encoder->adaptive_idle = 0;
+
+		if (step_adaptive_preset(encoder, 1)) {
+			blog(LOG_INFO, "encoder '%s': recovered (load %.0f%%), "
+					"stepped back to a slower preset "
+					"(level %ld)",
+					encoder->context.name, load * 100.0,
+					os_atomic_load_long(
+						&encoder->adaptive_level));
+			encoder->adaptive_cooldown = ADAPTIVE_COOLDOWN_WINDOWS;
+			signal_adaptive_preset(encoder, false);
+		}
+
+	} else {
+		encoder->adaptive_idle = 0;
+	}
+}
+
+static void encode_queued_audio(struct obs_encoder *encoder)
+{
+	struct encoder_audio_header header;
+	struct encoder_frame enc_frame;
+	uint64_t latency;
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+
+	if (!encoder->encode_audio_queue.size) {
+		pthread_mutex_unlock(&encoder->encode_queue_mutex);
+		return;
+	}
+
+	circlebuf_pop_front(&encoder->encode_audio_queue, &header,
+			sizeof(header));
+	for (size_t i = 0; i < encoder->planes; i++)
+		circlebuf_pop_front(&encoder->encode_audio_queue,
+				encoder->encode_audio_buffer[i],
+				encoder->framesize_bytes);
+
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+
+	memset(&enc_frame, 0, sizeof(struct encoder_frame));
+
+	for (size_t i = 0; i < encoder->planes; i++) {
+		enc_frame.data[i]     = encoder->encode_audio_buffer[i];
+		enc_frame.linesize[i] = (uint32_t)encoder->framesize_bytes;
+	}
+
+	enc_frame.frames = (uint32_t)encoder->framesize;
+	enc_frame.pts    = header.pts;
+
+	do_encode(encoder, &enc_frame);
+
+	latency = os_gettime_ns() - header.queued_ts;
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+	encoder->encode_queue_num--;
+	encoder->encoded_frames++;
+	encoder->total_latency_ns += latency;
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+}
+
+static void encode_queued_video(struct obs_encoder *encoder)
+{
+	struct encoder_queued_frame *entry;
+	struct encoder_frame enc_frame;
+	uint64_t latency;
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+	entry = encoder->encode_queue_num ?
+		&encoder->encode_queue[encoder->encode_queue_first] : NULL;
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+
+	if (!entry)
+		return;
+
+	memset(&enc_frame, 0, sizeof(struct encoder_frame));
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		enc_frame.data[i]     = entry->frame.data[i];
+		enc_frame.linesize[i] = entry->frame.linesize[i];
+	}
+
+	enc_frame.frames         = 1;
+	enc_frame.pts            = entry->pts;
+	enc_frame.force_keyframe = entry->force_keyframe;
+
+	do_encode(encoder, &enc_frame);
+	update_adaptive_preset(encoder);
+
+	latency = os_gettime_ns() - entry->queued_ts;
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+
+	if (++encoder->encode_queue_first == ENCODER_MAX_QUEUED_FRAMES)
+		encoder->encode_queue_first = 0;
+	encoder->encode_queue_num--;
+	encoder->encoded_frames++;
+	encoder->total_latency_ns += latency;
+
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+}
+
+static inline void encode_queued_frame(struct obs_encoder *encoder)
+{
+	if (encoder->info.type == OBS_ENCODER_AUDIO)
+		encode_queued_audio(encoder);
+	else
+		encode_queued_video(encoder);
+}
+
+/* nothing new is queued once the encoder is disconnected from its media, so
+ * this only has to catch up with what's already there.  an encoder error
+ * during the drain clears encode_thread_drain and ends it early */
+static void drain_encode_queue(struct obs_encoder *encoder)
+{
+	while (os_atomic_load_bool(&encoder->encode_thread_drain)) {
+		size_t num;
+
+		pthread_mutex_lock(&encoder->encode_queue_mutex);
+		num = encoder->encode_queue_num;
+		pthread_mutex_unlock(&encoder->encode_queue_mutex);
+
+		if (!num)
+			break;
+
+		encode_queued_frame(encoder);
+	}
+}
+
+static void *encode_thread(void *param)
+{
+	struct obs_encoder *encoder = param;
+
+	os_set_thread_name("obs-encoder: encode thread");
+
+	while (os_sem_wait(encoder->encode_sem) == 0) {
+		if (os_atomic_load_bool(&encoder->encode_thread_stop))
+			break;
+
+		profile_start(encoder->profile_encode_thread_name);
+		encode_queued_frame(encoder);
+		profile_end(encoder->profile_encode_thread_name);
+
+		profile_reenable_thread();
+
+		if (os_atomic_load_bool(&encoder->encode_thread_stop))
+			break;
+	}
+
+	drain_encode_queue(encoder);
+	return NULL;
+}
+
 static void clear_audio(struct obs_encoder *encoder)
 {
 	for (size_t i = 0; i < encoder->planes; i++)
@@ -987,25 +1812,44 @@ fail:
 	return success;
 }
 
+/* only copies the frame in to the encode queue, the audio thread never waits
+ * on the encoder itself */
 static void send_audio_data(struct obs_encoder *encoder)
 {
-	struct encoder_frame  enc_frame;
-
-	memset(&enc_frame, 0, sizeof(struct encoder_frame));
+	struct encoder_audio_header header;
 
-	for (size_t i = 0; i < encoder->planes; i++) {
+	for (size_t i = 0; i < encoder->planes; i++)
 		circlebuf_pop_front(&encoder->audio_input_buffer[i],
 				encoder->audio_output_buffer[i],
 				encoder->framesize_bytes);
 
-		enc_frame.data[i]     = encoder->audio_output_buffer[i];
-		enc_frame.linesize[i] = (uint32_t)encoder->framesize_bytes;
+	header.pts       = encoder->cur_pts;
+	header.queued_ts = os_gettime_ns();
+
+	pthread_mutex_lock(&encoder->encode_queue_mutex);
+
+	/* pts still advances, so the gap is timestamped correctly */
+	if (encoder->encode_queue_num == ENCODER_MAX_QUEUED_AUDIO_FRAMES) {
+		encoder->dropped_frames++;
+		pthread_mutex_unlock(&encoder->encode_queue_mutex);
+		encoder->cur_pts += encoder->framesize;
+		return;
 	}
 
-	enc_frame.frames = (uint32_t)encoder->framesize;
-	enc_frame.pts    = encoder->cur_pts;
+	circlebuf_push_back(&encoder->encode_audio_queue, &header,
+			sizeof(header));
+	for (size_t i = 0; i < encoder->planes; i++)
+		circlebuf_push_back(&encoder->encode_audio_queue,
+				encoder->audio_output_buffer[i],
+				encoder->framesize_bytes);
 
-	do_encode(encoder, &enc_frame);
+	encoder->encode_queue_num++;
+	if (encoder->encode_queue_num > encoder->max_queued_frames)
+		encoder->max_queued_frames = encoder->encode_queue_num;
+
+	pthread_mutex_unlock(&encoder->encode_queue_mutex);
+
+	os_sem_post(encoder->encode_sem);
 
 	encoder->cur_pts += encoder->framesize;
 }
@@ -1058,12 +1902,20 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
-	long *p_refs;
+	struct obs_encoder *encoder = src->encoder;
 
 	*dst = *src;
-	p_refs = bmalloc(src->size + sizeof(long));
-	dst->data = (void*)(p_refs + 1);
-	*p_refs = 1;
+
+	/* data the encoder wrote in to a pooled buffer is already reference
+	 * counted, so it can be shared rather than copied */
+	if (encoder && encoder->pooled_packet_data &&
+	    src->data == encoder->pooled_packet_data) {
+		long *p_refs = ((long*)src->data) - 1;
+		os_atomic_inc_long(p_refs);
+		return;
+	}
+
+	dst->data = obs_packet_pool_alloc(src->size);
 	memcpy(dst->data, src->data, src->size);
 }
 
@@ -1100,12 +1952,22 @@ void obs_encoder_packet_release(struct encoder_packet *pkt)
 	if (pkt->data) {
 		long *p_refs = ((long*)pkt->data) - 1;
 		if (os_atomic_dec_long(p_refs) == 0)
-			bfree(p_refs);
+			obs_packet_pool_release(pkt->data);
 	}
 
 	memset(pkt, 0, sizeof(struct encoder_packet));
 }
 
+uint8_t *obs_encoder_alloc_packet_data(obs_encoder_t *encoder, size_t size)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_alloc_packet_data"))
+		return NULL;
+
+	release_pooled_packet_data(encoder);
+	encoder->pooled_packet_data = obs_packet_pool_alloc(size);
+	return encoder->pooled_packet_data;
+}
+
 void obs_encoder_set_preferred_video_format(obs_encoder_t *encoder,
 		enum video_format format)
 {
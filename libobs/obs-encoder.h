@@ -30,6 +30,8 @@ extern "C" {
 #endif
 
 #define OBS_ENCODER_CAP_DEPRECATED             (1<<0)
+#define OBS_ENCODER_CAP_DYN_BITRATE            (1<<1)
+#define OBS_ENCODER_CAP_VFR                    (1<<2)
 
 /** Specifies the encoder type */
 enum obs_encoder_type {
@@ -97,6 +99,13 @@ struct encoder_frame {
 
 	/** Presentation timestamp */
 	int64_t               pts;
+
+	/**
+	 * Video only:  The frame must be encoded as a keyframe.  Set for
+	 * encoders in an encoder ladder so keyframes line up between
+	 * renditions.
+	 */
+	bool                  force_keyframe;
 };
 
 /**
@@ -251,6 +260,21 @@ struct obs_encoder_info {
 	 * @return                The properties data
 	 */
 	obs_properties_t *(*get_properties2)(void *data, void *type_data);
+
+	/**
+	 * Steps the encoder's preset one step toward a faster preset (direction
+	 * is negative) or a slower preset (direction is positive).  Used by
+	 * the adaptive preset controller when the encoder is overloaded.
+	 *
+	 * Called from the encode thread.  The new preset is applied by the
+	 * encoder itself, and the encoder's settings are left untouched.
+	 *
+	 * @param       data       Data associated with this encoder context
+	 * @param       direction  Direction to step in
+	 * @return                 true if the preset was changed, false if
+	 *                         there are no more presets in that direction
+	 */
+	bool (*step_preset)(void *data, int direction);
 };
 
 EXPORT void obs_register_encoder_s(const struct obs_encoder_info *info,
@@ -32,6 +32,7 @@
 
 #include "media-io/audio-resampler.h"
 #include "media-io/video-io.h"
+#include "media-io/video-frame.h"
 #include "media-io/audio-io.h"
 
 #include "obs.h"
@@ -413,6 +414,7 @@ extern bool audio_callback(void *param,
 
 extern void start_raw_video(video_t *video,
 		const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor, const void *cascade_group,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
 extern void stop_raw_video(video_t *video,
@@ -660,6 +662,12 @@ struct obs_source {
 	enum obs_allow_direct_render    allow_direct;
 	bool                            rendering_filter;
 
+	/* fused filter passes */
+	gs_effect_t                     *fused_effect;
+	DARRAY(const char*)             fused_key;
+	gs_effect_t                     *fused_stage_effect;
+	size_t                          fused_stage;
+
 	/* sources specific hotkeys */
 	obs_hotkey_pair_id              mute_unmute_key;
 	obs_hotkey_id                   push_to_mute_key;
@@ -707,6 +715,16 @@ extern bool obs_source_init_context(struct obs_source *source,
 		obs_data_t *settings, const char *name,
 		obs_data_t *hotkey_data, bool private);
 
+/* source creation split in to steps, used to create sources in parallel when
+ * loading.  the shell and finish steps must be called from the thread doing
+ * the loading, obs_source_create_data can be called from any thread if the
+ * source type has OBS_SOURCE_PARALLEL_CREATE */
+extern obs_source_t *obs_source_create_shell(const char *id,
+		const char *name, obs_data_t *settings,
+		obs_data_t *hotkey_data);
+extern void obs_source_create_data(obs_source_t *source);
+extern void obs_source_create_finish(obs_source_t *source);
+
 extern bool obs_transition_init(obs_source_t *transition);
 extern void obs_transition_free(obs_source_t *transition);
 extern void obs_transition_tick(obs_source_t *transition);
@@ -765,6 +783,7 @@ static inline enum gs_color_format convert_video_format(
 
 extern void obs_source_activate(obs_source_t *source, enum view_type type);
 extern void obs_source_deactivate(obs_source_t *source, enum view_type type);
+extern void obs_source_video_render_culled(obs_source_t *source);
 extern void obs_source_video_tick(obs_source_t *source, float seconds);
 extern float obs_source_get_target_volume(obs_source_t *source,
 		obs_source_t *target);
@@ -784,6 +803,12 @@ extern bool set_async_texture_size(struct obs_source *source,
 extern void remove_async_frame(obs_source_t *source,
 		struct obs_source_frame *frame);
 
+extern uint32_t get_base_width(const obs_source_t *source);
+extern uint32_t get_base_height(const obs_source_t *source);
+
+extern bool obs_source_render_fused(obs_source_t *filter);
+extern void obs_source_free_fused(obs_source_t *filter);
+
 extern void set_deinterlace_texture_size(obs_source_t *source);
 extern void deinterlace_process_last_frame(obs_source_t *source,
 		uint64_t sys_time);
@@ -804,8 +829,11 @@ struct delay_data {
 	enum delay_msg msg;
 	uint64_t ts;
 	struct encoder_packet packet;
+	bool spilled; /* packet data is in a spill segment */
 };
 
+struct delay_segment;
+
 typedef void (*encoded_callback_t)(void *data, struct encoder_packet *packet);
 
 struct obs_weak_output {
@@ -840,6 +868,10 @@ struct obs_output {
 	os_event_t                      *stopping_event;
 	pthread_mutex_t                 interleaved_mutex;
 	DARRAY(struct encoder_packet)   interleaved_packets;
+
+	/* once interleaving has started, packets are queued per track (video
+	 * first, then each audio mix) and merged by dts when sent */
+	struct circlebuf                interleaved_queues[MAX_AUDIO_MIXES + 1];
 	int                             stop_code;
 
 	int                             reconnect_retry_sec;
@@ -891,6 +923,21 @@ struct obs_output {
 	volatile bool                   delay_active;
 	volatile bool                   delay_capturing;
 
+	/* delayed packet data beyond max_memory is written to segment files,
+	 * and read back just before it's sent */
+	uint64_t                        delay_max_memory;
+	struct dstr                     delay_spill_dir;
+	uint64_t                        delay_cur_max_memory;
+	struct dstr                     delay_cur_spill_dir;
+	uint64_t                        delay_mem_size;
+	size_t                          delay_loaded;
+	long                            delay_segment_count;
+	pthread_mutex_t                 delay_spill_mutex;
+	DARRAY(struct delay_segment*)   delay_segments;
+	pthread_t                       delay_reader_thread;
+	os_event_t                      *delay_reader_event;
+	bool                            delay_reader_active;
+
 	char                            *last_error_message;
 };
 
@@ -907,6 +954,9 @@ extern void process_delay(void *data, struct encoder_packet *packet);
 extern void obs_output_cleanup_delay(obs_output_t *output);
 extern bool obs_output_delay_start(obs_output_t *output);
 extern void obs_output_delay_stop(obs_output_t *output);
+extern void get_delay_spill_dir(struct dstr *dir,
+		const char *spill_dir);
+extern void start_delay_reader(struct obs_output *output);
 extern bool obs_output_actual_start(obs_output_t *output);
 extern void obs_output_actual_stop(obs_output_t *output, bool force,
 		uint64_t ts);
@@ -935,6 +985,24 @@ struct encoder_callback {
 	void *param;
 };
 
+#define ENCODER_MAX_QUEUED_FRAMES 4
+
+/* audio frames are small and dropping them is audible, so audio gets a much
+ * deeper queue, but it's still capped so a stalled encoder can't grow it
+ * without limit (about 1.3 seconds of 1024 sample frames at 48khz) */
+#define ENCODER_MAX_QUEUED_AUDIO_FRAMES 64
+
+/* with duplicate frame skipping, an unchanged frame is still encoded if
+ * nothing has been queued for this long, so players never see long gaps */
+#define ENCODER_MAX_DUPLICATE_NS 1000000000ULL
+
+struct encoder_queued_frame {
+	struct video_frame              frame;
+	int64_t                         pts;
+	uint64_t                        queued_ts;
+	bool                            force_keyframe;
+};
+
 struct obs_encoder {
 	struct obs_context_data         context;
 	struct obs_encoder_info         info;
@@ -967,6 +1035,7 @@ struct obs_encoder {
 
 	struct circlebuf                audio_input_buffer[MAX_AV_PLANES];
 	uint8_t                         *audio_output_buffer[MAX_AV_PLANES];
+	uint8_t                         *encode_audio_buffer[MAX_AV_PLANES];
 
 	/* if a video encoder is paired with an audio encoder, make it start
 	 * up at the specific timestamp.  if this is the audio encoder,
@@ -982,6 +1051,10 @@ struct obs_encoder {
 	pthread_mutex_t                 outputs_mutex;
 	DARRAY(obs_output_t*)            outputs;
 
+	/* settings can be updated while active from several threads (the UI,
+	 * a stream output's adaptive bitrate), so updates are serialized */
+	pthread_mutex_t                 settings_mutex;
+
 	bool                            destroy_on_stop;
 
 	/* stores the video/audio media output pointer.  video_t *or audio_t **/
@@ -991,6 +1064,69 @@ struct obs_encoder {
 	DARRAY(struct encoder_callback) callbacks;
 
 	const char                      *profile_encoder_encode_name;
+	const char                      *profile_encode_thread_name;
+
+	/* frames are encoded on a separate thread so a slow encoder doesn't
+	 * hold up the video/audio threads or other encoders.  video frames
+	 * are copied in to a small fixed queue, and if it's full the new frame
+	 * is dropped.  audio frames are queued in encode_audio_queue as a
+	 * pts/timestamp header followed by each plane's data, and are only
+	 * dropped past ENCODER_MAX_QUEUED_AUDIO_FRAMES.  both queues share
+	 * encode_queue_mutex and encode_sem rather than being lock free: there
+	 * is a single producer and consumer, and the lock is only held to copy
+	 * a frame in or out */
+	pthread_t                       encode_thread;
+	bool                            encode_thread_active;
+	volatile bool                   encode_thread_stop;
+	volatile bool                   encode_thread_drain;
+	os_sem_t                        *encode_sem;
+	pthread_mutex_t                 encode_queue_mutex;
+	struct encoder_queued_frame     encode_queue[ENCODER_MAX_QUEUED_FRAMES];
+	size_t                          encode_queue_first;
+	size_t                          encode_queue_num;
+	enum video_format               encode_queue_format;
+	uint32_t                        encode_queue_height;
+
+	/* frames identical to the last queued frame are skipped rather than
+	 * queued if skip_duplicate_frames is set.  pts still advances, so the
+	 * output ends up variable frame rate */
+	bool                            skip_duplicate_frames;
+	size_t                          encode_queue_last;
+	bool                            encode_queue_has_last;
+	uint64_t                        last_queued_frame_ts;
+	struct circlebuf                encode_audio_queue;
+
+	/* encode queue stats, protected by encode_queue_mutex */
+	uint32_t                        dropped_frames;
+	uint32_t                        duplicate_frames;
+	uint32_t                        encoded_frames;
+	size_t                          max_queued_frames;
+	uint64_t                        total_latency_ns;
+
+	/* adaptive preset controller.  level is the number of steps the
+	 * preset has been moved toward faster presets, and everything else
+	 * is only touched by the encode thread */
+	volatile bool                   adaptive_preset;
+	volatile long                   adaptive_level;
+	uint64_t                        frame_interval_ns;
+	uint64_t                        last_encode_ns;
+	uint64_t                        adaptive_encode_ns;
+	uint32_t                        adaptive_frames;
+	uint32_t                        adaptive_dropped;
+	uint32_t                        adaptive_skipped;
+	int                             adaptive_cooldown;
+	int                             adaptive_idle;
+
+	/* packet buffer handed out by obs_encoder_alloc_packet_data during
+	 * the current encode call */
+	uint8_t                         *pooled_packet_data;
+
+	/* only every frame_rate_divisor'th frame of the video output is
+	 * passed to the encoder by video-io.  encoders in a ladder are also
+	 * given their keyframes (and start frame) by the ladder so that
+	 * renditions line up */
+	uint32_t                        frame_rate_divisor;
+	struct obs_encoder_ladder       *ladder;
 };
 
 extern struct obs_encoder_info *find_encoder(const char *id);
@@ -1012,6 +1148,26 @@ extern void obs_encoder_remove_output(struct obs_encoder *encoder,
 
 void obs_encoder_destroy(obs_encoder_t *encoder);
 
+/* pooled, reference counted encoder packet data */
+extern void obs_packet_pool_init(void);
+extern void obs_packet_pool_free(void);
+extern uint8_t *obs_packet_pool_alloc(size_t size);
+extern void obs_packet_pool_release(uint8_t *data);
+
+/* encoder ladders */
+extern bool obs_encoder_ladder_accept_frame(struct obs_encoder_ladder *ladder,
+		struct obs_encoder *encoder, uint64_t frame_index,
+		bool *keyframe);
+extern void obs_encoder_ladder_encoder_stopped(
+		struct obs_encoder_ladder *ladder, struct obs_encoder *encoder);
+
+
+/* ------------------------------------------------------------------------- */
+/* CPU budget */
+
+extern void obs_cpu_budget_init(void);
+extern void obs_cpu_budget_free(void);
+
 /* ------------------------------------------------------------------------- */
 /* services */
 
@@ -16,6 +16,8 @@
 ******************************************************************************/
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include "util/buffered-file-serializer.h"
 #include "obs-internal.h"
 
 static inline bool delay_active(const struct obs_output *output)
@@ -28,6 +30,359 @@ static inline bool delay_capturing(const struct obs_output *output)
 	return os_atomic_load_bool(&output->delay_capturing);
 }
 
+/* ------------------------------------------------------------------------- */
+/* spill segments
+ *
+ *   Once the delayed packet data exceeds delay_max_memory, the data of new
+ * packets is written to segment files instead, while the packet itself stays
+ * in the queue so ordering with start/stop messages is preserved.  Packets
+ * are spilled and read back in queue order, so each segment is written and
+ * read sequentially.
+ *
+ *   Spilled data is read back DELAY_READ_AHEAD_NS before the packet is due by
+ * a reader thread, so no file I/O happens on the packet threads or with
+ * delay_mutex held.  delay_loaded is the number of queued entries the reader
+ * has been through, and a spilled packet it hasn't got to yet is held in the
+ * queue until it has.  The reader also closes segments once they're full;
+ * the packet threads only ever write to the last segment, and stop touching
+ * it once it's no longer marked as writing. */
+
+#define DELAY_SEGMENT_SIZE     (64 * 1024 * 1024)
+#define DELAY_WRITE_BUFFER     (4 * 1024 * 1024)
+#define DELAY_READ_AHEAD_NS    2000000000ULL
+#define DELAY_READ_INTERVAL_MS 100
+
+struct delay_segment {
+	struct dstr       path;
+	struct serializer file;
+	FILE              *read_file;
+	bool              file_open;
+	bool              writing;
+	bool              failed;
+	int64_t           size;
+	size_t            num_packets;
+	size_t            num_read;
+};
+
+void get_delay_spill_dir(struct dstr *dir, const char *spill_dir)
+{
+	if (!spill_dir || !*spill_dir) {
+#ifdef _WIN32
+		spill_dir = getenv("TEMP");
+#else
+		spill_dir = getenv("TMPDIR");
+		if (!spill_dir || !*spill_dir)
+			spill_dir = "/tmp";
+#endif
+	}
+
+	dstr_copy(dir, spill_dir ? spill_dir : ".");
+	dstr_replace(dir, "\\", "/");
+	if (dstr_end(dir) == '/')
+		dstr_resize(dir, dir->len - 1);
+}
+
+/* waits for the segment's data to be written out, so only the reader thread
+ * closes segments */
+static void segment_close_file(struct delay_segment *seg)
+{
+	if (seg->file_open) {
+		if (!buffered_file_serializer_free(&seg->file))
+			seg->failed = true;
+		seg->file_open = false;
+	}
+}
+
+static void segment_destroy(struct delay_segment *seg)
+{
+	segment_close_file(seg);
+	if (seg->read_file)
+		fclose(seg->read_file);
+	os_unlink(seg->path.array);
+	dstr_free(&seg->path);
+	bfree(seg);
+}
+
+static inline void disable_spill(struct obs_output *output)
+{
+	blog(LOG_WARNING, "Output '%s': Failed to write delay segment, the "
+	                  "rest of the delay will be kept in memory",
+	                  output->context.name);
+	output->delay_cur_max_memory = 0;
+}
+
+/* called with delay_spill_mutex locked.  a full segment is left for the
+ * reader thread to close */
+static struct delay_segment *get_write_segment(struct obs_output *output)
+{
+	struct delay_segment *seg = NULL;
+
+	if (output->delay_segments.num) {
+		seg = output->delay_segments.array[
+			output->delay_segments.num - 1];
+		if (seg->writing && seg->size < DELAY_SEGMENT_SIZE)
+			return seg;
+
+		seg->writing = false;
+	}
+
+	seg = bzalloc(sizeof(*seg));
+	dstr_printf(&seg->path, "%s/obs-delay-%p-%ld.tmp",
+			output->delay_cur_spill_dir.array, output,
+			++output->delay_segment_count);
+
+	if (!buffered_file_serializer_init(&seg->file, seg->path.array, 0,
+				DELAY_WRITE_BUFFER, false)) {
+		blog(LOG_WARNING, "Output '%s': Failed to create delay "
+		                  "segment '%s'",
+		                  output->context.name, seg->path.array);
+		dstr_free(&seg->path);
+		bfree(seg);
+		return NULL;
+	}
+
+	seg->file_open = true;
+	seg->writing = true;
+	da_push_back(output->delay_segments, &seg);
+	return seg;
+}
+
+/* writes the packet data straight from the encoder's buffer, so spilled
+ * packets are never copied in memory.  called with delay_mutex locked, which
+ * keeps the segment data in queue order */
+static bool spill_packet(struct obs_output *output, struct delay_data *dd,
+		struct encoder_packet *packet)
+{
+	struct delay_segment *seg;
+	bool success = false;
+
+	pthread_mutex_lock(&output->delay_spill_mutex);
+
+	seg = get_write_segment(output);
+	if (!seg)
+		goto fail;
+
+	s_write(&seg->file, packet->data, packet->size);
+	if (buffered_file_serializer_failed(&seg->file)) {
+		seg->failed = true;
+		seg->writing = false;
+		goto fail;
+	}
+
+	dd->packet = *packet;
+	dd->packet.data = NULL;
+	dd->spilled = true;
+
+	seg->size += (int64_t)packet->size;
+	seg->num_packets++;
+	success = true;
+
+fail:
+	pthread_mutex_unlock(&output->delay_spill_mutex);
+
+	if (!success)
+		disable_spill(output);
+	return success;
+}
+
+/* closes the segments the packet threads have finished with */
+static void close_full_segments(struct obs_output *output)
+{
+	for (;;) {
+		struct delay_segment *seg = NULL;
+
+		pthread_mutex_lock(&output->delay_spill_mutex);
+		for (size_t i = 0; i < output->delay_segments.num; i++) {
+			struct delay_segment *cur =
+				output->delay_segments.array[i];
+			if (!cur->writing && cur->file_open) {
+				seg = cur;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&output->delay_spill_mutex);
+
+		if (!seg)
+			break;
+
+		segment_close_file(seg);
+	}
+}
+
+/* reads the next spilled packet's data back from the first segment.  the
+ * segment is taken off the packet threads first, so the file I/O happens
+ * without any locks held.  returns NULL if it can't be read */
+static uint8_t *read_spilled_data(struct obs_output *output, size_t size)
+{
+	struct delay_segment *seg;
+	uint8_t *data = NULL;
+	bool done;
+
+	pthread_mutex_lock(&output->delay_spill_mutex);
+	seg = output->delay_segments.array[0];
+	seg->writing = false;
+	pthread_mutex_unlock(&output->delay_spill_mutex);
+
+	/* the segment has to be on disk before it can be read */
+	segment_close_file(seg);
+
+	if (!seg->read_file && !seg->failed) {
+		seg->read_file = os_fopen(seg->path.array, "rb");
+		if (!seg->read_file)
+			seg->failed = true;
+	}
+
+	if (!seg->failed) {
+		data = obs_packet_pool_alloc(size);
+
+		if (fread(data, 1, size, seg->read_file) != size) {
+			obs_packet_pool_release(data);
+			data = NULL;
+			seg->failed = true;
+		}
+	}
+
+	if (seg->failed)
+		blog(LOG_ERROR, "Output '%s': Failed to read delay segment "
+		                "'%s', dropping packet",
+		                output->context.name, seg->path.array);
+
+	pthread_mutex_lock(&output->delay_spill_mutex);
+	done = ++seg->num_read == seg->num_packets;
+	if (done)
+		da_erase(output->delay_segments, 0);
+	pthread_mutex_unlock(&output->delay_spill_mutex);
+
+	if (done)
+		segment_destroy(seg);
+	return data;
+}
+
+/* skips over everything the reader has nothing to do for, and gets the size
+ * of the next spilled packet if it's due to be read back */
+static bool next_spilled_packet(struct obs_output *output, size_t *size)
+{
+	uint64_t t = os_gettime_ns();
+	bool found = false;
+	size_t count;
+
+	pthread_mutex_lock(&output->delay_mutex);
+
+	count = output->delay_data.size / sizeof(struct delay_data);
+
+	while (output->delay_loaded < count) {
+		struct delay_data *dd = circlebuf_data(&output->delay_data,
+				output->delay_loaded * sizeof(*dd));
+
+		if (dd->msg == DELAY_MSG_PACKET && dd->spilled) {
+			if (dd->ts + output->active_delay_ns <=
+					t + DELAY_READ_AHEAD_NS) {
+				*size = dd->packet.size;
+				found = true;
+			}
+			break;
+		}
+
+		output->delay_loaded++;
+	}
+
+	pthread_mutex_unlock(&output->delay_mutex);
+	return found;
+}
+
+/* the packet can't have been popped while it was being read, so it's still
+ * at delay_loaded.  if it couldn't be read it stays marked as spilled and is
+ * dropped when it's due */
+static void store_spilled_data(struct obs_output *output, uint8_t *data)
+{
+	struct delay_data *dd;
+
+	pthread_mutex_lock(&output->delay_mutex);
+
+	dd = circlebuf_data(&output->delay_data,
+			output->delay_loaded * sizeof(*dd));
+	if (data) {
+		dd->packet.data = data;
+		dd->spilled = false;
+		output->delay_mem_size += dd->packet.size;
+	}
+
+	output->delay_loaded++;
+
+	pthread_mutex_unlock(&output->delay_mutex);
+}
+
+static void *delay_reader_thread(void *data)
+{
+	struct obs_output *output = data;
+	size_t size;
+
+	os_set_thread_name("obs-output: delay reader");
+
+	do {
+		close_full_segments(output);
+
+		while (next_spilled_packet(output, &size))
+			store_spilled_data(output,
+					read_spilled_data(output, size));
+
+	} while (os_event_timedwait(output->delay_reader_event,
+				DELAY_READ_INTERVAL_MS) == ETIMEDOUT);
+
+	return NULL;
+}
+
+/* without the reader nothing could be read back, so the whole delay is kept
+ * in memory if it can't be started */
+void start_delay_reader(struct obs_output *output)
+{
+	if (!output->delay_cur_max_memory)
+		return;
+
+	if (os_event_init(&output->delay_reader_event,
+				OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+	if (pthread_create(&output->delay_reader_thread, NULL,
+				delay_reader_thread, output) != 0) {
+		os_event_destroy(output->delay_reader_event);
+		goto fail;
+	}
+
+	output->delay_reader_active = true;
+	return;
+
+fail:
+	output->delay_reader_event = NULL;
+	output->delay_cur_max_memory = 0;
+	blog(LOG_WARNING, "Output '%s': Failed to start the delay reader "
+	                  "thread, the delay will be kept in memory",
+	                  output->context.name);
+}
+
+static void stop_delay_reader(struct obs_output *output)
+{
+	if (!output->delay_reader_active)
+		return;
+
+	os_event_signal(output->delay_reader_event);
+	pthread_join(output->delay_reader_thread, NULL);
+	os_event_destroy(output->delay_reader_event);
+	output->delay_reader_event = NULL;
+	output->delay_reader_active = false;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool should_spill(struct obs_output *output,
+		struct encoder_packet *packet)
+{
+	return output->delay_cur_max_memory &&
+		output->delay_mem_size + packet->size >
+			output->delay_cur_max_memory;
+}
+
+/* pooled packet data is shared by reference, other encoder data has to be
+ * copied */
 static inline void push_packet(struct obs_output *output,
 		struct encoder_packet *packet, uint64_t t)
 {
@@ -35,9 +390,15 @@ static inline void push_packet(struct obs_output *output,
 
 	dd.msg = DELAY_MSG_PACKET;
 	dd.ts  = t;
-	obs_encoder_packet_create_instance(&dd.packet, packet);
 
 	pthread_mutex_lock(&output->delay_mutex);
+
+	if (!should_spill(output, packet) ||
+	    !spill_packet(output, &dd, packet)) {
+		obs_encoder_packet_create_instance(&dd.packet, packet);
+		output->delay_mem_size += packet->size;
+	}
+
 	circlebuf_push_back(&output->delay_data, &dd, sizeof(dd));
 	pthread_mutex_unlock(&output->delay_mutex);
 }
@@ -47,6 +408,8 @@ static inline void process_delay_data(struct obs_output *output,
 {
 	switch (dd->msg) {
 	case DELAY_MSG_PACKET:
+		if (dd->spilled)
+			break;
 		if (!delay_active(output) || !delay_capturing(output))
 			obs_encoder_packet_release(&dd->packet);
 		else
@@ -65,17 +428,34 @@ void obs_output_cleanup_delay(obs_output_t *output)
 {
 	struct delay_data dd;
 
+	stop_delay_reader(output);
+
 	while (output->delay_data.size) {
 		circlebuf_pop_front(&output->delay_data, &dd, sizeof(dd));
-		if (dd.msg == DELAY_MSG_PACKET) {
+		if (dd.msg == DELAY_MSG_PACKET && !dd.spilled) {
 			obs_encoder_packet_release(&dd.packet);
 		}
 	}
 
+	for (size_t i = 0; i < output->delay_segments.num; i++)
+		segment_destroy(output->delay_segments.array[i]);
+	da_free(output->delay_segments);
+
+	output->delay_mem_size = 0;
+	output->delay_loaded = 0;
 	output->active_delay_ns = 0;
 	os_atomic_set_long(&output->delay_restart_refs, 0);
 }
 
+/* a spilled packet is held until the reader thread has been through it, so
+ * the segments stay in step with the queue */
+static inline bool waiting_for_reader(const struct obs_output *output,
+		const struct delay_data *dd)
+{
+	return dd->msg == DELAY_MSG_PACKET && dd->spilled &&
+		!output->delay_loaded;
+}
+
 static inline bool pop_packet(struct obs_output *output, uint64_t t)
 {
 	uint64_t elapsed_time;
@@ -96,10 +476,16 @@ static inline bool pop_packet(struct obs_output *output, uint64_t t)
 		if (preserve && output->reconnecting) {
 			output->active_delay_ns = elapsed_time;
 
-		} else if (elapsed_time > output->active_delay_ns) {
+		} else if (elapsed_time > output->active_delay_ns &&
+		           !waiting_for_reader(output, &dd)) {
 			circlebuf_pop_front(&output->delay_data, NULL,
 					sizeof(dd));
 			popped = true;
+
+			if (output->delay_loaded)
+				output->delay_loaded--;
+			if (dd.msg == DELAY_MSG_PACKET && !dd.spilled)
+				output->delay_mem_size -= dd.packet.size;
 		}
 	}
 
@@ -197,6 +583,16 @@ void obs_output_set_delay(obs_output_t *output, uint32_t delay_sec,
 	output->delay_flags = flags;
 }
 
+void obs_output_set_delay_spill(obs_output_t *output, uint32_t max_memory_mb,
+		const char *directory)
+{
+	if (!obs_output_valid(output, "obs_output_set_delay_spill"))
+		return;
+
+	output->delay_max_memory = (uint64_t)max_memory_mb * 1024 * 1024;
+	dstr_copy(&output->delay_spill_dir, directory);
+}
+
 uint32_t obs_output_get_delay(const obs_output_t *output)
 {
 	return obs_output_valid(output, "obs_output_set_delay") ?
@@ -104,12 +104,15 @@ obs_output_t *obs_output_create(const char *id, const char *name,
 	output = bzalloc(sizeof(struct obs_output));
 	pthread_mutex_init_value(&output->interleaved_mutex);
 	pthread_mutex_init_value(&output->delay_mutex);
+	pthread_mutex_init_value(&output->delay_spill_mutex);
 	pthread_mutex_init_value(&output->caption_mutex);
 
 	if (pthread_mutex_init(&output->interleaved_mutex, NULL) != 0)
 		goto fail;
 	if (pthread_mutex_init(&output->delay_mutex, NULL) != 0)
 		goto fail;
+	if (pthread_mutex_init(&output->delay_spill_mutex, NULL) != 0)
+		goto fail;
 	if (pthread_mutex_init(&output->caption_mutex, NULL) != 0)
 		goto fail;
 	if (os_event_init(&output->stopping_event, OS_EVENT_TYPE_MANUAL) != 0)
@@ -167,6 +170,18 @@ static inline void free_packets(struct obs_output *output)
 	for (size_t i = 0; i < output->interleaved_packets.num; i++)
 		obs_encoder_packet_release(output->interleaved_packets.array+i);
 	da_free(output->interleaved_packets);
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES + 1; i++) {
+		struct circlebuf *queue = &output->interleaved_queues[i];
+		struct encoder_packet packet;
+
+		while (queue->size) {
+			circlebuf_pop_front(queue, &packet, sizeof(packet));
+			obs_encoder_packet_release(&packet);
+		}
+
+		circlebuf_free(queue);
+	}
 }
 
 void obs_output_destroy(obs_output_t *output)
@@ -207,9 +222,12 @@ void obs_output_destroy(obs_output_t *output)
 		pthread_mutex_destroy(&output->caption_mutex);
 		pthread_mutex_destroy(&output->interleaved_mutex);
 		pthread_mutex_destroy(&output->delay_mutex);
+		pthread_mutex_destroy(&output->delay_spill_mutex);
 		os_event_destroy(output->reconnect_stop_event);
 		obs_context_data_free(&output->context);
 		circlebuf_free(&output->delay_data);
+		dstr_free(&output->delay_spill_dir);
+		dstr_free(&output->delay_cur_spill_dir);
 		if (output->owns_info_id)
 			bfree((void*)output->info.id);
 		if (output->last_error_message)
@@ -1008,20 +1026,14 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 	caption_frame_t cf;
 	sei_t sei;
 	uint8_t *data;
+	uint8_t *out_data;
 	size_t size;
-	long ref = 1;
-
-	DARRAY(uint8_t) out_data;
 
 	if (out->priority > 1)
 		return false;
 
 	sei_init(&sei, 0.0);
 
-	da_init(out_data);
-	da_push_back_array(out_data, &ref, sizeof(ref));
-	da_push_back_array(out_data, out->data, out->size);
-
 	caption_frame_init(&cf);
 	caption_frame_from_text(&cf, &output->caption_head->text[0]);
 
@@ -1029,16 +1041,19 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 
 	data = malloc(sei_render_size(&sei));
 	size = sei_render(&sei, data);
+
 	/* TODO SEI should come after AUD/SPS/PPS, but before any VCL */
-	da_push_back_array(out_data, nal_start, 4);
-	da_push_back_array(out_data, data, size);
+	out_data = obs_packet_pool_alloc(out->size + sizeof(nal_start) + size);
+	memcpy(out_data, out->data, out->size);
+	memcpy(out_data + out->size, nal_start, sizeof(nal_start));
+	memcpy(out_data + out->size + sizeof(nal_start), data, size);
 	free(data);
 
 	obs_encoder_packet_release(out);
 
 	*out = backup;
-	out->data = (uint8_t*)out_data.array + sizeof(ref);
-	out->size = out_data.num - sizeof(ref);
+	out->data = out_data;
+	out->size = backup.size + sizeof(nal_start) + size;
 
 	sei_free(&sei);
 
@@ -1049,9 +1064,65 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 }
 #endif
 
+static inline struct circlebuf *get_interleaved_queue(
+		struct obs_output *output, struct encoder_packet *packet)
+{
+	size_t idx = packet->type == OBS_ENCODER_VIDEO ?
+		0 : packet->track_idx + 1;
+	return &output->interleaved_queues[idx];
+}
+
+/* packets of each track always arrive in dts order, so the next packet to
+ * send is the lowest dts out of the front packets of each track queue.
+ * video goes first if timestamps are equal. */
+static struct circlebuf *next_interleaved_queue(struct obs_output *output)
+{
+	struct circlebuf *next = NULL;
+	int64_t next_dts_usec = 0;
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES + 1; i++) {
+		struct circlebuf *queue = &output->interleaved_queues[i];
+		struct encoder_packet packet;
+
+		if (!queue->size)
+			continue;
+
+		circlebuf_peek_front(queue, &packet, sizeof(packet));
+		if (!next || packet.dts_usec < next_dts_usec) {
+			next = queue;
+			next_dts_usec = packet.dts_usec;
+		}
+	}
+
+	return next;
+}
+
+static inline void insert_queued_packet(struct obs_output *output,
+		struct encoder_packet *out)
+{
+	circlebuf_push_back(get_interleaved_queue(output, out), out,
+			sizeof(*out));
+}
+
+/* moves the sorted starting packets in to the track queues */
+static void queue_interleaved_packets(struct obs_output *output)
+{
+	for (size_t i = 0; i < output->interleaved_packets.num; i++)
+		insert_queued_packet(output,
+				&output->interleaved_packets.array[i]);
+
+	da_resize(output->interleaved_packets, 0);
+}
+
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct circlebuf *queue = next_interleaved_queue(output);
+	struct encoder_packet out;
+
+	if (!queue)
+		return;
+
+	circlebuf_peek_front(queue, &out, sizeof(out));
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timestamp in the interleave buffer.
@@ -1059,7 +1130,7 @@ static inline void send_interleaved(struct obs_output *output)
 	if (!has_higher_opposing_ts(output, &out))
 		return;
 
-	da_erase(output->interleaved_packets, 0);
+	circlebuf_pop_front(queue, NULL, sizeof(out));
 
 	if (out.type == OBS_ENCODER_VIDEO) {
 		output->total_frames++;
@@ -1451,12 +1522,14 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	else
 		obs_encoder_packet_create_instance(&out, packet);
 
-	if (was_started)
+	if (was_started) {
 		apply_interleaved_packet_offset(output, &out);
-	else
+		insert_queued_packet(output, &out);
+	} else {
 		check_received(output, packet);
+		insert_interleaved_packet(output, &out);
+	}
 
-	insert_interleaved_packet(output, &out);
 	set_higher_ts(output, &out);
 
 	/* when both video and audio have been received, we're ready
@@ -1466,6 +1539,7 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 			if (prune_interleaved_packets(output)) {
 				if (initialize_interleaved_packets(output)) {
 					resort_interleaved_packets(output);
+					queue_interleaved_packets(output);
 					send_interleaved(output);
 				}
 			}
@@ -1583,6 +1657,10 @@ static void hook_data_capture(struct obs_output *output, bool encoded,
 			output->active_delay_ns =
 				(uint64_t)output->delay_sec * 1000000000ULL;
 			output->delay_cur_flags = output->delay_flags;
+			output->delay_cur_max_memory = output->delay_max_memory;
+			get_delay_spill_dir(&output->delay_cur_spill_dir,
+					output->delay_spill_dir.array);
+			start_delay_reader(output);
 			output->delay_callback = encoded_callback;
 			encoded_callback = process_delay;
 			os_atomic_set_bool(&output->delay_active, true);
@@ -1592,6 +1670,14 @@ static void hook_data_capture(struct obs_output *output, bool encoded,
 			               output->context.name,
 			               output->delay_sec,
 			               preserve_active(output) ? "on" : "off");
+
+			if (output->delay_cur_max_memory)
+				blog(LOG_INFO, "Output '%s': delayed packets "
+				               "beyond %d MB are written to '%s'",
+				               output->context.name,
+				               (int)(output->delay_cur_max_memory /
+					               (1024 * 1024)),
+				               output->delay_cur_spill_dir.array);
 		}
 
 		if (has_audio)
@@ -1602,7 +1688,7 @@ static void hook_data_capture(struct obs_output *output, bool encoded,
 	} else {
 		if (has_video)
 			start_raw_video(output->video,
-					get_video_conversion(output),
+					get_video_conversion(output), 1, NULL,
 					default_raw_video_callback, output);
 		if (has_audio)
 			start_raw_audio(output);
@@ -0,0 +1,326 @@
+/******************************************************************************
+    Copyright (C) 2019 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-internal.h"
+
+/* encoder packet data is allocated in power of two size classes from 256
+ * bytes to 4 megabytes, with anything larger allocated directly.  freed
+ * blocks are kept in a small per-thread cache first, and moved to/from the
+ * shared per-class free lists in batches so the shared lists are only
+ * locked once per batch.
+ *
+ * every packet buffer is preceded by a header holding its size class, with
+ * the reference count stored directly before the data (which is where
+ * obs_encoder_packet_ref/release expect it to be). */
+
+#define POOL_MIN_SHIFT     8
+#define POOL_NUM_CLASSES   15
+#define POOL_CLASS_LARGE   0xFFFFFFFF
+#define POOL_HEADER_SIZE   16
+#define POOL_CACHE_SIZE    16
+#define POOL_MAX_FREE_SIZE (16 * 1024 * 1024)
+
+struct pool_block {
+	struct pool_block *next;
+};
+
+struct pool_class {
+	pthread_mutex_t   mutex;
+	struct pool_block *free;
+	size_t            num_free;
+	size_t            max_free;
+};
+
+struct pool_cache {
+	struct pool_block *blocks[POOL_NUM_CLASSES][POOL_CACHE_SIZE];
+	size_t            num[POOL_NUM_CLASSES];
+};
+
+static struct pool_class pool_classes[POOL_NUM_CLASSES];
+static pthread_key_t pool_cache_key;
+static volatile bool pool_initialized = false;
+
+/* threads that are still running when the pool is freed keep their caches
+ * until they exit, so the class mutexes and the cache key are referenced by
+ * every cache as well as by the pool itself, and are only destroyed once the
+ * last of them is gone */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static long pool_refs = 0;
+
+static inline size_t class_size(uint32_t size_class)
+{
+	return (size_t)1 << (size_class + POOL_MIN_SHIFT);
+}
+
+static inline uint32_t get_size_class(size_t size)
+{
+	uint32_t size_class = 0;
+
+	while (size_class < POOL_NUM_CLASSES && class_size(size_class) < size)
+		size_class++;
+
+	return size_class < POOL_NUM_CLASSES ? size_class : POOL_CLASS_LARGE;
+}
+
+static inline uint32_t *block_class(struct pool_block *block)
+{
+	return (uint32_t*)block;
+}
+
+static inline struct pool_block *data_block(uint8_t *data)
+{
+	return (struct pool_block*)(data - POOL_HEADER_SIZE);
+}
+
+static inline uint8_t *block_data(struct pool_block *block)
+{
+	return (uint8_t*)block + POOL_HEADER_SIZE;
+}
+
+/* moves up to count blocks from the shared free list in to the cache */
+static void take_shared_blocks(struct pool_cache *cache, uint32_t size_class,
+		size_t count)
+{
+	struct pool_class *pc = &pool_classes[size_class];
+
+	pthread_mutex_lock(&pc->mutex);
+
+	while (count-- && pc->free) {
+		struct pool_block *block = pc->free;
+		pc->free = block->next;
+		pc->num_free--;
+
+		cache->blocks[size_class][cache->num[size_class]++] = block;
+	}
+
+	pthread_mutex_unlock(&pc->mutex);
+}
+
+/* moves count blocks from the cache to the shared free list, freeing any
+ * that would go past the shared list's limit */
+static void return_shared_blocks(struct pool_cache *cache, uint32_t size_class,
+		size_t count)
+{
+	struct pool_class *pc = &pool_classes[size_class];
+	struct pool_block *excess = NULL;
+	bool keep;
+
+	pthread_mutex_lock(&pc->mutex);
+
+	/* once the pool is freed, nothing may be added to its lists */
+	keep = os_atomic_load_bool(&pool_initialized);
+
+	while (count-- && cache->num[size_class]) {
+		struct pool_block *block =
+			cache->blocks[size_class][--cache->num[size_class]];
+
+		if (keep && pc->num_free < pc->max_free) {
+			block->next = pc->free;
+			pc->free = block;
+			pc->num_free++;
+		} else {
+			block->next = excess;
+			excess = block;
+		}
+	}
+
+	pthread_mutex_unlock(&pc->mutex);
+
+	while (excess) {
+		struct pool_block *next = excess->next;
+		bfree(excess);
+		excess = next;
+	}
+}
+
+static void pool_release(void)
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	if (--pool_refs == 0) {
+		for (uint32_t i = 0; i < POOL_NUM_CLASSES; i++)
+			pthread_mutex_destroy(&pool_classes[i].mutex);
+
+		pthread_key_delete(pool_cache_key);
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+static void pool_cache_destroy(void *data)
+{
+	struct pool_cache *cache = data;
+
+	for (uint32_t i = 0; i < POOL_NUM_CLASSES; i++)
+		return_shared_blocks(cache, i, POOL_CACHE_SIZE);
+
+	bfree(cache);
+	pool_release();
+}
+
+static struct pool_cache *get_pool_cache(void)
+{
+	struct pool_cache *cache;
+
+	if (!os_atomic_load_bool(&pool_initialized))
+		return NULL;
+
+	cache = pthread_getspecific(pool_cache_key);
+	if (cache)
+		return cache;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	if (os_atomic_load_bool(&pool_initialized)) {
+		cache = bzalloc(sizeof(*cache));
+
+		if (pthread_setspecific(pool_cache_key, cache) == 0) {
+			pool_refs++;
+		} else {
+			bfree(cache);
+			cache = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+	return cache;
+}
+
+void obs_packet_pool_init(void)
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	/* caches left over from a previous startup still hold the mutexes and
+	 * the key, in which case they are simply reused */
+	if (pool_refs == 0) {
+		if (pthread_key_create(&pool_cache_key,
+					pool_cache_destroy) != 0) {
+			pthread_mutex_unlock(&pool_mutex);
+			return;
+		}
+
+		for (uint32_t i = 0; i < POOL_NUM_CLASSES; i++) {
+			struct pool_class *pc = &pool_classes[i];
+			size_t max_free = POOL_MAX_FREE_SIZE / class_size(i);
+
+			pthread_mutex_init(&pc->mutex, NULL);
+			pc->free = NULL;
+			pc->num_free = 0;
+			pc->max_free = max_free < 4 ? 4 : max_free;
+		}
+	}
+
+	pool_refs++;
+	os_atomic_set_bool(&pool_initialized, true);
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void obs_packet_pool_free(void)
+{
+	struct pool_cache *cache;
+
+	if (!os_atomic_load_bool(&pool_initialized))
+		return;
+
+	cache = pthread_getspecific(pool_cache_key);
+	if (cache)
+		pthread_setspecific(pool_cache_key, NULL);
+
+	/* from here on, caches of threads that are still running are no
+	 * longer used, and free their blocks when their threads exit */
+	os_atomic_set_bool(&pool_initialized, false);
+
+	if (cache)
+		pool_cache_destroy(cache);
+
+	for (uint32_t i = 0; i < POOL_NUM_CLASSES; i++) {
+		struct pool_class *pc = &pool_classes[i];
+		struct pool_block *block;
+
+		pthread_mutex_lock(&pc->mutex);
+		block = pc->free;
+		pc->free = NULL;
+		pc->num_free = 0;
+		pthread_mutex_unlock(&pc->mutex);
+
+		while (block) {
+			struct pool_block *next = block->next;
+			bfree(block);
+			block = next;
+		}
+	}
+
+	pool_release();
+}
+
+uint8_t *obs_packet_pool_alloc(size_t size)
+{
+	uint32_t size_class = get_size_class(size);
+	struct pool_block *block = NULL;
+	struct pool_cache *cache;
+	uint8_t *data;
+
+	if (size_class == POOL_CLASS_LARGE) {
+		block = bmalloc(POOL_HEADER_SIZE + size);
+
+	} else {
+		cache = get_pool_cache();
+
+		if (cache) {
+			if (!cache->num[size_class])
+				take_shared_blocks(cache, size_class,
+						POOL_CACHE_SIZE / 2);
+			if (cache->num[size_class])
+				block = cache->blocks[size_class]
+					[--cache->num[size_class]];
+		}
+
+		if (!block)
+			block = bmalloc(POOL_HEADER_SIZE +
+					class_size(size_class));
+	}
+
+	*block_class(block) = size_class;
+
+	data = block_data(block);
+	*(((long*)data) - 1) = 1;
+	return data;
+}
+
+void obs_packet_pool_release(uint8_t *data)
+{
+	struct pool_block *block = data_block(data);
+	uint32_t size_class = *block_class(block);
+	struct pool_cache *cache;
+
+	if (size_class == POOL_CLASS_LARGE) {
+		bfree(block);
+		return;
+	}
+
+	cache = get_pool_cache();
+	if (!cache) {
+		bfree(block);
+		return;
+	}
+
+	if (cache->num[size_class] == POOL_CACHE_SIZE)
+		return_shared_blocks(cache, size_class, POOL_CACHE_SIZE / 2);
+
+	cache->blocks[size_class][cache->num[size_class]++] = block;
+}
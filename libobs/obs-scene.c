@@ -24,6 +24,8 @@ const struct obs_source_info group_info;
 
 static void resize_group(obs_sceneitem_t *group);
 static void resize_scene(obs_scene_t *scene);
+static uint32_t scene_getwidth(void *data);
+static uint32_t scene_getheight(void *data);
 static void signal_parent(obs_scene_t *parent, const char *name,
 		calldata_t *params);
 static void get_ungrouped_transform(obs_sceneitem_t *group,
@@ -110,6 +112,11 @@ static void *scene_create(obs_data_t *settings, struct obs_source *source)
 				"mutex");
 		goto fail;
 	}
+	if (pthread_mutex_init(&scene->snapshot_mutex, NULL) != 0) {
+		blog(LOG_ERROR, "scene_create: Couldn't initialize snapshot "
+				"mutex");
+		goto fail;
+	}
 
 	UNUSED_PARAMETER(settings);
 	return scene;
@@ -125,6 +132,117 @@ fail:
 #define audio_unlock(scene) pthread_mutex_unlock(&scene->audio_mutex)
 #define video_unlock(scene) pthread_mutex_unlock(&scene->video_mutex)
 
+/* ------------------------------------------------------------------------- */
+/* item list snapshots
+ *
+ * the item list itself is only accessed with the video mutex locked.  every
+ * time the list is unlocked after being changed, a new snapshot of it is
+ * published, which is what the video and audio threads iterate instead.
+ * snapshot_mutex is only held to swap or reference the current snapshot, so
+ * rendering never waits on list operations */
+
+static void snapshot_free(struct scene_snapshot *snapshot)
+{
+	for (size_t i = 0; i < snapshot->items.num; i++)
+		obs_sceneitem_release(snapshot->items.array[i]);
+
+	da_free(snapshot->items);
+	bfree(snapshot);
+}
+
+static inline void snapshot_release(struct scene_snapshot *snapshot)
+{
+	if (snapshot && os_atomic_dec_long(&snapshot->refs) == 0)
+		snapshot_free(snapshot);
+}
+
+/* releasing the last reference of a snapshot can destroy scene items (and
+ * their sources), which shouldn't happen on the audio thread, so the audio
+ * thread retires snapshots to be freed on the next video tick instead */
+static inline void snapshot_release_deferred(struct obs_scene *scene,
+		struct scene_snapshot *snapshot)
+{
+	if (snapshot && os_atomic_dec_long(&snapshot->refs) == 0) {
+		pthread_mutex_lock(&scene->snapshot_mutex);
+		snapshot->next_retired = scene->retired_snapshots;
+		scene->retired_snapshots = snapshot;
+		pthread_mutex_unlock(&scene->snapshot_mutex);
+	}
+}
+
+static void free_retired_snapshots(struct obs_scene *scene)
+{
+	struct scene_snapshot *snapshot;
+
+	pthread_mutex_lock(&scene->snapshot_mutex);
+	snapshot = scene->retired_snapshots;
+	scene->retired_snapshots = NULL;
+	pthread_mutex_unlock(&scene->snapshot_mutex);
+
+	while (snapshot) {
+		struct scene_snapshot *next = snapshot->next_retired;
+		snapshot_free(snapshot);
+		snapshot = next;
+	}
+}
+
+static struct scene_snapshot *get_snapshot(struct obs_scene *scene)
+{
+	struct scene_snapshot *snapshot;
+
+	pthread_mutex_lock(&scene->snapshot_mutex);
+	snapshot = scene->snapshot;
+	if (snapshot)
+		os_atomic_inc_long(&snapshot->refs);
+	pthread_mutex_unlock(&scene->snapshot_mutex);
+
+	return snapshot;
+}
+
+static bool snapshot_matches(const struct scene_snapshot *snapshot,
+		const struct obs_scene_item *item)
+{
+	size_t idx = 0;
+
+	if (!snapshot)
+		return !item;
+
+	for (; item; item = item->next, idx++) {
+		if (idx == snapshot->items.num ||
+		    snapshot->items.array[idx] != item)
+			return false;
+	}
+
+	return idx == snapshot->items.num;
+}
+
+/* assumes video lock.  publishes a new snapshot if the item list changed, and
+ * returns the previous one, which should be released after unlocking */
+static struct scene_snapshot *update_snapshot(struct obs_scene *scene)
+{
+	struct scene_snapshot *new_snapshot;
+	struct scene_snapshot *old_snapshot;
+	struct obs_scene_item *item;
+
+	if (snapshot_matches(scene->snapshot, scene->first_item))
+		return NULL;
+
+	new_snapshot = bzalloc(sizeof(*new_snapshot));
+	new_snapshot->refs = 1;
+
+	for (item = scene->first_item; item; item = item->next) {
+		obs_sceneitem_addref(item);
+		da_push_back(new_snapshot->items, &item);
+	}
+
+	pthread_mutex_lock(&scene->snapshot_mutex);
+	old_snapshot = scene->snapshot;
+	scene->snapshot = new_snapshot;
+	pthread_mutex_unlock(&scene->snapshot_mutex);
+
+	return old_snapshot;
+}
+
 static inline void full_lock(struct obs_scene *scene)
 {
 	video_lock(scene);
@@ -133,10 +251,16 @@ static inline void full_lock(struct obs_scene *scene)
 
 static inline void full_unlock(struct obs_scene *scene)
 {
+	struct scene_snapshot *old_snapshot = update_snapshot(scene);
+
 	audio_unlock(scene);
 	video_unlock(scene);
+
+	snapshot_release(old_snapshot);
 }
 
+/* ------------------------------------------------------------------------- */
+
 static void set_visibility(struct obs_scene_item *item, bool vis);
 static inline void detach_sceneitem(struct obs_scene_item *item);
 
@@ -179,9 +303,13 @@ static void scene_destroy(void *data)
 	struct obs_scene *scene = data;
 
 	remove_all_items(scene);
+	snapshot_release(scene->snapshot);
+	free_retired_snapshots(scene);
+	da_free(scene->occluders);
 
 	pthread_mutex_destroy(&scene->video_mutex);
 	pthread_mutex_destroy(&scene->audio_mutex);
+	pthread_mutex_destroy(&scene->snapshot_mutex);
 	bfree(scene);
 }
 
@@ -334,20 +462,75 @@ static inline uint32_t calc_cy(const struct obs_scene_item *item,
 	return (crop_cy > height) ? 2 : (height - crop_cy);
 }
 
-static void update_item_transform(struct obs_scene_item *item, bool update_tex)
+static inline bool is_axis_aligned(const struct matrix4 *m)
 {
-	uint32_t        width;
-	uint32_t        height;
-	uint32_t        cx;
-	uint32_t        cy;
-	struct vec2     base_origin;
-	struct vec2     origin;
-	struct vec2     scale;
-	struct calldata params;
-	uint8_t         stack[128];
+	return (close_float(m->x.y, 0.0f, EPSILON) &&
+	        close_float(m->y.x, 0.0f, EPSILON)) ||
+	       (close_float(m->x.x, 0.0f, EPSILON) &&
+	        close_float(m->y.y, 0.0f, EPSILON));
+}
 
-	if (os_atomic_load_long(&item->defer_update) > 0)
-		return;
+/* calculates the scene-space rectangle covered by the draw transform */
+static void update_item_draw_rect(struct obs_scene_item *item,
+		uint32_t cx, uint32_t cy)
+{
+	struct vec3 corners[4];
+
+	vec3_set(&corners[0], 0.0f,      0.0f,      0.0f);
+	vec3_set(&corners[1], (float)cx, 0.0f,      0.0f);
+	vec3_set(&corners[2], 0.0f,      (float)cy, 0.0f);
+	vec3_set(&corners[3], (float)cx, (float)cy, 0.0f);
+
+	for (size_t i = 0; i < 4; i++) {
+		struct vec3 *corner = &corners[i];
+
+		vec3_transform(corner, corner, &item->draw_transform);
+
+		if (i == 0 || corner->x < item->draw_min.x)
+			item->draw_min.x = corner->x;
+		if (i == 0 || corner->y < item->draw_min.y)
+			item->draw_min.y = corner->y;
+		if (i == 0 || corner->x > item->draw_max.x)
+			item->draw_max.x = corner->x;
+		if (i == 0 || corner->y > item->draw_max.y)
+			item->draw_max.y = corner->y;
+	}
+
+	item->axis_aligned = is_axis_aligned(&item->draw_transform);
+}
+
+/* ------------------------------------------------------------------------- */
+/* transform updates
+ *
+ * transforms are calculated in three steps: the per-item sizes, scales and
+ * origins are calculated, the draw/box matrices are then built (scale ->
+ * translate by -origin -> rotate around z -> translate by pos, composed in
+ * closed form rather than with four full matrix multiplications), and
+ * finally the per-item state is updated and signals are sent.
+ *
+ * a single item is updated directly.  when several items are updated
+ * together, they're gathered in to a struct-of-arrays batch and the matrix
+ * elements of the whole batch are built four items at a time with SSE. */
+
+struct item_transform {
+	uint32_t               width;
+	uint32_t               height;
+	struct vec2            draw_scale;
+	struct vec2            draw_origin;
+	struct vec2            box_scale;
+	struct vec2            box_origin;
+};
+
+static void calc_item_transform(struct obs_scene_item *item,
+		struct item_transform *t)
+{
+	uint32_t    width;
+	uint32_t    height;
+	uint32_t    cx;
+	uint32_t    cy;
+	struct vec2 base_origin;
+	struct vec2 origin;
+	struct vec2 scale;
 
 	width             = obs_source_get_width(item->source);
 	height            = obs_source_get_height(item->source);
@@ -374,18 +557,13 @@ static void update_item_transform(struct obs_scene_item *item, bool update_tex)
 
 	add_alignment(&origin, item->align, (int)cx, (int)cy);
 
-	matrix4_identity(&item->draw_transform);
-	matrix4_scale3f(&item->draw_transform, &item->draw_transform,
-			scale.x, scale.y, 1.0f);
-	matrix4_translate3f(&item->draw_transform, &item->draw_transform,
-			-origin.x, -origin.y, 0.0f);
-	matrix4_rotate_aa4f(&item->draw_transform, &item->draw_transform,
-			0.0f, 0.0f, 1.0f, RAD(item->rot));
-	matrix4_translate3f(&item->draw_transform, &item->draw_transform,
-			item->pos.x, item->pos.y, 0.0f);
-
 	item->output_scale = scale;
 
+	t->width       = width;
+	t->height      = height;
+	t->draw_scale  = scale;
+	t->draw_origin = origin;
+
 	/* ----------------------- */
 
 	if (item->bounds_type != OBS_BOUNDS_NONE) {
@@ -397,17 +575,49 @@ static void update_item_transform(struct obs_scene_item *item, bool update_tex)
 
 	add_alignment(&base_origin, item->align, (int)scale.x, (int)scale.y);
 
-	matrix4_identity(&item->box_transform);
-	matrix4_scale3f(&item->box_transform, &item->box_transform,
-			scale.x, scale.y, 1.0f);
-	matrix4_translate3f(&item->box_transform, &item->box_transform,
-			-base_origin.x, -base_origin.y, 0.0f);
-	matrix4_rotate_aa4f(&item->box_transform, &item->box_transform,
-			0.0f, 0.0f, 1.0f, RAD(item->rot));
-	matrix4_translate3f(&item->box_transform, &item->box_transform,
-			item->pos.x, item->pos.y, 0.0f);
+	t->box_scale  = scale;
+	t->box_origin = base_origin;
+}
 
-	/* ----------------------- */
+static inline void calc_item_rotation(float rot, float *sin_r, float *cos_r)
+{
+	/* most items aren't rotated */
+	if (rot == 0.0f) {
+		*sin_r = 0.0f;
+		*cos_r = 1.0f;
+	} else {
+		*sin_r = sinf(rot);
+		*cos_r = cosf(rot);
+	}
+}
+
+/* builds the matrix
+ *
+ *   [  sx * cos_r                     sx * sin_r                    0  0 ]
+ *   [ -sy * sin_r                     sy * cos_r                    0  0 ]
+ *   [  0                              0                             1  0 ]
+ *   [ -ox * cos_r + oy * sin_r + px  -ox * sin_r - oy * cos_r + py  0  1 ]
+ */
+static inline void build_item_matrix(struct matrix4 *m,
+		const struct vec2 *scale, const struct vec2 *origin,
+		float sin_r, float cos_r, const struct vec2 *pos)
+{
+	vec4_set(&m->x, scale->x * cos_r, scale->x * sin_r, 0.0f, 0.0f);
+	vec4_set(&m->y, -(scale->y * sin_r), scale->y * cos_r, 0.0f, 0.0f);
+	vec4_set(&m->z, 0.0f, 0.0f, 1.0f, 0.0f);
+	vec4_set(&m->t,
+			pos->x - origin->x * cos_r + origin->y * sin_r,
+			pos->y - origin->x * sin_r - origin->y * cos_r,
+			0.0f, 1.0f);
+}
+
+static void finish_item_transform(struct obs_scene_item *item,
+		uint32_t width, uint32_t height, bool update_tex)
+{
+	struct calldata params;
+	uint8_t stack[128];
+
+	update_item_draw_rect(item, width, height);
 
 	calldata_init_fixed(&params, stack, sizeof(stack));
 	calldata_set_ptr(&params, "item", item);
@@ -431,6 +641,203 @@ static void update_item_transform(struct obs_scene_item *item, bool update_tex)
 	os_atomic_set_bool(&item->update_transform, false);
 }
 
+static void update_item_transform(struct obs_scene_item *item, bool update_tex)
+{
+	struct item_transform t;
+	float sin_r;
+	float cos_r;
+
+	if (os_atomic_load_long(&item->defer_update) > 0)
+		return;
+
+	calc_item_transform(item, &t);
+	calc_item_rotation(RAD(item->rot), &sin_r, &cos_r);
+
+	build_item_matrix(&item->draw_transform, &t.draw_scale,
+			&t.draw_origin, sin_r, cos_r, &item->pos);
+	build_item_matrix(&item->box_transform, &t.box_scale,
+			&t.box_origin, sin_r, cos_r, &item->pos);
+
+	finish_item_transform(item, t.width, t.height, update_tex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+#define TRANSFORM_BATCH_SIZE 64
+
+struct transform_batch {
+	size_t                 num;
+	bool                   update_tex;
+	struct obs_scene_item  *items[TRANSFORM_BATCH_SIZE];
+	uint32_t               width[TRANSFORM_BATCH_SIZE];
+	uint32_t               height[TRANSFORM_BATCH_SIZE];
+	float                  rot[TRANSFORM_BATCH_SIZE];
+	float                  pos_x[TRANSFORM_BATCH_SIZE];
+	float                  pos_y[TRANSFORM_BATCH_SIZE];
+	float                  draw_sx[TRANSFORM_BATCH_SIZE];
+	float                  draw_sy[TRANSFORM_BATCH_SIZE];
+	float                  draw_ox[TRANSFORM_BATCH_SIZE];
+	float                  draw_oy[TRANSFORM_BATCH_SIZE];
+	float                  box_sx[TRANSFORM_BATCH_SIZE];
+	float                  box_sy[TRANSFORM_BATCH_SIZE];
+	float                  box_ox[TRANSFORM_BATCH_SIZE];
+	float                  box_oy[TRANSFORM_BATCH_SIZE];
+};
+
+/* the varying elements of a batch of item matrices, see set_item_matrix */
+struct batch_matrices {
+	float                  xx[TRANSFORM_BATCH_SIZE];
+	float                  xy[TRANSFORM_BATCH_SIZE];
+	float                  yx[TRANSFORM_BATCH_SIZE];
+	float                  yy[TRANSFORM_BATCH_SIZE];
+	float                  tx[TRANSFORM_BATCH_SIZE];
+	float                  ty[TRANSFORM_BATCH_SIZE];
+};
+
+static inline void transform_batch_init(struct transform_batch *batch,
+		bool update_tex)
+{
+	batch->num = 0;
+	batch->update_tex = update_tex;
+}
+
+static void transform_batch_gather(struct transform_batch *batch,
+		struct obs_scene_item *item)
+{
+	struct item_transform t;
+	size_t idx = batch->num++;
+
+	calc_item_transform(item, &t);
+
+	batch->items[idx]   = item;
+	batch->width[idx]   = t.width;
+	batch->height[idx]  = t.height;
+	batch->rot[idx]     = RAD(item->rot);
+	batch->pos_x[idx]   = item->pos.x;
+	batch->pos_y[idx]   = item->pos.y;
+	batch->draw_sx[idx] = t.draw_scale.x;
+	batch->draw_sy[idx] = t.draw_scale.y;
+	batch->draw_ox[idx] = t.draw_origin.x;
+	batch->draw_oy[idx] = t.draw_origin.y;
+	batch->box_sx[idx]  = t.box_scale.x;
+	batch->box_sy[idx]  = t.box_scale.y;
+	batch->box_ox[idx]  = t.box_origin.x;
+	batch->box_oy[idx]  = t.box_origin.y;
+}
+
+/* zeroes the unused lanes past the last item, up to num, so that the SSE
+ * pass only ever works with finite values */
+static inline void transform_batch_pad(struct transform_batch *batch,
+		size_t num)
+{
+	for (size_t i = batch->num; i < num; i++) {
+		batch->rot[i]     = 0.0f;
+		batch->pos_x[i]   = 0.0f;
+		batch->pos_y[i]   = 0.0f;
+		batch->draw_sx[i] = 0.0f;
+		batch->draw_sy[i] = 0.0f;
+		batch->draw_ox[i] = 0.0f;
+		batch->draw_oy[i] = 0.0f;
+		batch->box_sx[i]  = 0.0f;
+		batch->box_sy[i]  = 0.0f;
+		batch->box_ox[i]  = 0.0f;
+		batch->box_oy[i]  = 0.0f;
+	}
+}
+
+/* builds the elements of the matrix described in build_item_matrix for
+ * every item in the batch, four items at a time.  num is rounded up to a
+ * multiple of four */
+static void build_batch_matrices(struct batch_matrices *m,
+		const float *sx, const float *sy,
+		const float *ox, const float *oy,
+		const float *sin_r, const float *cos_r,
+		const float *px, const float *py, size_t num)
+{
+	const __m128 zero = _mm_setzero_ps();
+
+	for (size_t i = 0; i < num; i += 4) {
+		__m128 s   = _mm_loadu_ps(sin_r + i);
+		__m128 c   = _mm_loadu_ps(cos_r + i);
+		__m128 vsx = _mm_loadu_ps(sx + i);
+		__m128 vsy = _mm_loadu_ps(sy + i);
+		__m128 vox = _mm_loadu_ps(ox + i);
+		__m128 voy = _mm_loadu_ps(oy + i);
+		__m128 vpx = _mm_loadu_ps(px + i);
+		__m128 vpy = _mm_loadu_ps(py + i);
+
+		_mm_storeu_ps(m->xx + i, _mm_mul_ps(vsx, c));
+		_mm_storeu_ps(m->xy + i, _mm_mul_ps(vsx, s));
+		_mm_storeu_ps(m->yx + i, _mm_sub_ps(zero, _mm_mul_ps(vsy, s)));
+		_mm_storeu_ps(m->yy + i, _mm_mul_ps(vsy, c));
+		_mm_storeu_ps(m->tx + i, _mm_add_ps(
+				_mm_sub_ps(vpx, _mm_mul_ps(vox, c)),
+				_mm_mul_ps(voy, s)));
+		_mm_storeu_ps(m->ty + i, _mm_sub_ps(
+				_mm_sub_ps(vpy, _mm_mul_ps(vox, s)),
+				_mm_mul_ps(voy, c)));
+	}
+}
+
+static inline void set_item_matrix(struct matrix4 *m,
+		const struct batch_matrices *bm, size_t i)
+{
+	vec4_set(&m->x, bm->xx[i], bm->xy[i], 0.0f, 0.0f);
+	vec4_set(&m->y, bm->yx[i], bm->yy[i], 0.0f, 0.0f);
+	vec4_set(&m->z, 0.0f, 0.0f, 1.0f, 0.0f);
+	vec4_set(&m->t, bm->tx[i], bm->ty[i], 0.0f, 1.0f);
+}
+
+static void transform_batch_flush(struct transform_batch *batch)
+{
+	float sin_r[TRANSFORM_BATCH_SIZE];
+	float cos_r[TRANSFORM_BATCH_SIZE];
+	struct batch_matrices draw;
+	struct batch_matrices box;
+	size_t num;
+
+	if (!batch->num)
+		return;
+
+	num = (batch->num + 3) & ~(size_t)3;
+	transform_batch_pad(batch, num);
+
+	for (size_t i = 0; i < num; i++)
+		calc_item_rotation(batch->rot[i], &sin_r[i], &cos_r[i]);
+
+	build_batch_matrices(&draw, batch->draw_sx, batch->draw_sy,
+			batch->draw_ox, batch->draw_oy, sin_r, cos_r,
+			batch->pos_x, batch->pos_y, num);
+	build_batch_matrices(&box, batch->box_sx, batch->box_sy,
+			batch->box_ox, batch->box_oy, sin_r, cos_r,
+			batch->pos_x, batch->pos_y, num);
+
+	for (size_t i = 0; i < batch->num; i++) {
+		struct obs_scene_item *item = batch->items[i];
+
+		set_item_matrix(&item->draw_transform, &draw, i);
+		set_item_matrix(&item->box_transform, &box, i);
+	}
+
+	for (size_t i = 0; i < batch->num; i++)
+		finish_item_transform(batch->items[i], batch->width[i],
+				batch->height[i], batch->update_tex);
+
+	batch->num = 0;
+}
+
+static void transform_batch_add(struct transform_batch *batch,
+		struct obs_scene_item *item)
+{
+	if (os_atomic_load_long(&item->defer_update) > 0)
+		return;
+
+	transform_batch_gather(batch, item);
+
+	if (batch->num == TRANSFORM_BATCH_SIZE)
+		transform_batch_flush(batch);
+}
+
 static inline bool source_size_changed(struct obs_scene_item *item)
 {
 	uint32_t width  = obs_source_get_width(item->source);
@@ -554,28 +961,37 @@ static inline void render_item(struct obs_scene_item *item)
 static void scene_video_tick(void *data, float seconds)
 {
 	struct obs_scene *scene = data;
-	struct obs_scene_item *item;
+	struct scene_snapshot *snapshot;
 
-	video_lock(scene);
-	item = scene->first_item;
-	while (item) {
-		if (item->item_render)
-			gs_texrender_reset(item->item_render);
-		item = item->next;
+	free_retired_snapshots(scene);
+
+	snapshot = get_snapshot(scene);
+	if (snapshot) {
+		for (size_t i = 0; i < snapshot->items.num; i++) {
+			struct obs_scene_item *item = snapshot->items.array[i];
+			if (item->item_render)
+				gs_texrender_reset(item->item_render);
+		}
 	}
-	video_unlock(scene);
+	snapshot_release(snapshot);
 
 	UNUSED_PARAMETER(seconds);
 }
 
-/* assumes video lock */
+/* assumes video lock.  changes propagate upward: items whose transforms are
+ * dirty (or whose source changed size) are recalculated in batches, and a
+ * group is only refitted to its children if something in it changed, which
+ * in turn marks the group item itself as changed in its parent */
 static void update_transforms_and_prune_sources(obs_scene_t *scene,
 		struct darray *remove_items, obs_sceneitem_t *group_sceneitem)
 {
 	struct obs_scene_item *item = scene->first_item;
+	struct transform_batch batch;
 	bool rebuild_group = group_sceneitem &&
 		os_atomic_load_bool(&group_sceneitem->update_group_resize);
 
+	transform_batch_init(&batch, true);
+
 	while (item) {
 		if (obs_source_removed(item->source)) {
 			struct obs_scene_item *del_item = item;
@@ -591,56 +1007,181 @@ static void update_transforms_and_prune_sources(obs_scene_t *scene,
 		if (item->is_group) {
 			obs_scene_t *group_scene = item->source->context.data;
 
-			video_lock(group_scene);
-			update_transforms_and_prune_sources(group_scene,
-					remove_items, item);
-			video_unlock(group_scene);
+			if (pthread_mutex_trylock(
+					&group_scene->video_mutex) == 0) {
+				struct scene_snapshot *old_snapshot;
+
+				update_transforms_and_prune_sources(group_scene,
+						remove_items, item);
+				old_snapshot = update_snapshot(group_scene);
+				video_unlock(group_scene);
+
+				snapshot_release(old_snapshot);
+			}
 		}
 
 		if (os_atomic_load_bool(&item->update_transform) ||
 		    source_size_changed(item)) {
 
-			update_item_transform(item, true);
+			transform_batch_add(&batch, item);
 			rebuild_group = true;
 		}
 
 		item = item->next;
 	}
 
+	transform_batch_flush(&batch);
+
 	if (rebuild_group && group_sceneitem)
 		resize_group(group_sceneitem);
 }
 
+static inline bool item_off_canvas(const struct obs_scene_item *item,
+		float cx, float cy)
+{
+	return item->draw_max.x <= 0.0f || item->draw_max.y <= 0.0f ||
+	       item->draw_min.x >= cx   || item->draw_min.y >= cy;
+}
+
+static inline bool video_format_has_alpha(enum video_format format)
+{
+	return format == VIDEO_FORMAT_RGBA || format == VIDEO_FORMAT_BGRA;
+}
+
+/* only unfiltered async video without an alpha channel is known to be fully
+ * opaque.  anything else could be partially transparent */
+static inline bool item_is_opaque(const struct obs_scene_item *item)
+{
+	const struct obs_source *source = item->source;
+	uint32_t flags = source->info.output_flags;
+
+	if (!item->axis_aligned || item->is_group || !source->enabled)
+		return false;
+	if ((flags & OBS_SOURCE_ASYNC_VIDEO) != OBS_SOURCE_ASYNC_VIDEO)
+		return false;
+	if (source->filters.num || !source->async_active ||
+	    !source->async_texture)
+		return false;
+
+	return !video_format_has_alpha(source->async_format);
+}
+
+static bool item_occluded(const struct obs_scene *scene,
+		const struct obs_scene_item *item, float cx, float cy)
+{
+	float min_x = item->draw_min.x < 0.0f ? 0.0f : item->draw_min.x;
+	float min_y = item->draw_min.y < 0.0f ? 0.0f : item->draw_min.y;
+	float max_x = item->draw_max.x > cx   ? cx   : item->draw_max.x;
+	float max_y = item->draw_max.y > cy   ? cy   : item->draw_max.y;
+
+	for (size_t i = 0; i < scene->occluders.num; i++) {
+		const struct obs_scene_item *occluder =
+			scene->occluders.array[i];
+
+		if (occluder->draw_min.x <= min_x &&
+		    occluder->draw_min.y <= min_y &&
+		    occluder->draw_max.x >= max_x &&
+		    occluder->draw_max.y >= max_y)
+			return true;
+	}
+
+	return false;
+}
+
+/* walks the items from top to bottom, culling items that are entirely
+ * off-canvas or entirely covered by an opaque item above them */
+static void cull_items(struct obs_scene *scene,
+		const struct scene_snapshot *snapshot,
+		struct obs_scene_cull_info *info)
+{
+	float cx = (float)scene_getwidth(scene);
+	float cy = (float)scene_getheight(scene);
+
+	da_resize(scene->occluders, 0);
+
+	for (size_t i = snapshot->items.num; i > 0; i--) {
+		struct obs_scene_item *item = snapshot->items.array[i - 1];
+
+		item->culled = false;
+
+		/* items without a known size are always drawn */
+		if (!item->user_visible || !item->last_width ||
+		    !item->last_height)
+			continue;
+
+		if (item_off_canvas(item, cx, cy)) {
+			item->culled = true;
+			info->culled_offscreen++;
+
+		} else if (item_occluded(scene, item, cx, cy)) {
+			item->culled = true;
+			info->culled_occluded++;
+
+		} else if (item_is_opaque(item)) {
+			da_push_back(scene->occluders, &item);
+		}
+	}
+}
+
 static void scene_video_render(void *data, gs_effect_t *effect)
 {
 	DARRAY(struct obs_scene_item*) remove_items;
 	struct obs_scene *scene = data;
-	struct obs_scene_item *item;
+	struct scene_snapshot *snapshot;
+	struct obs_scene_cull_info cull_info = {0};
 
 	da_init(remove_items);
 
-	video_lock(scene);
+	/* transforms are only updated if the scene isn't currently being
+	 * modified.  otherwise, the previous transforms are used for this
+	 * frame and updated on the next one */
+	if (!scene->is_group &&
+	    pthread_mutex_trylock(&scene->video_mutex) == 0) {
+		struct scene_snapshot *old_snapshot;
 
-	if (!scene->is_group) {
 		update_transforms_and_prune_sources(scene, &remove_items.da,
 				NULL);
+		old_snapshot = update_snapshot(scene);
+		video_unlock(scene);
+
+		snapshot_release(old_snapshot);
 	}
 
+	snapshot = get_snapshot(scene);
+	if (!snapshot)
+		goto cleanup;
+
+	if (!scene->is_group)
+		cull_items(scene, snapshot, &cull_info);
+
 	gs_blend_state_push();
 	gs_reset_blend_state();
 
-	item = scene->first_item;
-	while (item) {
-		if (item->user_visible)
-			render_item(item);
+	for (size_t i = 0; i < snapshot->items.num; i++) {
+		struct obs_scene_item *item = snapshot->items.array[i];
 
-		item = item->next;
+		if (!item->user_visible || item->removed)
+			continue;
+
+		if (item->culled && !scene->is_group) {
+			obs_source_video_render_culled(item->source);
+		} else {
+			render_item(item);
+			cull_info.rendered++;
+		}
 	}
 
 	gs_blend_state_pop();
 
-	video_unlock(scene);
+	snapshot_release(snapshot);
+
+	pthread_mutex_lock(&scene->snapshot_mutex);
+	cull_info.total_culled = scene->cull_info.total_culled +
+		cull_info.culled_offscreen + cull_info.culled_occluded;
+	scene->cull_info = cull_info;
+	pthread_mutex_unlock(&scene->snapshot_mutex);
 
+cleanup:
 	for (size_t i = 0; i < remove_items.num; i++)
 		obs_sceneitem_release(remove_items.array[i]);
 	da_free(remove_items);
@@ -1032,12 +1573,15 @@ static bool scene_audio_render(void *data, uint64_t *ts_out,
 	float *buf = NULL;
 	struct obs_source_audio_mix child_audio;
 	struct obs_scene *scene = data;
-	struct obs_scene_item *item;
+	struct scene_snapshot *snapshot;
 
-	audio_lock(scene);
+	snapshot = get_snapshot(scene);
+	if (!snapshot)
+		return false;
+
+	for (size_t i = 0; i < snapshot->items.num; i++) {
+		struct obs_scene_item *item = snapshot->items.array[i];
 
-	item = scene->first_item;
-	while (item) {
 		if (!obs_source_audio_pending(item->source) && item->visible) {
 			uint64_t source_ts =
 				obs_source_get_audio_timestamp(item->source);
@@ -1045,25 +1589,21 @@ static bool scene_audio_render(void *data, uint64_t *ts_out,
 			if (source_ts && (!timestamp || source_ts < timestamp))
 				timestamp = source_ts;
 		}
-
-		item = item->next;
 	}
 
 	if (!timestamp) {
 		/* just process all pending audio actions if no audio playing,
 		 * otherwise audio actions will just never be processed */
-		item = scene->first_item;
-		while (item) {
-			process_all_audio_actions(item, sample_rate);
-			item = item->next;
-		}
+		for (size_t i = 0; i < snapshot->items.num; i++)
+			process_all_audio_actions(snapshot->items.array[i],
+					sample_rate);
 
-		audio_unlock(scene);
+		snapshot_release_deferred(scene, snapshot);
 		return false;
 	}
 
-	item = scene->first_item;
-	while (item) {
+	for (size_t i = 0; i < snapshot->items.num; i++) {
+		struct obs_scene_item *item = snapshot->items.array[i];
 		uint64_t source_ts;
 		size_t pos, count;
 		bool apply_buf;
@@ -1071,25 +1611,19 @@ static bool scene_audio_render(void *data, uint64_t *ts_out,
 		apply_buf = apply_scene_item_volume(item, &buf, timestamp,
 				sample_rate);
 
-		if (obs_source_audio_pending(item->source)) {
-			item = item->next;
+		if (obs_source_audio_pending(item->source))
 			continue;
-		}
 
 		source_ts = obs_source_get_audio_timestamp(item->source);
-		if (!source_ts) {
-			item = item->next;
+		if (!source_ts)
 			continue;
-		}
 
 		pos = (size_t)ns_to_audio_frames(sample_rate,
 				source_ts - timestamp);
 		count = AUDIO_OUTPUT_FRAMES - pos;
 
-		if (!apply_buf && !item->visible) {
-			item = item->next;
+		if (!apply_buf && !item->visible)
 			continue;
-		}
 
 		obs_source_get_audio_mix(item->source, &child_audio);
 		for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
@@ -1107,12 +1641,10 @@ static bool scene_audio_render(void *data, uint64_t *ts_out,
 					mix_audio(out, in, pos, count);
 			}
 		}
-
-		item = item->next;
 	}
 
 	*ts_out = timestamp;
-	audio_unlock(scene);
+	snapshot_release_deferred(scene, snapshot);
 
 	free(buf);
 	return true;
@@ -1689,6 +2221,19 @@ obs_sceneitem_t *obs_scene_add(obs_scene_t *scene, obs_source_t *source)
 	return item;
 }
 
+void obs_scene_get_cull_info(obs_scene_t *scene,
+		struct obs_scene_cull_info *info)
+{
+	if (!obs_ptr_valid(scene, "obs_scene_get_cull_info"))
+		return;
+	if (!obs_ptr_valid(info, "obs_scene_get_cull_info"))
+		return;
+
+	pthread_mutex_lock(&scene->snapshot_mutex);
+	*info = scene->cull_info;
+	pthread_mutex_unlock(&scene->snapshot_mutex);
+}
+
 static void obs_sceneitem_destroy(obs_sceneitem_t *item)
 {
 	if (item) {
@@ -2369,6 +2914,9 @@ static bool resize_scene_base(obs_scene_t *scene,
 		struct vec2 *maxv,
 		struct vec2 *scale)
 {
+	struct transform_batch batch;
+	bool moved;
+
 	vec2_set(minv, M_INFINITE, M_INFINITE);
 	vec2_set(maxv, -M_INFINITE, -M_INFINITE);
 
@@ -2400,13 +2948,28 @@ static bool resize_scene_base(obs_scene_t *scene,
 		item = item->next;
 	}
 
+	/* children only need to be recalculated if the group's origin moved,
+	 * or if they're still waiting on a transform update */
+	moved = !close_float(minv->x, 0.0f, EPSILON) ||
+	        !close_float(minv->y, 0.0f, EPSILON);
+
+	transform_batch_init(&batch, false);
+
 	item = scene->first_item;
 	while (item) {
-		vec2_sub(&item->pos, &item->pos, minv);
-		update_item_transform(item, false);
+		if (moved) {
+			vec2_sub(&item->pos, &item->pos, minv);
+			transform_batch_add(&batch, item);
+
+		} else if (os_atomic_load_bool(&item->update_transform)) {
+			transform_batch_add(&batch, item);
+		}
+
 		item = item->next;
 	}
 
+	transform_batch_flush(&batch);
+
 	vec2_sub(scale, maxv, minv);
 	scene->cx = (uint32_t)ceilf(scale->x);
 	scene->cy = (uint32_t)ceilf(scale->y);
@@ -67,6 +67,13 @@ struct obs_scene_item {
 	struct matrix4        box_transform;
 	struct matrix4        draw_transform;
 
+	/* scene-space bounding rectangle of what the item draws, used to cull
+	 * items that are off-canvas or covered by an opaque item above them */
+	struct vec2           draw_min;
+	struct vec2           draw_max;
+	bool                  axis_aligned;
+	bool                  culled;
+
 	enum obs_bounds_type  bounds_type;
 	uint32_t              bounds_align;
 	struct vec2           bounds;
@@ -83,6 +90,15 @@ struct obs_scene_item {
 	struct obs_scene_item *next;
 };
 
+/* immutable, refcounted copy of a scene's item list.  the video and audio
+ * threads iterate snapshots rather than the list itself, so they never have
+ * to wait for the list to be modified */
+struct scene_snapshot {
+	volatile long         refs;
+	struct scene_snapshot *next_retired;
+	DARRAY(struct obs_scene_item*) items;
+};
+
 struct obs_scene {
 	struct obs_source     *source;
 
@@ -96,4 +112,13 @@ struct obs_scene {
 	pthread_mutex_t       video_mutex;
 	pthread_mutex_t       audio_mutex;
 	struct obs_scene_item *first_item;
+
+	/* snapshot_mutex only guards swapping/referencing the snapshot */
+	pthread_mutex_t       snapshot_mutex;
+	struct scene_snapshot *snapshot;
+	struct scene_snapshot *retired_snapshots;
+
+	/* culling */
+	DARRAY(struct obs_scene_item*) occluders;
+	struct obs_scene_cull_info cull_info;
 };
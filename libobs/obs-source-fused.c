@@ -0,0 +1,360 @@
+/******************************************************************************
+    Copyright (C) 2019 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-internal.h"
+
+#define MAX_FUSED_STAGES 16
+#define FUSED_HEAD_FLAGS (OBS_FUSED_TRANSFORM_UV | OBS_FUSED_NEIGHBORHOOD)
+
+static const char *fused_effect_header =
+"uniform float4x4 ViewProj;\n"
+"uniform texture2d image;\n"
+"\n"
+"sampler_state fused_sampler {\n"
+"	Filter   = Linear;\n"
+"	AddressU = Clamp;\n"
+"	AddressV = Clamp;\n"
+"};\n"
+"\n"
+"sampler_state fused_border_sampler {\n"
+"	Filter      = Linear;\n"
+"	AddressU    = Border;\n"
+"	AddressV    = Border;\n"
+"	BorderColor = 00000000;\n"
+"};\n"
+"\n"
+"struct VertData {\n"
+"	float4 pos : POSITION;\n"
+"	float2 uv  : TEXCOORD0;\n"
+"};\n"
+"\n";
+
+struct fused_pass {
+	obs_source_t *stages[MAX_FUSED_STAGES];
+	const char   *shaders[MAX_FUSED_STAGES];
+	size_t       num;
+	uint32_t     head_flags;
+};
+
+static inline void stage_prefix(struct dstr *prefix, size_t idx)
+{
+	dstr_printf(prefix, "fuse%d_", (int)idx);
+}
+
+/* stages are ordered from the outermost filter (the one being rendered) to
+ * the innermost filter (the first one applied to the image), so the head of
+ * the pass is always the last stage */
+static bool build_fused_pass(obs_source_t *filter, struct fused_pass *pass)
+{
+	obs_source_t *parent = filter->filter_parent;
+	obs_source_t *cur = filter;
+
+	pass->num = 0;
+	pass->head_flags = 0;
+
+	while (cur && cur != parent && pass->num < MAX_FUSED_STAGES) {
+		const char *shader;
+		uint32_t flags;
+
+		/* disabled filters are no-ops and can simply be skipped */
+		if (!cur->enabled) {
+			cur = cur->filter_target;
+			continue;
+		}
+
+		if (!cur->context.data || !cur->info.get_fused_shader ||
+		    !cur->info.fused_set_params)
+			break;
+
+		shader = cur->info.get_fused_shader(cur->context.data);
+		if (!shader)
+			break;
+
+		flags = cur->info.fused_flags;
+		pass->stages[pass->num] = cur;
+		pass->shaders[pass->num] = shader;
+		pass->num++;
+
+		if ((flags & FUSED_HEAD_FLAGS) != 0) {
+			pass->head_flags = flags;
+			break;
+		}
+
+		cur = cur->filter_target;
+	}
+
+	return pass->num > 1;
+}
+
+static void add_fragment(struct dstr *src, const char *shader, size_t idx)
+{
+	struct dstr fragment = {0};
+	struct dstr prefix = {0};
+
+	stage_prefix(&prefix, idx);
+	dstr_copy(&fragment, shader);
+	dstr_replace(&fragment, "FUSE_", prefix.array);
+
+	dstr_cat_dstr(src, &fragment);
+	dstr_cat(src, "\n\n");
+
+	dstr_free(&fragment);
+	dstr_free(&prefix);
+}
+
+static char *build_fused_effect_string(const struct fused_pass *pass)
+{
+	struct dstr src = {0};
+	size_t head = pass->num - 1;
+
+	dstr_copy(&src, fused_effect_header);
+
+	for (size_t i = pass->num; i > 0; i--)
+		add_fragment(&src, pass->shaders[i - 1], i - 1);
+
+	dstr_cat(&src,
+		"VertData VSFused(VertData v_in)\n"
+		"{\n"
+		"	VertData vert_out;\n"
+		"	vert_out.pos = mul(float4(v_in.pos.xyz, 1.0), ViewProj);\n");
+
+	if ((pass->head_flags & OBS_FUSED_TRANSFORM_UV) != 0)
+		dstr_catf(&src, "	vert_out.uv  = fuse%d_uv(v_in.uv);\n",
+				(int)head);
+	else
+		dstr_cat(&src, "	vert_out.uv  = v_in.uv;\n");
+
+	dstr_cat(&src,
+		"	return vert_out;\n"
+		"}\n"
+		"\n"
+		"float4 PSFused(VertData v_in) : TARGET\n"
+		"{\n"
+		"	float4 rgba = image.Sample(fused_sampler, v_in.uv);\n");
+
+	for (size_t i = pass->num; i > 0; i--)
+		dstr_catf(&src, "	rgba = fuse%d_main(rgba, v_in.uv);\n",
+				(int)(i - 1));
+
+	dstr_cat(&src,
+		"	return rgba;\n"
+		"}\n"
+		"\n"
+		"technique Draw\n"
+		"{\n"
+		"	pass\n"
+		"	{\n"
+		"		vertex_shader = VSFused(v_in);\n"
+		"		pixel_shader  = PSFused(v_in);\n"
+		"	}\n"
+		"}\n");
+
+	return src.array;
+}
+
+static inline bool fused_key_matches(const obs_source_t *filter,
+		const struct fused_pass *pass)
+{
+	if (filter->fused_key.num != pass->num)
+		return false;
+
+	return memcmp(filter->fused_key.array, pass->shaders,
+			pass->num * sizeof(const char*)) == 0;
+}
+
+/* the generated effect is cached on the outermost filter of the pass, and is
+ * only rebuilt if the set of fused fragments changes.  a failed compile is
+ * cached as well (as a NULL effect) so it's not retried every frame */
+static gs_effect_t *get_fused_effect(obs_source_t *filter,
+		const struct fused_pass *pass)
+{
+	char *effect_string;
+	char *errors = NULL;
+
+	if (fused_key_matches(filter, pass))
+		return filter->fused_effect;
+
+	gs_effect_destroy(filter->fused_effect);
+	filter->fused_effect = NULL;
+
+	da_resize(filter->fused_key, pass->num);
+	memcpy(filter->fused_key.array, pass->shaders,
+			pass->num * sizeof(const char*));
+
+	effect_string = build_fused_effect_string(pass);
+	filter->fused_effect = gs_effect_create(effect_string, NULL, &errors);
+
+	if (!filter->fused_effect)
+		blog(LOG_WARNING, "Failed to create fused effect for filter "
+				"'%s', falling back to separate passes: %s",
+				filter->context.name,
+				errors ? errors : "(unknown error)");
+	else
+		blog(LOG_DEBUG, "Fused %d filters starting at '%s' into a "
+				"single pass", (int)pass->num,
+				filter->context.name);
+
+	bfree(effect_string);
+	bfree(errors);
+	return filter->fused_effect;
+}
+
+static void set_fused_params(const struct fused_pass *pass,
+		gs_effect_t *effect)
+{
+	for (size_t i = 0; i < pass->num; i++) {
+		obs_source_t *stage = pass->stages[i];
+
+		stage->fused_stage_effect = effect;
+		stage->fused_stage = i;
+		stage->info.fused_set_params(stage->context.data);
+		stage->fused_stage_effect = NULL;
+	}
+}
+
+static inline bool can_bypass_fused(obs_source_t *target, obs_source_t *parent,
+		const struct fused_pass *pass)
+{
+	uint32_t parent_flags = parent->info.output_flags;
+
+	return (target == parent) &&
+		((pass->head_flags & FUSED_HEAD_FLAGS) == 0) &&
+		((parent_flags & OBS_SOURCE_CUSTOM_DRAW) == 0) &&
+		((parent_flags & OBS_SOURCE_ASYNC) == 0);
+}
+
+static void render_fused_target(obs_source_t *filter, obs_source_t *target,
+		obs_source_t *parent, uint32_t cx, uint32_t cy)
+{
+	uint32_t parent_flags = parent->info.output_flags;
+	bool custom_draw = (parent_flags & OBS_SOURCE_CUSTOM_DRAW) != 0;
+	bool async = (parent_flags & OBS_SOURCE_ASYNC) != 0;
+
+	if (!filter->filter_texrender)
+		filter->filter_texrender = gs_texrender_create(GS_RGBA,
+				GS_ZS_NONE);
+
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+
+	if (gs_texrender_begin(filter->filter_texrender, cx, cy)) {
+		struct vec4 clear_color;
+
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+		if (target == parent && !custom_draw && !async)
+			obs_source_default_render(target);
+		else
+			obs_source_video_render(target);
+
+		gs_texrender_end(filter->filter_texrender);
+	}
+
+	gs_blend_state_pop();
+}
+
+static void draw_fused(gs_effect_t *effect, obs_source_t *target,
+		gs_texture_t *tex, uint32_t width, uint32_t height)
+{
+	gs_technique_t *tech = gs_effect_get_technique(effect, "Draw");
+	size_t passes;
+
+	if (tex)
+		gs_effect_set_texture(gs_effect_get_param_by_name(effect,
+					"image"), tex);
+
+	passes = gs_technique_begin(tech);
+	for (size_t i = 0; i < passes; i++) {
+		gs_technique_begin_pass(tech, i);
+		if (tex)
+			gs_draw_sprite(tex, 0, width, height);
+		else
+			obs_source_video_render(target);
+		gs_technique_end_pass(tech);
+	}
+	gs_technique_end(tech);
+}
+
+/* renders the filter, along with any consecutive fusable filters below it,
+ * as a single pass.  returns false if the filter should be rendered
+ * normally */
+bool obs_source_render_fused(obs_source_t *filter)
+{
+	struct fused_pass pass;
+	obs_source_t *parent = filter->filter_parent;
+	obs_source_t *target;
+	gs_effect_t *effect;
+	uint32_t cx, cy;
+
+	if (!parent || !filter->info.get_fused_shader)
+		return false;
+	if (!build_fused_pass(filter, &pass))
+		return false;
+
+	effect = get_fused_effect(filter, &pass);
+	if (!effect)
+		return false;
+
+	target = pass.stages[pass.num - 1]->filter_target;
+	if (!target)
+		return false;
+
+	set_fused_params(&pass, effect);
+
+	if (can_bypass_fused(target, parent, &pass)) {
+		draw_fused(effect, target, NULL, 0, 0);
+		return true;
+	}
+
+	cx = get_base_width(target);
+	cy = get_base_height(target);
+	if (!cx || !cy) {
+		obs_source_skip_video_filter(filter);
+		return true;
+	}
+
+	render_fused_target(filter, target, parent, cx, cy);
+	draw_fused(effect, target,
+			gs_texrender_get_texture(filter->filter_texrender),
+			get_base_width(filter), get_base_height(filter));
+	return true;
+}
+
+void obs_source_free_fused(obs_source_t *filter)
+{
+	gs_effect_destroy(filter->fused_effect);
+	filter->fused_effect = NULL;
+	da_free(filter->fused_key);
+}
+
+gs_eparam_t *obs_filter_get_fused_param(obs_source_t *filter,
+		const char *name)
+{
+	char param_name[128];
+
+	if (!obs_ptr_valid(filter, "obs_filter_get_fused_param"))
+		return NULL;
+	if (!filter->fused_stage_effect)
+		return NULL;
+
+	snprintf(param_name, sizeof(param_name), "fuse%d_%s",
+			(int)filter->fused_stage, name);
+	return gs_effect_get_param_by_name(filter->fused_stage_effect,
+			param_name);
+}
@@ -294,7 +294,9 @@ static void obs_source_init_audio_hotkeys(struct obs_source *source)
 			obs_source_hotkey_push_to_talk, source);
 }
 
-static obs_source_t *obs_source_create_internal(const char *id,
+/* creates everything about the source except the source type's own data,
+ * which is created with obs_source_create_data */
+static obs_source_t *obs_source_create_shell_internal(const char *id,
 		const char *name, obs_data_t *settings,
 		obs_data_t *hotkey_data, bool private)
 {
@@ -339,30 +341,59 @@ static obs_source_t *obs_source_create_internal(const char *id,
 	if (!private)
 		obs_source_init_audio_hotkeys(source);
 
+	return source;
+
+fail:
+	blog(LOG_ERROR, "obs_source_create failed");
+	obs_source_destroy(source);
+	return NULL;
+}
+
+obs_source_t *obs_source_create_shell(const char *id, const char *name,
+		obs_data_t *settings, obs_data_t *hotkey_data)
+{
+	return obs_source_create_shell_internal(id, name, settings,
+			hotkey_data, false);
+}
+
+void obs_source_create_data(obs_source_t *source)
+{
 	/* allow the source to be created even if creation fails so that the
 	 * user's data doesn't become lost */
-	if (info)
-		source->context.data = info->create(source->context.settings,
-				source);
+	if (source->info.create)
+		source->context.data = source->info.create(
+				source->context.settings, source);
 	if (!source->context.data)
-		blog(LOG_ERROR, "Failed to create source '%s'!", name);
+		blog(LOG_ERROR, "Failed to create source '%s'!",
+				source->context.name);
 
 	blog(LOG_DEBUG, "%ssource '%s' (%s) created",
-			private ? "private " : "", name, id);
+			source->context.private ? "private " : "",
+			source->context.name, source->info.id);
+}
 
+void obs_source_create_finish(obs_source_t *source)
+{
 	source->flags = source->default_flags;
 	source->enabled = true;
 
-	if (!private) {
+	if (!source->context.private) {
 		obs_source_dosignal(source, "source_create", NULL);
 	}
+}
 
-	return source;
+static obs_source_t *obs_source_create_internal(const char *id,
+		const char *name, obs_data_t *settings,
+		obs_data_t *hotkey_data, bool private)
+{
+	struct obs_source *source = obs_source_create_shell_internal(id, name,
+			settings, hotkey_data, private);
+	if (!source)
+		return NULL;
 
-fail:
-	blog(LOG_ERROR, "obs_source_create failed");
-	obs_source_destroy(source);
-	return NULL;
+	obs_source_create_data(source);
+	obs_source_create_finish(source);
+	return source;
 }
 
 obs_source_t *obs_source_create(const char *id, const char *name,
@@ -581,6 +612,7 @@ void obs_source_destroy(struct obs_source *source)
 		gs_texture_destroy(source->async_prev_texture);
 	if (source->filter_texrender)
 		gs_texrender_destroy(source->filter_texrender);
+	obs_source_free_fused(source);
 	gs_leave_context();
 
 	for (i = 0; i < MAX_AV_PLANES; i++)
@@ -1811,6 +1843,9 @@ static inline void render_video(obs_source_t *source)
 	if (source->filters.num && !source->rendering_filter)
 		obs_source_render_filters(source);
 
+	else if (source->filter_parent && obs_source_render_fused(source))
+		return;
+
 	else if (source->info.video_render)
 		obs_source_main_render(source);
 
@@ -1834,7 +1869,22 @@ void obs_source_video_render(obs_source_t *source)
 	obs_source_release(source);
 }
 
-static uint32_t get_base_width(const obs_source_t *source)
+/* called instead of obs_source_video_render for sources that are culled from
+ * a scene.  async sources still need their texture and timing updated so
+ * that they are current (and audio stays in sync) once they're drawn again */
+void obs_source_video_render_culled(obs_source_t *source)
+{
+	if (source->info.type != OBS_SOURCE_TYPE_INPUT ||
+	    (source->info.output_flags & OBS_SOURCE_ASYNC) == 0 ||
+	    !source->enabled)
+		return;
+
+	if (deinterlacing_enabled(source))
+		deinterlace_update_async_video(source);
+	obs_source_update_async_video(source);
+}
+
+uint32_t get_base_width(const obs_source_t *source)
 {
 	bool is_filter = !!source->filter_parent;
 	bool func_valid = source->context.data && source->info.get_width;
@@ -1852,7 +1902,7 @@ static uint32_t get_base_width(const obs_source_t *source)
 	return source->async_active ? source->async_width : 0;
 }
 
-static uint32_t get_base_height(const obs_source_t *source)
+uint32_t get_base_height(const obs_source_t *source)
 {
 	bool is_filter = !!source->filter_parent;
 	bool func_valid = source->context.data && source->info.get_height;
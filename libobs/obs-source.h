@@ -140,6 +140,42 @@ enum obs_balance_type {
  */
 #define OBS_SOURCE_CAP_DISABLED (1<<10)
 
+/**
+ * Source can be created in parallel with other sources
+ *
+ * Specifies that the create callback is safe to call from a thread other
+ * than the one loading the scene collection, at the same time as other
+ * sources are being created.  When loading, sources with this flag are
+ * created on a pool of worker threads.
+ */
+#define OBS_SOURCE_PARALLEL_CREATE (1<<11)
+
+/** @} */
+
+/**
+ * @name Fused filter flags
+ *
+ * These flags describe the shader fragment of a fusable filter.
+ * @{
+ */
+
+/**
+ * Fragment transforms the texture coordinates of the pass.
+ *
+ * The fragment must define float2 FUSE_uv(float2 uv), which is called in the
+ * vertex shader.  The filter can only be the first filter of a fused pass.
+ */
+#define OBS_FUSED_TRANSFORM_UV  (1<<0)
+
+/**
+ * Fragment samples a fixed neighborhood of the input image.
+ *
+ * The fragment may read the "image" texture directly with the fused_sampler
+ * or fused_border_sampler sampler states.  The filter can only be the first
+ * filter of a fused pass.
+ */
+#define OBS_FUSED_NEIGHBORHOOD  (1<<1)
+
 /** @} */
 
 typedef void (*obs_source_enum_proc_t)(obs_source_t *parent,
@@ -457,6 +493,36 @@ struct obs_source_info {
 	 * @return          The properties data
 	 */
 	obs_properties_t *(*get_properties2)(void *data, void *type_data);
+
+	/**
+	 * Gets the shader fragment of a fusable filter.
+	 *
+	 * Consecutive fusable filters of a source are compiled into a single
+	 * effect and drawn in one pass instead of one render target per
+	 * filter.  The fragment must define
+	 * float4 FUSE_main(float4 rgba, float2 uv), and every identifier it
+	 * declares must start with FUSE_, which is replaced with a unique
+	 * prefix when the fragments are combined.
+	 *
+	 * The returned string must stay valid and unchanged for the lifetime
+	 * of the filter.  Return NULL if the filter cannot currently be
+	 * fused; video_render is used instead.
+	 *
+	 * @param  data  Filter data
+	 * @return       Effect fragment, or NULL
+	 */
+	const char *(*get_fused_shader)(void *data);
+
+	/**
+	 * Sets the parameters of the fused shader fragment.  Use
+	 * obs_filter_get_fused_param to find the fragment's parameters.
+	 *
+	 * @param  data  Filter data
+	 */
+	void (*fused_set_params)(void *data);
+
+	/** Fused filter flags (OBS_FUSED_*) */
+	uint32_t fused_flags;
 };
 
 EXPORT void obs_register_source_s(const struct obs_source_info *info,
@@ -762,6 +762,8 @@ static bool obs_init(const char *locale, const char *module_config_path,
 	}
 
 	log_system_info();
+	obs_packet_pool_init();
+	obs_cpu_budget_init();
 
 	if (!obs_init_data())
 		return false;
@@ -928,6 +930,8 @@ void obs_shutdown(void)
 	obs_free_video();
 	obs_free_hotkeys();
 	obs_free_graphics();
+	obs_packet_pool_free();
+	obs_cpu_budget_free();
 	proc_handler_destroy(obs->procs);
 	signal_handler_destroy(obs->signals);
 	obs->procs = NULL;
@@ -1616,14 +1620,9 @@ float obs_get_master_volume(void)
 	return obs ? obs->audio.user_volume : 0.0f;
 }
 
-static obs_source_t *obs_load_source_type(obs_data_t *source_data)
+static void obs_source_load_data(obs_source_t *source,
+		obs_data_t *source_data)
 {
-	obs_data_array_t *filters = obs_data_get_array(source_data, "filters");
-	obs_source_t *source;
-	const char   *name    = obs_data_get_string(source_data, "name");
-	const char   *id      = obs_data_get_string(source_data, "id");
-	obs_data_t   *settings = obs_data_get_obj(source_data, "settings");
-	obs_data_t   *hotkeys  = obs_data_get_obj(source_data, "hotkeys");
 	double       volume;
 	double       balance;
 	int64_t      sync;
@@ -1633,10 +1632,6 @@ static obs_source_t *obs_load_source_type(obs_data_t *source_data)
 	int          di_mode;
 	int          monitoring_type;
 
-	source = obs_source_create(id, name, settings, hotkeys);
-
-	obs_data_release(hotkeys);
-
 	obs_data_set_default_double(source_data, "volume", 1.0);
 	volume = obs_data_get_double(source_data, "volume");
 	obs_source_set_volume(source, (float)volume);
@@ -1696,6 +1691,22 @@ static obs_source_t *obs_load_source_type(obs_data_t *source_data)
 		obs_data_get_obj(source_data, "private_settings");
 	if (!source->private_settings)
 		source->private_settings = obs_data_create();
+}
+
+static obs_source_t *obs_load_source_type(obs_data_t *source_data)
+{
+	obs_data_array_t *filters = obs_data_get_array(source_data, "filters");
+	obs_source_t *source;
+	const char   *name    = obs_data_get_string(source_data, "name");
+	const char   *id      = obs_data_get_string(source_data, "id");
+	obs_data_t   *settings = obs_data_get_obj(source_data, "settings");
+	obs_data_t   *hotkeys  = obs_data_get_obj(source_data, "hotkeys");
+
+	source = obs_source_create(id, name, settings, hotkeys);
+
+	obs_data_release(hotkeys);
+
+	obs_source_load_data(source, source_data);
 
 	if (filters) {
 		size_t count = obs_data_array_count(filters);
@@ -1727,36 +1738,291 @@ obs_source_t *obs_load_source(obs_data_t *source_data)
 	return obs_load_source_type(source_data);
 }
 
+/* ------------------------------------------------------------------------- */
+/* parallel source loading
+ *
+ * sources are loaded in four steps:
+ *
+ * 1.) on the calling thread, sources and filters whose type has
+ *     OBS_SOURCE_PARALLEL_CREATE are created as shells (registered and
+ *     findable by name, but without their type data)
+ * 2.) the create callbacks of those shells are run on a pool of worker
+ *     threads
+ * 3.) back on the calling thread, the shells are finished, and then every
+ *     other source and filter is created.  their create callbacks may look
+ *     up other sources, so they only run once every parallel source is
+ *     complete
+ * 4.) saved data and filters are applied, and all sources are loaded in
+ *     their original order.  scenes are loaded last in this step, so every
+ *     source they reference is fully created by the time their items are
+ *     added. */
+
+#define MAX_LOAD_THREADS 8
+
+static const char *load_sources_worker_name = "obs_load_sources_worker";
+
+struct load_entry {
+	obs_source_t                 *source;
+	obs_data_t                   *data;
+	bool                         deferred;
+	DARRAY(struct load_entry)    filters;
+};
+
+struct load_create {
+	obs_source_t                 *source;
+	const char                   *profile_name;
+};
+
+struct load_profile_name {
+	const char                   *id;
+	const char                   *name;
+};
+
+struct parallel_load {
+	DARRAY(struct load_create)       creates;
+	DARRAY(struct load_profile_name) profile_names;
+	volatile long                    next_create;
+};
+
+static const char *get_load_profile_name(struct parallel_load *load,
+		const char *id)
+{
+	struct load_profile_name entry;
+
+	for (size_t i = 0; i < load->profile_names.num; i++) {
+		struct load_profile_name *cur = load->profile_names.array + i;
+		if (strcmp(cur->id, id) == 0)
+			return cur->name;
+	}
+
+	entry.id = id;
+	entry.name = profile_store_name(obs_get_profiler_name_store(),
+			"obs_source_create(%s)", id);
+	da_push_back(load->profile_names, &entry);
+	return entry.name;
+}
+
+static bool can_create_parallel(const char *id)
+{
+	const struct obs_source_info *info = get_source_info(id);
+	return info && (info->output_flags & OBS_SOURCE_PARALLEL_CREATE) != 0;
+}
+
+/* step 1.  other sources are left for step 3 */
+static void load_entry_create_shell(struct parallel_load *load,
+		struct load_entry *entry, obs_data_t *source_data)
+{
+	obs_data_array_t *filters = obs_data_get_array(source_data, "filters");
+	const char   *id       = obs_data_get_string(source_data, "id");
+
+	entry->data = source_data;
+	entry->deferred = can_create_parallel(id);
+
+	if (entry->deferred) {
+		const char *name     = obs_data_get_string(source_data, "name");
+		obs_data_t *settings = obs_data_get_obj(source_data,
+				"settings");
+		obs_data_t *hotkeys  = obs_data_get_obj(source_data, "hotkeys");
+
+		entry->source = obs_source_create_shell(id, name, settings,
+				hotkeys);
+
+		if (entry->source) {
+			struct load_create create = {
+				.source       = entry->source,
+				.profile_name = get_load_profile_name(load, id)
+			};
+			da_push_back(load->creates, &create);
+		}
+
+		obs_data_release(hotkeys);
+		obs_data_release(settings);
+	}
+
+	if (filters) {
+		size_t count = obs_data_array_count(filters);
+
+		for (size_t i = 0; i < count; i++) {
+			struct load_entry *filter =
+				da_push_back_new(entry->filters);
+
+			load_entry_create_shell(load, filter,
+					obs_data_array_item(filters, i));
+		}
+
+		obs_data_array_release(filters);
+	}
+}
+
+/* step 2 */
+static void run_load_creates(struct parallel_load *load)
+{
+	for (;;) {
+		long idx = os_atomic_inc_long(&load->next_create) - 1;
+		struct load_create *create;
+
+		if (idx >= (long)load->creates.num)
+			break;
+
+		create = load->creates.array + idx;
+
+		profile_start(create->profile_name);
+		obs_source_create_data(create->source);
+		profile_end(create->profile_name);
+	}
+}
+
+static void *load_sources_thread(void *param)
+{
+	os_set_thread_name("libobs: source loading thread");
+
+	profile_start(load_sources_worker_name);
+	run_load_creates(param);
+	profile_end(load_sources_worker_name);
+
+	return NULL;
+}
+
+static void load_entries_create_parallel(struct parallel_load *load)
+{
+	pthread_t threads[MAX_LOAD_THREADS];
+	size_t num_threads = 0;
+	size_t max_threads;
+	uint64_t start_time;
+	int cores;
+
+	if (!load->creates.num)
+		return;
+
+	start_time = os_gettime_ns();
+
+	/* the calling thread creates sources as well, so one less worker than
+	 * there are cores is needed */
+	cores = os_get_logical_cores();
+	max_threads = cores > 1 ? (size_t)(cores - 1) : 0;
+	if (max_threads > MAX_LOAD_THREADS)
+		max_threads = MAX_LOAD_THREADS;
+	if (max_threads > load->creates.num - 1)
+		max_threads = load->creates.num - 1;
+
+	for (size_t i = 0; i < max_threads; i++) {
+		if (pthread_create(&threads[num_threads], NULL,
+					load_sources_thread, load) == 0)
+			num_threads++;
+	}
+
+	run_load_creates(load);
+
+	for (size_t i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	blog(LOG_DEBUG, "Created %d sources on %d threads in %"PRIu64" ms",
+			(int)load->creates.num, (int)num_threads + 1,
+			(os_gettime_ns() - start_time) / 1000000);
+}
+
+/* step 3 */
+static void load_entry_finish_shell(struct load_entry *entry)
+{
+	if (entry->deferred && entry->source)
+		obs_source_create_finish(entry->source);
+
+	for (size_t i = 0; i < entry->filters.num; i++)
+		load_entry_finish_shell(entry->filters.array + i);
+}
+
+static void load_entry_create(struct parallel_load *load,
+		struct load_entry *entry)
+{
+	if (!entry->deferred) {
+		obs_data_t *source_data = entry->data;
+		const char *name     = obs_data_get_string(source_data, "name");
+		const char *id       = obs_data_get_string(source_data, "id");
+		obs_data_t *settings = obs_data_get_obj(source_data,
+				"settings");
+		obs_data_t *hotkeys  = obs_data_get_obj(source_data, "hotkeys");
+		const char *profile_name = get_load_profile_name(load, id);
+
+		profile_start(profile_name);
+		entry->source = obs_source_create(id, name, settings, hotkeys);
+		profile_end(profile_name);
+
+		obs_data_release(hotkeys);
+		obs_data_release(settings);
+	}
+
+	for (size_t i = 0; i < entry->filters.num; i++)
+		load_entry_create(load, entry->filters.array + i);
+}
+
+/* step 4 */
+static void load_entry_finish(struct load_entry *entry)
+{
+	obs_source_t *source = entry->source;
+
+	if (source)
+		obs_source_load_data(source, entry->data);
+
+	for (size_t i = 0; i < entry->filters.num; i++) {
+		struct load_entry *filter = entry->filters.array + i;
+
+		load_entry_finish(filter);
+
+		if (source && filter->source)
+			obs_source_filter_add(source, filter->source);
+	}
+}
+
+static void load_entry_free(struct load_entry *entry)
+{
+	for (size_t i = 0; i < entry->filters.num; i++)
+		load_entry_free(entry->filters.array + i);
+	da_free(entry->filters);
+
+	obs_source_release(entry->source);
+	obs_data_release(entry->data);
+}
+
 void obs_load_sources(obs_data_array_t *array, obs_load_source_cb cb,
 		void *private_data)
 {
 	if (!obs) return;
 
 	struct obs_core_data *data = &obs->data;
-	DARRAY(obs_source_t*) sources;
+	DARRAY(struct load_entry) entries;
+	struct parallel_load load = {0};
 	size_t count;
 	size_t i;
 
-	da_init(sources);
+	da_init(entries);
 
 	count = obs_data_array_count(array);
-	da_reserve(sources, count);
+	da_resize(entries, count);
 
 	pthread_mutex_lock(&data->sources_mutex);
 
-	for (i = 0; i < count; i++) {
-		obs_data_t   *source_data = obs_data_array_item(array, i);
-		obs_source_t *source      = obs_load_source(source_data);
+	for (i = 0; i < count; i++)
+		load_entry_create_shell(&load, entries.array + i,
+				obs_data_array_item(array, i));
 
-		da_push_back(sources, &source);
+	/* the create callbacks of sources may look up other sources, so the
+	 * sources mutex can't be held while waiting on the worker threads */
+	pthread_mutex_unlock(&data->sources_mutex);
+	load_entries_create_parallel(&load);
+	pthread_mutex_lock(&data->sources_mutex);
 
-		obs_data_release(source_data);
-	}
+	for (i = 0; i < entries.num; i++)
+		load_entry_finish_shell(entries.array + i);
+	for (i = 0; i < entries.num; i++)
+		load_entry_create(&load, entries.array + i);
+
+	for (i = 0; i < entries.num; i++)
+		load_entry_finish(entries.array + i);
 
 	/* tell sources that we want to load */
-	for (i = 0; i < sources.num; i++) {
-		obs_source_t *source = sources.array[i];
-		obs_data_t *source_data = obs_data_array_item(array, i);
+	for (i = 0; i < entries.num; i++) {
+		obs_source_t *source = entries.array[i].source;
+		obs_data_t *source_data = entries.array[i].data;
 		if (source) {
 			if (source->info.type == OBS_SOURCE_TYPE_TRANSITION)
 				obs_transition_load(source, source_data);
@@ -1764,15 +2030,16 @@ void obs_load_sources(obs_data_array_t *array, obs_load_source_cb cb,
 			if (cb)
 				cb(private_data, source);
 		}
-		obs_data_release(source_data);
 	}
 
-	for (i = 0; i < sources.num; i++)
-		obs_source_release(sources.array[i]);
+	for (i = 0; i < entries.num; i++)
+		load_entry_free(entries.array + i);
 
 	pthread_mutex_unlock(&data->sources_mutex);
 
-	da_free(sources);
+	da_free(load.creates);
+	da_free(load.profile_names);
+	da_free(entries);
 }
 
 obs_data_t *obs_save_source(obs_source_t *source)
@@ -2193,12 +2460,14 @@ uint32_t obs_get_lagged_frames(void)
 }
 
 void start_raw_video(video_t *v, const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor, const void *cascade_group,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
 {
 	struct obs_core_video *video = &obs->video;
 	os_atomic_inc_long(&video->raw_active);
-	video_output_connect(v, conversion, callback, param);
+	video_output_connect3(v, conversion, frame_rate_divisor,
+			cascade_group, callback, param);
 }
 
 void stop_raw_video(video_t *v,
@@ -2214,11 +2483,21 @@ void obs_add_raw_video_callback(
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
+{
+	obs_add_raw_video_callback2(conversion, 1, callback, param);
+}
+
+void obs_add_raw_video_callback2(
+		const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param)
 {
 	struct obs_core_video *video = &obs->video;
 	if (!obs)
 		return;
-	start_raw_video(video->video, conversion, callback, param);
+	start_raw_video(video->video, conversion, frame_rate_divisor, NULL,
+			callback, param);
 }
 
 void obs_remove_raw_video_callback(
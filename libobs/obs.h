@@ -62,6 +62,8 @@ typedef struct obs_service    obs_service_t;
 typedef struct obs_module     obs_module_t;
 typedef struct obs_fader      obs_fader_t;
 typedef struct obs_volmeter   obs_volmeter_t;
+typedef struct obs_cpu_claim  obs_cpu_claim_t;
+typedef struct obs_encoder_ladder obs_encoder_ladder_t;
 
 typedef struct obs_weak_source  obs_weak_source_t;
 typedef struct obs_weak_output  obs_weak_output_t;
@@ -145,6 +147,22 @@ struct obs_transform_info {
 	struct vec2          bounds;
 };
 
+/**
+ * Scene item culling statistics
+ */
+struct obs_scene_cull_info {
+	/** Items drawn in the last frame */
+	uint32_t             rendered;
+	/** Items skipped in the last frame for being entirely off-canvas */
+	uint32_t             culled_offscreen;
+	/** Items skipped in the last frame for being covered by an opaque
+	 * item above them */
+	uint32_t             culled_occluded;
+
+	/** Total number of items skipped since the scene was created */
+	uint64_t             total_culled;
+};
+
 /**
  * Video initialization structure
  */
@@ -698,6 +716,13 @@ EXPORT void obs_add_raw_video_callback(
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
+/** Adds a raw video callback that only receives every frame_rate_divisor'th
+ * frame of the main video output */
+EXPORT void obs_add_raw_video_callback2(
+		const struct video_scale_info *conversion,
+		uint32_t frame_rate_divisor,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param);
 EXPORT void obs_remove_raw_video_callback(
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
@@ -1172,6 +1197,15 @@ EXPORT void obs_source_process_filter_tech_end(obs_source_t *filter,
 /** Skips the filter if the filter is invalid and cannot be rendered */
 EXPORT void obs_source_skip_video_filter(obs_source_t *filter);
 
+/**
+ * Gets a parameter of the filter's fragment in the fused effect currently
+ * being drawn.  Only valid inside of the fused_set_params callback.
+ *
+ * @param  name  Parameter name without the FUSE_ prefix
+ */
+EXPORT gs_eparam_t *obs_filter_get_fused_param(obs_source_t *filter,
+		const char *name);
+
 /**
  * Adds an active child source.  Must be called by parent sources on child
  * sources when the child is added and active.  This ensures that the source is
@@ -1379,6 +1413,10 @@ EXPORT bool obs_scene_reorder_items2(obs_scene_t *scene,
 /** Adds/creates a new scene item for a source */
 EXPORT obs_sceneitem_t *obs_scene_add(obs_scene_t *scene, obs_source_t *source);
 
+/** Gets how many items of the scene were culled when last rendered */
+EXPORT void obs_scene_get_cull_info(obs_scene_t *scene,
+		struct obs_scene_cull_info *info);
+
 typedef void (*obs_scene_atomic_update_func)(void *, obs_scene_t *scene);
 EXPORT void obs_scene_atomic_update(obs_scene_t *scene,
 		obs_scene_atomic_update_func func, void *data);
@@ -1564,6 +1602,23 @@ EXPORT void obs_output_stop(obs_output_t *output);
 EXPORT void obs_output_set_delay(obs_output_t *output, uint32_t delay_sec,
 		uint32_t flags);
 
+/**
+ * Sets how much memory a delay may use for packet data before the data of
+ * new packets is written to segment files in directory instead, to be read
+ * back just before it's sent.  A max_memory_mb of 0 (the default) keeps
+ * everything in memory.  If directory is NULL or empty, the system's
+ * temporary directory is used.
+ *
+ * Packets kept in memory share the encoder's data only if it was allocated
+ * with obs_encoder_alloc_packet_data.  The data of other encoders (NVENC,
+ * audio encoders) is still copied.
+ *
+ * Like obs_output_set_delay, only affects the next time the output is
+ * activated.
+ */
+EXPORT void obs_output_set_delay_spill(obs_output_t *output,
+		uint32_t max_memory_mb, const char *directory);
+
 /** Gets the currently set delay value, in seconds. */
 EXPORT uint32_t obs_output_get_delay(const obs_output_t *output);
 
@@ -1878,7 +1933,8 @@ EXPORT obs_properties_t *obs_encoder_properties(const obs_encoder_t *encoder);
 
 /**
  * Updates the settings of the encoder context.  Usually used for changing
- * bitrate while active
+ * bitrate while active.  Updates are serialized, so this can be called from
+ * any thread
  */
 EXPORT void obs_encoder_update(obs_encoder_t *encoder, obs_data_t *settings);
 
@@ -1910,6 +1966,99 @@ EXPORT audio_t *obs_encoder_audio(const obs_encoder_t *encoder);
 /** Returns true if encoder is active, false otherwise */
 EXPORT bool obs_encoder_active(const obs_encoder_t *encoder);
 
+/** Returns the number of outputs the encoder is currently set on */
+EXPORT size_t obs_encoder_get_output_count(obs_encoder_t *encoder);
+
+/**
+ * Enables/disables the adaptive preset controller for a video encoder.  When
+ * enabled, the encoder's preset is stepped toward faster presets while the
+ * encoder can't keep up, and back toward the original preset once it can.
+ * Requires the encoder to implement step_preset.
+ */
+EXPORT void obs_encoder_set_adaptive_preset(obs_encoder_t *encoder,
+		bool enable);
+EXPORT bool obs_encoder_adaptive_preset_enabled(const obs_encoder_t *encoder);
+
+/**
+ * Returns how many steps the adaptive preset controller has moved the preset
+ * toward faster presets
+ */
+EXPORT int obs_encoder_get_adaptive_preset_level(const obs_encoder_t *encoder);
+
+/**
+ * Returns the number of frames dropped because the encoder's frame
+ * queue was full since it was last started
+ */
+EXPORT uint32_t obs_encoder_get_frames_dropped(const obs_encoder_t *encoder);
+
+/** Returns the number of frames currently waiting to be encoded */
+EXPORT uint32_t obs_encoder_get_queued_frames(const obs_encoder_t *encoder);
+
+/**
+ * Returns the average time in nanoseconds between a frame being queued and
+ * the encoder finishing with it, since it was last started
+ */
+EXPORT uint64_t obs_encoder_get_average_latency(const obs_encoder_t *encoder);
+
+/**
+ * Skips video frames that are identical to the last frame that was encoded
+ * (up to a second at a time), producing variable frame rate output.  Useful
+ * for mostly static recordings.  Cannot be changed while the encoder is
+ * active, and can only be enabled for encoders with OBS_ENCODER_CAP_VFR.
+ */
+EXPORT void obs_encoder_set_skip_duplicate_frames(obs_encoder_t *encoder,
+		bool skip);
+EXPORT bool obs_encoder_skips_duplicate_frames(const obs_encoder_t *encoder);
+
+/** Returns the number of duplicate frames skipped since the encoder was last
+ * started */
+EXPORT uint32_t obs_encoder_get_frames_duplicate(const obs_encoder_t *encoder);
+
+/**
+ * Only encodes every divisor'th frame of the video output, for encoding at a
+ * fraction of the output's frame rate.  Cannot be changed while the encoder
+ * is active or part of an encoder ladder.
+ */
+EXPORT void obs_encoder_set_frame_rate_divisor(obs_encoder_t *encoder,
+		uint32_t divisor);
+EXPORT uint32_t obs_encoder_get_frame_rate_divisor(
+		const obs_encoder_t *encoder);
+
+/**
+ * Returns true if keyframes are placed by libobs (the encoder is part of an
+ * encoder ladder), in which case the encoder should only emit keyframes for
+ * frames with force_keyframe set.
+ */
+EXPORT bool obs_encoder_keyframes_forced(const obs_encoder_t *encoder);
+
+/* ------------------------------------------------------------------------- */
+/* Encoder ladders */
+
+/**
+ * Creates an encoder ladder:  a set of video encoders encoding different
+ * renditions of the same video output.  Keyframes are aligned between all
+ * renditions every keyint_ms milliseconds (2 seconds if 0), and frame rate
+ * decimation uses the same frames for every rendition.
+ */
+EXPORT obs_encoder_ladder_t *obs_encoder_ladder_create(video_t *video,
+		uint32_t keyint_ms);
+
+/** Destroys a ladder.  None of its encoders should be active. */
+EXPORT void obs_encoder_ladder_destroy(obs_encoder_ladder_t *ladder);
+
+/**
+ * Adds a rendition to the ladder.  Sets the encoder's video output, scaled
+ * size and frame rate divisor.  Fails if the encoder is active, or if the
+ * divisor would change the keyframe interval while the ladder is encoding.
+ */
+EXPORT bool obs_encoder_ladder_add(obs_encoder_ladder_t *ladder,
+		obs_encoder_t *encoder, uint32_t width, uint32_t height,
+		uint32_t frame_rate_divisor);
+
+/** Removes a rendition from the ladder */
+EXPORT void obs_encoder_ladder_remove(obs_encoder_ladder_t *ladder,
+		obs_encoder_t *encoder);
+
 EXPORT void *obs_encoder_get_type_data(obs_encoder_t *encoder);
 
 EXPORT const char *obs_encoder_get_id(const obs_encoder_t *encoder);
@@ -1930,6 +2079,56 @@ EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
 		struct encoder_packet *src);
 EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
 
+/**
+ * Allocates a packet buffer that an encoder can write its encoded data in to
+ * directly from its encode callback.  If the packet's data points to this
+ * buffer it is shared with outputs rather than copied.  Only valid until the
+ * encode callback returns.
+ */
+EXPORT uint8_t *obs_encoder_alloc_packet_data(obs_encoder_t *encoder,
+		size_t size);
+
+
+/* ------------------------------------------------------------------------- */
+/* CPU budget */
+
+/**
+ * Sets the number of worker threads shared between software encoders and
+ * other CPU heavy work (0 uses the number of logical cores), and whether
+ * each claim should be given its own range of cores
+ */
+EXPORT void obs_set_cpu_budget(int threads, bool use_affinity);
+
+/** Returns the number of worker threads in the CPU budget */
+EXPORT int obs_get_cpu_budget(void);
+
+/**
+ * Claims part of the CPU budget.  The number of threads assigned is in
+ * proportion to the claim's weight relative to other active claims (at least
+ * 1), and every claim is rebalanced when a claim is created or destroyed.
+ * Until obs_set_cpu_budget is called, claims are assigned 0 threads.
+ */
+EXPORT obs_cpu_claim_t *obs_cpu_claim_create(const char *name,
+		uint64_t weight);
+EXPORT void obs_cpu_claim_destroy(obs_cpu_claim_t *claim);
+
+/**
+ * Returns the number of worker threads currently assigned to the claim, or 0
+ * if no CPU budget was set (the caller should then use its own default)
+ */
+EXPORT int obs_cpu_claim_get_threads(const obs_cpu_claim_t *claim);
+
+/** Returns the cores assigned to the claim, or 0 if not using affinity */
+EXPORT uint64_t obs_cpu_claim_get_affinity(const obs_cpu_claim_t *claim);
+
+/**
+ * Temporarily binds the calling thread to the claim's cores, so that worker
+ * threads created in between (by an encoder library for example) inherit
+ * them.  Does nothing if the claim has no affinity.
+ */
+EXPORT void obs_cpu_claim_push_affinity(obs_cpu_claim_t *claim);
+EXPORT void obs_cpu_claim_pop_affinity(obs_cpu_claim_t *claim);
+
 
 /* ------------------------------------------------------------------------- */
 /* Stream Services */
@@ -0,0 +1,563 @@
+/*
+ * Copyright (c) 2019 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <stdio.h>
+#include <io.h>
+#else
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "base.h"
+#include "bmem.h"
+#include "darray.h"
+#include "circlebuf.h"
+#include "platform.h"
+#include "threading.h"
+#include "buffered-file-serializer.h"
+
+/* alignment required by unbuffered I/O on every platform we support it on */
+#define CHUNK_ALIGNMENT 4096
+
+struct file_chunk {
+	uint8_t  *data;
+	size_t   size;
+	int64_t  offset;
+};
+
+struct buffered_file {
+#ifdef _WIN32
+	FILE                     *file;
+#else
+	int                      fd;
+#endif
+	bool                     direct;
+
+	size_t                   chunk_size;
+	size_t                   max_chunks;
+	size_t                   num_chunks;
+
+	/* only touched by the thread writing to the serializer */
+	struct file_chunk        cur;
+	int64_t                  pos;
+	int64_t                  end;
+
+	pthread_mutex_t          mutex;
+	struct circlebuf         pending;
+	DARRAY(uint8_t*)         free_chunks;
+	size_t                   in_flight;
+	bool                     stop;
+
+	os_sem_t                 *write_sem;
+	os_event_t               *done_event;
+	pthread_t                thread;
+	bool                     thread_active;
+
+	/* protected by mutex */
+	enum buffered_file_sync  sync;
+	struct buffered_file_stats stats;
+
+	volatile bool            failed;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static uint8_t *chunk_alloc(size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, CHUNK_ALIGNMENT);
+#else
+	void *ptr = NULL;
+	return posix_memalign(&ptr, CHUNK_ALIGNMENT, size) == 0 ? ptr : NULL;
+#endif
+}
+
+static void chunk_free(uint8_t *data)
+{
+#ifdef _WIN32
+	_aligned_free(data);
+#else
+	free(data);
+#endif
+}
+
+#ifdef _WIN32
+static bool write_chunk(struct buffered_file *bf, struct file_chunk *chunk)
+{
+	if (os_fseeki64(bf->file, chunk->offset, SEEK_SET) != 0)
+		return false;
+	return fwrite(chunk->data, 1, chunk->size, bf->file) == chunk->size;
+}
+
+#else
+static void disable_direct_io(struct buffered_file *bf)
+{
+#ifdef O_DIRECT
+	int flags = fcntl(bf->fd, F_GETFL);
+	if (flags != -1)
+		fcntl(bf->fd, F_SETFL, flags & ~O_DIRECT);
+#endif
+	bf->direct = false;
+}
+
+static bool write_chunk(struct buffered_file *bf, struct file_chunk *chunk)
+{
+	const uint8_t *data = chunk->data;
+	size_t size = chunk->size;
+	int64_t offset = chunk->offset;
+
+	if (bf->direct && (offset % CHUNK_ALIGNMENT != 0 ||
+	                   size % CHUNK_ALIGNMENT != 0))
+		disable_direct_io(bf);
+
+	while (size) {
+		ssize_t ret = pwrite(bf->fd, data, size, (off_t)offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data   += ret;
+		size   -= (size_t)ret;
+		offset += ret;
+	}
+
+	return true;
+}
+#endif
+
+#ifdef _WIN32
+static bool sync_file(struct buffered_file *bf)
+{
+	return fflush(bf->file) == 0 && _commit(_fileno(bf->file)) == 0;
+}
+
+#else
+static bool sync_file(struct buffered_file *bf)
+{
+#ifdef __linux__
+	return fdatasync(bf->fd) == 0;
+#else
+	return fsync(bf->fd) == 0;
+#endif
+}
+#endif
+
+static void *write_thread(void *param)
+{
+	struct buffered_file *bf = param;
+
+	os_set_thread_name("buffered file writer");
+
+	while (os_sem_wait(bf->write_sem) == 0) {
+		struct file_chunk chunk;
+		uint64_t start, elapsed;
+		bool sync;
+
+		pthread_mutex_lock(&bf->mutex);
+		if (!bf->pending.size) {
+			bool stop = bf->stop;
+			pthread_mutex_unlock(&bf->mutex);
+			if (stop)
+				break;
+			continue;
+		}
+
+		circlebuf_pop_front(&bf->pending, &chunk, sizeof(chunk));
+		bf->in_flight++;
+		sync = bf->sync == BUFFERED_FILE_SYNC_EVERY_CHUNK;
+		pthread_mutex_unlock(&bf->mutex);
+
+		start = os_gettime_ns();
+
+		/* after a failure the rest of the data is discarded so the
+		 * writing thread never ends up waiting on a full buffer */
+		if (!os_atomic_load_bool(&bf->failed) &&
+		    !write_chunk(bf, &chunk)) {
+			blog(LOG_ERROR, "buffered file: write of %d bytes at "
+					"offset %lld failed",
+					(int)chunk.size,
+					(long long)chunk.offset);
+			os_atomic_set_bool(&bf->failed, true);
+		}
+
+		if (sync && !os_atomic_load_bool(&bf->failed) &&
+		    !sync_file(bf)) {
+			blog(LOG_ERROR, "buffered file: sync failed");
+			os_atomic_set_bool(&bf->failed, true);
+		}
+
+		elapsed = os_gettime_ns() - start;
+
+		pthread_mutex_lock(&bf->mutex);
+		da_push_back(bf->free_chunks, &chunk.data);
+		bf->in_flight--;
+		bf->stats.chunks_written++;
+		bf->stats.bytes_written += chunk.size;
+		bf->stats.total_write_ns += elapsed;
+		if (elapsed > bf->stats.max_write_ns)
+			bf->stats.max_write_ns = elapsed;
+		pthread_mutex_unlock(&bf->mutex);
+
+		os_event_signal(bf->done_event);
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint8_t *get_free_chunk(struct buffered_file *bf)
+{
+	uint8_t *data = NULL;
+
+	for (;;) {
+		uint64_t start, elapsed;
+
+		pthread_mutex_lock(&bf->mutex);
+		if (bf->free_chunks.num) {
+			data = bf->free_chunks.array[bf->free_chunks.num - 1];
+			da_pop_back(bf->free_chunks);
+		} else if (bf->num_chunks < bf->max_chunks) {
+			bf->num_chunks++;
+			pthread_mutex_unlock(&bf->mutex);
+
+			data = chunk_alloc(bf->chunk_size);
+			if (!data) {
+				pthread_mutex_lock(&bf->mutex);
+				bf->num_chunks--;
+				pthread_mutex_unlock(&bf->mutex);
+			}
+			return data;
+		}
+		pthread_mutex_unlock(&bf->mutex);
+
+		if (data)
+			return data;
+
+		/* every chunk is waiting to be written, so the disk isn't
+		 * keeping up */
+		start = os_gettime_ns();
+		os_event_wait(bf->done_event);
+		elapsed = os_gettime_ns() - start;
+
+		pthread_mutex_lock(&bf->mutex);
+		bf->stats.stalls++;
+		bf->stats.total_stall_ns += elapsed;
+		pthread_mutex_unlock(&bf->mutex);
+	}
+}
+
+static void queue_cur_chunk(struct buffered_file *bf)
+{
+	if (!bf->cur.data)
+		return;
+
+	if (!bf->cur.size) {
+		pthread_mutex_lock(&bf->mutex);
+		da_push_back(bf->free_chunks, &bf->cur.data);
+		pthread_mutex_unlock(&bf->mutex);
+
+	} else {
+		pthread_mutex_lock(&bf->mutex);
+		circlebuf_push_back(&bf->pending, &bf->cur, sizeof(bf->cur));
+		pthread_mutex_unlock(&bf->mutex);
+
+		os_sem_post(bf->write_sem);
+	}
+
+	bf->cur.data = NULL;
+	bf->cur.size = 0;
+}
+
+/* waits until everything written so far is on disk */
+static void flush_chunks(struct buffered_file *bf)
+{
+	queue_cur_chunk(bf);
+
+	for (;;) {
+		bool done;
+
+		pthread_mutex_lock(&bf->mutex);
+		done = !bf->pending.size && !bf->in_flight;
+		pthread_mutex_unlock(&bf->mutex);
+
+		if (done)
+			break;
+
+		os_event_wait(bf->done_event);
+	}
+}
+
+static size_t buffered_file_write(void *sdata, const void *data, size_t size)
+{
+	struct buffered_file *bf = sdata;
+	const uint8_t *src = data;
+	size_t remaining = size;
+
+	if (os_atomic_load_bool(&bf->failed))
+		return 0;
+
+	while (remaining) {
+		size_t copy;
+
+		if (!bf->cur.data) {
+			bf->cur.data = get_free_chunk(bf);
+			if (!bf->cur.data) {
+				os_atomic_set_bool(&bf->failed, true);
+				return 0;
+			}
+
+			bf->cur.size = 0;
+			bf->cur.offset = bf->pos;
+		}
+
+		copy = bf->chunk_size - bf->cur.size;
+		if (copy > remaining)
+			copy = remaining;
+
+		memcpy(bf->cur.data + bf->cur.size, src, copy);
+		bf->cur.size += copy;
+		bf->pos      += (int64_t)copy;
+		src          += copy;
+		remaining    -= copy;
+
+		if (bf->cur.size == bf->chunk_size)
+			queue_cur_chunk(bf);
+	}
+
+	if (bf->pos > bf->end)
+		bf->end = bf->pos;
+	return size;
+}
+
+static int64_t buffered_file_seek(void *sdata, int64_t offset,
+		enum serialize_seek_type seek_type)
+{
+	struct buffered_file *bf = sdata;
+	int64_t pos = bf->pos;
+
+	switch (seek_type) {
+	case SERIALIZE_SEEK_START:   pos = offset; break;
+	case SERIALIZE_SEEK_CURRENT: pos = bf->pos + offset; break;
+	case SERIALIZE_SEEK_END:     pos = bf->end + offset; break;
+	}
+
+	if (pos < 0)
+		return -1;
+	if (pos == bf->pos)
+		return pos;
+
+	/* chunks are contiguous, so moving anywhere else starts a new one */
+	flush_chunks(bf);
+	bf->pos = pos;
+	return pos;
+}
+
+static int64_t buffered_file_get_pos(void *sdata)
+{
+	struct buffered_file *bf = sdata;
+	return bf->pos;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool open_file(struct buffered_file *bf, const char *path,
+		bool direct_io)
+{
+#ifdef _WIN32
+	bf->file = os_fopen(path, "wb");
+	bf->direct = false;
+	UNUSED_PARAMETER(direct_io);
+	return bf->file != NULL;
+
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+#ifdef O_DIRECT
+	if (direct_io) {
+		bf->fd = open(path, flags | O_DIRECT, 0644);
+		if (bf->fd != -1) {
+			bf->direct = true;
+			return true;
+		}
+	}
+#endif
+
+	bf->fd = open(path, flags, 0644);
+	if (bf->fd == -1)
+		return false;
+
+#ifdef F_NOCACHE
+	if (direct_io)
+		fcntl(bf->fd, F_NOCACHE, 1);
+#endif
+	bf->direct = false;
+	return true;
+#endif
+}
+
+static void close_file(struct buffered_file *bf)
+{
+#ifdef _WIN32
+	if (bf->file)
+		fclose(bf->file);
+#else
+	if (bf->fd != -1)
+		close(bf->fd);
+#endif
+}
+
+static void buffered_file_destroy(struct buffered_file *bf)
+{
+	if (bf->thread_active) {
+		pthread_mutex_lock(&bf->mutex);
+		bf->stop = true;
+		pthread_mutex_unlock(&bf->mutex);
+
+		os_sem_post(bf->write_sem);
+		pthread_join(bf->thread, NULL);
+	}
+
+	for (size_t i = 0; i < bf->free_chunks.num; i++)
+		chunk_free(bf->free_chunks.array[i]);
+	chunk_free(bf->cur.data);
+
+	da_free(bf->free_chunks);
+	circlebuf_free(&bf->pending);
+	os_event_destroy(bf->done_event);
+	os_sem_destroy(bf->write_sem);
+	pthread_mutex_destroy(&bf->mutex);
+	close_file(bf);
+	bfree(bf);
+}
+
+bool buffered_file_serializer_init(struct serializer *s, const char *path,
+		size_t chunk_size, size_t max_bufsize, bool direct_io)
+{
+	struct buffered_file *bf;
+
+	if (!chunk_size)
+		chunk_size = BUFFERED_FILE_DEFAULT_CHUNK_SIZE;
+	if (!max_bufsize)
+		max_bufsize = BUFFERED_FILE_DEFAULT_MAX_BUFSIZE;
+
+	chunk_size = (chunk_size + CHUNK_ALIGNMENT - 1) &
+		~(size_t)(CHUNK_ALIGNMENT - 1);
+
+	bf = bzalloc(sizeof(*bf));
+#ifndef _WIN32
+	bf->fd = -1;
+#endif
+	bf->chunk_size = chunk_size;
+	bf->max_chunks = max_bufsize / chunk_size;
+	if (bf->max_chunks < 2)
+		bf->max_chunks = 2;
+
+	if (pthread_mutex_init(&bf->mutex, NULL) != 0) {
+		bfree(bf);
+		return false;
+	}
+	if (os_sem_init(&bf->write_sem, 0) != 0)
+		goto fail;
+	if (os_event_init(&bf->done_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+	if (!open_file(bf, path, direct_io))
+		goto fail;
+	if (pthread_create(&bf->thread, NULL, write_thread, bf) != 0)
+		goto fail;
+
+	bf->thread_active = true;
+
+	s->data    = bf;
+	s->read    = NULL;
+	s->write   = buffered_file_write;
+	s->seek    = buffered_file_seek;
+	s->get_pos = buffered_file_get_pos;
+	return true;
+
+fail:
+	buffered_file_destroy(bf);
+	return false;
+}
+
+bool buffered_file_serializer_free(struct serializer *s)
+{
+	struct buffered_file *bf = s->data;
+	bool success;
+
+	if (!bf)
+		return false;
+
+	flush_chunks(bf);
+
+	if (bf->sync != BUFFERED_FILE_SYNC_NONE &&
+	    !os_atomic_load_bool(&bf->failed) && !sync_file(bf)) {
+		blog(LOG_ERROR, "buffered file: sync failed");
+		os_atomic_set_bool(&bf->failed, true);
+	}
+
+	success = !os_atomic_load_bool(&bf->failed);
+
+	buffered_file_destroy(bf);
+	s->data = NULL;
+	return success;
+}
+
+bool buffered_file_serializer_failed(struct serializer *s)
+{
+	struct buffered_file *bf = s->data;
+	return bf ? os_atomic_load_bool(&bf->failed) : true;
+}
+
+void buffered_file_serializer_set_sync(struct serializer *s,
+		enum buffered_file_sync sync)
+{
+	struct buffered_file *bf = s->data;
+	if (!bf)
+		return;
+
+	pthread_mutex_lock(&bf->mutex);
+	bf->sync = sync;
+	pthread_mutex_unlock(&bf->mutex);
+}
+
+void buffered_file_serializer_get_stats(struct serializer *s,
+		struct buffered_file_stats *stats)
+{
+	struct buffered_file *bf = s->data;
+	if (!bf) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+
+	pthread_mutex_lock(&bf->mutex);
+	*stats = bf->stats;
+	pthread_mutex_unlock(&bf->mutex);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2019 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "serializer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *   File output serializer that copies written data in to large page aligned
+ * chunks, and writes full chunks to disk from a separate thread.  Writes only
+ * block if max_bufsize bytes are already waiting to be written.  Seeking
+ * waits for everything written so far to reach the disk.
+ *
+ *   If direct_io is set, the file is opened for unbuffered I/O where the
+ * platform supports it (O_DIRECT on linux, F_NOCACHE on mac), which is turned
+ * back off for the first unaligned write (after a seek, or the last partial
+ * chunk).
+ */
+
+#define BUFFERED_FILE_DEFAULT_CHUNK_SIZE  (1024 * 1024)
+#define BUFFERED_FILE_DEFAULT_MAX_BUFSIZE (32 * 1024 * 1024)
+
+EXPORT bool buffered_file_serializer_init(struct serializer *s,
+		const char *path, size_t chunk_size, size_t max_bufsize,
+		bool direct_io);
+
+/* flushes all remaining data and closes the file.  returns false if any
+ * write failed */
+EXPORT bool buffered_file_serializer_free(struct serializer *s);
+
+/* returns true if a write has failed (disk full for example) */
+EXPORT bool buffered_file_serializer_failed(struct serializer *s);
+
+enum buffered_file_sync {
+	BUFFERED_FILE_SYNC_NONE,        /* leave it to the OS (default) */
+	BUFFERED_FILE_SYNC_ON_CLOSE,    /* sync once when the file is closed */
+	BUFFERED_FILE_SYNC_EVERY_CHUNK, /* sync after every chunk written */
+};
+
+/* sets when written data is synced to the storage device.  syncing happens
+ * on the writer thread, except for the sync on close */
+EXPORT void buffered_file_serializer_set_sync(struct serializer *s,
+		enum buffered_file_sync sync);
+
+struct buffered_file_stats {
+	uint64_t chunks_written;
+	uint64_t bytes_written;
+	uint64_t total_write_ns; /* includes syncs */
+	uint64_t max_write_ns;
+
+	/* times the writing thread had to wait for a free chunk */
+	uint64_t stalls;
+	uint64_t total_stall_ns;
+};
+
+EXPORT void buffered_file_serializer_get_stats(struct serializer *s,
+		struct buffered_file_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "file-split.h"
+#include "platform.h"
+#include "bmem.h"
+
+void file_split_init(struct file_split *split, const char *first_path,
+		const char *format, int64_t max_time, uint64_t max_size)
+{
+	dstr_copy(&split->first_path, first_path);
+	dstr_copy(&split->format, format);
+	split->count = 1;
+	split->max_time = max_time;
+	split->max_size = max_size;
+	split->started = false;
+	split->start_time = 0;
+	split->start_bytes = 0;
+}
+
+void file_split_free(struct file_split *split)
+{
+	dstr_free(&split->first_path);
+	dstr_free(&split->format);
+}
+
+void file_split_start(struct file_split *split, int64_t time, uint64_t bytes)
+{
+	split->started = true;
+	split->start_time = time;
+	split->start_bytes = bytes;
+}
+
+bool file_split_due(const struct file_split *split, int64_t time,
+		uint64_t bytes)
+{
+	if (!split->started)
+		return false;
+
+	return (split->max_time &&
+	        time - split->start_time >= split->max_time)
+	    || (split->max_size &&
+	        bytes - split->start_bytes >= split->max_size);
+}
+
+void file_split_next_path(struct file_split *split, struct dstr *dst)
+{
+	const char *first = split->first_path.array;
+	const char *slash;
+	const char *bslash;
+	const char *name;
+	const char *ext;
+	struct dstr base = {0};
+
+	if (!first)
+		first = "";
+
+	slash = strrchr(first, '/');
+	bslash = strrchr(first, '\\');
+	if (bslash > slash)
+		slash = bslash;
+	name = slash ? slash + 1 : first;
+	ext = strrchr(name, '.');
+
+	split->count++;
+
+	if (!dstr_is_empty(&split->format)) {
+		struct dstr format = {0};
+		struct dstr num = {0};
+		char *filename;
+
+		dstr_printf(&num, "%d", split->count);
+		dstr_copy_dstr(&format, &split->format);
+		dstr_replace(&format, "%n", num.array);
+
+		filename = os_generate_formatted_filename(NULL, true,
+				format.array);
+		dstr_ncopy(&base, first, name - first);
+		dstr_cat(&base, filename);
+
+		bfree(filename);
+		dstr_free(&format);
+		dstr_free(&num);
+	} else {
+		dstr_ncopy(&base, first, ext ? (size_t)(ext - first) :
+				strlen(first));
+		dstr_catf(&base, " (%d)", split->count);
+	}
+
+	dstr_printf(dst, "%s%s", base.array, ext ? ext : "");
+	for (int i = 2; os_file_exists(dst->array); i++)
+		dstr_printf(dst, "%s (%d)%s", base.array, i, ext ? ext : "");
+
+	dstr_free(&base);
+}
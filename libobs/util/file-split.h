@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2019 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "c99defs.h"
+#include "dstr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *   Split state for file outputs that start a new file after a maximum time
+ * or size.  Times are in whatever unit the output uses for its timestamps,
+ * and byte counts are whatever counter the output keeps, as long as the same
+ * units are used for the limits and for the values passed in.
+ *
+ *   Files after the first are named from the split format if set, where %n
+ * is the file number and the usual date/time specifiers can be used.
+ * Otherwise the first file's name is used with " (n)" appended.  The
+ * directory and extension of the first file are always kept.
+ */
+
+struct file_split {
+	struct dstr first_path;
+	struct dstr format;
+	int         count;
+
+	int64_t     max_time;
+	uint64_t    max_size;
+
+	bool        started;
+	int64_t     start_time;
+	uint64_t    start_bytes;
+};
+
+/**
+ * (Re)initializes the split state for a new recording to first_path.  A
+ * max_time or max_size of 0 means there's no limit of that type, and a NULL
+ * or empty format uses the default naming.  The structure must be zeroed
+ * before the first call.
+ */
+EXPORT void file_split_init(struct file_split *split, const char *first_path,
+		const char *format, int64_t max_time, uint64_t max_size);
+EXPORT void file_split_free(struct file_split *split);
+
+/** Marks the time and byte count the current file's limits count from */
+EXPORT void file_split_start(struct file_split *split, int64_t time,
+		uint64_t bytes);
+
+/**
+ * Returns true if a limit has been reached since file_split_start.  Always
+ * false before the first file_split_start call.
+ */
+EXPORT bool file_split_due(const struct file_split *split, int64_t time,
+		uint64_t bytes);
+
+/**
+ * Increments the file number and generates the path of the next file.  If a
+ * file already exists at that path, " (2)", " (3)", etc. is appended until
+ * the path is unused.
+ */
+EXPORT void file_split_next_path(struct file_split *split, struct dstr *dst);
+
+#ifdef __cplusplus
+}
+#endif
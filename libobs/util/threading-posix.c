@@ -262,3 +262,49 @@ void os_set_thread_name(const char *name)
 	}
 #endif
 }
+
+#if defined(__GLIBC__) && !defined(__MINGW32__)
+uint64_t os_get_thread_affinity(void)
+{
+	uint64_t mask = 0;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		return 0;
+
+	for (int i = 0; i < 64; i++) {
+		if (CPU_ISSET(i, &set))
+			mask |= 1ULL << i;
+	}
+
+	return mask;
+}
+
+bool os_set_thread_affinity(uint64_t mask)
+{
+	cpu_set_t set;
+
+	if (!mask)
+		return false;
+
+	CPU_ZERO(&set);
+	for (int i = 0; i < 64; i++) {
+		if ((mask & (1ULL << i)) != 0)
+			CPU_SET(i, &set);
+	}
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#else
+uint64_t os_get_thread_affinity(void)
+{
+	return 0;
+}
+
+bool os_set_thread_affinity(uint64_t mask)
+{
+	UNUSED_PARAMETER(mask);
+	return false;
+}
+#endif
@@ -189,3 +189,30 @@ void os_set_thread_name(const char *name)
 	}
 #endif
 }
+
+uint64_t os_get_thread_affinity(void)
+{
+	DWORD_PTR process_mask, system_mask, mask;
+	HANDLE thread = GetCurrentThread();
+
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask,
+				&system_mask))
+		return 0;
+
+	/* there's no way to query a thread's affinity directly, so swap it
+	 * out and back in */
+	mask = SetThreadAffinityMask(thread, process_mask);
+	if (!mask)
+		return 0;
+
+	SetThreadAffinityMask(thread, mask);
+	return (uint64_t)mask;
+}
+
+bool os_set_thread_affinity(uint64_t mask)
+{
+	if (!mask)
+		return false;
+
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+}
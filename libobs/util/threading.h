@@ -78,6 +78,12 @@ EXPORT int  os_sem_wait(os_sem_t *sem);
 
 EXPORT void os_set_thread_name(const char *name);
 
+/* affinity masks cover the first 64 logical cores.  getting the affinity
+ * returns 0 and setting it fails if not supported on this platform.
+ * threads created by the calling thread inherit its affinity */
+EXPORT uint64_t os_get_thread_affinity(void);
+EXPORT bool     os_set_thread_affinity(uint64_t mask);
+
 #ifdef _MSC_VER
 #define THREAD_LOCAL __declspec(thread)
 #else
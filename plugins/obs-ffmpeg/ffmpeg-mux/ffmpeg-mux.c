@@ -22,9 +22,19 @@
 
 #endif
 
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define USE_RING
+#endif
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ffmpeg-mux.h"
 
 #include <libavformat/avformat.h>
@@ -95,6 +105,16 @@ struct header {
 	int size;
 };
 
+struct ring {
+	struct ffm_ring_header *header;
+	uint8_t                *data;
+	size_t                 map_size;
+	uint64_t               read_pos;
+	int                    data_event;
+	int                    space_event;
+	bool                   eof;
+};
+
 struct ffmpeg_mux {
 	AVFormatContext        *output;
 	AVStream               *video_stream;
@@ -104,6 +124,8 @@ struct ffmpeg_mux {
 	struct header          video_header;
 	struct header          *audio_header;
 	int                    num_audio_streams;
+	struct ring            ring;
+	bool                   use_ring;
 	bool                   initialized;
 	char error[4096];
 };
@@ -132,6 +154,8 @@ static void free_avformat(struct ffmpeg_mux *ffm)
 	ffm->num_audio_streams = 0;
 }
 
+static void ring_free(struct ring *ring);
+
 static void ffmpeg_mux_free(struct ffmpeg_mux *ffm)
 {
 	if (ffm->initialized) {
@@ -140,6 +164,9 @@ static void ffmpeg_mux_free(struct ffmpeg_mux *ffm)
 
 	free_avformat(ffm);
 
+	if (ffm->use_ring)
+		ring_free(&ffm->ring);
+
 	header_free(&ffm->video_header);
 
 	if (ffm->audio_header) {
@@ -402,6 +429,143 @@ static void ffmpeg_mux_header(struct ffmpeg_mux *ffm, uint8_t *data,
 	}
 }
 
+/* ------------------------------------------------------------------------- */
+
+#ifdef USE_RING
+static bool ring_init(struct ffmpeg_mux *ffm, int *argc, char ***argv)
+{
+	struct ring *ring = &ffm->ring;
+	struct stat st;
+	int fd;
+	void *map;
+
+	if (!get_opt_int(argc, argv, &fd, "ring fd"))
+		return false;
+	if (!get_opt_int(argc, argv, &ring->data_event, "ring data eventfd"))
+		return false;
+	if (!get_opt_int(argc, argv, &ring->space_event, "ring space eventfd"))
+		return false;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		puts("Invalid ring file descriptor\n");
+		return false;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		puts("Couldn't map ring\n");
+		return false;
+	}
+
+	ring->header = map;
+	ring->map_size = (size_t)st.st_size;
+
+	if (ring->header->magic != FFM_RING_MAGIC ||
+	    ring->header->data_offset + ring->header->size > ring->map_size) {
+		puts("Invalid ring header\n");
+		ring_free(ring);
+		return false;
+	}
+
+	ring->data = (uint8_t*)map + ring->header->data_offset;
+	ring->read_pos = __atomic_load_n(&ring->header->read_pos,
+			__ATOMIC_ACQUIRE);
+	ffm->use_ring = true;
+	return true;
+}
+
+static void ring_free(struct ring *ring)
+{
+	if (ring->header)
+		munmap(ring->header, ring->map_size);
+	memset(ring, 0, sizeof(*ring));
+}
+
+static void ring_wait(struct ring *ring)
+{
+	struct ffm_ring_header *header = ring->header;
+	struct pollfd fds[2] = {
+		{.fd = ring->data_event, .events = POLLIN},
+		{.fd = STDIN_FILENO,     .events = POLLIN}
+	};
+
+	__atomic_store_n(&header->reader_waiting, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&header->write_pos, __ATOMIC_SEQ_CST) ==
+			ring->read_pos) {
+		if (poll(fds, 2, -1) < 0 && errno != EINTR)
+			ring->eof = true;
+	}
+
+	__atomic_store_n(&header->reader_waiting, 0, __ATOMIC_SEQ_CST);
+
+	if (fds[0].revents & POLLIN) {
+		uint64_t val;
+		if (read(ring->data_event, &val, sizeof(val)) < 0)
+			ring->eof = errno != EAGAIN && errno != EINTR;
+	}
+
+	/* obs never writes to stdin while using the ring, it only closes it
+	 * when done */
+	if (fds[1].revents)
+		ring->eof = true;
+}
+
+static void ring_advance(struct ring *ring, uint64_t size)
+{
+	struct ffm_ring_header *header = ring->header;
+	uint64_t one = 1;
+
+	ring->read_pos += size;
+	__atomic_store_n(&header->read_pos, ring->read_pos, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&header->writer_waiting, __ATOMIC_SEQ_CST)) {
+		if (write(ring->space_event, &one, sizeof(one)) < 0)
+			puts("Failed to signal ring space\n");
+	}
+}
+
+static bool ring_read(struct ring *ring, struct ffm_packet_info *info,
+		uint8_t **data)
+{
+	struct ffm_ring_header *header = ring->header;
+
+	for (;;) {
+		uint64_t write_pos = __atomic_load_n(&header->write_pos,
+				__ATOMIC_ACQUIRE);
+
+		if (write_pos != ring->read_pos) {
+			uint64_t pos = ring->read_pos % header->size;
+
+			memcpy(info, ring->data + pos, sizeof(*info));
+
+			if (info->type == FFM_PACKET_WRAP) {
+				ring_advance(ring, header->size - pos);
+				continue;
+			}
+
+			*data = ring->data + pos + sizeof(*info);
+			return true;
+		}
+
+		/* drain everything that was written before obs closed the
+		 * pipe before stopping */
+		if (ring->eof)
+			return false;
+
+		ring_wait(ring);
+	}
+}
+#else
+static void ring_free(struct ring *ring)
+{
+	(void)ring;
+}
+#endif
+
 static size_t safe_read(void *vdata, size_t size)
 {
 	uint8_t *data = vdata;
@@ -419,23 +583,51 @@ static size_t safe_read(void *vdata, size_t size)
 	return total;
 }
 
+/* packet data returned by read_packet is valid until release_packet */
+static bool read_packet(struct ffmpeg_mux *ffm, struct resize_buf *rb,
+		struct ffm_packet_info *info, uint8_t **data)
+{
+#ifdef USE_RING
+	if (ffm->use_ring)
+		return ring_read(&ffm->ring, info, data);
+#else
+	(void)ffm;
+#endif
+
+	if (safe_read(info, sizeof(*info)) != sizeof(*info))
+		return false;
+
+	resize_buf_resize(rb, info->size);
+	*data = rb->buf;
+
+	return safe_read(rb->buf, info->size) == info->size;
+}
+
+static inline void release_packet(struct ffmpeg_mux *ffm,
+		struct ffm_packet_info *info)
+{
+#ifdef USE_RING
+	if (ffm->use_ring)
+		ring_advance(&ffm->ring, ffm_ring_record_size(info->size));
+#else
+	(void)ffm;
+	(void)info;
+#endif
+}
+
 static bool ffmpeg_mux_get_header(struct ffmpeg_mux *ffm)
 {
 	struct ffm_packet_info info = {0};
+	struct resize_buf rb = {0};
+	uint8_t *data;
 
-	bool success = safe_read(&info, sizeof(info)) == sizeof(info);
+	bool success = read_packet(ffm, &rb, &info, &data);
 	if (success) {
-		uint8_t *data = malloc(info.size);
-
-		if (safe_read(data, info.size) == info.size) {
-			ffmpeg_mux_header(ffm, data, &info);
-		} else {
-			success = false;
-		}
-
-		free(data);
+		ffmpeg_mux_header(ffm, data, &info);
+		release_packet(ffm, &info);
 	}
 
+	resize_buf_free(&rb);
 	return success;
 }
 
@@ -556,6 +748,16 @@ static int ffmpeg_mux_init_internal(struct ffmpeg_mux *ffm, int argc,
 {
 	argc--;
 	argv++;
+
+#ifdef USE_RING
+	if (argc && strcmp(argv[0], "--ring") == 0) {
+		argc--;
+		argv++;
+		if (!ring_init(ffm, &argc, &argv))
+			return FFM_ERROR;
+	}
+#endif
+
 	if (!init_params(&argc, &argv, &ffm->params, &ffm->audio))
 		return FFM_ERROR;
 
@@ -652,7 +854,7 @@ int main(int argc, char *argv[])
 	struct ffm_packet_info info = {0};
 	struct ffmpeg_mux ffm = {0};
 	struct resize_buf rb = {0};
-	bool fail = false;
+	uint8_t *data;
 	int ret;
 
 #ifdef _WIN32
@@ -683,14 +885,9 @@ int main(int argc, char *argv[])
 		return ret;
 	}
 
-	while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
-		resize_buf_resize(&rb, info.size);
-
-		if (safe_read(rb.buf, info.size) == info.size) {
-			ffmpeg_mux_packet(&ffm, rb.buf, &info);
-		} else {
-			fail = true;
-		}
+	while (read_packet(&ffm, &rb, &info, &data)) {
+		ffmpeg_mux_packet(&ffm, data, &info);
+		release_packet(&ffm, &info);
 	}
 
 	ffmpeg_mux_free(&ffm);
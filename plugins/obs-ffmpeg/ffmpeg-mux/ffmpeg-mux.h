@@ -20,7 +20,8 @@
 
 enum ffm_packet_type {
 	FFM_PACKET_VIDEO,
-	FFM_PACKET_AUDIO
+	FFM_PACKET_AUDIO,
+	FFM_PACKET_WRAP
 };
 
 #define FFM_SUCCESS      0
@@ -35,3 +36,44 @@ struct ffm_packet_info {
 	enum ffm_packet_type type;
 	bool                 keyframe;
 };
+
+/* ------------------------------------------------------------------------- */
+/* Shared memory packet ring
+ *
+ *   On linux, packets can be passed to ffmpeg-mux through a shared memory
+ * ring instead of through the stdin pipe, with the ring's file descriptor
+ * and two eventfd descriptors passed on the command line:
+ *
+ *   ffmpeg-mux --ring <ring fd> <data eventfd> <space eventfd> ...
+ *
+ *   Each record is an ffm_packet_info structure directly followed by the
+ * packet data, padded to FFM_RING_ALIGN bytes.  Records never wrap around
+ * the end of the ring: if a record doesn't fit, the writer stores a record
+ * of type FFM_PACKET_WRAP and continues at the start of the ring.
+ *
+ *   Positions are byte counts that only ever increase; write_pos is only
+ * written by obs, and read_pos is only written by ffmpeg-mux.  Eventfds are
+ * only signaled if the other side has set its waiting flag, so there are no
+ * system calls per packet unless one side is waiting on the other.  The
+ * ring ends when obs closes the stdin pipe. */
+
+#define FFM_RING_MAGIC 0x474e4952 /* "RING" */
+#define FFM_RING_ALIGN 64
+
+struct ffm_ring_header {
+	uint32_t          magic;
+	uint32_t          data_offset;
+	uint64_t          size;
+
+	volatile uint64_t write_pos;
+	volatile uint64_t read_pos;
+	volatile uint32_t writer_waiting;
+	volatile uint32_t reader_waiting;
+};
+
+static inline uint64_t ffm_ring_record_size(uint32_t size)
+{
+	uint64_t rec_size = sizeof(struct ffm_packet_info) + (uint64_t)size;
+	return (rec_size + FFM_RING_ALIGN - 1) &
+		~(uint64_t)(FFM_RING_ALIGN - 1);
+}
@@ -0,0 +1,1021 @@
+/******************************************************************************
+    Copyright (C) 2019 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <obs-module.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/darray.h>
+#include <util/buffered-file-serializer.h>
+#include <util/file-split.h>
+
+#include <libavformat/avformat.h>
+#include "obs-ffmpeg-compat.h"
+
+/* muxes encoded packets in to a file from within the OBS process rather than
+ * piping them to the ffmpeg-mux helper.  packet data is handed to libavformat
+ * without being copied (the AVIO context is in direct mode, so payloads go
+ * straight to the write callback), and the write callback copies it in to
+ * the large aligned chunks of a buffered file serializer, which writes them
+ * to disk from its own thread.  each byte is copied once on its way to
+ * disk, and no file I/O happens on the encoder threads unless the muxer
+ * seeks (mp4/mkv only do that when finishing the file)
+ *
+ * the same code also implements the CMAF output, which uses libavformat's
+ * dash muxer to write fragmented mp4 chunks along with DASH and HLS
+ * playlists in to a directory, for a local web server to serve.  the dash
+ * muxer opens its own files, so no buffered writer is used there
+ *
+ * recordings can be split in to several files without restarting the
+ * encoders.  each file has its own libavformat context and buffered writer,
+ * and the trailer of the previous file is written on its own thread */
+
+#define do_log(level, format, ...) \
+	blog(level, "[ffmpeg in-process muxer: '%s'] " format, \
+			obs_output_get_name(stream->output), ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
+
+#define IO_BUFFER_SIZE 65536
+
+struct inproc_muxer;
+
+/* a file being written.  bytes is only touched by whichever thread is
+ * writing the file: the data thread, or the closing thread once the file has
+ * been split off */
+struct mux_file {
+	struct inproc_muxer *stream;
+	struct dstr       path;
+	uint64_t          bytes;
+	bool              sent_headers;
+
+	struct serializer file;
+	bool              file_open;
+
+	AVFormatContext   *fmt;
+	AVIOContext       *io;
+	AVStream          *video_stream;
+	AVStream          *audio_streams[MAX_AUDIO_MIXES];
+	size_t            num_audio_streams;
+
+	pthread_t         thread;
+	volatile bool     done;
+};
+
+struct inproc_muxer {
+	obs_output_t      *output;
+	int64_t           stop_ts;
+	uint64_t          total_bytes;
+	uint64_t          done_bytes;
+	bool              cmaf;
+	volatile bool     active;
+	volatile bool     stopping;
+	volatile bool     capturing;
+
+	bool              direct_io;
+	size_t            buffer_size;
+	struct mux_file   *mux;
+
+	AVRational        video_time_base;
+	AVRational        audio_time_bases[MAX_AUDIO_MIXES];
+
+	/* file splitting.  a new file is started at the first keyframe past
+	 * the split limits, and the previous one is finished on its own
+	 * thread */
+	struct file_split split;
+	int64_t           file_start_ts;
+	bool              offset_ts;
+	int64_t           video_dts_offset;
+	DARRAY(struct mux_file*) closing;
+};
+
+static const char *inproc_mux_getname(void *type)
+{
+	UNUSED_PARAMETER(type);
+	return obs_module_text("FFmpegInprocMuxer");
+}
+
+static const char *cmaf_output_getname(void *type)
+{
+	UNUSED_PARAMETER(type);
+	return obs_module_text("FFmpegCmafOutput");
+}
+
+static inline bool capturing(struct inproc_muxer *stream)
+{
+	return os_atomic_load_bool(&stream->capturing);
+}
+
+static inline bool stopping(struct inproc_muxer *stream)
+{
+	return os_atomic_load_bool(&stream->stopping);
+}
+
+static inline bool active(struct inproc_muxer *stream)
+{
+	return os_atomic_load_bool(&stream->active);
+}
+
+/* ------------------------------------------------------------------------ */
+/* AVIO callbacks */
+
+static int io_write(void *opaque, uint8_t *buf, int size)
+{
+	struct mux_file *mf = opaque;
+	size_t ret = s_write(&mf->file, buf, (size_t)size);
+
+	if (ret != (size_t)size)
+		return AVERROR(EIO);
+
+	mf->bytes += (uint64_t)size;
+	return size;
+}
+
+static int64_t io_seek(void *opaque, int64_t offset, int whence)
+{
+	struct mux_file *mf = opaque;
+	enum serialize_seek_type type;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case SEEK_SET: type = SERIALIZE_SEEK_START; break;
+	case SEEK_CUR: type = SERIALIZE_SEEK_CURRENT; break;
+	case SEEK_END: type = SERIALIZE_SEEK_END; break;
+	default:       return -1;
+	}
+
+	return serializer_seek(&mf->file, offset, type);
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void free_avformat(struct mux_file *mf)
+{
+	if (mf->fmt) {
+		for (unsigned i = 0; i < mf->fmt->nb_streams; i++)
+			av_freep(&mf->fmt->streams[i]->codec->extradata);
+
+		avformat_free_context(mf->fmt);
+		mf->fmt = NULL;
+	}
+
+	if (mf->io) {
+		av_freep(&mf->io->buffer);
+		av_freep(&mf->io);
+	}
+
+	mf->video_stream = NULL;
+	mf->num_audio_streams = 0;
+	memset(mf->audio_streams, 0, sizeof(mf->audio_streams));
+}
+
+static bool close_file(struct mux_file *mf)
+{
+	bool success = true;
+
+	if (mf->file_open) {
+		success = buffered_file_serializer_free(&mf->file);
+		mf->file_open = false;
+	}
+
+	return success;
+}
+
+/* the CMAF output's dash muxer opens its own files */
+static struct mux_file *mux_file_create(struct inproc_muxer *stream,
+		const char *path)
+{
+	struct mux_file *mf = bzalloc(sizeof(*mf));
+	mf->stream = stream;
+	dstr_copy(&mf->path, path);
+
+	if (!stream->cmaf) {
+		mf->file_open = buffered_file_serializer_init(&mf->file, path,
+				0, stream->buffer_size, stream->direct_io);
+		if (!mf->file_open) {
+			dstr_free(&mf->path);
+			bfree(mf);
+			return NULL;
+		}
+	}
+
+	return mf;
+}
+
+static void mux_file_destroy(struct mux_file *mf)
+{
+	if (mf) {
+		free_avformat(mf);
+		close_file(mf);
+		dstr_free(&mf->path);
+		bfree(mf);
+	}
+}
+
+/* writes the trailer and closes the file, which can take a while for large
+ * files as it waits for the buffered writer to get everything to disk */
+static bool finish_file(struct inproc_muxer *stream, struct mux_file *mf)
+{
+	bool success = true;
+
+	if (mf->fmt && mf->sent_headers) {
+		int ret = av_write_trailer(mf->fmt);
+		if (ret < 0) {
+			warn("Failed to write trailer of '%s': %s",
+					mf->path.array, av_err2str(ret));
+			success = false;
+		}
+	}
+
+	free_avformat(mf);
+	if (!close_file(mf))
+		success = false;
+
+	mf->sent_headers = false;
+	return success;
+}
+
+static void reap_closing_files(struct inproc_muxer *stream, bool wait);
+
+static void inproc_mux_destroy(void *data)
+{
+	struct inproc_muxer *stream = data;
+
+	mux_file_destroy(stream->mux);
+	reap_closing_files(stream, true);
+	da_free(stream->closing);
+	file_split_free(&stream->split);
+	bfree(stream);
+}
+
+static void *inproc_mux_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct inproc_muxer *stream = bzalloc(sizeof(*stream));
+	stream->output = output;
+
+	UNUSED_PARAMETER(settings);
+	return stream;
+}
+
+static void *cmaf_output_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct inproc_muxer *stream = inproc_mux_create(settings, output);
+	stream->cmaf = true;
+	return stream;
+}
+
+static AVStream *new_stream(struct inproc_muxer *stream, struct mux_file *mf,
+		obs_encoder_t *encoder)
+{
+	const char *codec = obs_encoder_get_codec(encoder);
+	const AVCodecDescriptor *desc = avcodec_descriptor_get_by_name(codec);
+	AVStream *st;
+
+	if (!desc) {
+		warn("Couldn't find codec '%s'", codec);
+		return NULL;
+	}
+
+	st = avformat_new_stream(mf->fmt, NULL);
+	if (!st) {
+		warn("Couldn't create stream for codec '%s'", codec);
+		return NULL;
+	}
+
+	st->id = mf->fmt->nb_streams - 1;
+	st->codec->codec_type = desc->type;
+	st->codec->codec_id   = desc->id;
+
+	if (mf->fmt->oformat->flags & AVFMT_GLOBALHEADER)
+		st->codec->flags |= CODEC_FLAG_GLOBAL_H;
+
+	return st;
+}
+
+static void set_extradata(AVCodecContext *context, obs_encoder_t *encoder)
+{
+	uint8_t *extra_data;
+	size_t size;
+
+	if (!obs_encoder_get_extra_data(encoder, &extra_data, &size) || !size)
+		return;
+
+	context->extradata = av_mallocz(size + INPUT_BUFFER_PADDING_SIZE);
+	if (context->extradata) {
+		memcpy(context->extradata, extra_data, size);
+		context->extradata_size = (int)size;
+	}
+}
+
+static bool create_video_stream(struct inproc_muxer *stream,
+		struct mux_file *mf, obs_encoder_t *vencoder)
+{
+	video_t *video = obs_encoder_video(vencoder);
+	const struct video_output_info *voi = video_output_get_info(video);
+	obs_data_t *settings = obs_encoder_get_settings(vencoder);
+	AVCodecContext *context;
+
+	mf->video_stream = new_stream(stream, mf, vencoder);
+	if (!mf->video_stream) {
+		obs_data_release(settings);
+		return false;
+	}
+
+	stream->video_time_base = (AVRational){(int)voi->fps_den,
+		(int)voi->fps_num};
+
+	context               = mf->video_stream->codec;
+	context->bit_rate     = obs_data_get_int(settings, "bitrate") * 1000;
+	context->width        = obs_encoder_get_width(vencoder);
+	context->height       = obs_encoder_get_height(vencoder);
+	context->coded_width  = context->width;
+	context->coded_height = context->height;
+	context->time_base    = stream->video_time_base;
+	set_extradata(context, vencoder);
+
+	mf->video_stream->time_base = context->time_base;
+	mf->video_stream->avg_frame_rate = av_inv_q(context->time_base);
+
+	obs_data_release(settings);
+	return true;
+}
+
+static bool create_audio_stream(struct inproc_muxer *stream,
+		struct mux_file *mf, obs_encoder_t *aencoder, size_t idx)
+{
+	audio_t *audio = obs_encoder_audio(aencoder);
+	obs_data_t *settings = obs_encoder_get_settings(aencoder);
+	uint32_t sample_rate = obs_encoder_get_sample_rate(aencoder);
+	AVCodecContext *context;
+	AVStream *st;
+
+	st = new_stream(stream, mf, aencoder);
+	if (!st) {
+		obs_data_release(settings);
+		return false;
+	}
+
+	av_dict_set(&st->metadata, "title", obs_encoder_get_name(aencoder), 0);
+
+	stream->audio_time_bases[idx] = (AVRational){1, (int)sample_rate};
+
+	context                 = st->codec;
+	context->bit_rate       = obs_data_get_int(settings, "bitrate") * 1000;
+	context->channels       = (int)audio_output_get_channels(audio);
+	context->sample_rate    = (int)sample_rate;
+	context->sample_fmt     = AV_SAMPLE_FMT_S16;
+	context->time_base      = stream->audio_time_bases[idx];
+	context->channel_layout =
+		av_get_default_channel_layout(context->channels);
+	if (context->channels == 4)
+		context->channel_layout = av_get_channel_layout("quad");
+	if (context->channels == 5)
+		context->channel_layout = av_get_channel_layout("4.1");
+	set_extradata(context, aencoder);
+
+	st->time_base = context->time_base;
+
+	mf->audio_streams[idx] = st;
+	mf->num_audio_streams = idx + 1;
+
+	obs_data_release(settings);
+	return true;
+}
+
+static inline void dict_set_int(AVDictionary **dict, const char *key,
+		int64_t val)
+{
+	struct dstr str = {0};
+	dstr_printf(&str, "%lld", (long long)val);
+	av_dict_set(dict, key, str.array, 0);
+	dstr_free(&str);
+}
+
+/* segments are cut at the first keyframe after segment_duration_ms.  with
+ * low latency on, segments are written as they're produced in chunks (one
+ * moof/mdat pair per part_duration_ms, or per frame on libavformat versions
+ * without fragment duration support), and the playlists announce the
+ * segment before it's complete (LL-DASH, LHLS).  producer reference times
+ * are written so the latency to a player can be measured */
+static void get_cmaf_settings(obs_data_t *settings, AVDictionary **dict)
+{
+	int64_t seg_ms = obs_data_get_int(settings, "segment_duration_ms");
+	int64_t part_ms = obs_data_get_int(settings, "part_duration_ms");
+	int64_t window = obs_data_get_int(settings, "window_size");
+	bool low_latency = obs_data_get_bool(settings, "low_latency");
+
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 20, 100)
+	dict_set_int(dict, "seg_duration", seg_ms * 1000);
+	av_dict_set(dict, "hls_playlist", "1", 0);
+#else
+	dict_set_int(dict, "min_seg_duration", seg_ms * 1000);
+#endif
+	dict_set_int(dict, "window_size", window);
+	dict_set_int(dict, "extra_window_size", window);
+	av_dict_set(dict, "use_template", "1", 0);
+	av_dict_set(dict, "use_timeline", "1", 0);
+
+	if (!low_latency)
+		return;
+
+	av_dict_set(dict, "streaming", "1", 0);
+
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 45, 100)
+	av_dict_set(dict, "ldash", "1", 0);
+	av_dict_set(dict, "lhls", "1", 0);
+	av_dict_set(dict, "write_prft", "1", 0);
+	if (part_ms) {
+		av_dict_set(dict, "frag_type", "duration", 0);
+		dict_set_int(dict, "frag_duration", part_ms * 1000);
+	} else {
+		av_dict_set(dict, "frag_type", "every_frame", 0);
+	}
+#else
+	UNUSED_PARAMETER(part_ms);
+#endif
+}
+
+/* faststart rewrites the file by reopening it by name, which would read the
+ * file behind the back of the buffered writer */
+static void get_muxer_settings(struct inproc_muxer *stream, AVDictionary **dict)
+{
+	obs_data_t *settings = obs_output_get_settings(stream->output);
+	const char *mux = obs_data_get_string(settings, "muxer_settings");
+	AVDictionaryEntry *entry = NULL;
+	int ret;
+
+	if (stream->cmaf)
+		get_cmaf_settings(settings, dict);
+
+	if (mux && *mux) {
+		ret = av_dict_parse_string(dict, mux, "=", " ", 0);
+		if (ret < 0)
+			warn("Failed to parse muxer settings: %s\n%s",
+					av_err2str(ret), mux);
+	}
+
+	entry = av_dict_get(*dict, "movflags", NULL, 0);
+	if (entry && strstr(entry->value, "faststart")) {
+		warn("movflags=faststart is not supported, ignoring");
+		av_dict_set(dict, "movflags", NULL, 0);
+	}
+
+	if (av_dict_count(*dict) > 0) {
+		struct dstr str = {0};
+
+		entry = NULL;
+		while ((entry = av_dict_get(*dict, "", entry,
+						AV_DICT_IGNORE_SUFFIX)))
+			dstr_catf(&str, "\n\t%s=%s", entry->key, entry->value);
+
+		info("Using muxer settings:%s", str.array);
+		dstr_free(&str);
+	}
+
+	obs_data_release(settings);
+}
+
+static int write_header(struct inproc_muxer *stream, struct mux_file *mf)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	AVOutputFormat *format;
+	AVDictionary *dict = NULL;
+	uint8_t *io_buffer;
+	int ret;
+
+	format = stream->cmaf ? av_guess_format("dash", NULL, NULL) :
+		av_guess_format(NULL, mf->path.array, NULL);
+	if (!format) {
+		warn("Couldn't find an appropriate muxer for '%s'",
+				mf->path.array);
+		return OBS_OUTPUT_ERROR;
+	}
+
+	ret = avformat_alloc_output_context2(&mf->fmt, format, NULL,
+			mf->path.array);
+	if (ret < 0) {
+		warn("Couldn't initialize output context: %s",
+				av_err2str(ret));
+		return OBS_OUTPUT_ERROR;
+	}
+
+	if (vencoder && !create_video_stream(stream, mf, vencoder))
+		return OBS_OUTPUT_UNSUPPORTED;
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		obs_encoder_t *aencoder = obs_output_get_audio_encoder(
+				stream->output, i);
+		if (!aencoder)
+			break;
+		if (!create_audio_stream(stream, mf, aencoder, i))
+			return OBS_OUTPUT_UNSUPPORTED;
+	}
+
+	if (!(format->flags & AVFMT_NOFILE)) {
+		io_buffer = av_malloc(IO_BUFFER_SIZE);
+		mf->io = avio_alloc_context(io_buffer, IO_BUFFER_SIZE, 1,
+				mf, NULL, io_write, io_seek);
+		if (!mf->io) {
+			av_free(io_buffer);
+			return OBS_OUTPUT_ERROR;
+		}
+
+		/* large writes (packet payloads) skip the AVIO buffer */
+		mf->io->direct = 1;
+
+		mf->fmt->pb = mf->io;
+		mf->fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+
+	get_muxer_settings(stream, &dict);
+
+	ret = avformat_write_header(mf->fmt, &dict);
+
+	/* options left in the dictionary weren't recognized by the muxer */
+	if (av_dict_count(dict) > 0) {
+		AVDictionaryEntry *entry = NULL;
+		while ((entry = av_dict_get(dict, "", entry,
+						AV_DICT_IGNORE_SUFFIX)))
+			warn("Muxer option '%s' not supported", entry->key);
+	}
+	av_dict_free(&dict);
+
+	if (ret < 0) {
+		warn("Error opening '%s': %s", mf->path.array,
+				av_err2str(ret));
+		return ret == AVERROR(EINVAL) ?
+			OBS_OUTPUT_UNSUPPORTED : OBS_OUTPUT_ERROR;
+	}
+
+	return OBS_OUTPUT_SUCCESS;
+}
+
+/* the playlists and chunks are all written in to the output directory */
+static bool cmaf_output_start(struct inproc_muxer *stream, struct dstr *path)
+{
+	obs_data_t *settings = obs_output_get_settings(stream->output);
+	const char *dir = obs_data_get_string(settings, "directory");
+	const char *name = obs_data_get_string(settings, "name");
+	bool success;
+
+	dstr_copy(path, dir);
+	dstr_replace(path, "\\", "/");
+	if (dstr_end(path) != '/')
+		dstr_cat_ch(path, '/');
+
+	success = os_mkdirs(path->array) != MKDIR_ERROR;
+
+	dstr_catf(path, "%s.mpd", *name ? name : "stream");
+	obs_data_release(settings);
+	return success;
+}
+
+/* the dash muxer segments the CMAF output by itself, so it's never split */
+static void get_file_settings(struct inproc_muxer *stream, struct dstr *path)
+{
+	obs_data_t *settings = obs_output_get_settings(stream->output);
+
+	dstr_copy(path, obs_data_get_string(settings, "path"));
+	stream->direct_io = obs_data_get_bool(settings, "direct_io");
+	stream->buffer_size = (size_t)obs_data_get_int(settings,
+			"buffer_size_mb") * 1024 * 1024;
+
+	file_split_init(&stream->split, path->array,
+			obs_data_get_string(settings, "split_format"),
+			obs_data_get_int(settings, "max_time_sec") * 1000000LL,
+			(uint64_t)obs_data_get_int(settings, "max_size_mb") *
+			(1024 * 1024));
+
+	obs_data_release(settings);
+}
+
+static bool inproc_mux_start(void *data)
+{
+	struct inproc_muxer *stream = data;
+	struct dstr path = {0};
+	bool success = true;
+
+	if (!obs_output_can_begin_data_capture(stream->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(stream->output, 0))
+		return false;
+
+	mux_file_destroy(stream->mux);
+	stream->mux = NULL;
+
+	file_split_init(&stream->split, NULL, NULL, 0, 0);
+	stream->offset_ts = false;
+
+	if (stream->cmaf)
+		success = cmaf_output_start(stream, &path);
+	else
+		get_file_settings(stream, &path);
+
+	if (success)
+		stream->mux = mux_file_create(stream, path.array);
+
+	if (!stream->mux) {
+		struct dstr error_message;
+		dstr_init_copy(&error_message,
+			obs_module_text("UnableToWritePath"));
+		dstr_replace(&error_message, "%1", path.array);
+		obs_output_set_last_error(stream->output,
+			error_message.array);
+		dstr_free(&error_message);
+		dstr_free(&path);
+		return false;
+	}
+
+	dstr_free(&path);
+
+	os_atomic_set_bool(&stream->active, true);
+	os_atomic_set_bool(&stream->capturing, true);
+	stream->total_bytes = 0;
+	stream->done_bytes = 0;
+	obs_output_begin_data_capture(stream->output, 0);
+
+	info("Writing file '%s'...", stream->mux->path.array);
+	return true;
+}
+
+static bool deactivate(struct inproc_muxer *stream)
+{
+	bool success = true;
+
+	if (active(stream)) {
+		success = finish_file(stream, stream->mux);
+		reap_closing_files(stream, true);
+		stream->total_bytes = stream->done_bytes + stream->mux->bytes;
+
+		os_atomic_set_bool(&stream->active, false);
+
+		info("Output of file '%s' stopped", stream->mux->path.array);
+	}
+
+	if (stopping(stream))
+		obs_output_end_data_capture(stream->output);
+
+	os_atomic_set_bool(&stream->stopping, false);
+	return success;
+}
+
+static void inproc_mux_stop(void *data, uint64_t ts)
+{
+	struct inproc_muxer *stream = data;
+
+	if (capturing(stream) || ts == 0) {
+		stream->stop_ts = (int64_t)ts / 1000LL;
+		os_atomic_set_bool(&stream->stopping, true);
+		os_atomic_set_bool(&stream->capturing, false);
+	}
+}
+
+static void signal_failure(struct inproc_muxer *stream, int code)
+{
+	deactivate(stream);
+	obs_output_signal_stop(stream->output, code);
+	os_atomic_set_bool(&stream->capturing, false);
+}
+
+static inline int64_t rescale_ts(int64_t val, AVRational time_base,
+		AVStream *st)
+{
+	return av_rescale_q_rnd(val / time_base.num, time_base, st->time_base,
+			AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+}
+
+static bool write_packet(struct inproc_muxer *stream, struct mux_file *mf,
+		struct encoder_packet *packet)
+{
+	AVRational time_base;
+	AVStream *st;
+	AVPacket pkt;
+	int ret;
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		st = mf->video_stream;
+		time_base = stream->video_time_base;
+	} else {
+		if (packet->track_idx >= mf->num_audio_streams)
+			return true;
+		st = mf->audio_streams[packet->track_idx];
+		time_base = stream->audio_time_bases[packet->track_idx];
+	}
+
+	if (!st)
+		return true;
+
+	av_init_packet(&pkt);
+
+	/* av_write_frame doesn't take a reference, so the packet data is
+	 * written out without being copied.  libobs already interleaves the
+	 * packets of encoded outputs */
+	pkt.data         = packet->data;
+	pkt.size         = (int)packet->size;
+	pkt.stream_index = st->index;
+	pkt.pts          = rescale_ts(packet->pts, time_base, st);
+	pkt.dts          = rescale_ts(packet->dts, time_base, st);
+
+	if (packet->keyframe)
+		pkt.flags = AV_PKT_FLAG_KEY;
+
+	ret = av_write_frame(mf->fmt, &pkt);
+	if (ret < 0) {
+		warn("Failed to write packet: %s", av_err2str(ret));
+		return false;
+	}
+
+	/* the dash muxer writes its own files, so bytes are counted here */
+	if (!mf->io)
+		mf->bytes += packet->size;
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------ */
+/* file splitting */
+
+static void *close_file_thread(void *data)
+{
+	struct mux_file *mf = data;
+	struct inproc_muxer *stream = mf->stream;
+
+	os_set_thread_name("inproc-mux: close file");
+
+	if (finish_file(stream, mf))
+		info("Finished file '%s'", mf->path.array);
+	else
+		warn("Failed to finish file '%s'", mf->path.array);
+
+	os_atomic_set_bool(&mf->done, true);
+	return NULL;
+}
+
+/* the bytes written by the trailer are counted once the closing thread has
+ * been joined, so total_bytes is only ever written by the data thread */
+static void reap_closing_files(struct inproc_muxer *stream, bool wait)
+{
+	for (size_t i = stream->closing.num; i > 0; i--) {
+		struct mux_file *mf = stream->closing.array[i - 1];
+
+		if (!wait && !os_atomic_load_bool(&mf->done))
+			continue;
+
+		pthread_join(mf->thread, NULL);
+		stream->done_bytes += mf->bytes;
+		mux_file_destroy(mf);
+		da_erase(stream->closing, i - 1);
+	}
+}
+
+static void close_file_async(struct inproc_muxer *stream, struct mux_file *mf)
+{
+	stream->done_bytes += mf->bytes;
+	mf->bytes = 0;
+
+	if (pthread_create(&mf->thread, NULL, close_file_thread, mf) != 0) {
+		close_file_thread(mf);
+		stream->done_bytes += mf->bytes;
+		mux_file_destroy(mf);
+		return;
+	}
+
+	da_push_back(stream->closing, &mf);
+}
+
+static inline bool split_due(struct inproc_muxer *stream,
+		struct encoder_packet *packet)
+{
+	if (packet->type != OBS_ENCODER_VIDEO || !packet->keyframe)
+		return false;
+
+	return file_split_due(&stream->split, packet->dts_usec,
+			stream->mux->bytes);
+}
+
+/* starts the next file with the keyframe packet.  the next file's header is
+ * written before the current file is handed off, so no packets are lost.  if
+ * it can't be created, the current file is kept */
+static void split_file(struct inproc_muxer *stream,
+		struct encoder_packet *packet)
+{
+	struct mux_file *next;
+	struct dstr path = {0};
+
+	file_split_next_path(&stream->split, &path);
+
+	next = mux_file_create(stream, path.array);
+	if (!next) {
+		warn("Unable to open file '%s', continuing to write '%s'",
+		     path.array, stream->mux->path.array);
+		goto fail;
+	}
+
+	if (write_header(stream, next) != OBS_OUTPUT_SUCCESS) {
+		warn("Could not write headers for file '%s', continuing to "
+		     "write '%s'", path.array, stream->mux->path.array);
+		mux_file_destroy(next);
+		os_unlink(path.array);
+		goto fail;
+	}
+
+	next->sent_headers = true;
+
+	reap_closing_files(stream, false);
+	close_file_async(stream, stream->mux);
+	stream->mux = next;
+
+	file_split_start(&stream->split, packet->dts_usec, 0);
+	stream->file_start_ts = packet->dts_usec;
+	stream->offset_ts = true;
+	stream->video_dts_offset = packet->dts;
+
+	dstr_free(&path);
+	info("Writing file '%s'...", stream->mux->path.array);
+	return;
+
+fail:
+	dstr_free(&path);
+	file_split_start(&stream->split, packet->dts_usec, stream->mux->bytes);
+}
+
+/* split files start their timestamps at the keyframe they start with.
+ * audio is offset by the same time, in its own time base */
+static inline void offset_split_packet(struct inproc_muxer *stream,
+		struct encoder_packet *packet)
+{
+	int64_t offset;
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		offset = stream->video_dts_offset;
+	} else {
+		offset = stream->file_start_ts * packet->timebase_den /
+			((int64_t)packet->timebase_num * 1000000LL);
+	}
+
+	packet->dts -= offset;
+	packet->pts -= offset;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void inproc_mux_data(void *data, struct encoder_packet *packet)
+{
+	struct inproc_muxer *stream = data;
+	struct mux_file *mf;
+	struct encoder_packet pkt;
+
+	if (!active(stream))
+		return;
+
+	if (stopping(stream)) {
+		if (packet->sys_dts_usec >= stream->stop_ts) {
+			deactivate(stream);
+			return;
+		}
+	}
+
+	/* encoders may not have their headers until they're running, so the
+	 * file header is written with the first packet */
+	if (!stream->mux->sent_headers) {
+		int code = write_header(stream, stream->mux);
+		if (code != OBS_OUTPUT_SUCCESS) {
+			signal_failure(stream, code);
+			return;
+		}
+
+		stream->mux->sent_headers = true;
+	}
+
+	if (split_due(stream, packet))
+		split_file(stream, packet);
+
+	if (!stream->split.started && packet->type == OBS_ENCODER_VIDEO)
+		file_split_start(&stream->split, packet->dts_usec, 0);
+
+	pkt = *packet;
+	if (stream->offset_ts)
+		offset_split_packet(stream, &pkt);
+
+	mf = stream->mux;
+	if (!write_packet(stream, mf, &pkt) || (mf->file_open &&
+	    buffered_file_serializer_failed(&mf->file))) {
+		signal_failure(stream, OBS_OUTPUT_ERROR);
+		return;
+	}
+
+	stream->total_bytes = stream->done_bytes + mf->bytes;
+}
+
+static void inproc_mux_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_bool(settings, "direct_io", false);
+	obs_data_set_default_int(settings, "buffer_size_mb", 32);
+}
+
+static obs_properties_t *inproc_mux_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_text(props, "path",
+			obs_module_text("FilePath"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_bool(props, "direct_io",
+			obs_module_text("DirectIO"));
+	obs_properties_add_int(props, "buffer_size_mb",
+			obs_module_text("WriteBufferSize"), 4, 1024, 1);
+	obs_properties_add_int(props, "max_time_sec",
+			obs_module_text("SplitTime"), 0, 24 * 3600, 60);
+	obs_properties_add_int(props, "max_size_mb",
+			obs_module_text("SplitSize"), 0, 1024 * 1024, 256);
+	obs_properties_add_text(props, "split_format",
+			obs_module_text("SplitFormat"),
+			OBS_TEXT_DEFAULT);
+	return props;
+}
+
+static void cmaf_output_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_string(settings, "name", "stream");
+	obs_data_set_default_int(settings, "segment_duration_ms", 2000);
+	obs_data_set_default_int(settings, "part_duration_ms", 500);
+	obs_data_set_default_int(settings, "window_size", 5);
+	obs_data_set_default_bool(settings, "low_latency", true);
+}
+
+static obs_properties_t *cmaf_output_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_path(props, "directory",
+			obs_module_text("OutputDirectory"),
+			OBS_PATH_DIRECTORY, NULL, NULL);
+	obs_properties_add_text(props, "name",
+			obs_module_text("PlaylistName"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, "segment_duration_ms",
+			obs_module_text("SegmentDuration"), 100, 60000, 100);
+	obs_properties_add_int(props, "part_duration_ms",
+			obs_module_text("PartDuration"), 0, 10000, 50);
+	obs_properties_add_int(props, "window_size",
+			obs_module_text("PlaylistWindow"), 1, 1000, 1);
+	obs_properties_add_bool(props, "low_latency",
+			obs_module_text("LowLatency"));
+	return props;
+}
+
+static uint64_t inproc_mux_total_bytes(void *data)
+{
+	struct inproc_muxer *stream = data;
+	return stream->total_bytes;
+}
+
+struct obs_output_info ffmpeg_inproc_muxer = {
+	.id             = "ffmpeg_inproc_muxer",
+	.flags          = OBS_OUTPUT_AV |
+	                  OBS_OUTPUT_ENCODED |
+	                  OBS_OUTPUT_MULTI_TRACK,
+	.get_name       = inproc_mux_getname,
+	.create         = inproc_mux_create,
+	.destroy        = inproc_mux_destroy,
+	.start          = inproc_mux_start,
+	.stop           = inproc_mux_stop,
+	.encoded_packet = inproc_mux_data,
+	.get_total_bytes= inproc_mux_total_bytes,
+	.get_defaults   = inproc_mux_defaults,
+	.get_properties = inproc_mux_properties
+};
+
+struct obs_output_info ffmpeg_cmaf_output = {
+	.id             = "ffmpeg_cmaf_output",
+	.flags          = OBS_OUTPUT_AV |
+	                  OBS_OUTPUT_ENCODED |
+	                  OBS_OUTPUT_MULTI_TRACK,
+	.get_name       = cmaf_output_getname,
+	.create         = cmaf_output_create,
+	.destroy        = inproc_mux_destroy,
+	.start          = inproc_mux_start,
+	.stop           = inproc_mux_stop,
+	.encoded_packet = inproc_mux_data,
+	.get_total_bytes= inproc_mux_total_bytes,
+	.get_defaults   = cmaf_output_defaults,
+	.get_properties = cmaf_output_properties
+};
@@ -15,6 +15,12 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+/* for pipe2 */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <inttypes.h>
 #include <obs-module.h>
 #include <obs-hotkey.h>
 #include <obs-avc.h>
@@ -24,12 +30,24 @@
 #include <util/platform.h>
 #include <util/circlebuf.h>
 #include <util/threading.h>
+#include <util/buffered-file-serializer.h>
+#include <util/file-split.h>
 #include "ffmpeg-mux/ffmpeg-mux.h"
 
 #ifdef _WIN32
 #include "util/windows/win-version.h"
 #endif
 
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#define USE_RING
+#endif
+
 #include <libavformat/avformat.h>
 
 #define do_log(level, format, ...) \
@@ -39,9 +57,91 @@
 #define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
 #define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
 
+#define RING_SIZE (64 * 1024 * 1024)
+
+/* replay buffer packets in memory are stored in reference counted blocks,
+ * so saves can hold on to the packets they write without copying them */
+#define PACKET_BLOCK_SIZE 256
+
+/* number of replay saves that can be written at the same time */
+#define MAX_SAVES 4
+
+/* replay buffer packets spilled to disk are stored in keyframe aligned
+ * segment files of about this size */
+#define SEGMENT_SIZE (16 * 1024 * 1024)
+#define SEGMENT_WRITE_BUFFER (4 * 1024 * 1024)
+
+struct replay_segment {
+	volatile long     refs;
+	struct dstr       path;
+	struct serializer file;
+	pthread_mutex_t   close_mutex;
+	bool              writing;
+	bool              failed;
+	int64_t           size;
+	int64_t           start_time;
+	size_t            num_packets;
+	int               keyframes;
+
+	/* first timestamps of each track, to offset saved replays */
+	bool              has_video;
+	int64_t           video_dts;
+	int64_t           video_dts_usec;
+	bool              has_audio[MAX_AUDIO_MIXES];
+	int64_t           audio_dts[MAX_AUDIO_MIXES];
+	int64_t           audio_dts_usec[MAX_AUDIO_MIXES];
+};
+
+struct packet_block {
+	volatile long         refs;
+	size_t                num;
+	struct encoder_packet packets[PACKET_BLOCK_SIZE];
+};
+
+struct keyframe_entry {
+	uint64_t              seq;
+	int64_t               dts_usec;
+	uint64_t              offset;
+};
+
+/* packet header stored in front of each packet in segment files */
+struct replay_packet_info {
+	int64_t           pts;
+	int64_t           dts;
+	int64_t           dts_usec;
+	int64_t           sys_dts_usec;
+	int32_t           timebase_num;
+	int32_t           timebase_den;
+	uint32_t          size;
+	uint32_t          track_idx;
+	int32_t           priority;
+	int32_t           drop_priority;
+	uint8_t           type;
+	uint8_t           keyframe;
+};
+
+/* an ffmpeg-mux process and the pipe or ring its packets are sent through */
+struct mux_pipe {
+	os_process_pipe_t *pipe;
+
+	/* shared memory packet ring (linux only) */
+	struct ffm_ring_header *ring;
+	uint8_t           *ring_data;
+	size_t            ring_map_size;
+	uint64_t          ring_write_pos;
+	int               ring_fd;
+	int               ring_data_event;
+	int               ring_space_event;
+	int               ring_lifeline[2];
+	uint64_t          ring_stalls;
+	uint64_t          ring_stall_ns;
+	uint64_t          ring_peak;
+	volatile long     ring_usage;
+};
+
 struct ffmpeg_muxer {
 	obs_output_t      *output;
-	os_process_pipe_t *pipe;
+	struct mux_pipe   mux;
 	int64_t           stop_ts;
 	uint64_t          total_bytes;
 	struct dstr       path;
@@ -50,20 +150,75 @@ struct ffmpeg_muxer {
 	volatile bool     stopping;
 	volatile bool     capturing;
 
-	/* replay buffer */
-	struct circlebuf  packets;
-	int64_t           cur_size;
+	/* file splitting.  a new file is started at the first keyframe past
+	 * the split limits, and the previous one is finished on its own
+	 * thread */
+	struct file_split split;
+	int64_t           file_start_ts;
+	uint64_t          file_bytes;
+	bool              offset_ts;
+	int64_t           video_dts_offset;
+	DARRAY(struct closing_file*) closing;
+
+	/* replay buffer.  packets are numbered in the order they're added,
+	 * first_seq being the oldest packet still in memory, and base_seq
+	 * being the first packet of the first block.  the keyframe index
+	 * holds the keyframes from first_seq on */
+	DARRAY(struct packet_block*) blocks;
+	struct circlebuf  keyframe_index;
+	uint64_t          base_seq;
+	uint64_t          first_seq;
+	uint64_t          next_seq;
+	uint64_t          bytes_pushed;
+	uint64_t          bytes_popped;
 	int64_t           cur_time;
 	int64_t           max_size;
 	int64_t           max_time;
 	int64_t           save_ts;
-	int               keyframes;
 	obs_hotkey_id     hotkey;
 
-	DARRAY(struct encoder_packet) mux_packets;
-	pthread_t                     mux_thread;
-	bool                          mux_thread_joinable;
-	volatile bool                 muxing;
+	/* replay buffer disk segments, older than the packets in memory */
+	DARRAY(struct replay_segment*) segments;
+	struct replay_segment *cur_segment;
+	struct dstr       spill_dir;
+	int64_t           max_memory;
+	int64_t           disk_size;
+	int               disk_keyframes;
+	long              segment_count;
+
+	DARRAY(struct replay_save*) saves;
+	pthread_mutex_t   last_replay_mutex;
+	struct dstr       last_replay;
+};
+
+/* a split file whose ffmpeg-mux process is being finished */
+struct closing_file {
+	struct ffmpeg_muxer *stream;
+	struct mux_pipe     mux;
+	struct dstr         path;
+	pthread_t           thread;
+	volatile bool       done;
+};
+
+/* a replay being written on its own thread from a snapshot of the replay
+ * buffer */
+struct replay_save {
+	struct ffmpeg_muxer *stream;
+	struct mux_pipe     mux;
+	struct dstr         path;
+	pthread_t           thread;
+	volatile bool       done;
+
+	DARRAY(struct replay_segment*) segments;
+	DARRAY(struct packet_block*)   blocks;
+	uint64_t            base_seq;
+	uint64_t            start_seq;
+	uint64_t            end_seq;
+
+	int64_t             video_offset;
+	int64_t             video_dts_offset;
+	int64_t             audio_offsets[MAX_AUDIO_MIXES];
+	int64_t             audio_dts_offsets[MAX_AUDIO_MIXES];
 };
 
 static const char *ffmpeg_mux_getname(void *type)
@@ -72,34 +227,57 @@ static const char *ffmpeg_mux_getname(void *type)
 	return obs_module_text("FFmpegMuxer");
 }
 
-static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
+static void segment_release(struct replay_segment *seg);
+
+static void block_release(struct packet_block *block)
 {
-	while (stream->packets.size > 0) {
-		struct encoder_packet pkt;
-		circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
-		obs_encoder_packet_release(&pkt);
+	if (os_atomic_dec_long(&block->refs) == 0) {
+		for (size_t i = 0; i < block->num; i++)
+			obs_encoder_packet_release(&block->packets[i]);
+		bfree(block);
 	}
+}
+
+static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
+{
+	for (size_t i = 0; i < stream->blocks.num; i++)
+		block_release(stream->blocks.array[i]);
+	da_free(stream->blocks);
+	circlebuf_free(&stream->keyframe_index);
+	stream->base_seq = 0;
+	stream->first_seq = 0;
+	stream->next_seq = 0;
+	stream->bytes_pushed = 0;
+	stream->bytes_popped = 0;
+
+	for (size_t i = 0; i < stream->segments.num; i++)
+		segment_release(stream->segments.array[i]);
+	da_free(stream->segments);
+	stream->cur_segment = NULL;
+	stream->disk_size = 0;
+	stream->disk_keyframes = 0;
 
-	circlebuf_free(&stream->packets);
-	stream->cur_size = 0;
 	stream->cur_time = 0;
 	stream->max_size = 0;
 	stream->max_time = 0;
 	stream->save_ts = 0;
-	stream->keyframes = 0;
 }
 
+static int stop_pipe(struct ffmpeg_muxer *stream, struct mux_pipe *mp);
+static void reap_closing_files(struct ffmpeg_muxer *stream, bool wait);
+
 static void ffmpeg_mux_destroy(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
 
 	replay_buffer_clear(stream);
-	if (stream->mux_thread_joinable)
-		pthread_join(stream->mux_thread, NULL);
-	da_free(stream->mux_packets);
+	dstr_free(&stream->spill_dir);
 
-	os_process_pipe_destroy(stream->pipe);
+	stop_pipe(stream, &stream->mux);
+	reap_closing_files(stream, true);
+	da_free(stream->closing);
 	dstr_free(&stream->path);
+	file_split_free(&stream->split);
 	bfree(stream);
 }
 
@@ -137,6 +315,316 @@ static inline bool active(struct ffmpeg_muxer *stream)
 	return os_atomic_load_bool(&stream->active);
 }
 
+/* ------------------------------------------------------------------------ */
+/* shared memory packet ring, see ffmpeg-mux.h for the layout */
+
+#ifdef USE_RING
+#define RING_DATA_OFFSET 4096
+
+static void close_fd(int *fd)
+{
+	if (*fd != -1) {
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+static void ring_close_fds(struct mux_pipe *mp)
+{
+	close_fd(&mp->ring_fd);
+	close_fd(&mp->ring_data_event);
+	close_fd(&mp->ring_space_event);
+	close_fd(&mp->ring_lifeline[0]);
+	close_fd(&mp->ring_lifeline[1]);
+}
+
+static bool ring_create(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp)
+{
+	static volatile long ring_count = 0;
+	size_t map_size = RING_DATA_OFFSET + RING_SIZE;
+	struct dstr name = {0};
+	void *map;
+
+	mp->ring_fd = -1;
+	mp->ring_data_event = -1;
+	mp->ring_space_event = -1;
+	mp->ring_lifeline[0] = -1;
+	mp->ring_lifeline[1] = -1;
+
+	/* the name is only used to create the memory; ffmpeg-mux inherits
+	 * the file descriptor.  everything is created close-on-exec, and only
+	 * made inheritable while ffmpeg-mux is being started, see
+	 * ring_spawn_begin */
+	dstr_printf(&name, "/obs-ffmpeg-mux-%d-%ld", (int)getpid(),
+			os_atomic_inc_long(&ring_count));
+	mp->ring_fd = shm_open(name.array, O_RDWR | O_CREAT | O_EXCL,
+			0600);
+	if (mp->ring_fd != -1)
+		shm_unlink(name.array);
+	dstr_free(&name);
+
+	if (mp->ring_fd == -1)
+		goto fail;
+	if (ftruncate(mp->ring_fd, (off_t)map_size) != 0)
+		goto fail;
+
+	mp->ring_data_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	mp->ring_space_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mp->ring_data_event == -1 || mp->ring_space_event == -1)
+		goto fail;
+
+	/* ffmpeg-mux holds the only write end of this pipe, so it hangs up
+	 * if ffmpeg-mux exits while obs is waiting for ring space */
+	if (pipe2(mp->ring_lifeline, O_CLOEXEC) != 0)
+		goto fail;
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			mp->ring_fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	mp->ring = map;
+	mp->ring_data = (uint8_t*)map + RING_DATA_OFFSET;
+	mp->ring_map_size = map_size;
+	mp->ring_write_pos = 0;
+	mp->ring_stalls = 0;
+	mp->ring_stall_ns = 0;
+	mp->ring_peak = 0;
+
+	mp->ring->magic = FFM_RING_MAGIC;
+	mp->ring->data_offset = RING_DATA_OFFSET;
+	mp->ring->size = RING_SIZE;
+	return true;
+
+fail:
+	warn("Failed to create packet ring (%s), using a pipe instead",
+			strerror(errno));
+	ring_close_fds(mp);
+	return false;
+}
+
+static void ring_destroy(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp)
+{
+	if (!mp->ring)
+		return;
+
+	info("Packet ring peak usage: %"PRIu64" KB of %d KB, "
+			"stalled %"PRIu64" times (%"PRIu64" ms total)",
+			mp->ring_peak / 1024, RING_SIZE / 1024,
+			mp->ring_stalls, mp->ring_stall_ns / 1000000);
+
+	munmap(mp->ring, mp->ring_map_size);
+	mp->ring = NULL;
+	mp->ring_data = NULL;
+	os_atomic_set_long(&mp->ring_usage, 0);
+	ring_close_fds(mp);
+}
+
+/* popen gives no way to make descriptors inheritable in the child only, so
+ * the ring's descriptors are inheritable from ring_spawn_begin to
+ * ring_spawn_end.  the mutex keeps another output (or a split/replay save
+ * of this one) starting its own ffmpeg-mux in between and inheriting them */
+static pthread_mutex_t ring_spawn_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void set_cloexec(int fd, bool cloexec)
+{
+	if (fd != -1)
+		fcntl(fd, F_SETFD, cloexec ? FD_CLOEXEC : 0);
+}
+
+static void ring_spawn_begin(struct mux_pipe *mp)
+{
+	pthread_mutex_lock(&ring_spawn_mutex);
+
+	if (!mp->ring)
+		return;
+
+	set_cloexec(mp->ring_fd, false);
+	set_cloexec(mp->ring_data_event, false);
+	set_cloexec(mp->ring_space_event, false);
+	set_cloexec(mp->ring_lifeline[1], false);
+}
+
+/* called once ffmpeg-mux has been started (or failed to start).  it has its
+ * own copies of the shared memory and lifeline descriptors, so they're closed
+ * here */
+static void ring_spawn_end(struct mux_pipe *mp)
+{
+	if (mp->ring) {
+		close_fd(&mp->ring_fd);
+		close_fd(&mp->ring_lifeline[1]);
+		set_cloexec(mp->ring_data_event, true);
+		set_cloexec(mp->ring_space_event, true);
+	}
+
+	pthread_mutex_unlock(&ring_spawn_mutex);
+}
+
+static void add_ring_params(struct mux_pipe *mp, struct dstr *cmd)
+{
+	if (mp->ring)
+		dstr_catf(cmd, "--ring %d %d %d ", mp->ring_fd,
+				mp->ring_data_event,
+				mp->ring_space_event);
+}
+
+static inline uint64_t ring_space(struct mux_pipe *mp)
+{
+	uint64_t read_pos = __atomic_load_n(&mp->ring->read_pos,
+			__ATOMIC_SEQ_CST);
+	return mp->ring->size - (mp->ring_write_pos - read_pos);
+}
+
+static bool ring_wait_space(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp, uint64_t needed)
+{
+	struct ffm_ring_header *ring = mp->ring;
+	uint64_t stall_start = 0;
+	bool success = true;
+
+	while (success && ring_space(mp) < needed) {
+		struct pollfd fds[2] = {
+			{.fd = mp->ring_space_event,  .events = POLLIN},
+			{.fd = mp->ring_lifeline[0], .events = POLLIN}
+		};
+
+		if (!stall_start) {
+			if (!mp->ring_stalls)
+				warn("Packet ring is full, waiting for the "
+				     "muxer (the disk may be too slow)");
+
+			mp->ring_stalls++;
+			stall_start = os_gettime_ns();
+		}
+
+		__atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+
+		if (ring_space(mp) < needed &&
+		    poll(fds, 2, -1) < 0 && errno != EINTR)
+			success = false;
+
+		__atomic_store_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST);
+
+		if (fds[0].revents & POLLIN) {
+			uint64_t val;
+			if (read(mp->ring_space_event, &val,
+						sizeof(val)) < 0 &&
+			    errno != EAGAIN && errno != EINTR)
+				success = false;
+		}
+
+		if (fds[1].revents) {
+			warn("Muxer process exited while waiting for ring "
+			     "space");
+			success = false;
+		}
+	}
+
+	if (stall_start)
+		mp->ring_stall_ns += os_gettime_ns() - stall_start;
+
+	return success;
+}
+
+static bool ring_write(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp, struct ffm_packet_info *info,
+		const uint8_t *data)
+{
+	struct ffm_ring_header *ring = mp->ring;
+	uint64_t rec_size = ffm_ring_record_size(info->size);
+	uint64_t pos = mp->ring_write_pos % ring->size;
+	uint64_t to_end = ring->size - pos;
+	uint64_t needed = rec_size > to_end ? rec_size + to_end : rec_size;
+	uint64_t used;
+
+	if (rec_size > ring->size / 2) {
+		warn("Packet of %"PRIu32" bytes is too large for the packet "
+		     "ring", info->size);
+		return false;
+	}
+
+	if (!ring_wait_space(stream, mp, needed))
+		return false;
+
+	/* records are aligned, so there's always room for the marker */
+	if (rec_size > to_end) {
+		struct ffm_packet_info wrap = {.type = FFM_PACKET_WRAP};
+		memcpy(mp->ring_data + pos, &wrap, sizeof(wrap));
+		mp->ring_write_pos += to_end;
+		pos = 0;
+	}
+
+	memcpy(mp->ring_data + pos, info, sizeof(*info));
+	if (info->size)
+		memcpy(mp->ring_data + pos + sizeof(*info), data,
+				info->size);
+
+	mp->ring_write_pos += rec_size;
+	__atomic_store_n(&ring->write_pos, mp->ring_write_pos,
+			__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->reader_waiting, __ATOMIC_SEQ_CST)) {
+		uint64_t one = 1;
+		if (write(mp->ring_data_event, &one, sizeof(one)) < 0 &&
+		    errno != EAGAIN)
+			return false;
+	}
+
+	used = ring->size - ring_space(mp);
+	if (used > mp->ring_peak)
+		mp->ring_peak = used;
+	os_atomic_set_long(&mp->ring_usage,
+			(long)(used * 1000 / ring->size));
+	return true;
+}
+#else
+static inline bool ring_create(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp)
+{
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(mp);
+	return false;
+}
+
+static inline void ring_destroy(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp)
+{
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(mp);
+}
+
+static inline void ring_spawn_begin(struct mux_pipe *mp)
+{
+	UNUSED_PARAMETER(mp);
+}
+
+static inline void ring_spawn_end(struct mux_pipe *mp)
+{
+	UNUSED_PARAMETER(mp);
+}
+
+static inline void add_ring_params(struct mux_pipe *mp, struct dstr *cmd)
+{
+	UNUSED_PARAMETER(mp);
+	UNUSED_PARAMETER(cmd);
+}
+
+static inline bool ring_write(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp, struct ffm_packet_info *info,
+		const uint8_t *data)
+{
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(mp);
+	UNUSED_PARAMETER(info);
+	UNUSED_PARAMETER(data);
+	return false;
+}
+#endif
+
+/* ------------------------------------------------------------------------ */
+
 /* TODO: allow codecs other than h264 whenever we start using them */
 
 static void add_video_encoder_params(struct ffmpeg_muxer *stream,
@@ -224,11 +712,12 @@ static void add_muxer_params(struct dstr *cmd, struct ffmpeg_muxer *stream)
 	dstr_free(&mux);
 }
 
-static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
-		const char *path)
+static void build_command_line(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp, struct dstr *cmd, const char *path)
 {
 	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
 	obs_encoder_t *aencoders[MAX_AUDIO_MIXES];
+	struct dstr quoted_path = {0};
 	int num_tracks = 0;
 
 	for (;;) {
@@ -243,11 +732,14 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 
 	dstr_init_move_array(cmd, obs_module_file(FFMPEG_MUX));
 	dstr_insert_ch(cmd, 0, '\"');
-	dstr_cat(cmd, "\" \"");
+	dstr_cat(cmd, "\" ");
+	add_ring_params(mp, cmd);
+	dstr_cat(cmd, "\"");
 
-	dstr_copy(&stream->path, path);
-	dstr_replace(&stream->path, "\"", "\"\"");
-	dstr_cat_dstr(cmd, &stream->path);
+	dstr_copy(&quoted_path, path);
+	dstr_replace(&quoted_path, "\"", "\"\"");
+	dstr_cat_dstr(cmd, &quoted_path);
+	dstr_free(&quoted_path);
 
 	dstr_catf(cmd, "\" %d %d ", vencoder ? 1 : 0, num_tracks);
 
@@ -265,12 +757,32 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 	add_muxer_params(cmd, stream);
 }
 
-static inline void start_pipe(struct ffmpeg_muxer *stream, const char *path)
+static bool start_pipe(struct ffmpeg_muxer *stream, struct mux_pipe *mp,
+		const char *path)
 {
 	struct dstr cmd;
-	build_command_line(stream, &cmd, path);
-	stream->pipe = os_process_pipe_create(cmd.array, "w");
+
+	ring_create(stream, mp);
+	build_command_line(stream, mp, &cmd, path);
+
+	ring_spawn_begin(mp);
+	mp->pipe = os_process_pipe_create(cmd.array, "w");
+	ring_spawn_end(mp);
 	dstr_free(&cmd);
+
+	if (!mp->pipe)
+		ring_destroy(stream, mp);
+
+	return mp->pipe != NULL;
+}
+
+static int stop_pipe(struct ffmpeg_muxer *stream, struct mux_pipe *mp)
+{
+	/* closing the pipe also tells ffmpeg-mux that the ring has ended */
+	int ret = os_process_pipe_destroy(mp->pipe);
+	mp->pipe = NULL;
+	ring_destroy(stream, mp);
+	return ret;
 }
 
 static bool ffmpeg_mux_start(void *data)
@@ -315,10 +827,19 @@ static bool ffmpeg_mux_start(void *data)
 	fclose(test_file);
 	os_unlink(path);
 
-	start_pipe(stream, path);
+	dstr_copy(&stream->path, path);
+	file_split_init(&stream->split, path,
+			obs_data_get_string(settings, "split_format"),
+			obs_data_get_int(settings, "max_time_sec") * 1000000LL,
+			(uint64_t)obs_data_get_int(settings, "max_size_mb") *
+			(1024 * 1024));
+	stream->file_bytes = 0;
+	stream->offset_ts = false;
+
+	start_pipe(stream, &stream->mux, path);
 	obs_data_release(settings);
 
-	if (!stream->pipe) {
+	if (!stream->mux.pipe) {
 		obs_output_set_last_error(stream->output,
 			obs_module_text("HelperProcessFailed"));
 		warn("Failed to create process pipe");
@@ -340,8 +861,8 @@ static int deactivate(struct ffmpeg_muxer *stream)
 	int ret = -1;
 
 	if (active(stream)) {
-		ret = os_process_pipe_destroy(stream->pipe);
-		stream->pipe = NULL;
+		ret = stop_pipe(stream, &stream->mux);
+		reap_closing_files(stream, true);
 
 		os_atomic_set_bool(&stream->active, false);
 		os_atomic_set_bool(&stream->sent_headers, false);
@@ -381,7 +902,7 @@ static void signal_failure(struct ffmpeg_muxer *stream)
 	os_atomic_set_bool(&stream->capturing, false);
 }
 
-static bool write_packet(struct ffmpeg_muxer *stream,
+static bool write_packet(struct ffmpeg_muxer *stream, struct mux_pipe *mp,
 		struct encoder_packet *packet)
 {
 	bool is_video = packet->type == OBS_ENCODER_VIDEO;
@@ -396,27 +917,33 @@ static bool write_packet(struct ffmpeg_muxer *stream,
 		.keyframe = packet->keyframe
 	};
 
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t*)&info,
+	if (mp->ring) {
+		if (!ring_write(stream, mp, &info, packet->data)) {
+			warn("Failed to write packet to the packet ring");
+			return false;
+		}
+
+		return true;
+	}
+
+	ret = os_process_pipe_write(mp->pipe, (const uint8_t*)&info,
 			sizeof(info));
 	if (ret != sizeof(info)) {
 		warn("os_process_pipe_write for info structure failed");
-		signal_failure(stream);
 		return false;
 	}
 
-	ret = os_process_pipe_write(stream->pipe, packet->data, packet->size);
+	ret = os_process_pipe_write(mp->pipe, packet->data, packet->size);
 	if (ret != packet->size) {
 		warn("os_process_pipe_write for packet data failed");
-		signal_failure(stream);
 		return false;
 	}
 
-	stream->total_bytes += packet->size;
 	return true;
 }
 
 static bool send_audio_headers(struct ffmpeg_muxer *stream,
-		obs_encoder_t *aencoder, size_t idx)
+		struct mux_pipe *mp, obs_encoder_t *aencoder, size_t idx)
 {
 	struct encoder_packet packet = {
 		.type         = OBS_ENCODER_AUDIO,
@@ -425,10 +952,11 @@ static bool send_audio_headers(struct ffmpeg_muxer *stream,
 	};
 
 	obs_encoder_get_extra_data(aencoder, &packet.data, &packet.size);
-	return write_packet(stream, &packet);
+	return write_packet(stream, mp, &packet);
 }
 
-static bool send_video_headers(struct ffmpeg_muxer *stream)
+static bool send_video_headers(struct ffmpeg_muxer *stream,
+		struct mux_pipe *mp)
 {
 	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
 
@@ -438,21 +966,21 @@ static bool send_video_headers(struct ffmpeg_muxer *stream)
 	};
 
 	obs_encoder_get_extra_data(vencoder, &packet.data, &packet.size);
-	return write_packet(stream, &packet);
+	return write_packet(stream, mp, &packet);
 }
 
-static bool send_headers(struct ffmpeg_muxer *stream)
+static bool send_headers(struct ffmpeg_muxer *stream, struct mux_pipe *mp)
 {
 	obs_encoder_t *aencoder;
 	size_t idx = 0;
 
-	if (!send_video_headers(stream))
+	if (!send_video_headers(stream, mp))
 		return false;
 
 	do {
 		aencoder = obs_output_get_audio_encoder(stream->output, idx);
 		if (aencoder) {
-			if (!send_audio_headers(stream, aencoder, idx)) {
+			if (!send_audio_headers(stream, mp, aencoder, idx)) {
 				return false;
 			}
 			idx++;
@@ -462,16 +990,153 @@ static bool send_headers(struct ffmpeg_muxer *stream)
 	return true;
 }
 
+/* ------------------------------------------------------------------------ */
+/* file splitting */
+
+static void *close_file_thread(void *data)
+{
+	struct closing_file *cf = data;
+	struct ffmpeg_muxer *stream = cf->stream;
+	int ret;
+
+	os_set_thread_name("ffmpeg-mux: close file");
+
+	ret = stop_pipe(stream, &cf->mux);
+	if (ret == 0)
+		info("Finished file '%s'", cf->path.array);
+	else
+		warn("ffmpeg-mux returned %d when finishing file '%s'",
+				ret, cf->path.array);
+
+	os_atomic_set_bool(&cf->done, true);
+	return NULL;
+}
+
+static void reap_closing_files(struct ffmpeg_muxer *stream, bool wait)
+{
+	for (size_t i = stream->closing.num; i > 0; i--) {
+		struct closing_file *cf = stream->closing.array[i - 1];
+
+		if (!wait && !os_atomic_load_bool(&cf->done))
+			continue;
+
+		pthread_join(cf->thread, NULL);
+		dstr_free(&cf->path);
+		bfree(cf);
+		da_erase(stream->closing, i - 1);
+	}
+}
+
+/* ffmpeg-mux writes the index/trailer when its input ends, which can take
+ * a while for large files, so that's left to another thread */
+static void close_file_async(struct ffmpeg_muxer *stream)
+{
+	struct closing_file *cf = bzalloc(sizeof(*cf));
+	cf->stream = stream;
+	cf->mux = stream->mux;
+	dstr_copy_dstr(&cf->path, &stream->path);
+
+	memset(&stream->mux, 0, sizeof(stream->mux));
+
+	if (pthread_create(&cf->thread, NULL, close_file_thread, cf) != 0) {
+		close_file_thread(cf);
+		dstr_free(&cf->path);
+		bfree(cf);
+		return;
+	}
+
+	da_push_back(stream->closing, &cf);
+}
+
+static inline bool split_due(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet)
+{
+	if (packet->type != OBS_ENCODER_VIDEO || !packet->keyframe)
+		return false;
+
+	return file_split_due(&stream->split, packet->dts_usec,
+			stream->file_bytes);
+}
+
+/* starts the next file with the keyframe packet.  the new ffmpeg-mux
+ * process is started before the current one is let go of, so no packets
+ * are lost.  if it can't be started, the current file is kept */
+static void split_file(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet)
+{
+	struct mux_pipe next = {0};
+	struct dstr path = {0};
+
+	file_split_next_path(&stream->split, &path);
+
+	if (!start_pipe(stream, &next, path.array)) {
+		warn("Failed to create process pipe for file '%s', "
+		     "continuing to write '%s'",
+		     path.array, stream->path.array);
+		goto fail;
+	}
+
+	if (!send_headers(stream, &next)) {
+		warn("Could not write headers for file '%s', continuing to "
+		     "write '%s'", path.array, stream->path.array);
+		stop_pipe(stream, &next);
+		goto fail;
+	}
+
+	reap_closing_files(stream, false);
+	close_file_async(stream);
+
+	stream->mux = next;
+	dstr_move(&stream->path, &path);
+
+	file_split_start(&stream->split, packet->dts_usec, 0);
+	stream->file_start_ts = packet->dts_usec;
+	stream->file_bytes = 0;
+	stream->offset_ts = true;
+	stream->video_dts_offset = packet->dts;
+
+	info("Writing file '%s'...", stream->path.array);
+	return;
+
+fail:
+	dstr_free(&path);
+	file_split_start(&stream->split, packet->dts_usec, 0);
+	stream->file_bytes = 0;
+}
+
+/* split files start their timestamps at the keyframe they start with.
+ * audio is offset by the same time, in its own time base */
+static inline void offset_split_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet)
+{
+	int64_t offset;
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		offset = stream->video_dts_offset;
+	} else {
+		offset = stream->file_start_ts * packet->timebase_den /
+			((int64_t)packet->timebase_num * 1000000LL);
+	}
+
+	packet->dts -= offset;
+	packet->pts -= offset;
+}
+
+/* ------------------------------------------------------------------------ */
+
 static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 {
 	struct ffmpeg_muxer *stream = data;
+	struct encoder_packet pkt;
 
 	if (!active(stream))
 		return;
 
 	if (!stream->sent_headers) {
-		if (!send_headers(stream))
+		if (!send_headers(stream, &stream->mux)) {
+			signal_failure(stream);
 			return;
+		}
 
 		stream->sent_headers = true;
 	}
@@ -483,7 +1148,23 @@ static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	write_packet(stream, packet);
+	if (split_due(stream, packet))
+		split_file(stream, packet);
+
+	if (!stream->split.started && packet->type == OBS_ENCODER_VIDEO)
+		file_split_start(&stream->split, packet->dts_usec, 0);
+
+	pkt = *packet;
+	if (stream->offset_ts)
+		offset_split_packet(stream, &pkt);
+
+	if (!write_packet(stream, &stream->mux, &pkt)) {
+		signal_failure(stream);
+		return;
+	}
+
+	stream->file_bytes += packet->size;
+	stream->total_bytes += packet->size;
 }
 
 static obs_properties_t *ffmpeg_mux_properties(void *unused)
@@ -495,6 +1176,13 @@ static obs_properties_t *ffmpeg_mux_properties(void *unused)
 	obs_properties_add_text(props, "path",
 			obs_module_text("FilePath"),
 			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, "max_time_sec",
+			obs_module_text("SplitTime"), 0, 24 * 3600, 60);
+	obs_properties_add_int(props, "max_size_mb",
+			obs_module_text("SplitSize"), 0, 1024 * 1024, 256);
+	obs_properties_add_text(props, "split_format",
+			obs_module_text("SplitFormat"),
+			OBS_TEXT_DEFAULT);
 	return props;
 }
 
@@ -504,6 +1192,14 @@ static uint64_t ffmpeg_mux_total_bytes(void *data)
 	return stream->total_bytes;
 }
 
+/* how full the packet ring is, so a disk that can't keep up shows before
+ * the encoders start to stall */
+static float ffmpeg_mux_congestion(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+	return (float)os_atomic_load_long(&stream->mux.ring_usage) / 1000.0f;
+}
+
 struct obs_output_info ffmpeg_muxer = {
 	.id             = "ffmpeg_muxer",
 	.flags          = OBS_OUTPUT_AV |
@@ -516,7 +1212,8 @@ struct obs_output_info ffmpeg_muxer = {
 	.stop           = ffmpeg_mux_stop,
 	.encoded_packet = ffmpeg_mux_data,
 	.get_total_bytes= ffmpeg_mux_total_bytes,
-	.get_properties = ffmpeg_mux_properties
+	.get_properties = ffmpeg_mux_properties,
+	.get_congestion = ffmpeg_mux_congestion
 };
 
 /* ------------------------------------------------------------------------ */
@@ -548,8 +1245,11 @@ static void save_replay_proc(void *data, calldata_t *cd)
 static void get_last_replay(void *data, calldata_t *cd)
 {
 	struct ffmpeg_muxer *stream = data;
-	if (!os_atomic_load_bool(&stream->muxing))
-		calldata_set_string(cd, "path", stream->path.array);
+
+	pthread_mutex_lock(&stream->last_replay_mutex);
+	if (stream->last_replay.len)
+		calldata_set_string(cd, "path", stream->last_replay.array);
+	pthread_mutex_unlock(&stream->last_replay_mutex);
 }
 
 static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
@@ -558,6 +1258,11 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
 	stream->output = output;
 
+	if (pthread_mutex_init(&stream->last_replay_mutex, NULL) != 0) {
+		bfree(stream);
+		return NULL;
+	}
+
 	stream->hotkey = obs_hotkey_register_output(output,
 			"ReplayBuffer.Save",
 			obs_module_text("ReplayBuffer.Save"),
@@ -571,14 +1276,361 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 	return stream;
 }
 
+static void reap_saves(struct ffmpeg_muxer *stream, bool wait);
+
 static void replay_buffer_destroy(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
 	if (stream->hotkey)
 		obs_hotkey_unregister(stream->hotkey);
+
+	reap_saves(stream, true);
+	da_free(stream->saves);
+	pthread_mutex_destroy(&stream->last_replay_mutex);
+	dstr_free(&stream->last_replay);
+
 	ffmpeg_mux_destroy(data);
 }
 
+/* ------------------------------------------------------------------------ */
+/* replay buffer packets in memory */
+
+static inline struct encoder_packet *get_packet(struct packet_block **blocks,
+		uint64_t base_seq, uint64_t seq)
+{
+	uint64_t idx = seq - base_seq;
+	return &blocks[idx / PACKET_BLOCK_SIZE]->packets[
+		idx % PACKET_BLOCK_SIZE];
+}
+
+static inline struct encoder_packet *stream_packet(
+		struct ffmpeg_muxer *stream, uint64_t seq)
+{
+	return get_packet(stream->blocks.array, stream->base_seq, seq);
+}
+
+static inline size_t mem_keyframes(struct ffmpeg_muxer *stream)
+{
+	return stream->keyframe_index.size / sizeof(struct keyframe_entry);
+}
+
+static inline struct keyframe_entry *get_keyframe(
+		struct ffmpeg_muxer *stream, size_t idx)
+{
+	return circlebuf_data(&stream->keyframe_index,
+			idx * sizeof(struct keyframe_entry));
+}
+
+static inline int64_t mem_size(struct ffmpeg_muxer *stream)
+{
+	return (int64_t)(stream->bytes_pushed - stream->bytes_popped);
+}
+
+static inline int64_t replay_size(struct ffmpeg_muxer *stream)
+{
+	return stream->disk_size + mem_size(stream);
+}
+
+static inline int total_keyframes(struct ffmpeg_muxer *stream)
+{
+	return stream->disk_keyframes + (int)mem_keyframes(stream);
+}
+
+static inline bool replay_empty(struct ffmpeg_muxer *stream)
+{
+	return stream->first_seq == stream->next_seq && !stream->segments.num;
+}
+
+static inline void update_cur_time(struct ffmpeg_muxer *stream)
+{
+	if (stream->segments.num)
+		stream->cur_time = stream->segments.array[0]->start_time;
+	else if (stream->first_seq != stream->next_seq)
+		stream->cur_time = stream_packet(stream,
+				stream->first_seq)->dts_usec;
+	else
+		stream->cur_time = 0;
+}
+
+static void push_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet)
+{
+	struct packet_block *block = stream->blocks.num ?
+		stream->blocks.array[stream->blocks.num - 1] : NULL;
+
+	if (!block || block->num == PACKET_BLOCK_SIZE) {
+		block = bmalloc(sizeof(*block));
+		block->refs = 1;
+		block->num = 0;
+		da_push_back(stream->blocks, &block);
+	}
+
+	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe) {
+		struct keyframe_entry kf = {
+			.seq      = stream->next_seq,
+			.dts_usec = packet->dts_usec,
+			.offset   = stream->bytes_pushed
+		};
+		circlebuf_push_back(&stream->keyframe_index, &kf, sizeof(kf));
+	}
+
+	/* saves only read packets that were added before they started, so
+	 * the block can keep being filled while a save reads it */
+	obs_encoder_packet_ref(&block->packets[block->num], packet);
+	block->num++;
+
+	if (replay_empty(stream))
+		stream->cur_time = packet->dts_usec;
+
+	stream->next_seq++;
+	stream->bytes_pushed += packet->size;
+}
+
+/* returns the keyframe that ends the GOP at the front of the packets in
+ * memory, or NULL if that GOP is the last one */
+static struct keyframe_entry *front_gop_end(struct ffmpeg_muxer *stream)
+{
+	size_t count = mem_keyframes(stream);
+	struct keyframe_entry *kf;
+
+	if (!count)
+		return NULL;
+
+	kf = get_keyframe(stream, 0);
+	if (kf->seq == stream->first_seq)
+		kf = count > 1 ? get_keyframe(stream, 1) : NULL;
+
+	return kf;
+}
+
+/* drops packets from the front up to the keyframe end, or all packets if
+ * end is NULL */
+static void pop_packets(struct ffmpeg_muxer *stream,
+		const struct keyframe_entry *end)
+{
+	uint64_t end_seq = end ? end->seq : stream->next_seq;
+	uint64_t end_offset = end ? end->offset : stream->bytes_pushed;
+
+	stream->first_seq = end_seq;
+	stream->bytes_popped = end_offset;
+
+	while (mem_keyframes(stream) &&
+	       get_keyframe(stream, 0)->seq < end_seq)
+		circlebuf_pop_front(&stream->keyframe_index, NULL,
+				sizeof(struct keyframe_entry));
+
+	while (stream->first_seq - stream->base_seq >= PACKET_BLOCK_SIZE) {
+		block_release(stream->blocks.array[0]);
+		da_erase(stream->blocks, 0);
+		stream->base_seq += PACKET_BLOCK_SIZE;
+	}
+
+	update_cur_time(stream);
+}
+
+/* ------------------------------------------------------------------------ */
+/* replay buffer disk segments
+ *
+ *   When the packets held in memory exceed max_memory, the oldest GOP is
+ * moved to a segment file.  Segments only ever contain whole GOPs, so purging
+ * drops whole segments, and saving streams the segments from disk before the
+ * packets still in memory. */
+
+static void get_spill_dir(struct dstr *dir, obs_data_t *settings)
+{
+	const char *spill_dir = obs_data_get_string(settings,
+			"spill_directory");
+
+	if (!spill_dir || !*spill_dir) {
+#ifdef _WIN32
+		spill_dir = getenv("TEMP");
+#else
+		spill_dir = getenv("TMPDIR");
+		if (!spill_dir || !*spill_dir)
+			spill_dir = "/tmp";
+#endif
+	}
+
+	dstr_copy(dir, spill_dir ? spill_dir : ".");
+	dstr_replace(dir, "\\", "/");
+	if (dstr_end(dir) == '/')
+		dstr_resize(dir, dir->len - 1);
+}
+
+/* waits for the segment to be written out.  saving a replay hands the
+ * segment being written off to the save thread to close, so segments can be
+ * closed from several threads */
+static void segment_close(struct replay_segment *seg)
+{
+	pthread_mutex_lock(&seg->close_mutex);
+	if (seg->writing) {
+		if (!buffered_file_serializer_free(&seg->file))
+			seg->failed = true;
+		seg->writing = false;
+	}
+	pthread_mutex_unlock(&seg->close_mutex);
+}
+
+static void segment_release(struct replay_segment *seg)
+{
+	if (os_atomic_dec_long(&seg->refs) == 0) {
+		segment_close(seg);
+		os_unlink(seg->path.array);
+		pthread_mutex_destroy(&seg->close_mutex);
+		dstr_free(&seg->path);
+		bfree(seg);
+	}
+}
+
+static struct replay_segment *get_write_segment(struct ffmpeg_muxer *stream)
+{
+	struct replay_segment *seg = stream->cur_segment;
+
+	if (seg && seg->size < SEGMENT_SIZE)
+		return seg;
+
+	if (seg) {
+		segment_close(seg);
+		stream->cur_segment = NULL;
+		if (seg->failed)
+			return NULL;
+	}
+
+	seg = bzalloc(sizeof(*seg));
+	seg->refs = 1;
+	dstr_printf(&seg->path, "%s/obs-replay-%p-%ld.tmp",
+			stream->spill_dir.array, stream,
+			++stream->segment_count);
+
+	if (pthread_mutex_init(&seg->close_mutex, NULL) != 0) {
+		dstr_free(&seg->path);
+		bfree(seg);
+		return NULL;
+	}
+
+	if (!buffered_file_serializer_init(&seg->file, seg->path.array, 0,
+				SEGMENT_WRITE_BUFFER, false)) {
+		warn("Failed to create replay segment '%s'", seg->path.array);
+		pthread_mutex_destroy(&seg->close_mutex);
+		dstr_free(&seg->path);
+		bfree(seg);
+		return NULL;
+	}
+
+	seg->writing = true;
+	da_push_back(stream->segments, &seg);
+	stream->cur_segment = seg;
+	return seg;
+}
+
+static void segment_write(struct ffmpeg_muxer *stream,
+		struct replay_segment *seg, struct encoder_packet *pkt)
+{
+	bool keyframe = pkt->type == OBS_ENCODER_VIDEO && pkt->keyframe;
+
+	struct replay_packet_info info = {
+		.pts           = pkt->pts,
+		.dts           = pkt->dts,
+		.dts_usec      = pkt->dts_usec,
+		.sys_dts_usec  = pkt->sys_dts_usec,
+		.timebase_num  = pkt->timebase_num,
+		.timebase_den  = pkt->timebase_den,
+		.size          = (uint32_t)pkt->size,
+		.track_idx     = (uint32_t)pkt->track_idx,
+		.priority      = pkt->priority,
+		.drop_priority = pkt->drop_priority,
+		.type          = (uint8_t)pkt->type,
+		.keyframe      = pkt->keyframe
+	};
+
+	if (!seg->num_packets)
+		seg->start_time = pkt->dts_usec;
+
+	if (pkt->type == OBS_ENCODER_VIDEO) {
+		if (!seg->has_video) {
+			seg->has_video = true;
+			seg->video_dts = pkt->dts;
+			seg->video_dts_usec = pkt->dts_usec;
+		}
+	} else if (!seg->has_audio[pkt->track_idx]) {
+		seg->has_audio[pkt->track_idx] = true;
+		seg->audio_dts[pkt->track_idx] = pkt->dts;
+		seg->audio_dts_usec[pkt->track_idx] = pkt->dts_usec;
+	}
+
+	s_write(&seg->file, &info, sizeof(info));
+	s_write(&seg->file, pkt->data, pkt->size);
+
+	seg->size += (int64_t)pkt->size;
+	seg->num_packets++;
+	stream->disk_size += (int64_t)pkt->size;
+
+	if (keyframe) {
+		seg->keyframes++;
+		stream->disk_keyframes++;
+	}
+}
+
+static void purge_segment(struct ffmpeg_muxer *stream)
+{
+	struct replay_segment *seg = stream->segments.array[0];
+
+	da_erase(stream->segments, 0);
+	if (seg == stream->cur_segment)
+		stream->cur_segment = NULL;
+
+	stream->disk_keyframes -= seg->keyframes;
+	stream->disk_size -= seg->size;
+	update_cur_time(stream);
+
+	segment_release(seg);
+}
+
+/* a segment couldn't be written (most likely the disk is full), so the
+ * replay is cut back to what's in memory and spilling is disabled */
+static void spill_failed(struct ffmpeg_muxer *stream)
+{
+	warn("Failed to write replay buffer segment, replay buffer will be "
+	     "limited to %d MB of memory",
+	     (int)(stream->max_memory / (1024 * 1024)));
+
+	while (stream->segments.num)
+		purge_segment(stream);
+
+	stream->max_memory = 0;
+}
+
+static void spill_gop(struct ffmpeg_muxer *stream,
+		const struct keyframe_entry *end)
+{
+	struct replay_segment *seg = get_write_segment(stream);
+
+	if (!seg) {
+		spill_failed(stream);
+		return;
+	}
+
+	for (uint64_t seq = stream->first_seq; seq < end->seq; seq++)
+		segment_write(stream, seg, stream_packet(stream, seq));
+
+	pop_packets(stream, end);
+
+	if (buffered_file_serializer_failed(&seg->file))
+		spill_failed(stream);
+}
+
+/* only spills whole GOPs, and always leaves the last GOP in memory */
+static inline void replay_buffer_spill(struct ffmpeg_muxer *stream)
+{
+	struct keyframe_entry *end;
+
+	while (stream->max_memory && mem_size(stream) > stream->max_memory &&
+	       (end = front_gop_end(stream)) != NULL)
+		spill_gop(stream, end);
+}
+
+/* ------------------------------------------------------------------------ */
+
 static bool replay_buffer_start(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -591,206 +1643,378 @@ static bool replay_buffer_start(void *data)
 	obs_data_t *s = obs_output_get_settings(stream->output);
 	stream->max_time = obs_data_get_int(s, "max_time_sec") * 1000000LL;
 	stream->max_size = obs_data_get_int(s, "max_size_mb") * (1024 * 1024);
+	stream->max_memory = obs_data_get_int(s, "max_memory_mb") *
+		(1024 * 1024);
+	get_spill_dir(&stream->spill_dir, s);
 	obs_data_release(s);
 
+	if (stream->max_memory)
+		info("Spilling replay buffer packets beyond %d MB to '%s'",
+				(int)(stream->max_memory / (1024 * 1024)),
+				stream->spill_dir.array);
+
 	os_atomic_set_bool(&stream->active, true);
 	os_atomic_set_bool(&stream->capturing, true);
+
+	pthread_mutex_lock(&stream->last_replay_mutex);
 	stream->total_bytes = 0;
+	pthread_mutex_unlock(&stream->last_replay_mutex);
+
 	obs_output_begin_data_capture(stream->output, 0);
 
 	return true;
 }
 
-static bool purge_front(struct ffmpeg_muxer *stream)
-{
-	struct encoder_packet pkt;
-	bool keyframe;
-
-	circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
-
-	keyframe = pkt.type == OBS_ENCODER_VIDEO && pkt.keyframe;
-
-	if (keyframe)
-		stream->keyframes--;
-
-	if (!stream->packets.size) {
-		stream->cur_size = 0;
-		stream->cur_time = 0;
-	} else {
-		struct encoder_packet first;
-		circlebuf_peek_front(&stream->packets, &first, sizeof(first));
-		stream->cur_time = first.dts_usec;
-		stream->cur_size -= (int64_t)pkt.size;
-	}
-
-	obs_encoder_packet_release(&pkt);
-	return keyframe;
-}
-
+/* drops the oldest segment, or the oldest GOP in memory */
 static inline void purge(struct ffmpeg_muxer *stream)
 {
-	if (purge_front(stream)) {
-		struct encoder_packet pkt;
-
-		for (;;) {
-			circlebuf_peek_front(&stream->packets, &pkt,
-					sizeof(pkt));
-			if (pkt.type == OBS_ENCODER_VIDEO && pkt.keyframe)
-				return;
-
-			purge_front(stream);
-		}
-	}
+	if (stream->segments.num)
+		purge_segment(stream);
+	else
+		pop_packets(stream, front_gop_end(stream));
 }
 
 static inline void replay_buffer_purge(struct ffmpeg_muxer *stream,
 		struct encoder_packet *pkt)
 {
 	if (stream->max_size) {
-		if (!stream->packets.size || stream->keyframes <= 2)
+		if (replay_empty(stream) || total_keyframes(stream) <= 2)
 			return;
 
-		while ((stream->cur_size + (int64_t)pkt->size) >
+		while (!replay_empty(stream) &&
+		       (replay_size(stream) + (int64_t)pkt->size) >
 				stream->max_size)
 			purge(stream);
 	}
 
-	if (!stream->packets.size || stream->keyframes <= 2)
+	if (replay_empty(stream) || total_keyframes(stream) <= 2)
 		return;
 
-	while ((pkt->dts_usec - stream->cur_time) > stream->max_time)
+	while (!replay_empty(stream) &&
+	       (pkt->dts_usec - stream->cur_time) > stream->max_time)
 		purge(stream);
 }
 
-static void insert_packet(struct darray *array, struct encoder_packet *packet,
-		int64_t video_offset, int64_t *audio_offsets,
-		int64_t video_dts_offset, int64_t *audio_dts_offsets)
+/* ------------------------------------------------------------------------ */
+/* replay saves */
+
+static inline void offset_packet(struct replay_save *save,
+		struct encoder_packet *pkt)
 {
-	struct encoder_packet pkt;
-	DARRAY(struct encoder_packet) packets;
-	packets.da = *array;
-	size_t idx;
+	if (pkt->type == OBS_ENCODER_VIDEO) {
+		pkt->dts_usec -= save->video_offset;
+		pkt->dts -= save->video_dts_offset;
+		pkt->pts -= save->video_dts_offset;
+	} else {
+		pkt->dts_usec -= save->audio_offsets[pkt->track_idx];
+		pkt->dts -= save->audio_dts_offsets[pkt->track_idx];
+		pkt->pts -= save->audio_dts_offsets[pkt->track_idx];
+	}
+}
 
-	obs_encoder_packet_ref(&pkt, packet);
+/* streams a segment's packets from disk */
+static bool write_segment(struct replay_save *save,
+		struct replay_segment *seg, uint64_t *bytes)
+{
+	struct ffmpeg_muxer *stream = save->stream;
+	struct replay_packet_info info;
+	DARRAY(uint8_t) data = {0};
+	FILE *file;
+	bool success = true;
+
+	if (seg->failed) {
+		warn("Replay segment '%s' is incomplete", seg->path.array);
+		return false;
+	}
 
-	if (pkt.type == OBS_ENCODER_VIDEO) {
-		pkt.dts_usec -= video_offset;
-		pkt.dts -= video_dts_offset;
-		pkt.pts -= video_dts_offset;
-	} else {
-		pkt.dts_usec -= audio_offsets[pkt.track_idx];
-		pkt.dts -= audio_dts_offsets[pkt.track_idx];
-		pkt.pts -= audio_dts_offsets[pkt.track_idx];
+	file = os_fopen(seg->path.array, "rb");
+	if (!file) {
+		warn("Failed to open replay segment '%s'", seg->path.array);
+		return false;
 	}
 
-	for (idx = packets.num; idx > 0; idx--) {
-		struct encoder_packet *p = packets.array + (idx - 1);
-		if (p->dts_usec < pkt.dts_usec)
+	while (success && fread(&info, sizeof(info), 1, file) == 1) {
+		struct encoder_packet pkt = {
+			.size          = info.size,
+			.pts           = info.pts,
+			.dts           = info.dts,
+			.dts_usec      = info.dts_usec,
+			.sys_dts_usec  = info.sys_dts_usec,
+			.timebase_num  = info.timebase_num,
+			.timebase_den  = info.timebase_den,
+			.type          = (enum obs_encoder_type)info.type,
+			.keyframe      = info.keyframe != 0,
+			.priority      = info.priority,
+			.drop_priority = info.drop_priority,
+			.track_idx     = info.track_idx
+		};
+
+		da_resize(data, info.size);
+		if (fread(data.array, 1, info.size, file) != info.size) {
+			warn("Failed to read replay segment '%s'",
+					seg->path.array);
+			success = false;
 			break;
+		}
+
+		pkt.data = data.array;
+		offset_packet(save, &pkt);
+
+		success = write_packet(stream, &save->mux, &pkt);
+		*bytes += pkt.size;
 	}
 
-	da_insert(packets, idx, &pkt);
-	*array = packets.da;
+	da_free(data);
+	fclose(file);
+	return success;
 }
 
-static void *replay_buffer_mux_thread(void *data)
+static void release_snapshot(struct replay_save *save)
 {
-	struct ffmpeg_muxer *stream = data;
+	for (size_t i = 0; i < save->segments.num; i++)
+		segment_release(save->segments.array[i]);
+	for (size_t i = 0; i < save->blocks.num; i++)
+		block_release(save->blocks.array[i]);
+	da_free(save->segments);
+	da_free(save->blocks);
+}
 
-	start_pipe(stream, stream->path.array);
+static void *replay_save_thread(void *data)
+{
+	struct replay_save *save = data;
+	struct ffmpeg_muxer *stream = save->stream;
+	uint64_t bytes = 0;
+	bool success = false;
 
-	if (!stream->pipe) {
+	if (!start_pipe(stream, &save->mux, save->path.array)) {
 		warn("Failed to create process pipe");
-		goto error;
+		goto finish;
 	}
 
-	if (!send_headers(stream)) {
+	if (!send_headers(stream, &save->mux)) {
 		warn("Could not write headers for file '%s'",
-				stream->path.array);
-		goto error;
+				save->path.array);
+		goto finish;
 	}
 
-	for (size_t i = 0; i < stream->mux_packets.num; i++) {
-		struct encoder_packet *pkt = &stream->mux_packets.array[i];
-		write_packet(stream, pkt);
-		obs_encoder_packet_release(pkt);
+	for (size_t i = 0; i < save->segments.num; i++) {
+		struct replay_segment *seg = save->segments.array[i];
+
+		/* the segment has to be on disk before it can be read */
+		segment_close(seg);
+
+		if (!write_segment(save, seg, &bytes))
+			goto finish;
 	}
 
-	info("Wrote replay buffer to '%s'", stream->path.array);
+	for (uint64_t seq = save->start_seq; seq < save->end_seq; seq++) {
+		struct encoder_packet pkt = *get_packet(save->blocks.array,
+				save->base_seq, seq);
+
+		offset_packet(save, &pkt);
+		if (!write_packet(stream, &save->mux, &pkt))
+			goto finish;
+
+		bytes += pkt.size;
+	}
+
+	success = true;
+
+finish:
+	stop_pipe(stream, &save->mux);
+	release_snapshot(save);
+
+	if (success) {
+		info("Wrote replay buffer to '%s'", save->path.array);
 
-error:
-	os_process_pipe_destroy(stream->pipe);
-	stream->pipe = NULL;
-	da_free(stream->mux_packets);
-	os_atomic_set_bool(&stream->muxing, false);
+		pthread_mutex_lock(&stream->last_replay_mutex);
+		dstr_copy_dstr(&stream->last_replay, &save->path);
+		stream->total_bytes += bytes;
+		pthread_mutex_unlock(&stream->last_replay_mutex);
+	}
+
+	os_atomic_set_bool(&save->done, true);
 	return NULL;
 }
 
-static void replay_buffer_save(struct ffmpeg_muxer *stream)
+static void reap_saves(struct ffmpeg_muxer *stream, bool wait)
+{
+	for (size_t i = stream->saves.num; i > 0; i--) {
+		struct replay_save *save = stream->saves.array[i - 1];
+
+		if (!wait && !os_atomic_load_bool(&save->done))
+			continue;
+
+		pthread_join(save->thread, NULL);
+		dstr_free(&save->path);
+		bfree(save);
+		da_erase(stream->saves, i - 1);
+	}
+}
+
+static bool path_in_use(struct ffmpeg_muxer *stream, const char *path)
 {
-	const size_t size = sizeof(struct encoder_packet);
-	size_t num_packets = stream->packets.size / size;
+	for (size_t i = 0; i < stream->saves.num; i++) {
+		if (strcmp(stream->saves.array[i]->path.array, path) == 0)
+			return true;
+	}
+
+	return os_file_exists(path);
+}
+
+/* saves can overlap, so a replay saved in the same second as another one
+ * gets a number added to its name */
+static void generate_filename(struct ffmpeg_muxer *stream, struct dstr *dst)
+{
+	obs_data_t *settings = obs_output_get_settings(stream->output);
+	const char *dir = obs_data_get_string(settings, "directory");
+	const char *fmt = obs_data_get_string(settings, "format");
+	const char *ext = obs_data_get_string(settings, "extension");
+	bool space = obs_data_get_bool(settings, "allow_spaces");
+	struct dstr base = {0};
 
-	da_reserve(stream->mux_packets, num_packets);
+	char *filename = os_generate_formatted_filename(NULL, space, fmt);
 
-	/* ---------------------------- */
-	/* reorder packets */
+	dstr_copy(&base, dir);
+	dstr_replace(&base, "\\", "/");
+	if (dstr_end(&base) != '/')
+		dstr_cat_ch(&base, '/');
+	dstr_cat(&base, filename);
 
+	dstr_printf(dst, "%s.%s", base.array, ext);
+	for (int i = 2; path_in_use(stream, dst->array); i++)
+		dstr_printf(dst, "%s (%d).%s", base.array, i, ext);
+
+	dstr_free(&base);
+	bfree(filename);
+	obs_data_release(settings);
+}
+
+/* finds the first packet of each track, to offset the saved replay's
+ * timestamps so it starts at 0 */
+static void find_offsets(struct ffmpeg_muxer *stream,
+		struct replay_save *save)
+{
 	bool found_video = false;
 	bool found_audio[MAX_AUDIO_MIXES] = {0};
-	int64_t video_offset = 0;
-	int64_t video_dts_offset = 0;
-	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
-	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
+	size_t num_tracks = 0;
+	size_t found_tracks = 0;
+
+	while (num_tracks < MAX_AUDIO_MIXES &&
+	       obs_output_get_audio_encoder(stream->output, num_tracks))
+		num_tracks++;
+
+	for (size_t i = 0; i < save->segments.num; i++) {
+		struct replay_segment *seg = save->segments.array[i];
+
+		if (seg->has_video && !found_video) {
+			save->video_offset = seg->video_dts_usec;
+			save->video_dts_offset = seg->video_dts;
+			found_video = true;
+		}
 
-	for (size_t i = 0; i < num_packets; i++) {
+		for (size_t j = 0; j < MAX_AUDIO_MIXES; j++) {
+			if (seg->has_audio[j] && !found_audio[j]) {
+				found_audio[j] = true;
+				save->audio_offsets[j] = seg->audio_dts_usec[j];
+				save->audio_dts_offsets[j] = seg->audio_dts[j];
+				found_tracks++;
+			}
+		}
+	}
+
+	/* only has to look at packets until each track has been found */
+	for (uint64_t seq = save->start_seq; seq < save->end_seq; seq++) {
 		struct encoder_packet *pkt;
-		pkt = circlebuf_data(&stream->packets, i * size);
+
+		if (found_video && found_tracks >= num_tracks)
+			break;
+
+		pkt = stream_packet(stream, seq);
 
 		if (pkt->type == OBS_ENCODER_VIDEO) {
 			if (!found_video) {
-				video_offset = pkt->dts_usec;
-				video_dts_offset = pkt->dts;
+				save->video_offset = pkt->dts_usec;
+				save->video_dts_offset = pkt->dts;
 				found_video = true;
 			}
-		} else {
-			if (!found_audio[pkt->track_idx]) {
-				found_audio[pkt->track_idx] = true;
-				audio_offsets[pkt->track_idx] = pkt->dts_usec;
-				audio_dts_offsets[pkt->track_idx] = pkt->dts;
-			}
+		} else if (!found_audio[pkt->track_idx]) {
+			found_audio[pkt->track_idx] = true;
+			save->audio_offsets[pkt->track_idx] = pkt->dts_usec;
+			save->audio_dts_offsets[pkt->track_idx] = pkt->dts;
+			found_tracks++;
 		}
+	}
+}
+
+static void free_save(struct replay_save *save)
+{
+	release_snapshot(save);
+	dstr_free(&save->path);
+	bfree(save);
+}
+
+/* takes a snapshot of the replay buffer and writes it on a new thread.
+ * only references to the segments and packet blocks are taken, so this
+ * doesn't depend on the size of the replay.  returns false if too many
+ * saves are already in progress */
+static bool replay_buffer_save(struct ffmpeg_muxer *stream)
+{
+	struct replay_save *save;
+
+	reap_saves(stream, false);
+	if (stream->saves.num >= MAX_SAVES)
+		return false;
+
+	save = bzalloc(sizeof(*save));
+	save->stream = stream;
 
-		insert_packet(&stream->mux_packets.da, pkt,
-				video_offset, audio_offsets,
-				video_dts_offset, audio_dts_offsets);
+	/* segments on disk hold the oldest packets.  the segment being
+	 * written is finished with here, and closed by the save thread so the
+	 * data thread doesn't wait for it to be written out */
+	stream->cur_segment = NULL;
+
+	for (size_t i = 0; i < stream->segments.num; i++) {
+		struct replay_segment *seg = stream->segments.array[i];
+		os_atomic_inc_long(&seg->refs);
+		da_push_back(save->segments, &seg);
 	}
 
-	/* ---------------------------- */
-	/* generate filename */
+	/* without segments, the replay starts at the first keyframe */
+	save->start_seq = stream->first_seq;
+	save->end_seq = stream->next_seq;
 
-	obs_data_t *settings = obs_output_get_settings(stream->output);
-	const char *dir = obs_data_get_string(settings, "directory");
-	const char *fmt = obs_data_get_string(settings, "format");
-	const char *ext = obs_data_get_string(settings, "extension");
-	bool space = obs_data_get_bool(settings, "allow_spaces");
+	if (!save->segments.num && mem_keyframes(stream))
+		save->start_seq = get_keyframe(stream, 0)->seq;
 
-	char *filename = os_generate_formatted_filename(ext, space, fmt);
+	if (save->start_seq < save->end_seq) {
+		size_t first = (size_t)((save->start_seq - stream->base_seq) /
+				PACKET_BLOCK_SIZE);
+		size_t last = (size_t)((save->end_seq - 1 - stream->base_seq) /
+				PACKET_BLOCK_SIZE);
 
-	dstr_copy(&stream->path, dir);
-	dstr_replace(&stream->path, "\\", "/");
-	if (dstr_end(&stream->path) != '/')
-		dstr_cat_ch(&stream->path, '/');
-	dstr_cat(&stream->path, filename);
+		for (size_t i = first; i <= last; i++) {
+			struct packet_block *block = stream->blocks.array[i];
+			os_atomic_inc_long(&block->refs);
+			da_push_back(save->blocks, &block);
+		}
 
-	bfree(filename);
-	obs_data_release(settings);
+		save->base_seq = stream->base_seq +
+			(uint64_t)first * PACKET_BLOCK_SIZE;
+	}
 
-	/* ---------------------------- */
+	find_offsets(stream, save);
+	generate_filename(stream, &save->path);
 
-	os_atomic_set_bool(&stream->muxing, true);
-	stream->mux_thread_joinable = pthread_create(&stream->mux_thread, NULL,
-			replay_buffer_mux_thread, stream) == 0;
+	if (pthread_create(&save->thread, NULL, replay_save_thread,
+				save) != 0) {
+		warn("Failed to create replay save thread");
+		free_save(save);
+		return true;
+	}
+
+	da_push_back(stream->saves, &save);
+	return true;
 }
 
 static void deactivate_replay_buffer(struct ffmpeg_muxer *stream)
@@ -807,7 +2031,6 @@ static void deactivate_replay_buffer(struct ffmpeg_muxer *stream)
 static void replay_buffer_data(void *data, struct encoder_packet *packet)
 {
 	struct ffmpeg_muxer *stream = data;
-	struct encoder_packet pkt;
 
 	if (!active(stream))
 		return;
@@ -819,36 +2042,34 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	obs_encoder_packet_ref(&pkt, packet);
-	replay_buffer_purge(stream, &pkt);
-
-	if (!stream->packets.size)
-		stream->cur_time = pkt.dts_usec;
-	stream->cur_size += pkt.size;
-
-	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
-
-	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
-		stream->keyframes++;
+	replay_buffer_purge(stream, packet);
+	push_packet(stream, packet);
+	replay_buffer_spill(stream);
 
 	if (stream->save_ts && packet->sys_dts_usec >= stream->save_ts) {
-		if (os_atomic_load_bool(&stream->muxing))
-			return;
+		if (replay_buffer_save(stream))
+			stream->save_ts = 0;
+	}
+}
 
-		if (stream->mux_thread_joinable) {
-			pthread_join(stream->mux_thread, NULL);
-			stream->mux_thread_joinable = false;
-		}
+/* bytes are added by the save threads */
+static uint64_t replay_buffer_total_bytes(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+	uint64_t bytes;
 
-		stream->save_ts = 0;
-		replay_buffer_save(stream);
-	}
+	pthread_mutex_lock(&stream->last_replay_mutex);
+	bytes = stream->total_bytes;
+	pthread_mutex_unlock(&stream->last_replay_mutex);
+	return bytes;
 }
 
 static void replay_buffer_defaults(obs_data_t *s)
 {
 	obs_data_set_default_int(s, "max_time_sec", 15);
 	obs_data_set_default_int(s, "max_size_mb", 500);
+	obs_data_set_default_int(s, "max_memory_mb", 0);
+	obs_data_set_default_string(s, "spill_directory", "");
 	obs_data_set_default_string(s, "format", "%CCYY-%MM-%DD %hh-%mm-%ss");
 	obs_data_set_default_string(s, "extension", "mp4");
 	obs_data_set_default_bool(s, "allow_spaces", true);
@@ -865,6 +2086,6 @@ struct obs_output_info replay_buffer = {
 	.start          = replay_buffer_start,
 	.stop           = ffmpeg_mux_stop,
 	.encoded_packet = replay_buffer_data,
-	.get_total_bytes= ffmpeg_mux_total_bytes,
+	.get_total_bytes= replay_buffer_total_bytes,
 	.get_defaults   = replay_buffer_defaults
 };
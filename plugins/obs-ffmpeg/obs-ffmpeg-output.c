@@ -84,6 +84,7 @@ struct ffmpeg_data {
 	AVFrame            *aframe[MAX_AUDIO_MIXES];
 
 	struct ffmpeg_cfg  config;
+	obs_cpu_claim_t    *cpu_claim;
 
 	bool               initialized;
 };
@@ -184,7 +185,10 @@ static bool open_video_codec(struct ffmpeg_data *data)
 		strlist_free(opts);
 	}
 
+	/* frame/slice threads are created when the codec is opened */
+	obs_cpu_claim_push_affinity(data->cpu_claim);
 	ret = avcodec_open2(context, data->vcodec, NULL);
+	obs_cpu_claim_pop_affinity(data->cpu_claim);
 	if (ret < 0) {
 		blog(LOG_WARNING, "Failed to open video codec: %s",
 				av_err2str(ret));
@@ -258,7 +262,11 @@ static bool create_video_stream(struct ffmpeg_data *data)
 	context->pix_fmt        = closest_format;
 	context->colorspace     = data->config.color_space;
 	context->color_range    = data->config.color_range;
-	context->thread_count   = 0;
+
+	data->cpu_claim = obs_cpu_claim_create(data->config.video_encoder,
+			(uint64_t)context->width * context->height *
+			ovi.fps_num / ovi.fps_den);
+	context->thread_count = obs_cpu_claim_get_threads(data->cpu_claim);
 
 	data->video->time_base = context->time_base;
 
@@ -500,6 +508,7 @@ static void ffmpeg_data_free(struct ffmpeg_data *data)
 		avformat_free_context(data->output);
 	}
 
+	obs_cpu_claim_destroy(data->cpu_claim);
 	memset(data, 0, sizeof(struct ffmpeg_data));
 }
 
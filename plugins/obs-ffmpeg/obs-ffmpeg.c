@@ -18,6 +18,8 @@ extern struct obs_source_info  ffmpeg_source;
 extern struct obs_output_info  ffmpeg_output;
 extern struct obs_output_info  ffmpeg_muxer;
 extern struct obs_output_info  replay_buffer;
+extern struct obs_output_info  ffmpeg_inproc_muxer;
+extern struct obs_output_info  ffmpeg_cmaf_output;
 extern struct obs_encoder_info aac_encoder_info;
 extern struct obs_encoder_info opus_encoder_info;
 extern struct obs_encoder_info nvenc_encoder_info;
@@ -190,6 +192,8 @@ bool obs_module_load(void)
 	obs_register_output(&ffmpeg_output);
 	obs_register_output(&ffmpeg_muxer);
 	obs_register_output(&replay_buffer);
+	obs_register_output(&ffmpeg_inproc_muxer);
+	obs_register_output(&ffmpeg_cmaf_output);
 	obs_register_encoder(&aac_encoder_info);
 	obs_register_encoder(&opus_encoder_info);
 #ifndef __APPLE__
@@ -186,19 +186,26 @@ static void *chroma_key_create(obs_data_t *settings, obs_source_t *context)
 	return filter;
 }
 
-static void chroma_key_render(void *data, gs_effect_t *effect)
+static inline void get_pixel_size(struct chroma_key_filter_data *filter,
+		struct vec2 *pixel_size)
 {
-	struct chroma_key_filter_data *filter = data;
 	obs_source_t *target = obs_filter_get_target(filter->context);
 	uint32_t width = obs_source_get_base_width(target);
 	uint32_t height = obs_source_get_base_height(target);
+
+	vec2_set(pixel_size, 1.0f / (float)width, 1.0f / (float)height);
+}
+
+static void chroma_key_render(void *data, gs_effect_t *effect)
+{
+	struct chroma_key_filter_data *filter = data;
 	struct vec2 pixel_size;
 
 	if (!obs_source_process_filter_begin(filter->context, GS_RGBA,
 				OBS_ALLOW_DIRECT_RENDERING))
 		return;
 
-	vec2_set(&pixel_size, 1.0f / (float)width, 1.0f / (float)height);
+	get_pixel_size(filter, &pixel_size);
 
 	gs_effect_set_vec4(filter->color_param, &filter->color);
 	gs_effect_set_float(filter->contrast_param, filter->contrast);
@@ -216,6 +223,100 @@ static void chroma_key_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+/* same as PSChromaKeyRGBA in chroma_key_filter.effect, for fused passes.  the
+ * box filter samples neighboring pixels, so this must be the first filter of
+ * the fused pass */
+static const char *chroma_key_fused =
+"uniform float4x4 FUSE_yuv_mat = { 0.182586,  0.614231,  0.062007, 0.062745,\n"
+"                                 -0.100644, -0.338572,  0.439216, 0.501961,\n"
+"                                  0.439216, -0.398942, -0.040274, 0.501961,\n"
+"                                  0.000000,  0.000000,  0.000000, 1.000000};\n"
+"\n"
+"uniform float4 FUSE_color;\n"
+"uniform float FUSE_contrast;\n"
+"uniform float FUSE_brightness;\n"
+"uniform float FUSE_gamma;\n"
+"\n"
+"uniform float2 FUSE_chroma_key;\n"
+"uniform float2 FUSE_pixel_size;\n"
+"uniform float FUSE_similarity;\n"
+"uniform float FUSE_smoothness;\n"
+"uniform float FUSE_spill;\n"
+"\n"
+"float FUSE_GetChromaDist(float3 rgb)\n"
+"{\n"
+"	float4 yuvx = mul(float4(rgb.rgb, 1.0), FUSE_yuv_mat);\n"
+"	return distance(FUSE_chroma_key, yuvx.yz);\n"
+"}\n"
+"\n"
+"float3 FUSE_Sample(float2 uv)\n"
+"{\n"
+"	return image.Sample(fused_sampler, uv).rgb;\n"
+"}\n"
+"\n"
+"float4 FUSE_main(float4 rgba, float2 uv)\n"
+"{\n"
+"	float2 h_pixel_size = FUSE_pixel_size / 2.0;\n"
+"	float2 point_0 = float2(FUSE_pixel_size.x, h_pixel_size.y);\n"
+"	float2 point_1 = float2(h_pixel_size.x, -FUSE_pixel_size.y);\n"
+"	float distVal = FUSE_GetChromaDist(FUSE_Sample(uv - point_0));\n"
+"	distVal += FUSE_GetChromaDist(FUSE_Sample(uv + point_0));\n"
+"	distVal += FUSE_GetChromaDist(FUSE_Sample(uv - point_1));\n"
+"	distVal += FUSE_GetChromaDist(FUSE_Sample(uv + point_1));\n"
+"	distVal *= 2.0;\n"
+"	distVal += FUSE_GetChromaDist(rgba.rgb);\n"
+"	distVal /= 9.0;\n"
+"\n"
+"	float baseMask = distVal - FUSE_similarity;\n"
+"	float fullMask = pow(saturate(baseMask / FUSE_smoothness), 1.5);\n"
+"	float spillVal = pow(saturate(baseMask / FUSE_spill), 1.5);\n"
+"\n"
+"	rgba.rgba *= FUSE_color;\n"
+"	rgba.a *= fullMask;\n"
+"\n"
+"	float desat = (rgba.r * 0.2126 + rgba.g * 0.7152 + rgba.b * 0.0722);\n"
+"	rgba.rgb = saturate(float3(desat, desat, desat)) * (1.0 - spillVal) +\n"
+"			rgba.rgb * spillVal;\n"
+"\n"
+"	float3 gamma = float3(FUSE_gamma, FUSE_gamma, FUSE_gamma);\n"
+"	return float4(pow(rgba.rgb, gamma) * FUSE_contrast +\n"
+"			FUSE_brightness, rgba.a);\n"
+"}\n";
+
+static const char *chroma_key_fused_shader(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return chroma_key_fused;
+}
+
+static void chroma_key_fused_params(void *data)
+{
+	struct chroma_key_filter_data *filter = data;
+	obs_source_t *context = filter->context;
+	struct vec2 pixel_size;
+
+	get_pixel_size(filter, &pixel_size);
+
+	gs_effect_set_vec4(obs_filter_get_fused_param(context, "color"),
+			&filter->color);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "contrast"),
+			filter->contrast);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "brightness"),
+			filter->brightness);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "gamma"),
+			filter->gamma);
+	gs_effect_set_vec2(obs_filter_get_fused_param(context, "chroma_key"),
+			&filter->chroma);
+	gs_effect_set_vec2(obs_filter_get_fused_param(context, "pixel_size"),
+			&pixel_size);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "similarity"),
+			filter->similarity);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "smoothness"),
+			filter->smoothness);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "spill"),
+			filter->spill);
+}
+
 static bool key_type_changed(obs_properties_t *props, obs_property_t *p,
 		obs_data_t *settings)
 {
@@ -284,6 +385,9 @@ struct obs_source_info chroma_key_filter = {
 	.create                        = chroma_key_create,
 	.destroy                       = chroma_key_destroy,
 	.video_render                  = chroma_key_render,
+	.get_fused_shader              = chroma_key_fused_shader,
+	.fused_set_params              = chroma_key_fused_params,
+	.fused_flags                   = OBS_FUSED_NEIGHBORHOOD,
 	.update                        = chroma_key_update,
 	.get_properties                = chroma_key_properties,
 	.get_defaults                  = chroma_key_defaults
@@ -340,6 +340,38 @@ static void color_correction_filter_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+/*
+ * When this filter is next to other simple filters on a source, OBS can fuse
+ * them into one pass using the fragment below instead of rendering each one
+ * to its own texture.  The math is the same as color_correction_filter.effect.
+ */
+static const char *color_correction_fused =
+"uniform float3 FUSE_gamma;\n"
+"uniform float4x4 FUSE_color_matrix;\n"
+"\n"
+"float4 FUSE_main(float4 rgba, float2 uv)\n"
+"{\n"
+"	rgba.rgb = pow(rgba.rgb, FUSE_gamma);\n"
+"	return mul(FUSE_color_matrix, rgba);\n"
+"}\n";
+
+static const char *color_correction_filter_fused_shader(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return color_correction_fused;
+}
+
+static void color_correction_filter_fused_params(void *data)
+{
+	struct color_correction_filter_data *filter = data;
+	obs_source_t *context = filter->context;
+
+	gs_effect_set_vec3(obs_filter_get_fused_param(context, "gamma"),
+			&filter->gamma);
+	gs_effect_set_matrix4(obs_filter_get_fused_param(context,
+			"color_matrix"), &filter->final_matrix);
+}
+
 /*
  * This function sets the interface. the types (add_*_Slider), the type of
  * data collected (int), the internal name, user-facing name, minimum,
@@ -407,6 +439,8 @@ struct obs_source_info color_filter = {
 	.create = color_correction_filter_create,
 	.destroy = color_correction_filter_destroy,
 	.video_render = color_correction_filter_render,
+	.get_fused_shader = color_correction_filter_fused_shader,
+	.fused_set_params = color_correction_filter_fused_params,
 	.update = color_correction_filter_update,
 	.get_properties = color_correction_filter_properties,
 	.get_defaults = color_correction_filter_defaults
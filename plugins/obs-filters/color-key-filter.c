@@ -183,6 +183,56 @@ static void color_key_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+/* same as PSColorKeyRGBA in color_key_filter.effect, for fused passes */
+static const char *color_key_fused =
+"uniform float4 FUSE_color;\n"
+"uniform float FUSE_contrast;\n"
+"uniform float FUSE_brightness;\n"
+"uniform float FUSE_gamma;\n"
+"uniform float4 FUSE_key_color;\n"
+"uniform float FUSE_similarity;\n"
+"uniform float FUSE_smoothness;\n"
+"\n"
+"float4 FUSE_main(float4 rgba, float2 uv)\n"
+"{\n"
+"	rgba *= FUSE_color;\n"
+"\n"
+"	float colorDist = distance(FUSE_key_color.rgb, rgba.rgb);\n"
+"	rgba.a *= saturate(max(colorDist - FUSE_similarity, 0.0) /\n"
+"			FUSE_smoothness);\n"
+"\n"
+"	float3 gamma = float3(FUSE_gamma, FUSE_gamma, FUSE_gamma);\n"
+"	return float4(pow(rgba.rgb, gamma) * FUSE_contrast +\n"
+"			FUSE_brightness, rgba.a);\n"
+"}\n";
+
+static const char *color_key_fused_shader(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return color_key_fused;
+}
+
+static void color_key_fused_params(void *data)
+{
+	struct color_key_filter_data *filter = data;
+	obs_source_t *context = filter->context;
+
+	gs_effect_set_vec4(obs_filter_get_fused_param(context, "color"),
+			&filter->color);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "contrast"),
+			filter->contrast);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "brightness"),
+			filter->brightness);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "gamma"),
+			filter->gamma);
+	gs_effect_set_vec4(obs_filter_get_fused_param(context, "key_color"),
+			&filter->key_color);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "similarity"),
+			filter->similarity);
+	gs_effect_set_float(obs_filter_get_fused_param(context, "smoothness"),
+			filter->smoothness);
+}
+
 static bool key_type_changed(obs_properties_t *props, obs_property_t *p,
 		obs_data_t *settings)
 {
@@ -250,6 +300,8 @@ struct obs_source_info color_key_filter = {
 	.create                        = color_key_create,
 	.destroy                       = color_key_destroy,
 	.video_render                  = color_key_render,
+	.get_fused_shader              = color_key_fused_shader,
+	.fused_set_params              = color_key_fused_params,
 	.update                        = color_key_update,
 	.get_properties                = color_key_properties,
 	.get_defaults                  = color_key_defaults
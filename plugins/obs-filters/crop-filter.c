@@ -195,6 +195,38 @@ static void crop_filter_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+/* same as crop_filter.effect, for fused passes.  cropping remaps the texture
+ * coordinates of the pass, so this must be the first filter of the pass */
+static const char *crop_filter_fused =
+"uniform float2 FUSE_mul_val;\n"
+"uniform float2 FUSE_add_val;\n"
+"\n"
+"float2 FUSE_uv(float2 uv)\n"
+"{\n"
+"	return uv * FUSE_mul_val + FUSE_add_val;\n"
+"}\n"
+"\n"
+"float4 FUSE_main(float4 rgba, float2 uv)\n"
+"{\n"
+"	return image.Sample(fused_border_sampler, uv);\n"
+"}\n";
+
+static const char *crop_filter_fused_shader(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return crop_filter_fused;
+}
+
+static void crop_filter_fused_params(void *data)
+{
+	struct crop_filter_data *filter = data;
+
+	gs_effect_set_vec2(obs_filter_get_fused_param(filter->context,
+			"mul_val"), &filter->mul_val);
+	gs_effect_set_vec2(obs_filter_get_fused_param(filter->context,
+			"add_val"), &filter->add_val);
+}
+
 static uint32_t crop_filter_width(void *data)
 {
 	struct crop_filter_data *crop = data;
@@ -219,6 +251,10 @@ struct obs_source_info crop_filter = {
 	.get_defaults                  = crop_filter_defaults,
 	.video_tick                    = crop_filter_tick,
 	.video_render                  = crop_filter_render,
+	.get_fused_shader              = crop_filter_fused_shader,
+	.fused_set_params              = crop_filter_fused_params,
+	.fused_flags                   = OBS_FUSED_TRANSFORM_UV |
+	                                 OBS_FUSED_NEIGHBORHOOD,
 	.get_width                     = crop_filter_width,
 	.get_height                    = crop_filter_height
 };
@@ -96,6 +96,64 @@ static void sharpness_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+/* same as PSDrawBare in sharpness.effect, with the neighborhood offsets
+ * computed per pixel, for fused passes */
+static const char *sharpness_fused =
+"uniform float FUSE_sharpness;\n"
+"uniform float FUSE_texture_width;\n"
+"uniform float FUSE_texture_height;\n"
+"\n"
+"float4 FUSE_Sample(float2 uv)\n"
+"{\n"
+"	return image.Sample(fused_sampler, uv);\n"
+"}\n"
+"\n"
+"float4 FUSE_main(float4 E, float2 uv)\n"
+"{\n"
+"	float dx = 1.0 / FUSE_texture_width;\n"
+"	float dy = 1.0 / FUSE_texture_height;\n"
+"\n"
+"	float4 colorx = 8*E;\n"
+"	float4 B = FUSE_Sample(uv + float2(  0, -dy));\n"
+"	float4 D = FUSE_Sample(uv + float2(-dx,   0));\n"
+"	float4 F = FUSE_Sample(uv + float2( dx,   0));\n"
+"	float4 H = FUSE_Sample(uv + float2(  0,  dy));\n"
+"	colorx -= FUSE_Sample(uv + float2(-dx, -dy));\n"
+"	colorx -= B;\n"
+"	colorx -= FUSE_Sample(uv + float2( dx, -dy));\n"
+"	colorx -= D;\n"
+"	colorx -= F;\n"
+"	colorx -= FUSE_Sample(uv + float2(-dx,  dy));\n"
+"	colorx -= H;\n"
+"	colorx -= FUSE_Sample(uv + float2( dx,  dy));\n"
+"\n"
+"	return ((E!=F && E!=D) || (E!=B && E!=H)) ?\n"
+"		saturate(E + colorx*FUSE_sharpness) : E;\n"
+"}\n";
+
+static const char *sharpness_fused_shader(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return sharpness_fused;
+}
+
+static void sharpness_fused_params(void *data)
+{
+	struct sharpness_data *filter = data;
+	obs_source_t *context = filter->context;
+	obs_source_t *target = obs_filter_get_target(context);
+
+	filter->texwidth = (float)obs_source_get_width(target);
+	filter->texheight = (float)obs_source_get_height(target);
+
+	gs_effect_set_float(obs_filter_get_fused_param(context, "sharpness"),
+			filter->sharpness);
+	gs_effect_set_float(obs_filter_get_fused_param(context,
+			"texture_width"), filter->texwidth);
+	gs_effect_set_float(obs_filter_get_fused_param(context,
+			"texture_height"), filter->texheight);
+}
+
 static obs_properties_t *sharpness_properties(void *data)
 {
 	obs_properties_t *props = obs_properties_create();
@@ -121,6 +179,9 @@ struct obs_source_info sharpness_filter = {
 	.destroy = sharpness_destroy,
 	.update = sharpness_update,
 	.video_render = sharpness_render,
+	.get_fused_shader = sharpness_fused_shader,
+	.fused_set_params = sharpness_fused_params,
+	.fused_flags = OBS_FUSED_NEIGHBORHOOD,
 	.get_properties = sharpness_properties,
 	.get_defaults = sharpness_defaults
 };
@@ -42,18 +42,18 @@ static inline double encoder_bitrate(obs_encoder_t *encoder)
 
 #define FLV_INFO_SIZE_OFFSET 42
 
-void write_file_info(FILE *file, int64_t duration_ms, int64_t size)
+void write_file_info(struct serializer *s, int64_t duration_ms, int64_t size)
 {
 	char buf[64];
 	char *enc = buf;
 	char *end = enc + sizeof(buf);
 
-	fseek(file, FLV_INFO_SIZE_OFFSET, SEEK_SET);
+	serializer_seek(s, FLV_INFO_SIZE_OFFSET, SERIALIZE_SEEK_START);
 
 	enc_num_val(&enc, end, "duration", (double)duration_ms / 1000.0);
 	enc_num_val(&enc, end, "fileSize", (double)size);
 
-	fwrite(buf, 1, enc - buf, file);
+	s_write(s, buf, enc - buf);
 }
 
 static bool build_flv_meta_data(obs_output_t *context,
@@ -189,11 +189,31 @@ bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 static int32_t last_time = 0;
 #endif
 
+size_t flv_packet_body_prefix(struct encoder_packet *packet, bool is_header,
+		uint8_t *prefix)
+{
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		int32_t offset = get_ms_time(packet, packet->pts - packet->dts);
+
+		prefix[0] = packet->keyframe ? 0x17 : 0x27;
+		prefix[1] = is_header ? 0 : 1;
+		prefix[2] = (uint8_t)(offset >> 16);
+		prefix[3] = (uint8_t)(offset >> 8);
+		prefix[4] = (uint8_t)offset;
+		return 5;
+	}
+
+	prefix[0] = 0xaf;
+	prefix[1] = is_header ? 0 : 1;
+	return 2;
+}
+
 static void flv_video(struct serializer *s, int32_t dts_offset,
 		struct encoder_packet *packet, bool is_header)
 {
-	int64_t offset  = packet->pts - packet->dts;
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
+	uint8_t prefix[FLV_MAX_BODY_PREFIX];
+	int64_t start = serializer_get_pos(s);
 
 	if (!packet->data || !packet->size)
 		return;
@@ -215,19 +235,19 @@ static void flv_video(struct serializer *s, int32_t dts_offset,
 	s_wb24(s, 0);
 
 	/* these are the 5 extra bytes mentioned above */
-	s_w8(s, packet->keyframe ? 0x17 : 0x27);
-	s_w8(s, is_header ? 0 : 1);
-	s_wb24(s, get_ms_time(packet, offset));
+	s_write(s, prefix, flv_packet_body_prefix(packet, is_header, prefix));
 	s_write(s, packet->data, packet->size);
 
 	/* write tag size (starting byte doesn't count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	s_wb32(s, (uint32_t)(serializer_get_pos(s) - start) - 1);
 }
 
 static void flv_audio(struct serializer *s, int32_t dts_offset,
 		struct encoder_packet *packet, bool is_header)
 {
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
+	uint8_t prefix[FLV_MAX_BODY_PREFIX];
+	int64_t start = serializer_get_pos(s);
 
 	if (!packet->data || !packet->size)
 		return;
@@ -249,12 +269,20 @@ static void flv_audio(struct serializer *s, int32_t dts_offset,
 	s_wb24(s, 0);
 
 	/* these are the two extra bytes mentioned above */
-	s_w8(s, 0xaf);
-	s_w8(s, is_header ? 0 : 1);
+	s_write(s, prefix, flv_packet_body_prefix(packet, is_header, prefix));
 	s_write(s, packet->data, packet->size);
 
 	/* write tag size (starting byte doesn't count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	s_wb32(s, (uint32_t)(serializer_get_pos(s) - start) - 1);
+}
+
+void flv_packet_write(struct serializer *s, struct encoder_packet *packet,
+		int32_t dts_offset, bool is_header)
+{
+	if (packet->type == OBS_ENCODER_VIDEO)
+		flv_video(s, dts_offset, packet, is_header);
+	else
+		flv_audio(s, dts_offset, packet, is_header);
 }
 
 void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
@@ -264,11 +292,7 @@ void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
 	struct serializer s;
 
 	array_output_serializer_init(&s, &data);
-
-	if (packet->type == OBS_ENCODER_VIDEO)
-		flv_video(&s, dts_offset, packet, is_header);
-	else
-		flv_audio(&s, dts_offset, packet, is_header);
+	flv_packet_write(&s, packet, dts_offset, is_header);
 
 	*output = data.bytes.array;
 	*size   = data.bytes.num;
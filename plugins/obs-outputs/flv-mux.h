@@ -18,6 +18,7 @@
 #pragma once
 
 #include <obs.h>
+#include <util/serializer.h>
 
 #define MILLISECOND_DEN   1000
 
@@ -26,9 +27,22 @@ static int32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 	return (int32_t)(val * MILLISECOND_DEN / packet->timebase_den);
 }
 
-extern void write_file_info(FILE *file, int64_t duration_ms, int64_t size);
+extern void write_file_info(struct serializer *s, int64_t duration_ms,
+		int64_t size);
 
 extern bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 		bool write_header, size_t audio_idx);
+/* the bytes of an FLV tag body that precede the encoded packet data: the
+ * codec/frame type, packet type and (for video) composition time offset */
+#define FLV_MAX_BODY_PREFIX 5
+
+extern size_t flv_packet_body_prefix(struct encoder_packet *packet,
+		bool is_header, uint8_t *prefix);
+
+/* writes the FLV tag for a packet straight to a serializer */
+extern void flv_packet_write(struct serializer *s,
+		struct encoder_packet *packet, int32_t dts_offset,
+		bool is_header);
+
 extern void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
 		uint8_t **output, size_t *size, bool is_header);
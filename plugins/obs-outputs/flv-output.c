@@ -21,6 +21,9 @@
 #include <util/platform.h>
 #include <util/dstr.h>
 #include <util/threading.h>
+#include <util/darray.h>
+#include <util/buffered-file-serializer.h>
+#include <util/file-split.h>
 #include <inttypes.h>
 #include "flv-mux.h"
 
@@ -34,7 +37,6 @@
 struct flv_output {
 	obs_output_t    *output;
 	struct dstr     path;
-	FILE            *file;
 	volatile bool   active;
 	volatile bool   stopping;
 	uint64_t        stop_ts;
@@ -43,8 +45,34 @@ struct flv_output {
 
 	pthread_mutex_t mutex;
 
+	/* tags are written straight in to the buffers of a buffered file
+	 * serializer, which writes them to disk from its own thread, so a
+	 * slow disk doesn't hold up the encoders until the buffer is full */
+	struct serializer file;
+	bool            file_open;
+	size_t          buffer_size;
+	enum buffered_file_sync sync_mode;
+
 	bool            got_first_video;
 	int32_t         start_dts_offset;
+
+	/* file splitting.  a new file is started at the first keyframe past
+	 * the split limits, and the previous one is finished on its own
+	 * thread */
+	struct file_split split;
+	int64_t         file_start_ms;
+	uint64_t        file_bytes;
+	DARRAY(struct closing_file*) closing;
+};
+
+/* a split file that's being finished */
+struct closing_file {
+	struct flv_output *stream;
+	struct serializer file;
+	struct dstr       path;
+	int64_t           duration_ms;
+	pthread_t         thread;
+	volatile bool     done;
 };
 
 static inline bool stopping(struct flv_output *stream)
@@ -64,13 +92,17 @@ static const char *flv_output_getname(void *unused)
 }
 
 static void flv_output_stop(void *data, uint64_t ts);
+static void reap_closing_files(struct flv_output *stream, bool wait);
 
 static void flv_output_destroy(void *data)
 {
 	struct flv_output *stream = data;
 
+	reap_closing_files(stream, true);
+	da_free(stream->closing);
 	pthread_mutex_destroy(&stream->mutex);
 	dstr_free(&stream->path);
+	file_split_free(&stream->split);
 	bfree(stream);
 }
 
@@ -84,19 +116,63 @@ static void *flv_output_create(obs_data_t *settings, obs_output_t *output)
 	return stream;
 }
 
+static bool open_file(struct flv_output *stream, struct serializer *s,
+		const char *path)
+{
+	if (!buffered_file_serializer_init(s, path, 0, stream->buffer_size,
+				false))
+		return false;
+
+	buffered_file_serializer_set_sync(s, stream->sync_mode);
+	return true;
+}
+
+static void log_write_stats(struct flv_output *stream, struct serializer *s,
+		const char *path)
+{
+	struct buffered_file_stats stats;
+	buffered_file_serializer_get_stats(s, &stats);
+
+	if (!stats.chunks_written)
+		return;
+
+	info("Disk writes for '%s': %"PRIu64" chunks, "
+	     "%.2f ms average, %.2f ms max, "
+	     "%"PRIu64" buffer stalls (%.2f ms total)",
+	     path, stats.chunks_written,
+	     (double)stats.total_write_ns /
+		     (double)stats.chunks_written / 1000000.0,
+	     (double)stats.max_write_ns / 1000000.0,
+	     stats.stalls, (double)stats.total_stall_ns / 1000000.0);
+}
+
+/* writes the duration/size info and closes the file */
+static bool finish_file(struct flv_output *stream, struct serializer *s,
+		int64_t duration_ms, const char *path)
+{
+	write_file_info(s, duration_ms, serializer_get_pos(s));
+	log_write_stats(stream, s, path);
+
+	if (!buffered_file_serializer_free(s)) {
+		warn("Failed to write FLV file '%s'", path);
+		return false;
+	}
+
+	return true;
+}
+
 static int write_packet(struct flv_output *stream,
 		struct encoder_packet *packet, bool is_header)
 {
-	uint8_t *data;
-	size_t  size;
+	int64_t start = serializer_get_pos(&stream->file);
 	int     ret = 0;
 
 	stream->last_packet_ts = get_ms_time(packet, packet->dts);
 
-	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset,
-			&data, &size, is_header);
-	fwrite(data, 1, size, stream->file);
-	bfree(data);
+	flv_packet_write(&stream->file, packet,
+			is_header ? 0 : stream->start_dts_offset, is_header);
+
+	stream->file_bytes += serializer_get_pos(&stream->file) - start;
 
 	return ret;
 }
@@ -107,7 +183,7 @@ static void write_meta_data(struct flv_output *stream)
 	size_t  meta_data_size;
 
 	flv_meta_data(stream->output, &meta_data, &meta_data_size, true, 0);
-	fwrite(meta_data, 1, meta_data_size, stream->file);
+	s_write(&stream->file, meta_data, meta_data_size);
 	bfree(meta_data);
 }
 
@@ -170,10 +246,22 @@ static bool flv_output_start(void *data)
 	settings = obs_output_get_settings(stream->output);
 	path = obs_data_get_string(settings, "path");
 	dstr_copy(&stream->path, path);
+	file_split_init(&stream->split, path,
+			obs_data_get_string(settings, "split_format"),
+			obs_data_get_int(settings, "max_time_sec") * 1000LL,
+			(uint64_t)obs_data_get_int(settings, "max_size_mb") *
+			(1024 * 1024));
+	stream->file_start_ms = 0;
+	stream->file_bytes = 0;
+	stream->buffer_size = (size_t)obs_data_get_int(settings,
+			"buffer_size_mb") * 1024 * 1024;
+	stream->sync_mode = (enum buffered_file_sync)obs_data_get_int(
+			settings, "sync_mode");
 	obs_data_release(settings);
 
-	stream->file = os_fopen(stream->path.array, "wb");
-	if (!stream->file) {
+	stream->file_open = open_file(stream, &stream->file,
+			stream->path.array);
+	if (!stream->file_open) {
 		warn("Unable to open FLV file '%s'", stream->path.array);
 		return false;
 	}
@@ -193,21 +281,139 @@ static void flv_output_stop(void *data, uint64_t ts)
 	os_atomic_set_bool(&stream->stopping, true);
 }
 
+static bool close_current_file(struct flv_output *stream)
+{
+	bool success = true;
+
+	if (stream->file_open) {
+		success = finish_file(stream, &stream->file,
+				stream->last_packet_ts - stream->file_start_ms,
+				stream->path.array);
+		stream->file_open = false;
+	}
+
+	reap_closing_files(stream, true);
+	return success;
+}
+
 static void flv_output_actual_stop(struct flv_output *stream)
 {
 	os_atomic_set_bool(&stream->active, false);
 
-	if (stream->file) {
-		write_file_info(stream->file, stream->last_packet_ts,
-				os_ftelli64(stream->file));
-
-		fclose(stream->file);
-	}
+	close_current_file(stream);
 	obs_output_end_data_capture(stream->output);
 
 	info("FLV file output complete");
 }
 
+/* a write failed (disk full for example) */
+static void flv_output_failed(struct flv_output *stream)
+{
+	os_atomic_set_bool(&stream->active, false);
+
+	close_current_file(stream);
+	obs_output_signal_stop(stream->output, OBS_OUTPUT_ERROR);
+}
+
+/* ------------------------------------------------------------------------ */
+/* file splitting */
+
+static void *close_file_thread(void *data)
+{
+	struct closing_file *cf = data;
+	struct flv_output *stream = cf->stream;
+
+	os_set_thread_name("flv-output: close file");
+
+	if (finish_file(stream, &cf->file, cf->duration_ms, cf->path.array))
+		info("Finished FLV file '%s'", cf->path.array);
+
+	os_atomic_set_bool(&cf->done, true);
+	return NULL;
+}
+
+static void reap_closing_files(struct flv_output *stream, bool wait)
+{
+	for (size_t i = stream->closing.num; i > 0; i--) {
+		struct closing_file *cf = stream->closing.array[i - 1];
+
+		if (!wait && !os_atomic_load_bool(&cf->done))
+			continue;
+
+		pthread_join(cf->thread, NULL);
+		dstr_free(&cf->path);
+		bfree(cf);
+		da_erase(stream->closing, i - 1);
+	}
+}
+
+static void close_file_async(struct flv_output *stream)
+{
+	struct closing_file *cf = bzalloc(sizeof(*cf));
+	cf->stream = stream;
+	cf->file = stream->file;
+	cf->duration_ms = stream->last_packet_ts - stream->file_start_ms;
+	dstr_copy_dstr(&cf->path, &stream->path);
+
+	memset(&stream->file, 0, sizeof(stream->file));
+
+	if (pthread_create(&cf->thread, NULL, close_file_thread, cf) != 0) {
+		close_file_thread(cf);
+		dstr_free(&cf->path);
+		bfree(cf);
+		return;
+	}
+
+	da_push_back(stream->closing, &cf);
+}
+
+static inline bool split_due(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	if (packet->type != OBS_ENCODER_VIDEO || !packet->keyframe)
+		return false;
+
+	return file_split_due(&stream->split, get_ms_time(packet, packet->dts),
+			stream->file_bytes);
+}
+
+/* opens the next file, which starts with the keyframe packet.  if it
+ * can't be opened, the current file is kept */
+static void split_file(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	struct dstr path = {0};
+	struct serializer file;
+
+	file_split_next_path(&stream->split, &path);
+
+	if (!open_file(stream, &file, path.array)) {
+		warn("Unable to open FLV file '%s', continuing to write "
+		     "'%s'", path.array, stream->path.array);
+		dstr_free(&path);
+		file_split_start(&stream->split,
+				get_ms_time(packet, packet->dts), 0);
+		stream->file_bytes = 0;
+		return;
+	}
+
+	reap_closing_files(stream, false);
+	close_file_async(stream);
+
+	stream->file = file;
+	dstr_move(&stream->path, &path);
+
+	stream->start_dts_offset = get_ms_time(packet, packet->dts);
+	file_split_start(&stream->split, stream->start_dts_offset, 0);
+	stream->file_start_ms = stream->start_dts_offset;
+	stream->file_bytes = 0;
+	write_headers(stream);
+
+	info("Writing FLV file '%s'...", stream->path.array);
+}
+
+/* ------------------------------------------------------------------------ */
+
 static void flv_output_data(void *data, struct encoder_packet *packet)
 {
 	struct flv_output     *stream = data;
@@ -230,10 +436,15 @@ static void flv_output_data(void *data, struct encoder_packet *packet)
 		stream->sent_headers = true;
 	}
 
+	if (split_due(stream, packet))
+		split_file(stream, packet);
+
 	if (packet->type == OBS_ENCODER_VIDEO) {
 		if (!stream->got_first_video) {
 			stream->start_dts_offset =
 				get_ms_time(packet, packet->dts);
+			file_split_start(&stream->split,
+					stream->start_dts_offset, 0);
 			stream->got_first_video = true;
 		}
 
@@ -244,19 +455,57 @@ static void flv_output_data(void *data, struct encoder_packet *packet)
 		write_packet(stream, packet, false);
 	}
 
+	if (buffered_file_serializer_failed(&stream->file)) {
+		warn("Failed to write to FLV file '%s'", stream->path.array);
+		flv_output_failed(stream);
+	}
+
 unlock:
 	pthread_mutex_unlock(&stream->mutex);
 }
 
+static void flv_output_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, "buffer_size_mb", 16);
+	obs_data_set_default_int(settings, "sync_mode",
+			BUFFERED_FILE_SYNC_NONE);
+}
+
 static obs_properties_t *flv_output_properties(void *unused)
 {
 	UNUSED_PARAMETER(unused);
 
 	obs_properties_t *props = obs_properties_create();
+	obs_property_t *p;
 
 	obs_properties_add_text(props, "path",
 			obs_module_text("FLVOutput.FilePath"),
 			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, "max_time_sec",
+			obs_module_text("FLVOutput.SplitTime"),
+			0, 24 * 3600, 60);
+	obs_properties_add_int(props, "max_size_mb",
+			obs_module_text("FLVOutput.SplitSize"),
+			0, 1024 * 1024, 256);
+	obs_properties_add_text(props, "split_format",
+			obs_module_text("FLVOutput.SplitFormat"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, "buffer_size_mb",
+			obs_module_text("FLVOutput.WriteBufferSize"),
+			2, 1024, 1);
+
+	p = obs_properties_add_list(props, "sync_mode",
+			obs_module_text("FLVOutput.SyncMode"),
+			OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p,
+			obs_module_text("FLVOutput.SyncMode.None"),
+			BUFFERED_FILE_SYNC_NONE);
+	obs_property_list_add_int(p,
+			obs_module_text("FLVOutput.SyncMode.OnClose"),
+			BUFFERED_FILE_SYNC_ON_CLOSE);
+	obs_property_list_add_int(p,
+			obs_module_text("FLVOutput.SyncMode.EveryChunk"),
+			BUFFERED_FILE_SYNC_EVERY_CHUNK);
 	return props;
 }
 
@@ -271,5 +520,6 @@ struct obs_output_info flv_output_info = {
 	.start                = flv_output_start,
 	.stop                 = flv_output_stop,
 	.encoded_packet       = flv_output_data,
+	.get_defaults         = flv_output_defaults,
 	.get_properties       = flv_output_properties
 };
@@ -1702,6 +1702,94 @@ WriteN(RTMP *r, const char *buffer, int n)
     return n == 0;
 }
 
+/* sends the buffers in order.  buffers are gathered in to a single write
+ * whenever possible, and only copied in to one contiguous buffer when the
+ * transport can't gather them (HTTP tunneling, TLS, or RC4 encryption) */
+static int
+WriteV(RTMP *r, RTMPBuf *bufs, int count)
+{
+    int coalesce = (r->Link.protocol & RTMP_FEATURE_HTTP) != 0 ||
+                   r->m_sb.sb_ssl != NULL;
+    int total = 0;
+    int i;
+
+#ifdef CRYPTO
+    if (r->Link.rc4keyOut)
+        coalesce = TRUE;
+#endif
+
+    for (i = 0; i < count; i++)
+        total += bufs[i].size;
+
+    if (r->m_bCustomSend && r->m_customSendFunc)
+    {
+        if (r->m_customSendVFunc)
+            return r->m_customSendVFunc(&r->m_sb, bufs, count,
+                                        r->m_customSendParam) == total;
+        coalesce = TRUE;
+    }
+
+    if (coalesce)
+    {
+        char *tbuf = malloc(total);
+        char *toff = tbuf;
+        int wrote;
+
+        if (!tbuf)
+            return FALSE;
+
+        for (i = 0; i < count; i++)
+        {
+            memcpy(toff, bufs[i].data, bufs[i].size);
+            toff += bufs[i].size;
+        }
+
+        wrote = WriteN(r, tbuf, total);
+        free(tbuf);
+        return wrote;
+    }
+
+    while (count > 0)
+    {
+        int nBytes = RTMPSockBuf_SendV(&r->m_sb, bufs, count);
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d bytes)", __FUNCTION__,
+                     sockerr, total);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            r->last_error_code = sockerr;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        total -= nBytes;
+
+        /* skip what was sent, partial writes resume mid-buffer */
+        while (count > 0 && nBytes >= bufs->size)
+        {
+            nBytes -= bufs->size;
+            bufs++;
+            count--;
+        }
+        if (count > 0)
+        {
+            bufs->data += nBytes;
+            bufs->size -= nBytes;
+        }
+    }
+
+    return TRUE;
+}
+
 #define SAVC(x)	static const AVal av_##x = AVC(#x)
 
 SAVC(app);
@@ -4195,22 +4283,12 @@ RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
     return wrote;
 }
 
-int
-RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+static int
+EnsureChannelsOut(RTMP *r, int channel)
 {
-    const RTMPPacket *prevPacket;
-    uint32_t last = 0;
-    int nSize;
-    int hSize, cSize;
-    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
-    uint32_t t;
-    char *buffer, *tbuf = NULL, *toff = NULL;
-    int nChunkSize;
-    int tlen;
-
-    if (packet->m_nChannel >= r->m_channelsAllocatedOut)
+    if (channel >= r->m_channelsAllocatedOut)
     {
-        int n = packet->m_nChannel + 10;
+        int n = channel + 10;
         RTMPPacket **packets = realloc(r->m_vecChannelsOut, sizeof(RTMPPacket*) * n);
         if (!packets)
         {
@@ -4223,6 +4301,24 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
         r->m_channelsAllocatedOut = n;
     }
+    return TRUE;
+}
+
+int
+RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+{
+    const RTMPPacket *prevPacket;
+    uint32_t last = 0;
+    int nSize;
+    int hSize, cSize;
+    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    uint32_t t;
+    char *buffer, *tbuf = NULL, *toff = NULL;
+    int nChunkSize;
+    int tlen;
+
+    if (!EnsureChannelsOut(r, packet->m_nChannel))
+        return FALSE;
 
     prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
     if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
@@ -4647,6 +4743,38 @@ RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len)
     return rc;
 }
 
+/* TLS can't gather buffers, so this is only used for plain sockets */
+int
+RTMPSockBuf_SendV(RTMPSockBuf *sb, const RTMPBuf *bufs, int count)
+{
+#ifdef _WIN32
+    WSABUF wsabufs[RTMP_MAX_SEND_BUFS];
+    DWORD sent = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        wsabufs[i].buf = (char *)bufs[i].data;
+        wsabufs[i].len = (ULONG)bufs[i].size;
+    }
+
+    if (WSASend(sb->sb_socket, wsabufs, (DWORD)count, &sent, 0, NULL, NULL) != 0)
+        return -1;
+    return (int)sent;
+#else
+    struct iovec iov[RTMP_MAX_SEND_BUFS];
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *)bufs[i].data;
+        iov[i].iov_len = (size_t)bufs[i].size;
+    }
+
+    return (int)writev(sb->sb_socket, iov, count);
+#endif
+}
+
 int
 RTMPSockBuf_Close(RTMPSockBuf *sb)
 {
@@ -5517,3 +5645,179 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
     }
     return size+s2;
 }
+
+typedef struct RTMPSendVec
+{
+    RTMP *r;
+    RTMPBuf bufs[RTMP_MAX_SEND_BUFS];
+    int count;
+    int failed;
+} RTMPSendVec;
+
+static void
+SendVecAdd(RTMPSendVec *vec, const char *data, int size)
+{
+    if (vec->failed || !size)
+        return;
+
+    if (vec->count == RTMP_MAX_SEND_BUFS)
+    {
+        if (!WriteV(vec->r, vec->bufs, vec->count))
+            vec->failed = TRUE;
+        vec->count = 0;
+        if (vec->failed)
+            return;
+    }
+
+    vec->bufs[vec->count].data = data;
+    vec->bufs[vec->count].size = size;
+    vec->count++;
+}
+
+/* same chunking and header compression as RTMP_SendPacket, except that the
+ * chunk headers are sent from their own small buffers, interleaved with the
+ * caller's body buffers, instead of being written in to a packet copy */
+int
+RTMP_WriteV(RTMP *r, int packetType, uint32_t timestamp,
+            const RTMPBuf *body, int count, int streamIdx)
+{
+    RTMPPacket packet = {0};
+    const RTMPPacket *prevPacket;
+    RTMPSendVec vec;
+    uint32_t last = 0;
+    uint32_t t;
+    char header[RTMP_MAX_HEADER_SIZE], cont[3];
+    char *hptr, *hend = header + sizeof(header);
+    char c;
+    int nSize, cSize = 0;
+    int nChunkSize = r->m_outChunkSize;
+    int chunkLeft;
+    int i;
+
+    packet.m_nChannel = 0x04;	/* source channel */
+    packet.m_nInfoField2 = r->Link.streams[streamIdx].id;
+    packet.m_packetType = (uint8_t)packetType;
+    packet.m_nTimeStamp = timestamp;
+
+    for (i = 0; i < count; i++)
+        packet.m_nBodySize += body[i].size;
+
+    if (!timestamp)
+        packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
+    else
+        packet.m_headerType = RTMP_PACKET_SIZE_MEDIUM;
+
+    if (!EnsureChannelsOut(r, packet.m_nChannel))
+        return FALSE;
+
+    prevPacket = r->m_vecChannelsOut[packet.m_nChannel];
+    if (prevPacket && packet.m_headerType != RTMP_PACKET_SIZE_LARGE)
+    {
+        /* compress a bit by using the prev packet's attributes */
+        if (prevPacket->m_nBodySize == packet.m_nBodySize
+                && prevPacket->m_packetType == packet.m_packetType
+                && packet.m_headerType == RTMP_PACKET_SIZE_MEDIUM)
+            packet.m_headerType = RTMP_PACKET_SIZE_SMALL;
+
+        if (prevPacket->m_nTimeStamp == packet.m_nTimeStamp
+                && packet.m_headerType == RTMP_PACKET_SIZE_SMALL)
+            packet.m_headerType = RTMP_PACKET_SIZE_MINIMUM;
+        last = prevPacket->m_nTimeStamp;
+    }
+
+    nSize = packetSize[packet.m_headerType];
+    t = packet.m_nTimeStamp - last;
+
+    if (packet.m_nChannel > 319)
+        cSize = 2;
+    else if (packet.m_nChannel > 63)
+        cSize = 1;
+
+    hptr = header;
+    c = packet.m_headerType << 6;
+    switch (cSize)
+    {
+    case 0:
+        c |= packet.m_nChannel;
+        break;
+    case 1:
+        break;
+    case 2:
+        c |= 1;
+        break;
+    }
+    *hptr++ = c;
+    if (cSize)
+    {
+        int tmp = packet.m_nChannel - 64;
+        *hptr++ = tmp & 0xff;
+        if (cSize == 2)
+            *hptr++ = tmp >> 8;
+    }
+
+    if (nSize > 1)
+        hptr = AMF_EncodeInt24(hptr, hend, t > 0xffffff ? 0xffffff : t);
+
+    if (nSize > 4)
+    {
+        hptr = AMF_EncodeInt24(hptr, hend, packet.m_nBodySize);
+        *hptr++ = packet.m_packetType;
+    }
+
+    if (nSize > 8)
+        hptr += EncodeInt32LE(hptr, packet.m_nInfoField2);
+
+    if (nSize > 1 && t >= 0xffffff)
+        hptr = AMF_EncodeInt32(hptr, hend, t);
+
+    /* continuation chunk header */
+    cont[0] = (0xc0 | c);
+    if (cSize)
+    {
+        int tmp = packet.m_nChannel - 64;
+        cont[1] = tmp & 0xff;
+        if (cSize == 2)
+            cont[2] = tmp >> 8;
+    }
+
+    vec.r = r;
+    vec.count = 0;
+    vec.failed = FALSE;
+
+    SendVecAdd(&vec, header, (int)(hptr - header));
+
+    chunkLeft = nChunkSize;
+    for (i = 0; i < count; i++)
+    {
+        const char *data = body[i].data;
+        int left = body[i].size;
+
+        while (left > 0)
+        {
+            int num;
+
+            if (!chunkLeft)
+            {
+                SendVecAdd(&vec, cont, cSize + 1);
+                chunkLeft = nChunkSize;
+            }
+
+            num = left < chunkLeft ? left : chunkLeft;
+            SendVecAdd(&vec, data, num);
+
+            data += num;
+            left -= num;
+            chunkLeft -= num;
+        }
+    }
+
+    if (!vec.failed && vec.count && !WriteV(r, vec.bufs, vec.count))
+        vec.failed = TRUE;
+    if (vec.failed)
+        return FALSE;
+
+    if (!r->m_vecChannelsOut[packet.m_nChannel])
+        r->m_vecChannelsOut[packet.m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet.m_nChannel], &packet, sizeof(RTMPPacket));
+    return TRUE;
+}
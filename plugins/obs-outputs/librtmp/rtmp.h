@@ -269,6 +269,19 @@ extern "C"
 
     typedef int (*CUSTOMSEND)(RTMPSockBuf*, const char *, int, void*);
 
+    /* a buffer of a scatter-gather write */
+    typedef struct RTMPBuf
+    {
+        const char *data;
+        int size;
+    } RTMPBuf;
+
+#define RTMP_MAX_SEND_BUFS 64
+
+    /* queues all of the buffers, returns <= 0 if the connection failed
+     * (part of them may have been queued by then) */
+    typedef int (*CUSTOMSENDV)(RTMPSockBuf*, const RTMPBuf *, int, void*);
+
     typedef struct RTMP
     {
         int m_inChunkSize;
@@ -293,6 +306,7 @@ extern "C"
         uint8_t m_bCustomSend;
         void*   m_customSendParam;
         CUSTOMSEND m_customSendFunc;
+        CUSTOMSENDV m_customSendVFunc;
 
         RTMP_BINDINFO m_bindIP;
 
@@ -404,6 +418,7 @@ extern "C"
 
     int RTMPSockBuf_Fill(RTMPSockBuf *sb);
     int RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len);
+    int RTMPSockBuf_SendV(RTMPSockBuf *sb, const RTMPBuf *bufs, int count);
     int RTMPSockBuf_Close(RTMPSockBuf *sb);
 
     int RTMP_SendCreateStream(RTMP *r);
@@ -414,6 +429,11 @@ extern "C"
     int RTMP_Read(RTMP *r, char *buf, int size);
     int RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx);
 
+    /* sends an audio or video message whose body is the concatenation of
+     * the given buffers, without copying them in to a packet first */
+    int RTMP_WriteV(RTMP *r, int packetType, uint32_t timestamp,
+                    const RTMPBuf *body, int count, int streamIdx);
+
     /* hashswf.c */
     int RTMP_HashSWF(const char *url, unsigned int *size, unsigned char *hash,
                      int age);
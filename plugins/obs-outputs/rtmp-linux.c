@@ -0,0 +1,298 @@
+#ifdef __linux__
+#include "rtmp-stream.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#if defined(USE_MBEDTLS)
+#include <mbedtls/ssl.h>
+#endif
+
+/* the send thread still uses the socket (for the unsent data queries, and
+ * RTMP_Close when it exits), so only shut it down here and mark the stream
+ * disconnected.  closing it would let the descriptor be reused while the send
+ * thread still refers to it */
+static void fatal_sock_shutdown(struct rtmp_stream *stream)
+{
+	shutdown(stream->rtmp.m_sb.sb_socket, SHUT_RDWR);
+	os_atomic_set_bool(&stream->disconnected, true);
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	stream->write_buf_len = 0;
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+	os_event_signal(stream->buffer_space_available_event);
+}
+
+static inline bool would_block(struct rtmp_stream *stream, int ret)
+{
+#if defined(USE_MBEDTLS)
+	if (stream->rtmp.m_sb.sb_ssl)
+		return ret == MBEDTLS_ERR_SSL_WANT_WRITE ||
+		       ret == MBEDTLS_ERR_SSL_WANT_READ;
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+	return ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static inline int sock_error_code(struct rtmp_stream *stream, int ret)
+{
+#if defined(USE_MBEDTLS)
+	if (stream->rtmp.m_sb.sb_ssl)
+		return ret;
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+	return ret == -1 ? errno : 0;
+}
+
+static bool discard_recv_data(struct rtmp_stream *stream)
+{
+	char discard[16384];
+
+	/* the socket is edge triggered, so read until it would block */
+	for (;;) {
+		int ret;
+
+#if defined(USE_MBEDTLS)
+		if (stream->rtmp.m_sb.sb_ssl)
+			ret = mbedtls_ssl_read(stream->rtmp.m_sb.sb_ssl,
+					(unsigned char *)discard,
+					sizeof(discard));
+		else
+#endif
+			ret = (int)recv(stream->rtmp.m_sb.sb_socket,
+					discard, sizeof(discard), 0);
+
+		if (ret > 0)
+			continue;
+		if (ret < 0 && would_block(stream, ret))
+			return true;
+
+		int err_code = sock_error_code(stream, ret);
+		blog(LOG_ERROR, "socket_thread_linux: Socket error, recv() "
+				"returned %d, errno %d", ret, err_code);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+}
+
+static bool socket_event(struct rtmp_stream *stream, uint32_t events,
+		bool *can_write, uint64_t last_send_time)
+{
+	if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+		int err_code = 0;
+		socklen_t size = sizeof(err_code);
+
+		getsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_ERROR,
+				&err_code, &size);
+
+		if (last_send_time) {
+			uint32_t diff = (uint32_t)(
+				(os_gettime_ns() / 1000000) - last_send_time);
+
+			blog(LOG_ERROR, "socket_thread_linux: Socket closed, "
+					"%u ms since last send "
+					"(buffer: %d / %d)",
+					diff,
+					(int)stream->write_buf_len,
+					(int)stream->write_buf_size);
+		}
+
+		if (os_event_try(stream->stop_event) != EAGAIN)
+			blog(LOG_ERROR, "socket_thread_linux: Aborting due "
+					"to socket close during shutdown, "
+					"%d bytes lost, error %d",
+					(int)stream->write_buf_len, err_code);
+		else
+			blog(LOG_ERROR, "socket_thread_linux: Aborting due "
+					"to socket close, error %d",
+					err_code);
+
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+
+	if (events & EPOLLOUT)
+		*can_write = true;
+
+	if (events & EPOLLIN)
+		return discard_recv_data(stream);
+
+	return true;
+}
+
+enum data_ret {
+	RET_BREAK,
+	RET_FATAL,
+	RET_CONTINUE
+};
+
+static enum data_ret write_data(struct rtmp_stream *stream, bool *can_write,
+		uint64_t *last_send_time)
+{
+	bool exit_loop = false;
+	int ret;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+
+	if (!stream->write_buf_len) {
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		return RET_BREAK;
+	}
+
+	ret = RTMPSockBuf_Send(&stream->rtmp.m_sb,
+			(const char *)stream->write_buf,
+			(int)stream->write_buf_len);
+
+	if (ret > 0) {
+		if (stream->write_buf_len - ret)
+			memmove(stream->write_buf,
+					stream->write_buf + ret,
+					stream->write_buf_len - ret);
+		stream->write_buf_len -= ret;
+
+		*last_send_time = os_gettime_ns() / 1000000;
+
+		os_event_signal(stream->buffer_space_available_event);
+
+	} else if (ret < 0 && would_block(stream, ret)) {
+		/* the socket has TCP_NOTSENT_LOWAT worth of unsent data, wait
+		 * for EPOLLOUT */
+		*can_write = false;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		return RET_BREAK;
+
+	} else {
+		int err_code = sock_error_code(stream, ret);
+
+		blog(LOG_ERROR, "socket_thread_linux: Socket error, send() "
+				"returned %d, errno %d", ret, err_code);
+
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return RET_FATAL;
+	}
+
+	/* the socket is edge triggered, so keep writing until the buffer is
+	 * empty or the socket would block */
+	if (!stream->write_buf_len)
+		exit_loop = true;
+
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	return exit_loop ? RET_BREAK : RET_CONTINUE;
+}
+
+static inline void socket_thread_linux_internal(struct rtmp_stream *stream)
+{
+	struct epoll_event events[2];
+	struct epoll_event ev = {0};
+	bool can_write = true;
+	uint64_t last_send_time = 0;
+	int epoll_fd;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+				"epoll_create1 failure, %d", errno);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = stream->rtmp.m_sb.sb_socket;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+				"epoll_ctl failure, %d", errno);
+		close(epoll_fd);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = stream->socket_wake_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+				"epoll_ctl failure, %d", errno);
+		close(epoll_fd);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	for (;;) {
+		if (os_event_try(stream->send_thread_signaled_exit) != EAGAIN) {
+			pthread_mutex_lock(&stream->write_buf_mutex);
+			if (stream->write_buf_len == 0) {
+				pthread_mutex_unlock(&stream->write_buf_mutex);
+				os_event_reset(stream->send_thread_signaled_exit);
+				break;
+			}
+
+			pthread_mutex_unlock(&stream->write_buf_mutex);
+		}
+
+		int count = epoll_wait(epoll_fd, events, 2, -1);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+
+			blog(LOG_ERROR, "socket_thread_linux: Aborting due "
+					"to epoll_wait failure, %d", errno);
+			close(epoll_fd);
+			fatal_sock_shutdown(stream);
+			return;
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.fd == stream->socket_wake_fd) {
+				/* new data or exit, just reset the count */
+				uint64_t val;
+				ssize_t size = read(stream->socket_wake_fd,
+						&val, sizeof(val));
+				UNUSED_PARAMETER(size);
+				continue;
+			}
+
+			if (!socket_event(stream, events[i].events,
+						&can_write, last_send_time)) {
+				close(epoll_fd);
+				return;
+			}
+		}
+
+		if (can_write) {
+			for (;;) {
+				enum data_ret ret = write_data(
+						stream,
+						&can_write,
+						&last_send_time);
+
+				switch (ret) {
+				case RET_BREAK:
+					goto exit_write_loop;
+				case RET_FATAL:
+					close(epoll_fd);
+					return;
+				case RET_CONTINUE:;
+				}
+			}
+		}
+		exit_write_loop:;
+	}
+
+	close(epoll_fd);
+
+	blog(LOG_INFO, "socket_thread_linux: Normal exit");
+}
+
+void *socket_thread_linux(void *data)
+{
+	struct rtmp_stream *stream = data;
+	os_set_thread_name("rtmp-stream: socket_thread");
+	socket_thread_linux_internal(stream);
+	return NULL;
+}
+#endif
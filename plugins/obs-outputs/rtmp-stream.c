@@ -112,6 +112,10 @@ static void rtmp_stream_destroy(void *data)
 	os_event_destroy(stream->socket_available_event);
 	os_event_destroy(stream->send_thread_signaled_exit);
 	pthread_mutex_destroy(&stream->write_buf_mutex);
+#ifdef __linux__
+	if (stream->socket_wake_fd != -1)
+		close(stream->socket_wake_fd);
+#endif
 
 	if (stream->write_buf)
 		bfree(stream->write_buf);
@@ -123,6 +127,9 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
+#ifdef __linux__
+	stream->socket_wake_fd = -1;
+#endif
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
@@ -158,6 +165,13 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 		warn("Failed to initialize socket exit event");
 		goto fail;
 	}
+#ifdef __linux__
+	stream->socket_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stream->socket_wake_fd == -1) {
+		warn("Failed to initialize socket wake event");
+		goto fail;
+	}
+#endif
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -293,44 +307,115 @@ static void droptest_cap_data_rate(struct rtmp_stream *stream, size_t size)
 }
 #endif
 
-static int socket_queue_data(RTMPSockBuf *sb, const char *data, int len, void *arg)
+static int socket_queue_datav(RTMPSockBuf *sb, const RTMPBuf *bufs, int count,
+		void *arg)
 {
 	UNUSED_PARAMETER(sb);
 
 	struct rtmp_stream *stream = arg;
+	size_t len = 0;
+	size_t offset = 0;
+	int idx = 0;
 
-retry_send:
+	for (int i = 0; i < count; i++)
+		len += (size_t)bufs[i].size;
 
-	if (!RTMP_IsConnected(&stream->rtmp))
-		return 0;
+	/* a batch can be larger than the whole write buffer (it's only
+	 * 128KB at low bitrates), so copy as much as fits, and wait for the
+	 * socket thread to make room for the rest */
+	while (idx < count) {
+		size_t space;
 
-	pthread_mutex_lock(&stream->write_buf_mutex);
+		if (!RTMP_IsConnected(&stream->rtmp) || disconnected(stream))
+			return 0;
 
-	if (stream->write_buf_len + len > stream->write_buf_size) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
 
-		pthread_mutex_unlock(&stream->write_buf_mutex);
+		space = stream->write_buf_size - stream->write_buf_len;
 
-		if (os_event_wait(stream->buffer_space_available_event)) {
-			return 0;
+		while (space && idx < count) {
+			size_t size = (size_t)bufs[idx].size - offset;
+			if (size > space)
+				size = space;
+
+			memcpy(stream->write_buf + stream->write_buf_len,
+					bufs[idx].data + offset, size);
+			stream->write_buf_len += size;
+			space -= size;
+			offset += size;
+
+			if (offset == (size_t)bufs[idx].size) {
+				offset = 0;
+				idx++;
+			}
 		}
 
-		goto retry_send;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+
+		signal_socket_thread(stream);
+
+		if (idx < count &&
+		    os_event_wait(stream->buffer_space_available_event))
+			return 0;
 	}
 
-	memcpy(stream->write_buf + stream->write_buf_len, data, len);
-	stream->write_buf_len += len;
+	return (int)len;
+}
+
+static int socket_queue_data(RTMPSockBuf *sb, const char *data, int len, void *arg)
+{
+	RTMPBuf buf;
+	buf.data = data;
+	buf.size = len;
+	return socket_queue_datav(sb, &buf, 1, arg);
+}
+
+/* sends the packet as an RTMP message directly, with the chunk headers and
+ * FLV tag body prefix sent from small separate buffers around the packet
+ * data, instead of muxing it in to an FLV tag that librtmp then parses and
+ * copies back out.  the packet data itself is never copied here */
+static int write_packet_direct(struct rtmp_stream *stream,
+		struct encoder_packet *packet, bool is_header, size_t idx,
+		size_t *size)
+{
+	int32_t dts_offset = is_header ? 0 : stream->start_dts_offset;
+	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
+	uint8_t prefix[FLV_MAX_BODY_PREFIX];
+	RTMPBuf body[2];
+	int type;
+
+	*size = 0;
 
-	pthread_mutex_unlock(&stream->write_buf_mutex);
+	if (!packet->data || !packet->size)
+		return 0;
+
+	type = packet->type == OBS_ENCODER_VIDEO ?
+		RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO;
+
+	body[0].data = (const char*)prefix;
+	body[0].size = (int)flv_packet_body_prefix(packet, is_header, prefix);
+	body[1].data = (const char*)packet->data;
+	body[1].size = (int)packet->size;
+
+	/* same as the size of the equivalent FLV tag, including the tag header
+	 * and trailing tag size */
+	*size = 11 + (size_t)body[0].size + packet->size + 4;
+
+#ifdef TEST_FRAMEDROPS
+	droptest_cap_data_rate(stream, *size);
+#endif
 
-	os_event_signal (stream->buffer_has_data_event);
+	if (!RTMP_WriteV(&stream->rtmp, type,
+				(uint32_t)time_ms & 0x7FFFFFFF, body, 2,
+				(int)idx))
+		return -1;
 
-	return len;
+	return (int)*size;
 }
 
 static int send_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet, bool is_header, size_t idx)
 {
-	uint8_t *data;
 	size_t  size;
 	int     recv_size = 0;
 	int     ret = 0;
@@ -349,15 +434,7 @@ static int send_packet(struct rtmp_stream *stream,
 		}
 	}
 
-	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset,
-			&data, &size, is_header);
-
-#ifdef TEST_FRAMEDROPS
-	droptest_cap_data_rate(stream, size);
-#endif
-
-	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size, (int)idx);
-	bfree(data);
+	ret = write_packet_direct(stream, packet, is_header, idx, &size);
 
 	if (is_header)
 		bfree(packet->data);
@@ -450,6 +527,323 @@ static void set_output_error(struct rtmp_stream *stream)
 	obs_output_set_last_error(stream->output, msg);
 }
 
+/* ------------------------------------------------------------------------- */
+/* adaptive bitrate
+ *
+ *   once per window, measures how many bytes actually left the send buffers
+ * (bytes sent minus the growth of the data still queued in the write buffer
+ * and the socket's send queue) and how much media time is waiting to be sent.
+ * if the queue is over the high watermark, or the connection's RTT climbs
+ * well above the lowest RTT seen, the link is saturated and the drain rate is
+ * taken as the available throughput: the video bitrate is lowered to fit in
+ * it with some headroom.  once the queue has stayed under the low watermark
+ * for several windows in a row, the bitrate is stepped back up toward the
+ * ceiling.  changes smaller than the hysteresis are not made at all, so small
+ * fluctuations are left to the frame dropping code */
+
+#define ABR_WINDOW_NS           1000000000ULL
+#define ABR_HIGH_QUEUE_MS       400
+#define ABR_LOW_QUEUE_MS        50
+#define ABR_RTT_SLACK_MS        50
+#define ABR_HEADROOM_PCT        80
+#define ABR_COOLDOWN_WINDOWS    2
+#define ABR_RECOVER_WINDOWS     10
+
+static bool abr_init_encoder(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(stream->output,
+			0);
+	const char *rate_control;
+	obs_data_t *settings;
+
+	if (!vencoder)
+		return false;
+
+	if ((obs_get_encoder_caps(obs_encoder_get_id(vencoder)) &
+	     OBS_ENCODER_CAP_DYN_BITRATE) == 0) {
+		info("Adaptive bitrate disabled: video encoder '%s' cannot "
+		     "change its bitrate while encoding",
+		     obs_encoder_get_id(vencoder));
+		return false;
+	}
+
+	/* the bitrate is part of the encoder's settings, so changing it would
+	 * also change the bitrate of a recording using the same encoder */
+	if (obs_encoder_get_output_count(vencoder) > 1) {
+		info("Adaptive bitrate disabled: video encoder '%s' is shared "
+		     "with another output",
+		     obs_encoder_get_name(vencoder));
+		return false;
+	}
+
+	settings = obs_encoder_get_settings(vencoder);
+	stream->abr_orig_bitrate = (long)obs_data_get_int(settings, "bitrate");
+	rate_control = obs_data_get_string(settings, "rate_control");
+
+	/* constant quality modes ignore the bitrate */
+	if (astrcmpi(rate_control, "CRF") == 0 ||
+	    astrcmpi(rate_control, "CQP") == 0 ||
+	    astrcmpi(rate_control, "ICQ") == 0 ||
+	    astrcmpi(rate_control, "LA_ICQ") == 0) {
+		info("Adaptive bitrate disabled: rate control '%s' does "
+		     "not use a bitrate", rate_control);
+		stream->abr_orig_bitrate = 0;
+	} else if (stream->abr_orig_bitrate <= 0) {
+		info("Adaptive bitrate disabled: video encoder didn't "
+		     "return a valid bitrate");
+	}
+	obs_data_release(settings);
+
+	if (stream->abr_orig_bitrate <= 0)
+		return false;
+
+	stream->abr_audio_bitrate = 0;
+	if (aencoder) {
+		settings = obs_encoder_get_settings(aencoder);
+		stream->abr_audio_bitrate =
+			(long)obs_data_get_int(settings, "bitrate");
+		obs_data_release(settings);
+	}
+
+	return true;
+}
+
+static void abr_init(struct rtmp_stream *stream)
+{
+	if (!stream->abr_enabled)
+		return;
+
+	if (!abr_init_encoder(stream)) {
+		stream->abr_enabled = false;
+		return;
+	}
+
+	if (!stream->abr_max_bitrate)
+		stream->abr_max_bitrate = stream->abr_orig_bitrate;
+	if (stream->abr_min_bitrate > stream->abr_max_bitrate)
+		stream->abr_min_bitrate = stream->abr_max_bitrate;
+
+	stream->abr_cur_bitrate     = stream->abr_orig_bitrate;
+	stream->abr_window_start_ns = os_gettime_ns();
+	stream->abr_window_bytes    = stream->total_bytes_sent;
+	stream->abr_window_unsent   = 0;
+	stream->abr_last_queue_ms   = 0;
+	stream->abr_min_rtt_ms      = 0;
+	stream->abr_est_kbps        = 0.0;
+	stream->abr_clear_windows   = 0;
+	stream->abr_cooldown        = 0;
+
+	info("Adaptive bitrate enabled: %ld kbps (min %ld kbps, max %ld "
+	     "kbps, hysteresis %d%%)",
+	     stream->abr_cur_bitrate,
+	     stream->abr_min_bitrate,
+	     stream->abr_max_bitrate,
+	     stream->abr_hysteresis);
+}
+
+static void abr_set_bitrate(struct rtmp_stream *stream, long bitrate)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_data_t *settings;
+
+	if (!vencoder)
+		return;
+
+	settings = obs_data_create();
+	obs_data_set_int(settings, "bitrate", bitrate);
+	obs_encoder_update(vencoder, settings);
+	obs_data_release(settings);
+
+	stream->abr_cur_bitrate = bitrate;
+}
+
+/* data already handed off by send_packet that is still waiting to go out */
+static size_t abr_unsent_bytes(struct rtmp_stream *stream)
+{
+	size_t unsent = 0;
+
+	if (stream->new_socket_loop) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		unsent += stream->write_buf_len;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+	}
+
+#if defined(__linux__) && defined(SIOCOUTQ)
+	int outq = 0;
+	if (ioctl(stream->rtmp.m_sb.sb_socket, SIOCOUTQ, &outq) == 0 &&
+	    outq > 0)
+		unsent += (size_t)outq;
+#endif
+
+	return unsent;
+}
+
+/* smoothed round trip time of the connection, or 0 if unknown */
+static uint32_t abr_rtt_ms(struct rtmp_stream *stream)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info tcpi;
+	socklen_t len = sizeof(tcpi);
+
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP, TCP_INFO,
+				&tcpi, &len) == 0)
+		return tcpi.tcpi_rtt / 1000;
+#elif defined(__APPLE__) && defined(TCP_CONNECTION_INFO)
+	struct tcp_connection_info tcpi;
+	socklen_t len = sizeof(tcpi);
+
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP,
+				TCP_CONNECTION_INFO, &tcpi, &len) == 0)
+		return tcpi.tcpi_srtt;
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+	return 0;
+}
+
+/* media time waiting in the packet queue */
+static int64_t abr_queued_ms(struct rtmp_stream *stream)
+{
+	int64_t queued_usec = 0;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	if (stream->packets.size) {
+		struct encoder_packet *first = circlebuf_data(&stream->packets,
+				0);
+		queued_usec = stream->last_dts_usec - first->dts_usec;
+	}
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	return queued_usec > 0 ? queued_usec / 1000 : 0;
+}
+
+static inline long abr_clamp(struct rtmp_stream *stream, long bitrate)
+{
+	if (bitrate < stream->abr_min_bitrate)
+		return stream->abr_min_bitrate;
+	if (bitrate > stream->abr_max_bitrate)
+		return stream->abr_max_bitrate;
+	return bitrate;
+}
+
+static inline bool abr_encoder_shared(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	return obs_encoder_get_output_count(vencoder) > 1;
+}
+
+static void abr_restore(struct rtmp_stream *stream)
+{
+	if (!stream->abr_enabled ||
+	    stream->abr_cur_bitrate == stream->abr_orig_bitrate)
+		return;
+
+	info("Adaptive bitrate: restoring %ld kbps",
+			stream->abr_orig_bitrate);
+	abr_set_bitrate(stream, stream->abr_orig_bitrate);
+}
+
+static void abr_update(struct rtmp_stream *stream)
+{
+	uint64_t ts = os_gettime_ns();
+	uint64_t elapsed = ts - stream->abr_window_start_ns;
+	long cur = stream->abr_cur_bitrate;
+	long step = cur * stream->abr_hysteresis / 100;
+	long new_bitrate = cur;
+	bool rtt_congested = false;
+	bool congested;
+	bool clear;
+	double drain_kbps;
+	int64_t drained;
+	int64_t queue_ms;
+	size_t unsent;
+	uint32_t rtt;
+
+	if (elapsed < ABR_WINDOW_NS)
+		return;
+
+	unsent = abr_unsent_bytes(stream);
+	drained = (int64_t)(stream->total_bytes_sent -
+			stream->abr_window_bytes) +
+		(int64_t)stream->abr_window_unsent - (int64_t)unsent;
+	if (drained < 0)
+		drained = 0;
+
+	/* bits per millisecond == kbps */
+	drain_kbps = (double)drained * 8.0 * 1000000.0 / (double)elapsed;
+
+	queue_ms = abr_queued_ms(stream);
+	if (drain_kbps > 0.0)
+		queue_ms += (int64_t)((double)unsent * 8.0 / drain_kbps);
+
+	rtt = abr_rtt_ms(stream);
+	if (rtt && (!stream->abr_min_rtt_ms || rtt < stream->abr_min_rtt_ms))
+		stream->abr_min_rtt_ms = rtt;
+	if (rtt && stream->abr_min_rtt_ms)
+		rtt_congested = rtt > stream->abr_min_rtt_ms * 2 +
+			ABR_RTT_SLACK_MS;
+
+	stream->abr_est_kbps = stream->abr_est_kbps > 0.0 ?
+		(stream->abr_est_kbps + drain_kbps) * 0.5 : drain_kbps;
+
+	/* a queue that is already shrinking since the last window doesn't
+	 * need another decrease */
+	congested = (queue_ms > ABR_HIGH_QUEUE_MS || rtt_congested) &&
+		queue_ms + ABR_LOW_QUEUE_MS > stream->abr_last_queue_ms;
+	clear = queue_ms <= ABR_LOW_QUEUE_MS && !rtt_congested;
+
+	stream->abr_clear_windows = clear ? stream->abr_clear_windows + 1 : 0;
+
+	if (stream->abr_cooldown > 0) {
+		stream->abr_cooldown--;
+
+	} else if (congested) {
+		double est = drain_kbps < stream->abr_est_kbps ?
+			drain_kbps : stream->abr_est_kbps;
+		long target = (long)(est * ABR_HEADROOM_PCT / 100.0) -
+			stream->abr_audio_bitrate;
+
+		if (target > cur - step)
+			target = cur - step;
+		target = abr_clamp(stream, target);
+
+		if (target < cur)
+			new_bitrate = target;
+
+	} else if (stream->abr_clear_windows >= ABR_RECOVER_WINDOWS) {
+		long target = abr_clamp(stream, cur + (step > 0 ? step : 1));
+
+		if (target > cur)
+			new_bitrate = target;
+		stream->abr_clear_windows = 0;
+	}
+
+	if (new_bitrate != cur && abr_encoder_shared(stream)) {
+		info("Adaptive bitrate disabled: video encoder is now shared "
+		     "with another output");
+		abr_restore(stream);
+		stream->abr_enabled = false;
+		return;
+	}
+
+	if (new_bitrate != cur) {
+		info("Adaptive bitrate: %ld -> %ld kbps (throughput %.0f "
+		     "kbps, queue %" PRId64 " ms, rtt %u ms)",
+		     cur, new_bitrate, drain_kbps, queue_ms, rtt);
+
+		abr_set_bitrate(stream, new_bitrate);
+		stream->abr_cooldown = ABR_COOLDOWN_WINDOWS;
+		stream->abr_clear_windows = 0;
+	}
+
+	stream->abr_window_start_ns = ts;
+	stream->abr_window_bytes    = stream->total_bytes_sent;
+	stream->abr_window_unsent   = unsent;
+	stream->abr_last_queue_ms   = queue_ms;
+}
+
+
 static void *send_thread(void *data)
 {
 	struct rtmp_stream *stream = data;
@@ -484,6 +878,9 @@ static void *send_thread(void *data)
 			os_atomic_set_bool(&stream->disconnected, true);
 			break;
 		}
+
+		if (stream->abr_enabled)
+			abr_update(stream);
 	}
 
 	if (disconnected(stream)) {
@@ -494,12 +891,13 @@ static void *send_thread(void *data)
 
 	if (stream->new_socket_loop) {
 		os_event_signal(stream->send_thread_signaled_exit);
-		os_event_signal(stream->buffer_has_data_event);
+		signal_socket_thread(stream);
 		pthread_join(stream->socket_thread, NULL);
 		stream->socket_thread_active = false;
 		stream->rtmp.m_bCustomSend = false;
 	}
 
+	abr_restore(stream);
 	set_output_error(stream);
 	RTMP_Close(&stream->rtmp);
 
@@ -621,6 +1019,74 @@ static void adjust_sndbuf_size(struct rtmp_stream *stream, int new_size)
 	}
 }
 
+static int get_total_bitrate(struct rtmp_stream *stream)
+{
+	int total_bitrate = 0;
+	obs_output_t  *context  = stream->output;
+
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(context);
+	if (vencoder) {
+		obs_data_t *params = obs_encoder_get_settings(vencoder);
+		if (params) {
+			int bitrate = (int)obs_data_get_int(params, "bitrate");
+			if (!bitrate) {
+				if (stream->new_socket_loop) {
+					warn ("Video encoder didn't return a "
+						"valid bitrate, new network "
+						"code may function poorly. "
+						"Low latency mode disabled.");
+					stream->low_latency_mode = false;
+				}
+				bitrate = 10000;
+			}
+			total_bitrate += bitrate;
+			obs_data_release(params);
+		}
+	}
+
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(context, 0);
+	if (aencoder) {
+		obs_data_t *params = obs_encoder_get_settings(aencoder);
+		if (params) {
+			int bitrate = (int)obs_data_get_int(params, "bitrate");
+			if (!bitrate)
+				bitrate = 160;
+			total_bitrate += bitrate;
+			obs_data_release(params);
+		}
+	}
+
+	return total_bitrate;
+}
+
+#if defined(__linux__) && defined(TCP_NOTSENT_LOWAT)
+/* limits the data the kernel holds that hasn't been sent yet (as opposed to
+ * sent but not yet acknowledged) to about NOTSENT_LOWAT_MS of the stream.
+ * without it the send buffer grows to megabytes on a slow connection, which
+ * adds latency and hides the backlog from the frame dropping code.  with
+ * blocking sends the send thread now waits with the data still in the packet
+ * queue, and the new socket loop keeps it in its write buffer */
+#define NOTSENT_LOWAT_MS             100
+#define LOW_LATENCY_NOTSENT_LOWAT_MS 50
+#define MIN_NOTSENT_LOWAT            16384
+
+static void set_notsent_lowat(struct rtmp_stream *stream)
+{
+	int ms = stream->low_latency_mode ?
+		LOW_LATENCY_NOTSENT_LOWAT_MS : NOTSENT_LOWAT_MS;
+	int lowat = stream->total_bitrate * ms / 8;
+
+	if (lowat < MIN_NOTSENT_LOWAT)
+		lowat = MIN_NOTSENT_LOWAT;
+
+	if (setsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP,
+				TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) == 0)
+		info("Unsent socket data limited to %d bytes", lowat);
+	else
+		warn("Failed to set TCP_NOTSENT_LOWAT: %d", errno);
+}
+#endif
+
 static int init_send(struct rtmp_stream *stream)
 {
 	int ret;
@@ -631,6 +1097,12 @@ static int init_send(struct rtmp_stream *stream)
 	adjust_sndbuf_size(stream, MIN_SENDBUF_SIZE);
 #endif
 
+	stream->total_bitrate = get_total_bitrate(stream);
+
+#if defined(__linux__) && defined(TCP_NOTSENT_LOWAT)
+	set_notsent_lowat(stream);
+#endif
+
 	reset_semaphore(stream);
 
 	ret = pthread_create(&stream->send_thread, NULL, send_thread, stream);
@@ -662,41 +1134,8 @@ static int init_send(struct rtmp_stream *stream)
 		if (stream->write_buf)
 			bfree(stream->write_buf);
 
-		int total_bitrate = 0;
-		obs_output_t  *context  = stream->output;
-
-		obs_encoder_t *vencoder = obs_output_get_video_encoder(context);
-		if (vencoder) {
-			obs_data_t *params = obs_encoder_get_settings(vencoder);
-			if (params) {
-				int bitrate = obs_data_get_int(params, "bitrate");
-				if (!bitrate) {
-					warn ("Video encoder didn't return a "
-						"valid bitrate, new network "
-						"code may function poorly. "
-						"Low latency mode disabled.");
-					stream->low_latency_mode = false;
-					bitrate = 10000;
-				}
-				total_bitrate += bitrate;
-				obs_data_release(params);
-			}
-		}
-
-		obs_encoder_t *aencoder = obs_output_get_audio_encoder(context, 0);
-		if (aencoder) {
-			obs_data_t *params = obs_encoder_get_settings(aencoder);
-			if (params) {
-				int bitrate = obs_data_get_int(params, "bitrate");
-				if (!bitrate)
-					bitrate = 160;
-				total_bitrate += bitrate;
-				obs_data_release(params);
-			}
-		}
-
 		// to bytes/sec
-		int ideal_buffer_size = total_bitrate * 128;
+		int ideal_buffer_size = stream->total_bitrate * 128;
 
 		if (ideal_buffer_size < 131072)
 			ideal_buffer_size = 131072;
@@ -707,6 +1146,9 @@ static int init_send(struct rtmp_stream *stream)
 #ifdef _WIN32
 		ret = pthread_create(&stream->socket_thread, NULL,
 				socket_thread_windows, stream);
+#elif defined(__linux__)
+		ret = pthread_create(&stream->socket_thread, NULL,
+				socket_thread_linux, stream);
 #else
 		warn("New socket loop not supported on this platform");
 		return OBS_OUTPUT_ERROR;
@@ -721,9 +1163,12 @@ static int init_send(struct rtmp_stream *stream)
 		stream->socket_thread_active = true;
 		stream->rtmp.m_bCustomSend = true;
 		stream->rtmp.m_customSendFunc = socket_queue_data;
+		stream->rtmp.m_customSendVFunc = socket_queue_datav;
 		stream->rtmp.m_customSendParam = stream;
 	}
 
+	abr_init(stream);
+
 	os_atomic_set_bool(&stream->active, true);
 	while (next) {
 		if (!send_meta_data(stream, idx++, &next)) {
@@ -916,6 +1361,14 @@ static bool init_connect(struct rtmp_stream *stream)
 	stream->low_latency_mode = obs_data_get_bool(settings,
 			OPT_LOWLATENCY_ENABLED);
 
+	stream->abr_enabled = obs_data_get_bool(settings, OPT_ABR_ENABLED);
+	stream->abr_min_bitrate =
+		(long)obs_data_get_int(settings, OPT_ABR_MIN_BITRATE);
+	stream->abr_max_bitrate =
+		(long)obs_data_get_int(settings, OPT_ABR_MAX_BITRATE);
+	stream->abr_hysteresis =
+		(int)obs_data_get_int(settings, OPT_ABR_HYSTERESIS);
+
 	obs_data_release(settings);
 	return true;
 }
@@ -1038,7 +1491,38 @@ static bool find_first_video_packet(struct rtmp_stream *stream,
 	return false;
 }
 
-static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
+/* time it will take to send the data that has already left the packet queue
+ * but not the machine: the new socket loop's write buffer and, on linux, the
+ * data in the socket that hasn't been sent yet */
+static int64_t unsent_duration_usec(struct rtmp_stream *stream)
+{
+	size_t unsent = 0;
+	long kbps = stream->abr_enabled ?
+		stream->abr_cur_bitrate + stream->abr_audio_bitrate :
+		(long)stream->total_bitrate;
+
+	if (stream->new_socket_loop) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		unsent += stream->write_buf_len;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+	}
+
+#if defined(__linux__) && defined(SIOCOUTQNSD)
+	int notsent = 0;
+	if (ioctl(stream->rtmp.m_sb.sb_socket, SIOCOUTQNSD, &notsent) == 0 &&
+	    notsent > 0)
+		unsent += (size_t)notsent;
+#endif
+
+	if (!unsent || kbps <= 0)
+		return 0;
+
+	/* bytes * 8 / kbps == milliseconds */
+	return (int64_t)unsent * 8000 / kbps;
+}
+
+static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes,
+		int64_t unsent_usec)
 {
 	struct encoder_packet first;
 	int64_t buffer_duration_usec;
@@ -1050,18 +1534,20 @@ static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 		stream->pframe_drop_threshold_usec :
 		stream->drop_threshold_usec;
 
-	if (num_packets < 5) {
+	if (num_packets < 5 && !unsent_usec) {
 		if (!pframes)
 			stream->congestion = 0.0f;
 		return;
 	}
 
-	if (!find_first_video_packet(stream, &first))
-		return;
+	/* if the amount of time stored in the buffered packets and unsent
+	 * data waiting to be sent is higher than threshold, drop frames */
+	buffer_duration_usec = unsent_usec;
 
-	/* if the amount of time stored in the buffered packets waiting to be
-	 * sent is higher than threshold, drop frames */
-	buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
+	if (num_packets >= 5 && find_first_video_packet(stream, &first))
+		buffer_duration_usec += stream->last_dts_usec - first.dts_usec;
+	else if (!unsent_usec)
+		return;
 
 	if (!pframes) {
 		stream->congestion = (float)buffer_duration_usec /
@@ -1077,8 +1563,10 @@ static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 static bool add_video_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet)
 {
-	check_to_drop_frames(stream, false);
-	check_to_drop_frames(stream, true);
+	int64_t unsent_usec = unsent_duration_usec(stream);
+
+	check_to_drop_frames(stream, false, unsent_usec);
+	check_to_drop_frames(stream, true, unsent_usec);
 
 	/* if currently dropping frames, drop packets until it reaches the
 	 * desired priority */
@@ -1138,6 +1626,10 @@ static void rtmp_stream_defaults(obs_data_t *defaults)
 	obs_data_set_default_string(defaults, OPT_BIND_IP, "default");
 	obs_data_set_default_bool(defaults, OPT_NEWSOCKETLOOP_ENABLED, false);
 	obs_data_set_default_bool(defaults, OPT_LOWLATENCY_ENABLED, false);
+	obs_data_set_default_bool(defaults, OPT_ABR_ENABLED, false);
+	obs_data_set_default_int(defaults, OPT_ABR_MIN_BITRATE, 500);
+	obs_data_set_default_int(defaults, OPT_ABR_MAX_BITRATE, 0);
+	obs_data_set_default_int(defaults, OPT_ABR_HYSTERESIS, 15);
 }
 
 static obs_properties_t *rtmp_stream_properties(void *unused)
@@ -1170,6 +1662,18 @@ static obs_properties_t *rtmp_stream_properties(void *unused)
 	obs_properties_add_bool(props, OPT_LOWLATENCY_ENABLED,
 			obs_module_text("RTMPStream.LowLatencyMode"));
 
+	obs_properties_add_bool(props, OPT_ABR_ENABLED,
+			obs_module_text("RTMPStream.AdaptiveBitrate"));
+	obs_properties_add_int(props, OPT_ABR_MIN_BITRATE,
+			obs_module_text("RTMPStream.AdaptiveBitrate.Min"),
+			100, 1000000, 50);
+	obs_properties_add_int(props, OPT_ABR_MAX_BITRATE,
+			obs_module_text("RTMPStream.AdaptiveBitrate.Max"),
+			0, 1000000, 50);
+	obs_properties_add_int(props, OPT_ABR_HYSTERESIS,
+			obs_module_text("RTMPStream.AdaptiveBitrate.Hysteresis"),
+			1, 50, 1);
+
 	return props;
 }
 
@@ -14,6 +14,12 @@
 #include <Iphlpapi.h>
 #else
 #include <sys/ioctl.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 #endif
 
 #define do_log(level, format, ...) \
@@ -30,6 +36,10 @@
 #define OPT_BIND_IP "bind_ip"
 #define OPT_NEWSOCKETLOOP_ENABLED "new_socket_loop_enabled"
 #define OPT_LOWLATENCY_ENABLED "low_latency_mode_enabled"
+#define OPT_ABR_ENABLED "abr_enabled"
+#define OPT_ABR_MIN_BITRATE "abr_min_bitrate"
+#define OPT_ABR_MAX_BITRATE "abr_max_bitrate"
+#define OPT_ABR_HYSTERESIS "abr_hysteresis"
 
 //#define TEST_FRAMEDROPS
 
@@ -83,6 +93,24 @@ struct rtmp_stream {
 
 	uint64_t         total_bytes_sent;
 	int              dropped_frames;
+	int              total_bitrate;
+
+	/* adaptive bitrate variables (bitrates are in kbps) */
+	bool             abr_enabled;
+	long             abr_min_bitrate;
+	long             abr_max_bitrate;
+	int              abr_hysteresis;
+	long             abr_orig_bitrate;
+	long             abr_cur_bitrate;
+	long             abr_audio_bitrate;
+	uint64_t         abr_window_start_ns;
+	uint64_t         abr_window_bytes;
+	size_t           abr_window_unsent;
+	int64_t          abr_last_queue_ms;
+	uint32_t         abr_min_rtt_ms;
+	double           abr_est_kbps;
+	int              abr_clear_windows;
+	int              abr_cooldown;
 
 #ifdef TEST_FRAMEDROPS
 	struct circlebuf droptest_info;
@@ -104,8 +132,26 @@ struct rtmp_stream {
 	os_event_t       *buffer_has_data_event;
 	os_event_t       *socket_available_event;
 	os_event_t       *send_thread_signaled_exit;
+#ifdef __linux__
+	int              socket_wake_fd;
+#endif
 };
 
 #ifdef _WIN32
 void *socket_thread_windows(void *data);
 #endif
+
+#ifdef __linux__
+void *socket_thread_linux(void *data);
+#endif
+
+/* wakes the socket thread when data is queued or the send thread exits */
+static inline void signal_socket_thread(struct rtmp_stream *stream)
+{
+	os_event_signal(stream->buffer_has_data_event);
+#ifdef __linux__
+	uint64_t val = 1;
+	ssize_t size = write(stream->socket_wake_fd, &val, sizeof(val));
+	UNUSED_PARAMETER(size);
+#endif
+}
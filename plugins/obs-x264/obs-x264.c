@@ -19,6 +19,7 @@
 #include <util/dstr.h>
 #include <util/darray.h>
 #include <util/platform.h>
+#include <util/threading.h>
 #include <obs-module.h>
 
 #ifndef _STDINT_H_INCLUDED
@@ -45,8 +46,6 @@ struct obs_x264 {
 	x264_param_t           params;
 	x264_t                 *context;
 
-	DARRAY(uint8_t)        packet_data;
-
 	uint8_t                *extra_data;
 	uint8_t                *sei;
 
@@ -54,6 +53,25 @@ struct obs_x264 {
 	size_t                 sei_size;
 
 	os_performance_token_t *performance_token;
+	obs_cpu_claim_t        *cpu_claim;
+
+	/* preset currently in use, can change while active (and be stepped by
+	 * the adaptive preset controller, which doesn't change the settings).
+	 * settings_preset is the preset last set in the settings, so an
+	 * unrelated update doesn't undo a step */
+	char                   *preset;
+	char                   *settings_preset;
+	char                   *tune;
+
+	/* keyframe interval in pts when libobs skips duplicate frames, in
+	 * which case keyframes are forced by pts rather than left to x264 */
+	int64_t                keyint_pts;
+	int64_t                last_keyframe_pts;
+
+	/* settings can be updated from other threads (the UI, the encode
+	 * thread's adaptive preset, a stream output's adaptive bitrate) while
+	 * encoding, so updates and encodes are serialized */
+	pthread_mutex_t        mutex;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -86,7 +104,11 @@ static void obs_x264_destroy(void *data)
 	if (obsx264) {
 		os_end_high_performance(obsx264->performance_token);
 		clear_data(obsx264);
-		da_free(obsx264->packet_data);
+		obs_cpu_claim_destroy(obsx264->cpu_claim);
+		pthread_mutex_destroy(&obsx264->mutex);
+		bfree(obsx264->preset);
+		bfree(obsx264->settings_preset);
+		bfree(obsx264->tune);
 		bfree(obsx264);
 	}
 }
@@ -347,6 +369,32 @@ static bool reset_x264_params(struct obs_x264 *obsx264,
 	return ret == 0;
 }
 
+/* once the encoder is open only its analysis settings can change, so
+ * switching presets while active only applies those (x264_encoder_reconfig
+ * ignores anything that can't be changed) */
+static void apply_live_preset(struct obs_x264 *obsx264,
+		const char *preset, const char *tune)
+{
+	x264_param_t params;
+	const char *new_preset = validate(obsx264, preset, "preset",
+			x264_preset_names);
+
+	if (!new_preset || !*new_preset)
+		return;
+	if (x264_param_default_preset(&params, new_preset,
+				validate(obsx264, tune, "tune",
+					x264_tune_names)) != 0)
+		return;
+
+	obsx264->params.analyse           = params.analyse;
+	obsx264->params.i_frame_reference = params.i_frame_reference;
+
+	info("preset changed: %s -> %s", obsx264->preset, new_preset);
+
+	bfree(obsx264->preset);
+	obsx264->preset = bstrdup(new_preset);
+}
+
 static void log_x264(void *param, int level, const char *format, va_list args)
 {
 	struct obs_x264 *obsx264 = param;
@@ -414,6 +462,8 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 	int width        = (int)obs_encoder_get_width(obsx264->encoder);
 	int height       = (int)obs_encoder_get_height(obsx264->encoder);
 	int bf           = (int)obs_data_get_int(settings, "bf");
+	int fps_den      = (int)(voi->fps_den *
+			obs_encoder_get_frame_rate_divisor(obsx264->encoder));
 	bool use_bufsize = obs_data_get_bool(settings, "use_bufsize");
 	bool cbr_override= obs_data_get_bool(settings, "cbr");
 	enum rate_control rc;
@@ -451,7 +501,7 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 
 	if (keyint_sec)
 		obsx264->params.i_keyint_max =
-			keyint_sec * voi->fps_num / voi->fps_den;
+			keyint_sec * voi->fps_num / fps_den;
 
 	if (!use_bufsize)
 		buffer_size = bitrate;
@@ -461,13 +511,21 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 #else
 	obsx264->params.b_vfr_input          = false;
 #endif
+
+	/* libobs skips unchanged frames, so rate control has to go by the
+	 * timestamps rather than assume every frame is 1/fps long */
+	if (obs_encoder_skips_duplicate_frames(obsx264->encoder)) {
+		obsx264->params.b_vfr_input      = true;
+		obsx264->params.i_timebase_num   = 1;
+		obsx264->params.i_timebase_den   = voi->fps_num;
+	}
 	obsx264->params.rc.i_vbv_max_bitrate = bitrate;
 	obsx264->params.rc.i_vbv_buffer_size = buffer_size;
 	obsx264->params.rc.i_bitrate         = bitrate;
 	obsx264->params.i_width              = width;
 	obsx264->params.i_height             = height;
 	obsx264->params.i_fps_num            = voi->fps_num;
-	obsx264->params.i_fps_den            = voi->fps_den;
+	obsx264->params.i_fps_den            = fps_den;
 	obsx264->params.pf_log               = log_x264;
 	obsx264->params.p_log_private        = obsx264;
 	obsx264->params.i_log_level          = X264_LOG_WARNING;
@@ -502,6 +560,22 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 
 	obsx264->params.rc.f_rf_constant = (float)crf;
 
+	/* in an encoder ladder libobs decides which frames are keyframes so
+	 * they line up between renditions */
+	if (obs_encoder_keyframes_forced(obsx264->encoder)) {
+		obsx264->params.i_keyint_max         = X264_KEYINT_MAX_INFINITE;
+		obsx264->params.i_scenecut_threshold = 0;
+	}
+
+	/* thread count can only be set before opening, and can still be
+	 * overridden with custom settings.  the claim has no threads unless a
+	 * CPU budget was set, and x264 then picks its own count */
+	if (!obsx264->context && obsx264->cpu_claim) {
+		int threads = obs_cpu_claim_get_threads(obsx264->cpu_claim);
+		if (threads)
+			obsx264->params.i_threads = threads;
+	}
+
 	if (info.format == VIDEO_FORMAT_NV12)
 		obsx264->params.i_csp = X264_CSP_NV12;
 	else if (info.format == VIDEO_FORMAT_I420)
@@ -514,6 +588,15 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 	while (*params)
 		set_param(obsx264, *(params++));
 
+	/* x264 counts its keyframe interval in frames, which would stretch out
+	 * in real time while libobs skips duplicate frames */
+	if (obs_encoder_skips_duplicate_frames(obsx264->encoder) &&
+	    !obs_encoder_keyframes_forced(obsx264->encoder) &&
+	    obsx264->params.i_keyint_max != X264_KEYINT_MAX_INFINITE) {
+		obsx264->keyint_pts          = obsx264->params.i_keyint_max;
+		obsx264->params.i_keyint_max = X264_KEYINT_MAX_INFINITE;
+	}
+
 	info("settings:\n"
 	     "\trate_control: %s\n"
 	     "\tbitrate:      %d\n"
@@ -523,14 +606,16 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 	     "\tfps_den:      %d\n"
 	     "\twidth:        %d\n"
 	     "\theight:       %d\n"
-	     "\tkeyint:       %d\n",
+	     "\tkeyint:       %d\n"
+	     "\tthreads:      %d\n",
 	     rate_control,
 	     obsx264->params.rc.i_vbv_max_bitrate,
 	     obsx264->params.rc.i_vbv_buffer_size,
 	     (int)obsx264->params.rc.f_rf_constant,
-	     voi->fps_num, voi->fps_den,
+	     voi->fps_num, fps_den,
 	     width, height,
-	     obsx264->params.i_keyint_max);
+	     obsx264->params.i_keyint_max,
+	     obsx264->params.i_threads);
 }
 
 static bool update_settings(struct obs_x264 *obsx264, obs_data_t *settings)
@@ -556,8 +641,20 @@ static bool update_settings(struct obs_x264 *obsx264, obs_data_t *settings)
 		if (tune    && *tune)    info("tune: %s",    tune);
 
 		success = reset_x264_params(obsx264, preset, tune);
+
+		bfree(obsx264->preset);
+		obsx264->preset = bstrdup(validate_preset(obsx264, preset));
+
+	} else if (preset && *preset && obsx264->settings_preset &&
+	           strcmp(preset, obsx264->settings_preset) != 0) {
+		apply_live_preset(obsx264, preset, tune);
 	}
 
+	bfree(obsx264->settings_preset);
+	bfree(obsx264->tune);
+	obsx264->settings_preset = bstrdup(preset);
+	obsx264->tune            = bstrdup(tune);
+
 	if (success) {
 		update_params(obsx264, settings, paramlist);
 		if (opts && *opts)
@@ -580,17 +677,21 @@ static bool update_settings(struct obs_x264 *obsx264, obs_data_t *settings)
 static bool obs_x264_update(void *data, obs_data_t *settings)
 {
 	struct obs_x264 *obsx264 = data;
-	bool success = update_settings(obsx264, settings);
-	int ret;
+	bool success;
+	int ret = 0;
+
+	pthread_mutex_lock(&obsx264->mutex);
 
+	success = update_settings(obsx264, settings);
 	if (success) {
 		ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
 		if (ret != 0)
 			warn("Failed to reconfigure: %d", ret);
-		return ret == 0;
 	}
 
-	return false;
+	pthread_mutex_unlock(&obsx264->mutex);
+
+	return success && ret == 0;
 }
 
 static void load_headers(struct obs_x264 *obsx264)
@@ -621,13 +722,38 @@ static void load_headers(struct obs_x264 *obsx264)
 	obsx264->sei_size        = sei.num;
 }
 
+/* weighted by pixel rate, so lower resolution renditions get fewer threads */
+static obs_cpu_claim_t *create_cpu_claim(obs_encoder_t *encoder)
+{
+	video_t *video = obs_encoder_video(encoder);
+	const struct video_output_info *voi = video_output_get_info(video);
+	uint64_t weight = (uint64_t)obs_encoder_get_width(encoder) *
+		(uint64_t)obs_encoder_get_height(encoder);
+
+	if (voi && voi->fps_den)
+		weight = weight * voi->fps_num / voi->fps_den /
+			obs_encoder_get_frame_rate_divisor(encoder);
+
+	return obs_cpu_claim_create(obs_encoder_get_name(encoder), weight);
+}
+
 static void *obs_x264_create(obs_data_t *settings, obs_encoder_t *encoder)
 {
 	struct obs_x264 *obsx264 = bzalloc(sizeof(struct obs_x264));
 	obsx264->encoder = encoder;
 
+	if (pthread_mutex_init(&obsx264->mutex, NULL) != 0) {
+		bfree(obsx264);
+		return NULL;
+	}
+
+	obsx264->cpu_claim = create_cpu_claim(encoder);
+
 	if (update_settings(obsx264, settings)) {
+		/* x264 creates its worker threads when opened */
+		obs_cpu_claim_push_affinity(obsx264->cpu_claim);
 		obsx264->context = x264_encoder_open(&obsx264->params);
+		obs_cpu_claim_pop_affinity(obsx264->cpu_claim);
 
 		if (obsx264->context == NULL)
 			warn("x264 failed to load");
@@ -638,6 +764,11 @@ static void *obs_x264_create(obs_data_t *settings, obs_encoder_t *encoder)
 	}
 
 	if (!obsx264->context) {
+		obs_cpu_claim_destroy(obsx264->cpu_claim);
+		pthread_mutex_destroy(&obsx264->mutex);
+		bfree(obsx264->preset);
+		bfree(obsx264->settings_preset);
+		bfree(obsx264->tune);
 		bfree(obsx264);
 		return NULL;
 	}
@@ -652,22 +783,35 @@ static void parse_packet(struct obs_x264 *obsx264,
 		struct encoder_packet *packet, x264_nal_t *nals,
 		int nal_count, x264_picture_t *pic_out)
 {
+	uint8_t *data;
+	size_t size = 0;
+
 	if (!nal_count) return;
 
-	da_resize(obsx264->packet_data, 0);
+	for (int i = 0; i < nal_count; i++)
+		size += nals[i].i_payload;
 
+	/* write straight in to a pooled packet buffer so libobs doesn't
+	 * have to make its own copy of the packet */
+	data = obs_encoder_alloc_packet_data(obsx264->encoder, size);
+	if (!data) return;
+
+	packet->data = data;
 	for (int i = 0; i < nal_count; i++) {
 		x264_nal_t *nal = nals+i;
-		da_push_back_array(obsx264->packet_data, nal->p_payload,
-				nal->i_payload);
+		memcpy(data, nal->p_payload, nal->i_payload);
+		data += nal->i_payload;
 	}
 
-	packet->data          = obsx264->packet_data.array;
-	packet->size          = obsx264->packet_data.num;
+	packet->size          = size;
 	packet->type          = OBS_ENCODER_VIDEO;
 	packet->pts           = pic_out->i_pts;
 	packet->dts           = pic_out->i_dts;
 	packet->keyframe      = pic_out->b_keyframe != 0;
+
+	/* scene cuts also restart the keyframe interval */
+	if (packet->keyframe && pic_out->i_pts > obsx264->last_keyframe_pts)
+		obsx264->last_keyframe_pts = pic_out->i_pts;
 }
 
 static inline void init_pic_data(struct obs_x264 *obsx264, x264_picture_t *pic,
@@ -678,6 +822,15 @@ static inline void init_pic_data(struct obs_x264 *obsx264, x264_picture_t *pic,
 	pic->i_pts = frame->pts;
 	pic->img.i_csp = obsx264->params.i_csp;
 
+	if (obsx264->keyint_pts && frame->pts - obsx264->last_keyframe_pts >=
+			obsx264->keyint_pts) {
+		pic->i_type = X264_TYPE_IDR;
+		obsx264->last_keyframe_pts = frame->pts;
+	}
+
+	if (frame->force_keyframe)
+		pic->i_type = X264_TYPE_IDR;
+
 	if (obsx264->params.i_csp == X264_CSP_NV12)
 		pic->img.i_plane = 2;
 	else if (obsx264->params.i_csp == X264_CSP_I420)
@@ -703,12 +856,15 @@ static bool obs_x264_encode(void *data, struct encoder_frame *frame,
 	if (!frame || !packet || !received_packet)
 		return false;
 
+	pthread_mutex_lock(&obsx264->mutex);
+
 	if (frame)
 		init_pic_data(obsx264, &pic, frame);
 
 	ret = x264_encoder_encode(obsx264->context, &nals, &nal_count,
 			(frame ? &pic : NULL), &pic_out);
 	if (ret < 0) {
+		pthread_mutex_unlock(&obsx264->mutex);
 		warn("encode failed");
 		return false;
 	}
@@ -716,6 +872,7 @@ static bool obs_x264_encode(void *data, struct encoder_frame *frame,
 	*received_packet = (nal_count != 0);
 	parse_packet(obsx264, packet, nals, nal_count, &pic_out);
 
+	pthread_mutex_unlock(&obsx264->mutex);
 	return true;
 }
 
@@ -765,6 +922,40 @@ static void obs_x264_video_info(void *data, struct video_scale_info *info)
 	info->format = pref_format;
 }
 
+static bool obs_x264_step_preset(void *data, int direction)
+{
+	struct obs_x264 *obsx264 = data;
+	bool stepped = false;
+	int count = 0;
+	int idx = -1;
+	int new_idx;
+	int ret;
+
+	pthread_mutex_lock(&obsx264->mutex);
+
+	for (; x264_preset_names[count]; count++) {
+		if (obsx264->preset &&
+		    strcmp(obsx264->preset, x264_preset_names[count]) == 0)
+			idx = count;
+	}
+
+	new_idx = idx + (direction < 0 ? -1 : 1);
+
+	if (idx != -1 && new_idx >= 0 && new_idx < count) {
+		apply_live_preset(obsx264, x264_preset_names[new_idx],
+				obsx264->tune);
+
+		ret = x264_encoder_reconfig(obsx264->context,
+				&obsx264->params);
+		if (ret != 0)
+			warn("Failed to reconfigure: %d", ret);
+		stepped = ret == 0;
+	}
+
+	pthread_mutex_unlock(&obsx264->mutex);
+	return stepped;
+}
+
 struct obs_encoder_info obs_x264_encoder = {
 	.id             = "obs_x264",
 	.type           = OBS_ENCODER_VIDEO,
@@ -778,5 +969,7 @@ struct obs_encoder_info obs_x264_encoder = {
 	.get_defaults   = obs_x264_defaults,
 	.get_extra_data = obs_x264_extra_data,
 	.get_sei_data   = obs_x264_sei,
-	.get_video_info = obs_x264_video_info
+	.get_video_info = obs_x264_video_info,
+	.step_preset    = obs_x264_step_preset,
+	.caps           = OBS_ENCODER_CAP_DYN_BITRATE | OBS_ENCODER_CAP_VFR
 };